@@ -31,10 +31,10 @@ import m5
 from m5.defines import buildEnv
 from m5.objects import *
 from m5.params import NULL
-from m5.util import addToPath, fatal, warn
+from m5.util import addToPath, fatal, warn, convert
 
 from m5.objects.PciHost import *
-from m5.objects.Rnic import HanGuRnic, HanGuDriver
+from m5.objects.Rnic import HanGuRnic, HanGuDriver, HanGuAdaptiveQuantum
 
 
 addToPath('../../')
@@ -163,7 +163,10 @@ def config_rnic(system, options, node_num):
     system.platform.rdma_nic.wqe_cache_cap = 8192
     system.platform.rdma_nic.reorder_cap   = options.reorder_cap
     system.platform.rdma_nic.cpu_num       = options.num_cpus
-    system.platform.rdma_nic.prefetch_window_size       = 8
+    system.platform.rdma_nic.link_delay    = options.link_delay
+    if options.trace_file:
+        system.platform.rdma_nic.trace_file = "%s.%d" % (options.trace_file, node_num)
+        system.platform.rdma_nic.trace_mask = int(options.trace_mask, 0)
     if mac_addr == svr_mac:
         # system.platform.rdma_nic.mpt_cache_num = 8192
         # system.platform.rdma_nic.mtt_cache_num = 16384
@@ -175,6 +178,24 @@ def config_rnic(system, options, node_num):
         system.platform.rdma_nic.mtt_cache_num = 100000
         # system.platform.rdma_nic.qpc_cache_cap = options.qpc_cache_cap
         system.platform.rdma_nic.qpc_cache_cap = 100000
+
+    # Fast-forward the RNIC together with the CPUs, it switches to
+    # timing mode when the CPUs are switched out of atomic mode
+    if options.fast_forward:
+        system.platform.rdma_nic.fast_forward = True
+
+    if options.quantum_policy == "adaptive":
+        system.platform.rdma_nic.quantum_policy = HanGuAdaptiveQuantum()
+
+    # Tuning parameters of all nodes, e.g. --rnic-param window_cap=32,
+    # or --rnic-param quantum_policy.target_delay=1us for child objects
+    for param in options.rnic_param:
+        name, value = param.split('=', 1)
+        path = name.strip().split('.')
+        obj = system.platform.rdma_nic
+        for attr in path[:-1]:
+            obj = getattr(obj, attr)
+        setattr(obj, path[-1], value.strip())
     
     system.platform.attachIO(system.iobus)
     system.intrctrl = IntrControl()
@@ -188,6 +209,10 @@ def make_hangu_nic_system(options, CPUClass, test_mem_mode, node_id):
                     cache_line_size = options.cacheline_size,
                     workload = NULL)
 
+    # Nodes are spread over event queues, each simulated by one thread.
+    # All objects of the node inherit the index.
+    system.eventq_index = node_id % options.num_eventq
+
     # Create a top-level voltage domain
     system.voltage_domain = VoltageDomain(voltage = options.sys_voltage)
 
@@ -242,6 +267,29 @@ def make_hangu_nic_system(options, CPUClass, test_mem_mode, node_id):
     return system
 
 
+def connect_rnic_ports(etherswitch, rnic):
+    '''
+    Connect all ports of the RNIC to the switch, port 0 is 
+    interface, the others are ext_interface (see port_num). 
+    Each port has its own MAC (see mac_addr), port N of the 
+    sender addresses port N of the peer.
+    '''
+    etherswitch.interface = rnic.interface
+    for i in range(1, int(rnic.port_num)):
+        etherswitch.interface = rnic.ext_interface
+
+def check_port_num(rnicsys):
+    '''
+    Port N of the sender addresses port N of the peer (see 
+    connect_rnic_ports), so all the RNICs need the same port_num.
+    '''
+    port_num = int(rnicsys[0].platform.rdma_nic.port_num)
+    for i in range(1, len(rnicsys)):
+        if int(rnicsys[i].platform.rdma_nic.port_num) != port_num:
+            fatal("RNIC %d has %d ports, RNIC 0 has %d! port_num should "
+                  "be the same on both ends of a connection." % 
+                  (i, int(rnicsys[i].platform.rdma_nic.port_num), port_num))
+
 def make_root_system(rnicsys, en_bw):
     self = Root(full_system = False)
     self.svrsys = rnicsys[0]
@@ -251,8 +299,43 @@ def make_root_system(rnicsys, en_bw):
     self.etherswitch.fabric_speed = en_bw
     self.etherswitch.delay = "0us" # We don't use the delay mechanism in etherswitch
     self.etherswitch.time_to_live = "100s" # don't consider MAC addr mapping TTL
+    check_port_num(rnicsys)
     for i in range(len(rnicsys)):
-        self.etherswitch.interface = rnicsys[i].platform.rdma_nic.interface
+        connect_rnic_ports(self.etherswitch, rnicsys[i].platform.rdma_nic)
+
+    return self
+
+def make_dist_root(rnicsys, options):
+    """
+    Root of one dist-gem5 process (rank), which simulates a group of 
+    nodes. The group reaches the switch process (configs/dist/sw.py) 
+    through one DistEtherLink, nodes in the group are connected by a 
+    local EtherSwitch.
+    """
+    self = Root(full_system = False)
+    self.nodesys = rnicsys
+    check_port_num(rnicsys)
+
+    self.etherlink = DistEtherLink(speed = options.ethernet_linkspeed,
+                                   delay = options.ethernet_linkdelay,
+                                   dist_rank = options.dist_rank,
+                                   dist_size = options.dist_size,
+                                   server_name = options.dist_server_name,
+                                   server_port = options.dist_server_port,
+                                   sync_start = options.dist_sync_start,
+                                   sync_repeat = options.dist_sync_repeat,
+                                   dist_sync_on_pseudo_op = options.dist_sync_on_pseudo_op)
+
+    if len(rnicsys) == 1:
+        self.etherlink.int0 = rnicsys[0].platform.rdma_nic.interface
+    else:
+        self.etherswitch = EtherSwitch()
+        self.etherswitch.fabric_speed = options.ethernet_linkspeed
+        self.etherswitch.delay = "0us"
+        self.etherswitch.time_to_live = "100s"
+        for i in range(len(rnicsys)):
+            connect_rnic_ports(self.etherswitch, rnicsys[i].platform.rdma_nic)
+        self.etherlink.int0 = self.etherswitch.interface[len(rnicsys)]
 
     return self
 
@@ -272,6 +355,32 @@ def get_hangu_rnic_options():
     parser.add_option("--reorder-cap", default=100,
                         action="store", type="int",
                         help="capacity of qpc cache\nDEFAULT: 50 entries")
+    parser.add_option("--link-delay", default="100ns",
+                        action="store", type="string",
+                        help="ethernet link delay\nDEFAULT: 100ns")
+    parser.add_option("--nodes-per-rank", default=1,
+                        action="store", type="int",
+                        help="number of nodes simulated by one dist-gem5 process, "
+                             "--node-num must be --dist-size times of it\nDEFAULT: 1")
+    parser.add_option("--num-eventq", default=1,
+                        action="store", type="int",
+                        help="number of event queues (host threads), nodes are "
+                             "assigned round robin\nDEFAULT: 1")
+    parser.add_option("--trace-file", default="",
+                        action="store", type="string",
+                        help="RNIC binary event trace file in outdir, node id is appended\nDEFAULT: disabled")
+    parser.add_option("--trace-mask", default="0xffffffff",
+                        action="store", type="string",
+                        help="RNIC trace module mask, see hangu_trace.hh\nDEFAULT: all modules")
+    parser.add_option("--rnic-param", action="append", default=[],
+                        type="string",
+                        help="Set a HanGuRnic parameter of all nodes, "
+                             "e.g. --rnic-param max_prefetch_num=16, "
+                             "can be given multiple times")
+    parser.add_option("--quantum-policy", default="fixed",
+                        type="choice", choices=["fixed", "adaptive"],
+                        help="Scheduling quantum and WQE fetch depth policy "
+                             "of bulk QPs\nDEFAULT: fixed")
     # parser.add_option("--mpt-cache-cap", default=100,
     #                     action="store", type="int",
     #                     help="capacity of MPT cache\nDEFAULT: 200 entries")
@@ -309,11 +418,46 @@ def main():
     # qpc_cache_cap = options.qpc_cache_cap
     # reorder_cap   = options.reorder_cap
 
+    # dist-gem5, this process simulates the node group of its rank, 
+    # see scripts/run_hangu_dist.py
+    if options.dist:
+        if options.node_num != options.dist_size * options.nodes_per_rank:
+            fatal("--node-num should be --dist-size * --nodes-per-rank!")
+        if options.num_eventq > 1:
+            fatal("--num-eventq is not supported with --dist!")
+        first_node = options.dist_rank * options.nodes_per_rank
+        node_ids = range(first_node, first_node + options.nodes_per_rank)
+    else:
+        node_ids = range(options.node_num)
+
     rnic_sys = []
-    for i in range(options.node_num):
+    for i in node_ids:
         rnic_sys.append(make_hangu_nic_system(options, CPUClass, test_mem_mode, i))
 
+    if options.dist:
+        # Link delay is modeled by the DistEtherLinks of both sides
+        for sys_i in rnic_sys:
+            sys_i.platform.rdma_nic.link_delay = "0ns"
+        root = make_dist_root(rnic_sys, options)
+        Simulation.run(options, root, rnic_sys[0], FutureClass)
+        return
+
     root = make_root_system(rnic_sys, options.ethernet_linkspeed)
+
+    # Parallel simulation. Packets cross event queues only at the switch, 
+    # and each crossing is delayed by a half of the link delay, which is 
+    # the lookahead, so the end-to-end link delay is unchanged.
+    if options.num_eventq > 1:
+        m5.ticks.fixGlobalFrequency()
+        link_delay = m5.ticks.fromSeconds(convert.toLatency(options.link_delay))
+        quantum = link_delay // 2
+        if quantum == 0:
+            fatal("Parallel simulation needs a non-zero link delay!")
+        root.sim_quantum = quantum
+        root.etherswitch.lookahead = "%dt" % quantum
+        for sys_i in rnic_sys:
+            sys_i.platform.rdma_nic.link_delay = "%dt" % (link_delay - quantum)
+
     # root: the whole system including all nodes
     Simulation.run(options, root, root.svrsys, FutureClass)
 
@@ -24,19 +24,11 @@ def change_param(qps_per_clt):
     with open("../tests/test-progs/hangu-rnic/src/librdma.h", "w", encoding="utf-8") as f:
         f.write(file_data)
     
-    file_data = ""
-    with open("../src/dev/rdma/hangu_rnic_defs.hh", "r", encoding="utf-8") as f:
-        for line in f:
-            if "#define QPN_NUM" in line:
-                line = "#define QPN_NUM   (" + str(qps_per_clt) + " * " + str(CLIENT_NUM) + ")\n"
-            file_data += line
-
-    with open("../src/dev/rdma/hangu_rnic_defs.hh", "w", encoding="utf-8") as f:
-        f.write(file_data)
-
 
-def execute_program(node_num, qpc_cache_cap, reorder_cap):
-    return os.system("python3 run_hangu.py " + str(node_num) + " " + str(qpc_cache_cap) + " " + str(reorder_cap) + " " + str(WR_TYPE))
+def execute_program(node_num, qpc_cache_cap, reorder_cap, qps_per_clt):
+    # QP number is a runtime parameter of the RNIC, no rebuild is needed
+    rnic_params = " qpn_num=" + str(qps_per_clt * CLIENT_NUM)
+    return os.system("python3 run_hangu.py " + str(node_num) + " " + str(qpc_cache_cap) + " " + str(reorder_cap) + " " + str(WR_TYPE) + rnic_params)
 
 def print_result(file_name, qps_per_clt):
     bandwidth = 0
@@ -88,7 +80,7 @@ def main():
         print("=============================================")
         print("qps_per_clt is : %d" % (qps_per_clt))
         print("=============================================\n\n\n\n")
-        if execute_program(CLIENT_NUM + 1, QP_CACHE_CAP, REORDER_CAP) != 0:
+        if execute_program(CLIENT_NUM + 1, QP_CACHE_CAP, REORDER_CAP, qps_per_clt) != 0:
             print("\033[0;31;40mProgram execution error! %d\033[0m" % (qps_per_clt))
             return 1
         
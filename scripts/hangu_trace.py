@@ -0,0 +1,134 @@
+import sys
+import struct
+import argparse
+
+# Keep in sync with src/dev/rdma/hangu_trace.hh
+TRACE_MAGIC   = 0x48475452
+TRACE_VERSION = 1
+
+HEADER_FMT = "<IHHII"      # magic, version, recSize, mask, rsvd
+RECORD_FMT = "<QIIIHBB"    # tick, qpn, psn, len, event, module, rsvd
+
+MODULES = ["PIO", "SCHED", "TX", "RX", "MR", "QPC", "CQC", "DMA", "INTR"]
+
+EVENTS = {
+    1  : "DOORBELL",
+    2  : "CMD",
+    3  : "WQE_LAUNCH",
+    4  : "PKT_TX",
+    5  : "PKT_RX",
+    6  : "ACK_RX",
+    7  : "MR_REQ",
+    8  : "QPC_REQ",
+    9  : "QPC_RSP",
+    10 : "CQC_REQ",
+    11 : "DMA_RD",
+    12 : "DMA_WR",
+    13 : "CQE",
+    14 : "INTR",
+    15 : "QUANTUM",
+    16 : "PKT_DROP",
+}
+
+def read_trace(file_name):
+    '''
+    Yield (tick, module, event, qpn, psn, len) of each record
+    '''
+    with open(file_name, "rb") as f:
+        head = f.read(struct.calcsize(HEADER_FMT))
+        magic, version, rec_size, mask, _ = struct.unpack(HEADER_FMT, head)
+        if magic != TRACE_MAGIC:
+            raise Exception("%s is not a HanGu trace file" % file_name)
+        if version != TRACE_VERSION or rec_size != struct.calcsize(RECORD_FMT):
+            raise Exception("Unsupported trace version %d, record size %d" % (version, rec_size))
+
+        chunk_recs = 65536
+        while True:
+            buf = f.read(rec_size * chunk_recs)
+            if not buf:
+                break
+            cnt = len(buf) // rec_size
+            for rec in struct.iter_unpack(RECORD_FMT, buf[:cnt * rec_size]):
+                tick, qpn, psn, length, event, module, _ = rec
+                yield (tick, module, event, qpn, psn, length)
+
+def module_name(module):
+    return MODULES[module] if module < len(MODULES) else str(module)
+
+def parse_mask(names):
+    mask = 0
+    for name in names.split(","):
+        mask |= 1 << MODULES.index(name.strip().upper())
+    return mask
+
+def dump(args):
+    mod_mask = parse_mask(args.module) if args.module else ~0
+    events = set(args.event.upper().split(",")) if args.event else None
+    for tick, module, event, qpn, psn, length in read_trace(args.file):
+        if not (mod_mask >> module) & 1:
+            continue
+        ev_name = EVENTS.get(event, str(event))
+        if events is not None and ev_name not in events:
+            continue
+        if args.qpn is not None and qpn != args.qpn:
+            continue
+        if args.start is not None and tick < args.start:
+            continue
+        if args.end is not None and tick > args.end:
+            break
+        print("%d: %-5s %-10s qpn 0x%x psn %d len %d" %
+            (tick, module_name(module), ev_name, qpn, psn, length))
+
+def summary(args):
+    ev_cnt   = {}
+    ev_bytes = {}
+    qp_pkts  = {}
+    first_tick = None
+    last_tick  = 0
+    for tick, module, event, qpn, psn, length in read_trace(args.file):
+        if first_tick is None:
+            first_tick = tick
+        last_tick = tick
+        key = (module, event)
+        ev_cnt[key]   = ev_cnt.get(key, 0) + 1
+        ev_bytes[key] = ev_bytes.get(key, 0) + length
+        if event == 4: # PKT_TX
+            qp_pkts[qpn] = qp_pkts.get(qpn, 0) + 1
+
+    if first_tick is None:
+        print("Empty trace")
+        return
+
+    sec = (last_tick - first_tick) / 1e12 # tick is 1ps
+    print("Trace time: %d - %d (%.3f us)" % (first_tick, last_tick, sec * 1e6))
+    print("%-5s %-10s %12s %14s" % ("mod", "event", "count", "len sum"))
+    for key in sorted(ev_cnt):
+        print("%-5s %-10s %12d %14d" %
+            (module_name(key[0]), EVENTS.get(key[1], str(key[1])), ev_cnt[key], ev_bytes[key]))
+    if qp_pkts:
+        print("Top %d QPs by sent packets:" % min(args.top, len(qp_pkts)))
+        for qpn, cnt in sorted(qp_pkts.items(), key=lambda x: -x[1])[:args.top]:
+            print("  qpn 0x%x: %d" % (qpn, cnt))
+
+def main():
+    parser = argparse.ArgumentParser(description="Decode HanGu RNIC binary event trace")
+    parser.add_argument("file", help="trace file, e.g. m5out/rnic.trace.0")
+    parser.add_argument("-s", "--summary", action="store_true", help="print counts per event instead of records")
+    parser.add_argument("-m", "--module", help="comma separated modules to print, e.g. TX,RX")
+    parser.add_argument("-e", "--event", help="comma separated events to print, e.g. PKT_TX,ACK_RX")
+    parser.add_argument("-q", "--qpn", type=lambda x: int(x, 0), help="only print records of this QPN")
+    parser.add_argument("--start", type=int, help="first tick to print")
+    parser.add_argument("--end", type=int, help="last tick to print")
+    parser.add_argument("--top", type=int, default=10, help="number of QPs in summary")
+    args = parser.parse_args()
+
+    try:
+        if args.summary:
+            summary(args)
+        else:
+            dump(args)
+    except BrokenPipeError:
+        sys.stderr.close()
+
+if __name__ == "__main__":
+    main()
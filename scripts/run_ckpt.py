@@ -0,0 +1,121 @@
+import os
+import time
+import sys
+
+SERVER_LID  = 10
+
+NUM_CPUS  = 1
+CPU_CLK   = "2GHz"
+EN_SPEED  = "100Gbps"
+PCI_SPEED = "128Gbps"
+
+CKPT_DIR  = "m5out/ckpt"
+
+# Runs of one test, <name: checkpoint options, server options>.
+# "base" runs without interruption, "ckpt" takes a checkpoint once the
+# server has set up all connections, "restore" continues from it.
+RUNS = [
+    ("base",    "",                                   ""),
+    ("ckpt",    " --checkpoint-dir " + CKPT_DIR,      " -k"),
+    ("restore", " -r 1 --checkpoint-dir " + CKPT_DIR, ""),
+]
+
+class Param():
+    def __init__(self, num_nodes, qpc_cache_cap, reorder_cap, op_mode):
+        self.num_nodes     = num_nodes
+        self.qpc_cache_cap = qpc_cache_cap
+        self.reorder_cap   = reorder_cap
+        self.op_mode       = op_mode
+
+
+def cmd_run_sim(test_prog, option, params, run, ckpt_opt):
+    '''
+    Generate simulation running command, output of each run
+    goes to m5out/ckpt_test/<run>.txt
+    '''
+
+    cmd = "cd ../ && build/X86/gem5.opt"
+    cmd += " -d m5out/ckpt_test/" + run
+
+    # execution script
+    cmd += " configs/example/rdma/hangu_rnic_se.py"
+    cmd += " --cpu-clock " + CPU_CLK
+    cmd += " --num-cpus " + str(NUM_CPUS)
+    cmd += " -c " + test_prog
+    cmd += " -o " + option
+    cmd += " --node-num " + str(params.num_nodes)
+    cmd += " --ethernet-linkspeed " + EN_SPEED
+    cmd += " --pci-linkspeed "  + PCI_SPEED
+    cmd += " --qpc-cache-cap "  + str(params.qpc_cache_cap)
+    cmd += " --reorder-cap "    + str(params.reorder_cap)
+    cmd += " --mem-size 2048MB"
+    cmd += ckpt_opt
+    cmd += " > m5out/ckpt_test/" + run + ".txt"
+
+    return cmd
+
+def read_output(run):
+    '''
+    Data read back by the test program, and why the simulation exited
+    '''
+    data  = []
+    cause = ""
+    with open("../m5out/ckpt_test/" + run + ".txt") as f:
+        for line in f:
+            if "data is" in line:
+                data.append(line.split("data is", 1)[1].strip())
+            elif line.startswith("Exiting @ tick"):
+                cause = line.split("because", 1)[-1].strip()
+    return data, cause
+
+def execute_program(test_prog, option, params):
+
+    cmd_list = [
+        "cd ../tests/test-progs/hangu-rnic/src && make",
+        "cd ../ && scons build/X86/gem5.opt",
+        "rm -rf ../" + CKPT_DIR + " && mkdir -p ../m5out/ckpt_test"
+    ]
+    for run, ckpt_opt, svr_opt in RUNS:
+        cmd_list.append(cmd_run_sim(test_prog, option.replace("-s ", svr_opt.strip() + " -s ", 1)
+                if svr_opt else option, params, run, ckpt_opt))
+
+    for cmd in cmd_list:
+        print(cmd)
+        rtn = os.system(cmd)
+        if rtn != 0:
+            raise Exception("\033[0;31;40mError for cmd " + cmd + "\033[0m")
+        time.sleep(0.1)
+
+    # The restored run should read back the same data as the base run
+    base_data, base_cause = read_output("base")
+    for run, ckpt_opt, svr_opt in RUNS:
+        data, cause = read_output(run)
+        print("%-8s %-40s %d data lines" % (run, cause, len(data)))
+    rsto_data, rsto_cause = read_output("restore")
+    if rsto_data == base_data and rsto_cause == base_cause:
+        print("\033[0;32;40mrestored run matches the uninterrupted run\033[0m")
+    else:
+        raise Exception("\033[0;31;40mrestored run differs from the uninterrupted run\033[0m")
+
+def main():
+    if len(sys.argv) != 5:
+        raise Exception("\033[0;31;40mMissing input parameter. Needs 4: "
+            "node_num qpc_cache_cap reorder_cap op_mode\033[0m")
+    params = Param(int(sys.argv[1]), int(sys.argv[2]), int(sys.argv[3]), int(sys.argv[4]))
+
+    num_nodes = params.num_nodes
+    svr_lid = SERVER_LID
+
+    test_prog = "'tests/test-progs/hangu-rnic/bin/server"
+    opt = "'-s " + str(svr_lid) + " -t " + str(num_nodes - 1) + " -m " + str(params.op_mode)
+    for i in range(num_nodes - 1):
+        test_prog += ";tests/test-progs/hangu-rnic/bin/client"
+        opt += ";-s " + str(svr_lid) + " -l " + str(svr_lid + i + 1) + " -t " + str(num_nodes - 1) + " -m " + str(params.op_mode)
+    test_prog += "'"
+    opt += "'"
+
+    return execute_program(test_prog=test_prog, option=opt, params=params)
+
+
+if __name__ == "__main__":
+    main()
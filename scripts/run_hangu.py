@@ -10,11 +10,12 @@ EN_SPEED  = "100Gbps"
 PCI_SPEED = "128Gbps"
 
 class Param():
-    def __init__(self, num_nodes, qpc_cache_cap, reorder_cap, op_mode):
+    def __init__(self, num_nodes, qpc_cache_cap, reorder_cap, op_mode, rnic_params=[]):
         self.num_nodes     = num_nodes
         self.qpc_cache_cap = qpc_cache_cap
         self.reorder_cap   = reorder_cap
         self.op_mode       = op_mode
+        self.rnic_params   = rnic_params # ["name=value", ...], HanGuRnic params
 
 
 def cmd_run_sim(debug, test_prog, option, params):
@@ -41,6 +42,8 @@ def cmd_run_sim(debug, test_prog, option, params):
     cmd += " --qpc-cache-cap "  + str(params.qpc_cache_cap)
     cmd += " --reorder-cap "    + str(params.reorder_cap)
     cmd += " --mem-size 2048MB"
+    for rnic_param in params.rnic_params:
+        cmd += " --rnic-param " + rnic_param
     cmd += " > scripts/res_out/rnic_sys_test.txt"
 
     return cmd
@@ -62,8 +65,9 @@ def execute_program(debug, test_prog, option, params):
 
 def main():
     if len(sys.argv) < 5:
-        raise Exception("\033[0;31;40mMissing input parameter. Needs 4. " + cmd + "\033[0m")
-    params = Param(int(sys.argv[1]), int(sys.argv[2]), int(sys.argv[3]), int(sys.argv[4]))
+        raise Exception("\033[0;31;40mMissing input parameter. Needs 4: "
+            "node_num qpc_cache_cap reorder_cap op_mode [rnic_param=value ...]\033[0m")
+    params = Param(int(sys.argv[1]), int(sys.argv[2]), int(sys.argv[3]), int(sys.argv[4]), sys.argv[5:])
 
     num_nodes = params.num_nodes
     svr_lid = SERVER_LID
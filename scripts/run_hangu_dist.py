@@ -0,0 +1,105 @@
+import os
+import time
+import sys
+
+SERVER_LID  = 10
+
+NUM_CPUS  = 1
+CPU_CLK   = "2GHz"
+EN_SPEED  = "100Gbps"
+PCI_SPEED = "128Gbps"
+# End-to-end link delay, half of it is modeled by the node side
+# DistEtherLink, the other half by the switch side one.
+HALF_LINK_DELAY = "50ns"
+
+class Param():
+    def __init__(self, num_nodes, nodes_per_rank, qpc_cache_cap, reorder_cap, op_mode):
+        self.num_nodes      = num_nodes
+        self.nodes_per_rank = nodes_per_rank
+        self.qpc_cache_cap  = qpc_cache_cap
+        self.reorder_cap    = reorder_cap
+        self.op_mode        = op_mode
+
+
+def cmd_run_dist(debug, test_prog, option, params):
+    '''
+    Generate dist-gem5 running command, one gem5 process for
+    each group of nodes, plus one switch process.
+    '''
+
+    num_ranks = params.num_nodes // params.nodes_per_rank
+
+    cmd = "cd ../ && util/dist/gem5-dist.sh"
+    cmd += " -n " + str(num_ranks)
+    cmd += " -x build/X86/gem5.opt"
+    cmd += " -r scripts/res_out/dist"
+    cmd += " -c scripts/res_out/dist/ckpt"
+    cmd += " -s configs/dist/sw.py"
+    cmd += " -f configs/example/rdma/hangu_rnic_se.py"
+
+    # gem5 options
+    if debug != "":
+        cmd += " --m5-args --debug-flags=" + debug
+
+    # node options, quoted once more as they go through ssh
+    cmd += " --fs-args"
+    cmd += " --cpu-clock " + CPU_CLK
+    cmd += " --num-cpus " + str(NUM_CPUS)
+    cmd += " -c \"'" + test_prog + "'\""
+    cmd += " -o \"'" + option + "'\""
+    cmd += " --node-num " + str(params.num_nodes)
+    cmd += " --nodes-per-rank " + str(params.nodes_per_rank)
+    cmd += " --pci-linkspeed "  + PCI_SPEED
+    cmd += " --qpc-cache-cap "  + str(params.qpc_cache_cap)
+    cmd += " --reorder-cap "    + str(params.reorder_cap)
+    cmd += " --mem-size 2048MB"
+
+    # options for both the nodes and the switch
+    cmd += " --cf-args"
+    cmd += " --ethernet-linkspeed " + EN_SPEED
+    cmd += " --ethernet-linkdelay " + HALF_LINK_DELAY
+    cmd += " --dist-sync-start 0t"
+
+    return cmd
+
+def execute_program(debug, test_prog, option, params):
+
+    cmd_list = [
+        "cd ../tests/test-progs/hangu-rnic/src && make",
+        "cd ../ && scons build/X86/gem5.opt",
+        "mkdir -p res_out/dist"
+    ]
+    cmd_list.append(cmd_run_dist(debug, test_prog, option, params))
+
+    for cmd in cmd_list:
+        print(cmd)
+        rtn = os.system(cmd)
+        if rtn != 0:
+            raise Exception("\033[0;31;40mError for cmd " + cmd + "\033[0m")
+        time.sleep(0.1)
+
+def main():
+    if len(sys.argv) < 6:
+        raise Exception("\033[0;31;40mMissing input parameter. Needs 5: "
+            "node_num nodes_per_rank qpc_cache_cap reorder_cap op_mode\033[0m")
+    params = Param(int(sys.argv[1]), int(sys.argv[2]), int(sys.argv[3]), int(sys.argv[4]), int(sys.argv[5]))
+
+    num_nodes = params.num_nodes
+    svr_lid = SERVER_LID
+    if num_nodes % params.nodes_per_rank != 0:
+        raise Exception("\033[0;31;40mnode_num should be a multiple of nodes_per_rank\033[0m")
+
+    debug = ""
+
+    test_prog = "tests/test-progs/hangu-rnic/bin/server"
+    opt = "-s " + str(svr_lid) + " -t " + str(num_nodes - 1) + " -m " + str(params.op_mode)
+    for i in range(num_nodes - 1):
+        test_prog += ";tests/test-progs/hangu-rnic/bin/client"
+        opt += ";-s " + str(svr_lid) + " -l " + str(svr_lid + i + 1) + " -t " + str(num_nodes - 1) + " -m " + str(params.op_mode)
+
+    return execute_program(debug=debug, test_prog=test_prog, option=opt, params=params)
+
+
+
+if __name__ == "__main__":
+    main()
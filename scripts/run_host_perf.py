@@ -0,0 +1,123 @@
+import os
+import re
+import time
+import sys
+
+SERVER_LID  = 10
+
+NUM_CPUS  = 1
+CPU_CLK   = "2GHz"
+EN_SPEED  = "100Gbps"
+PCI_SPEED = "128Gbps"
+
+# Variants of one run, <name: HanGuRnic params>. The first one is the
+# baseline the others are compared with.
+VARIANTS = [
+    ("timing",        []),
+    ("fast_forward",  ["fast_forward=True"]),
+    ("no_pkt_pool",   ["eth_pkt_pool=False"]),
+    ("no_pool_alloc", ["pool_alloc=False"]),
+]
+
+class Param():
+    def __init__(self, num_nodes, qpc_cache_cap, reorder_cap, op_mode):
+        self.num_nodes     = num_nodes
+        self.qpc_cache_cap = qpc_cache_cap
+        self.reorder_cap   = reorder_cap
+        self.op_mode       = op_mode
+
+
+def cmd_run_sim(test_prog, option, params, variant, rnic_params):
+    '''
+    Generate simulation running command, stats of each variant
+    go to m5out/host_perf/<variant>
+    '''
+
+    cmd = "cd ../ && build/X86/gem5.fast"
+    cmd += " -d m5out/host_perf/" + variant
+
+    # execution script
+    cmd += " configs/example/rdma/hangu_rnic_se.py"
+    cmd += " --cpu-clock " + CPU_CLK
+    cmd += " --num-cpus " + str(NUM_CPUS)
+    cmd += " -c " + test_prog
+    cmd += " -o " + option
+    cmd += " --node-num " + str(params.num_nodes)
+    cmd += " --ethernet-linkspeed " + EN_SPEED
+    cmd += " --pci-linkspeed "  + PCI_SPEED
+    cmd += " --qpc-cache-cap "  + str(params.qpc_cache_cap)
+    cmd += " --reorder-cap "    + str(params.reorder_cap)
+    cmd += " --mem-size 2048MB"
+    for rnic_param in rnic_params:
+        cmd += " --rnic-param " + rnic_param
+    cmd += " > m5out/host_perf/" + variant + ".txt"
+
+    return cmd
+
+def read_stats(variant):
+    '''
+    Host seconds and packets sent by all RNICs of one run
+    '''
+    host_sec = 0.0
+    pkt_num  = 0
+    with open("../m5out/host_perf/" + variant + "/stats.txt") as f:
+        for line in f:
+            item = line.split()
+            if len(item) < 2:
+                continue
+            if item[0] == "host_seconds":
+                host_sec += float(item[1])
+            elif re.match(r".*rdma_nic\.txPackets$", item[0]):
+                pkt_num += int(float(item[1]))
+    return host_sec, pkt_num
+
+def execute_program(test_prog, option, params):
+
+    cmd_list = [
+        "cd ../tests/test-progs/hangu-rnic/src && make",
+        "cd ../ && scons build/X86/gem5.fast",
+        "mkdir -p ../m5out/host_perf"
+    ]
+    for variant, rnic_params in VARIANTS:
+        cmd_list.append(cmd_run_sim(test_prog, option, params, variant, rnic_params))
+
+    for cmd in cmd_list:
+        print(cmd)
+        rtn = os.system(cmd)
+        if rtn != 0:
+            raise Exception("\033[0;31;40mError for cmd " + cmd + "\033[0m")
+        time.sleep(0.1)
+
+    # Packets per host second, compared with the baseline
+    base_rate = 0
+    print("%-16s %12s %12s %16s %8s" % ("variant", "host_sec", "tx_pkts", "pkt/host_sec", "speedup"))
+    for variant, rnic_params in VARIANTS:
+        host_sec, pkt_num = read_stats(variant)
+        rate = pkt_num / host_sec if host_sec else 0
+        if base_rate == 0:
+            base_rate = rate
+        print("%-16s %12.2f %12d %16.0f %8.2f" % (variant, host_sec, pkt_num, rate,
+                rate / base_rate if base_rate else 0))
+
+def main():
+    if len(sys.argv) != 5:
+        raise Exception("\033[0;31;40mMissing input parameter. Needs 4: "
+            "node_num qpc_cache_cap reorder_cap op_mode\033[0m")
+    params = Param(int(sys.argv[1]), int(sys.argv[2]), int(sys.argv[3]), int(sys.argv[4]))
+
+    num_nodes = params.num_nodes
+    svr_lid = SERVER_LID
+
+    test_prog = "'tests/test-progs/hangu-rnic/bin/server"
+    opt = "'-s " + str(svr_lid) + " -t " + str(num_nodes - 1) + " -m " + str(params.op_mode)
+    for i in range(num_nodes - 1):
+        test_prog += ";tests/test-progs/hangu-rnic/bin/client"
+        opt += ";-s " + str(svr_lid) + " -l " + str(svr_lid + i + 1) + " -t " + str(num_nodes - 1) + " -m " + str(params.op_mode)
+    test_prog += "'"
+    opt += "'"
+
+    return execute_program(test_prog=test_prog, option=opt, params=params)
+
+
+if __name__ == "__main__":
+    main()
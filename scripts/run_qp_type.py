@@ -0,0 +1,117 @@
+import os
+import re
+import time
+import sys
+
+SERVER_LID  = 10
+
+NUM_CPUS  = 1
+CPU_CLK   = "2GHz"
+EN_SPEED  = "100Gbps"
+PCI_SPEED = "128Gbps"
+
+# QP types of one run, <name: test program options>
+VARIANTS = [
+    ("rc", ""),
+    ("uc", " -u"),
+]
+
+# RdmaEngine stats compared between the QP types, summed over all RNICs
+STATS = ["winPktNum", "ackTxNum", "ucRxNum", "ucDropNum"]
+
+class Param():
+    def __init__(self, num_nodes, qpc_cache_cap, reorder_cap, op_mode):
+        self.num_nodes     = num_nodes
+        self.qpc_cache_cap = qpc_cache_cap
+        self.reorder_cap   = reorder_cap
+        self.op_mode       = op_mode
+
+
+def cmd_run_sim(test_prog, option, params, variant):
+    '''
+    Generate simulation running command, stats of each variant
+    go to m5out/qp_type/<variant>
+    '''
+
+    cmd = "cd ../ && build/X86/gem5.opt"
+    cmd += " -d m5out/qp_type/" + variant
+
+    # execution script
+    cmd += " configs/example/rdma/hangu_rnic_se.py"
+    cmd += " --cpu-clock " + CPU_CLK
+    cmd += " --num-cpus " + str(NUM_CPUS)
+    cmd += " -c " + test_prog
+    cmd += " -o " + option
+    cmd += " --node-num " + str(params.num_nodes)
+    cmd += " --ethernet-linkspeed " + EN_SPEED
+    cmd += " --pci-linkspeed "  + PCI_SPEED
+    cmd += " --qpc-cache-cap "  + str(params.qpc_cache_cap)
+    cmd += " --reorder-cap "    + str(params.reorder_cap)
+    cmd += " --mem-size 2048MB"
+    cmd += " > m5out/qp_type/" + variant + ".txt"
+
+    return cmd
+
+def read_stats(variant):
+    '''
+    STATS summed over all RNICs and engine lanes of one run
+    '''
+    stats = dict.fromkeys(STATS, 0)
+    with open("../m5out/qp_type/" + variant + "/stats.txt") as f:
+        for line in f:
+            item = line.split()
+            if len(item) < 2:
+                continue
+            for stat in STATS:
+                if re.match(r".*rdma_nic\..*\." + stat + "$", item[0]):
+                    stats[stat] += int(float(item[1]))
+    return stats
+
+def execute_program(test_prog, option, params):
+
+    cmd_list = [
+        "cd ../tests/test-progs/hangu-rnic/src && make",
+        "cd ../ && scons build/X86/gem5.opt",
+        "mkdir -p ../m5out/qp_type"
+    ]
+    for variant, prog_opt in VARIANTS:
+        cmd_list.append(cmd_run_sim(test_prog, option.replace(" -m ", prog_opt + " -m "),
+                params, variant))
+
+    for cmd in cmd_list:
+        print(cmd)
+        rtn = os.system(cmd)
+        if rtn != 0:
+            raise Exception("\033[0;31;40mError for cmd " + cmd + "\033[0m")
+        time.sleep(0.1)
+
+    # Packets kept in the send window and ACKs sent, UC should need none
+    print(("%-8s" + " %12s" * len(STATS)) % tuple(["qp_type"] + STATS))
+    for variant, prog_opt in VARIANTS:
+        stats = read_stats(variant)
+        print(("%-8s" + " %12d" * len(STATS)) % tuple([variant] + [stats[stat] for stat in STATS]))
+
+def main():
+    if len(sys.argv) != 5:
+        raise Exception("\033[0;31;40mMissing input parameter. Needs 4: "
+            "node_num qpc_cache_cap reorder_cap op_mode\033[0m")
+    if int(sys.argv[4]) != 0:
+        raise Exception("\033[0;31;40mUC QP supports RDMA Write (op_mode 0) only\033[0m")
+    params = Param(int(sys.argv[1]), int(sys.argv[2]), int(sys.argv[3]), int(sys.argv[4]))
+
+    num_nodes = params.num_nodes
+    svr_lid = SERVER_LID
+
+    test_prog = "'tests/test-progs/hangu-rnic/bin/server"
+    opt = "'-s " + str(svr_lid) + " -t " + str(num_nodes - 1) + " -m " + str(params.op_mode)
+    for i in range(num_nodes - 1):
+        test_prog += ";tests/test-progs/hangu-rnic/bin/client"
+        opt += ";-s " + str(svr_lid) + " -l " + str(svr_lid + i + 1) + " -t " + str(num_nodes - 1) + " -m " + str(params.op_mode)
+    test_prog += "'"
+    opt += "'"
+
+    return execute_program(test_prog=test_prog, option=opt, params=params)
+
+
+if __name__ == "__main__":
+    main()
@@ -99,6 +99,8 @@ class EtherSwitch(SimObject):
     delay = Param.Latency('0us', "packet transmit delay")
     delay_var = Param.Latency('0ns', "packet transmit delay variability")
     time_to_live = Param.Latency('10ms', "time to live of MAC address maping")
+    lookahead = Param.Latency('0ns', "delay of packets from devices in "
+                              "other event queues, no less than sim_quantum")
 
 class EtherTapBase(SimObject):
     type = 'EtherTapBase'
@@ -29,6 +29,8 @@
 #include "dev/net/etherpkt.hh"
 
 #include <iostream>
+#include <mutex>
+#include <vector>
 
 #include "base/inet.hh"
 #include "base/logging.hh"
@@ -70,3 +72,96 @@ EthPacketData::unserialize(const string &base, CheckpointIn &cp)
         simLength = length;
 }
 
+
+const unsigned EthPacketPool::ClassSize[EthPacketPool::NumClass] =
+    {256, 2048, 4096 + 256, 16384 + 256};
+
+namespace
+{
+
+struct PoolState
+{
+    // Packets may be released by another event queue thread
+    std::mutex lock;
+    std::vector<EthPacketData *> freeList[EthPacketPool::NumClass];
+    uint64_t allocNum = 0;
+    uint64_t reuseNum = 0;
+    bool enabled = true;
+};
+
+// Never destroyed, packets may be released during static destruction
+PoolState &
+poolState()
+{
+    static PoolState *state = new PoolState;
+    return *state;
+}
+
+} // anonymous namespace
+
+EthPacketPtr
+EthPacketPool::alloc(unsigned size)
+{
+    int cls = 0;
+    while (cls < NumClass && ClassSize[cls] < size)
+        ++cls;
+    PoolState &state = poolState();
+    if (cls == NumClass || !state.enabled)
+        return make_shared<EthPacketData>(size);
+
+    EthPacketData *pkt = nullptr;
+    {
+        lock_guard<mutex> guard(state.lock);
+        ++state.allocNum;
+        if (!state.freeList[cls].empty()) {
+            pkt = state.freeList[cls].back();
+            state.freeList[cls].pop_back();
+            ++state.reuseNum;
+        }
+    }
+    if (!pkt)
+        pkt = new EthPacketData(ClassSize[cls]);
+
+    return EthPacketPtr(pkt, [cls](EthPacketData *p) { release(p, cls); });
+}
+
+void
+EthPacketPool::release(EthPacketData *pkt, int cls)
+{
+    // bufLength may be shrunk by unserialize, restore it
+    pkt->bufLength = ClassSize[cls];
+    pkt->length = 0;
+    pkt->simLength = 0;
+
+    PoolState &state = poolState();
+    {
+        lock_guard<mutex> guard(state.lock);
+        if (state.freeList[cls].size() < MaxFree) {
+            state.freeList[cls].push_back(pkt);
+            return;
+        }
+    }
+    delete pkt;
+}
+
+uint64_t
+EthPacketPool::allocNum()
+{
+    PoolState &state = poolState();
+    lock_guard<mutex> guard(state.lock);
+    return state.allocNum;
+}
+
+uint64_t
+EthPacketPool::reuseNum()
+{
+    PoolState &state = poolState();
+    lock_guard<mutex> guard(state.lock);
+    return state.reuseNum;
+}
+
+void
+EthPacketPool::setEnabled(bool enabled)
+{
+    poolState().enabled = enabled;
+}
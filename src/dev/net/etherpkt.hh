@@ -86,4 +86,44 @@ class EthPacketData
 
 typedef std::shared_ptr<EthPacketData> EthPacketPtr;
 
+/**
+ * Size-classed pool of EthPacketData buffers. A packet drawn from the
+ * pool goes back to it when its last reference drops, wherever that
+ * happens (device, link or switch), so that the data buffer is reused
+ * instead of being freed. Requests larger than the largest class are
+ * served by a plain allocation.
+ */
+class EthPacketPool
+{
+  public:
+    /** Number of size classes */
+    static const int NumClass = 4;
+
+    /** Buffer size of each class, MTU sized ones leave room for headers */
+    static const unsigned ClassSize[NumClass];
+
+    /** Max number of free buffers kept in each class */
+    static const unsigned MaxFree = 4096;
+
+    /**
+     * Get a packet whose buffer holds at least size bytes.
+     * length and simLength of the returned packet are 0.
+     */
+    static EthPacketPtr alloc(unsigned size);
+
+    /** Number of allocations, and the ones served by recycled buffers */
+    static uint64_t allocNum();
+    static uint64_t reuseNum();
+
+    /**
+     * Turn the pool on or off for all devices, off makes alloc() a
+     * plain allocation of size bytes. Used to measure what the pool
+     * saves, set it before the simulation starts.
+     */
+    static void setEnabled(bool enabled);
+
+  private:
+    static void release(EthPacketData *pkt, int cls);
+};
+
 #endif // __DEV_NET_ETHERPKT_HH__
@@ -40,7 +40,8 @@
 using namespace std;
 
 EtherSwitch::EtherSwitch(const Params *p)
-    : SimObject(p), ttl(p->time_to_live)
+    : SimObject(p), ttl(p->time_to_live),
+      lookahead(p->lookahead)
 {
     for (int i = 0; i < p->port_interface_connection_count; ++i) {
         std::string interfaceName = csprintf("%s.interface%d", name(), i);
@@ -134,6 +135,26 @@ EtherSwitch::Interface::Interface(const std::string &name,
 
 bool
 EtherSwitch::Interface::recvPacket(EthPacketPtr packet)
+{
+    // The sender is simulated in another event queue (parallel
+    // simulation), hand the packet over to the event queue of the
+    // switch. The lookahead keeps the hand-off in the future of the
+    // switch, so it must be no less than the simulation quantum.
+    if (parent->eventQueue() != curEventQueue()) {
+        fatal_if(parent->lookahead == 0, "%s: packet from another event "
+                 "queue needs a non-zero lookahead\n", parent->name());
+        parent->schedule(new EventFunctionWrapper(
+                [this, packet]{ route(packet); }, name() + ".handoff", true),
+                curTick() + parent->lookahead);
+        return true;
+    }
+
+    route(packet);
+    return true;
+}
+
+void
+EtherSwitch::Interface::route(EthPacketPtr packet)
 {
     Net::EthAddr destMacAddr(packet->data);
     Net::EthAddr srcMacAddr(&packet->data[6]);
@@ -156,7 +177,6 @@ EtherSwitch::Interface::recvPacket(EthPacketPtr packet)
     // don't (drop packet); in both cases packet is received on
     // the interface successfully and there is no notion of busy
     // interface here (as we don't have inputFifo)
-    return true;
 }
 
 void
@@ -239,7 +259,8 @@ EtherSwitch::Interface::learnSenderAddr(Net::EthAddr srcMacAddr,
     auto it = parent->forwardingTable.find(uint64_t(srcMacAddr));
 
     // if the port for sender's MAC address is not cached,
-    // cache it now, otherwise just update lastUseTime time
+    // cache it now, otherwise just update lastUseTime time,
+    // and the port if the MAC has moved (e.g. NIC port failover)
     if (it == parent->forwardingTable.end()) {
         DPRINTF(Ethernet, "adding forwarding table entry for MAC "
                 " address %x on port %s\n", uint64_t(srcMacAddr),
@@ -250,6 +271,12 @@ EtherSwitch::Interface::learnSenderAddr(Net::EthAddr srcMacAddr,
         parent->forwardingTable.insert(std::make_pair(uint64_t(srcMacAddr),
             forwardingTableEntry));
     } else {
+        if (it->second.interface != sender) {
+            DPRINTF(Ethernet, "moving forwarding table entry for MAC "
+                    " address %x to port %s\n", uint64_t(srcMacAddr),
+                    sender->name());
+            it->second.interface = sender;
+        }
         it->second.lastUseTime = curTick();
     }
 }
@@ -308,7 +335,7 @@ EtherSwitch::Interface::PortFifoEntry::serialize(CheckpointOut &cp) const
 void
 EtherSwitch::Interface::PortFifoEntry::unserialize(CheckpointIn &cp)
 {
-    packet = make_shared<EthPacketData>(16384);
+    packet = EthPacketPool::alloc(16384);
     packet->unserialize("packet", cp);
     UNSERIALIZE_SCALAR(recvTick);
     UNSERIALIZE_SCALAR(srcId);
@@ -76,6 +76,10 @@ class EtherSwitch : public SimObject
          * through an (several) output queue(s)
          */
         bool recvPacket(EthPacketPtr packet);
+        /**
+         * Route a received packet to the output queue(s)
+         */
+        void route(EthPacketPtr packet);
         /**
          * enqueue packet to the outputFifo
          */
@@ -181,6 +185,8 @@ class EtherSwitch : public SimObject
   private:
     // time to live for MAC address mappings
     const double ttl;
+    // delay of packets received from devices in other event queues
+    const Tick lookahead;
     // all interfaces of the switch
     std::vector<Interface*> interfaces;
     // table that maps MAC address to interfaces
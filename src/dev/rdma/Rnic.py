@@ -36,6 +36,51 @@ class HanGuDriver(EmulatedDriver):
     cxx_header = 'dev/rdma/hangu_driver.hh'
 
     device = Param.RdmaNic('HanGu Rnic controlled by this driver')
+    cmd_queue = Param.Bool(False, "Post commands through the pipelined "
+            "command queue in host memory instead of HCR")
+
+# QP scheduling policy of the descriptor scheduler.
+# fifo: round robin, one quantum for a QP each time it is served
+# drr : deficit round robin, unused quantum of a backlogged QP is kept
+# wfq : weighted fair queueing over groups, then deficit round robin
+#       over QPs of the group
+class HanGuSchedPolicy(ScopedEnum): vals = ['fifo', 'drr', 'wfq']
+
+# Scheduling quantum and WQE fetch depth of bulk QPs if QoS is disabled.
+class HanGuQuantumPolicy(SimObject):
+    type = 'HanGuQuantumPolicy'
+    abstract = True
+    cxx_header = 'dev/rdma/hangu_quantum_policy.hh'
+
+    period = Param.Latency('0ns',
+        "Interval of quantum and fetch depth updates, 0 disables updates")
+
+class HanGuFixedQuantum(HanGuQuantumPolicy):
+    type = 'HanGuFixedQuantum'
+    cxx_header = 'dev/rdma/hangu_quantum_policy.hh'
+
+    quantum = Param.UInt32(Parent.sched_quantum,
+        "Bytes scheduled for a QP each round")
+    fetch_depth = Param.UInt32(Parent.max_prefetch_num,
+        "Max WQEs fetched for one QP at a time")
+
+class HanGuAdaptiveQuantum(HanGuQuantumPolicy):
+    type = 'HanGuAdaptiveQuantum'
+    cxx_header = 'dev/rdma/hangu_quantum_policy.hh'
+
+    period = '1us'
+    min_quantum = Param.UInt32(1024, "Min bytes scheduled for a QP each round")
+    max_quantum = Param.UInt32(65536, "Max bytes scheduled for a QP each round")
+    min_fetch_depth = Param.UInt32(2, "Min WQEs fetched for one QP at a time")
+    max_fetch_depth = Param.UInt32(32, "Max WQEs fetched for one QP at a time")
+    target_delay = Param.Latency('2us',
+        "Target time a backlogged QP waits in the QPN queue")
+    link_speed = Param.NetworkBandwidth(Parent.ether_speed,
+        "Link speed the quantum is sized for")
+    wqe_budget = Param.UInt32(Parent.wqe_cache_cap,
+        "WQE buffer entries shared by the active QPs")
+    gain = Param.Float(0.25,
+        "Weight of the measured delay in the correction of the quantum")
 
 class RdmaNic(PciDevice):
     type = 'RdmaNic'
@@ -47,9 +92,19 @@ class HanGuRnic(RdmaNic):
     # class for Han Gu RNIC
     type = 'HanGuRnic'
     cxx_header = "dev/rdma/hangu_rnic.hh"
-    mac_addr   = Param.UInt64(0x0, "Ethernet Hardware Address")
+    mac_addr   = Param.UInt64(0x0,
+        "Ethernet Hardware Address, port N uses it with N in byte 1")
     
-    interface = EtherInt("Ethernet Interface")
+    interface = EtherInt("Ethernet Interface, port 0")
+    ext_interface = VectorEtherInt("Ethernet Interfaces of port 1 and above")
+    port_num = Param.UInt32(1,
+        "Number of Ethernet ports, each one has its own link pacing. "
+        "Port N addresses port N of the peer, so peers need the same number")
+    lag_mode = Param.Bool(False,
+        "Link aggregation: QPs are hashed across ports by QPN, "
+        "instead of being bound to the port in QPC")
+    port_fail_tick = VectorParam.Tick([],
+        "Tick at which each port fails over to other ports, 0 keeps it up")
     
     mpt_cache_num = Param.Int(40000,
         "Number of mpt cache enteries")
@@ -61,8 +116,69 @@ class HanGuRnic(RdmaNic):
         "Number of cqc cache enteries")
     wqe_cache_cap = Param.Int(512,
         "Number of wqe cache enteries")
-    prefetch_window_size = Param.Int(8,
-        "Prefetch Window")
+    prefetch_window_size = Param.UInt32(12,
+        "Initial lookahead depth of the prefetcher, in QPs at the head of "
+        "the low priority QPN queue")
+    prefetch_min_depth = Param.UInt32(1, "Min lookahead depth of the prefetcher")
+    prefetch_max_depth = Param.UInt32(64, "Max lookahead depth of the prefetcher")
+    prefetch_adapt_interval = Param.UInt32(64,
+        "Prefetches used or evicted between lookahead depth adjustments, "
+        "0 keeps the depth fixed")
+    prefetch_acc_low = Param.Float(0.6,
+        "Lookahead depth is halved if fewer prefetches than this are used "
+        "before eviction")
+    prefetch_late_high = Param.Float(0.2,
+        "Lookahead depth grows by one if more used prefetches than this "
+        "are late")
+
+    qpn_num = Param.UInt32(512 * 3,
+        "Max QP number, QPN indexed tables are sized by it")
+    max_prefetch_num = Param.UInt32(8,
+        "Max WQEs fetched (and kept in WQE buffer) for one QP at a time, "
+        "fetch depth of HanGuFixedQuantum")
+    window_cap = Param.UInt32(20,
+        "Send window capacity of each RDMA engine lane, in packets waiting for ACK")
+    engine_lanes = Param.UInt32(1,
+        "Number of parallel RDMA engine lanes, QPs are sharded to lanes by QPN")
+    unsent_batch_threshold = Param.Int(4,
+        "Max WQE batches scheduled but not sent out")
+    desc_req_limit = Param.UInt32(0,
+        "Max WQEs waiting to be launched to RDMA engine, 0 is unlimited")
+    data_req_limit = Param.UInt32(0,
+        "Max data requests in process in RDMA engine, 0 is unlimited")
+    enable_prefetch = Param.Bool(True,
+        "Prefetch QPC, WQEs and MPTs of QPs in the QPN queue")
+    enable_qos = Param.Bool(False,
+        "Size WQE batches by QP weight and group granularity, or sched_quantum if disabled")
+    cache_all_cq_mpt = Param.Bool(True,
+        "Keep MPTs of all CQs on chip, out of MPT cache")
+    cache_all_qp_mpt = Param.Bool(False,
+        "Keep MPTs of all WQE buffers on chip, out of MPT cache")
+    sched_policy = Param.HanGuSchedPolicy('fifo',
+        "QP scheduling policy of the descriptor scheduler")
+    sched_quantum = Param.UInt32(4096,
+        "Bytes scheduled for a QP each round by HanGuFixedQuantum if QoS is "
+        "disabled, or QP weight * group granularity if it is enabled")
+    qos_ctrl_period = Param.Latency('0ns',
+        "Window of the group granularity controller, which tunes granularity "
+        "set by the driver toward the target group shares if QoS is enabled, "
+        "0 disables it")
+    qos_ctrl_gain = Param.Float(0.5,
+        "Exponent of the target to measured share ratio applied each window")
+    qos_ctrl_tolerance = Param.Float(0.05,
+        "Group share error regarded as converged, a fraction of link share")
+    qos_ctrl_range = Param.UInt32(16,
+        "Granularity is kept within driver granularity / range and * range")
+    quantum_policy = Param.HanGuQuantumPolicy(HanGuFixedQuantum(),
+        "Scheduling quantum and WQE fetch depth of bulk QPs if QoS is disabled")
+    lat_wqe_reserve = Param.UInt32(8,
+        "WQE buffer entries only latency sensitive QPs may use, "
+        "in effect once a latency sensitive QP is created")
+    adaptive_wqe_keep = Param.Bool(False,
+        "Size WQEs prefetched for each QP by its consumption and WQE fetch "
+        "miss cost under the WQE buffer budget, instead of the fetch depth")
+    wqe_keep_gain = Param.Float(0.125,
+        "EWMA weight of the per QP history used by adaptive_wqe_keep")
     
     VendorID = 0x8086
     DeviceID = 0x1075
@@ -93,4 +209,50 @@ class HanGuRnic(RdmaNic):
     reorder_cap = Param.Int(100, "Number of concurrent request for one qpc req channel")
 
     link_delay = Param.Latency('100ns', "ethernet link delay")
+
+    cqe_coalesce_num = Param.UInt32(5,
+        "Max CQEs coalesced into one CQ write, 1 disables coalescing. Writes are "
+        "also cut at 64B lines of the CQ ring, which hold 5 CQEs (12B each)")
+    cqe_coalesce_timeout = Param.Latency('200ns',
+        "Max time a CQE stays in the CQE staging buffer")
+
+    intr_mod_count = Param.UInt32(1,
+        "Raise CQ interrupt after this number of CQEs (interrupt moderation)")
+    intr_mod_time = Param.Latency('0ns',
+        "Raise CQ interrupt after this time since the first pending CQE, 0 disables it")
+    intr_mod_adaptive = Param.Bool(False,
+        "Tune interrupt moderation count according to interrupt interval")
+
+    db_coalesce = Param.Bool(True,
+        "Merge doorbells of the same QP waiting in the doorbell FIFO")
+    watchdog_period = Param.Latency('1ms',
+        "Report stall if no DMA progress is made in this time with pending requests, 0 disables it")
+    watchdog_panic = Param.Bool(False,
+        "Panic after the stall report of the watchdog")
+
+    trace_file = Param.String("",
+        "Binary event trace file in the output directory, empty disables tracing, "
+        "decoded by scripts/hangu_trace.py")
+    trace_mask = Param.UInt32(0xffffffff,
+        "Trace enable mask, one bit per module (see hangu_trace.hh)")
+    trace_buf_size = Param.UInt32(65536,
+        "Number of trace records buffered before written to the file")
+
+    fast_forward = Param.Bool(False,
+        "Start in functional fast-forward mode: DMA is done by functional "
+        "memory accesses, and PIO, DMA, PCIe and rx link delays are zero")
+    fast_forward_end = Param.Tick(0,
+        "Switch to timing mode at this tick, 0 means on the first drain resume "
+        "out of atomic memory mode (CPU switching, m5 switchcpu or checkpoint)")
+    ff_warm_caches = Param.Bool(True,
+        "Keep QPC/CQC/MPT/MTT caches warmed by fast-forward, "
+        "or write them back and start timing mode with cold caches")
+
+    eth_pkt_pool = Param.Bool(True,
+        "Recycle Ethernet packet buffers through EthPacketPool, turn it off "
+        "to measure what it saves. The pool is shared by all devices")
+    pool_alloc = Param.Bool(True,
+        "Recycle request objects through per-type pools (makePooled), turn "
+        "it off to measure what they save. Shared by all HanGuRnics")
+
     cpu_num    = Param.Int(10, "Number of CPUs in this node")
\ No newline at end of file
@@ -27,6 +27,7 @@ bool
 HanGuRnic::CqcModule::postCqcReq(CxtReqRspPtr cqcReq) {
 
     assert(cqcReq->type == CXT_RREQ_CQ);
+    HANGU_TRACE(rnic, TRACE_MOD_CQC, TRACE_EV_CQC_REQ, cqcReq->num, cqcReq->chnl, 0);
 
     if (cqcReq->chnl == CXT_CHNL_TX) {
         rnic->txCqcReqFifo.push(cqcReq);
@@ -57,14 +58,14 @@ HanGuRnic::CqcModule::cqcRspProc() {
     /* Get event and push cqcRsp to relevant Fifo */
     if (type == CXT_RREQ_CQ && chnl == CXT_CHNL_TX) {
         cqcRsp->type = CXT_RRSP_CQ;
-        e = &rnic->rdmaEngine.scuEvent;
+        e = &rnic->rdmaEngines[cqcRsp->lane]->scuEvent;
 
-        rnic->txCqcRspFifo.push(cqcRsp);
+        rnic->rdmaEngines[cqcRsp->lane]->txCqcRspFifo.push(cqcRsp);
     } else if (type == CXT_RREQ_CQ && chnl == CXT_CHNL_RX) {
         cqcRsp->type = CXT_RRSP_CQ;
-        e = &rnic->rdmaEngine.rcuEvent;
+        e = &rnic->rdmaEngines[cqcRsp->lane]->rcuEvent;
 
-        rnic->rxCqcRspFifo.push(cqcRsp);
+        rnic->rdmaEngines[cqcRsp->lane]->rxCqcRspFifo.push(cqcRsp);
     } else {
         panic("[CqcModule]: cxtReq type error! type: %d, chnl %d", type, chnl);
     }
@@ -152,4 +153,13 @@ HanGuRnic::CqcModule::cqcReqProc() {
         }
     }
 }
+void
+HanGuRnic::CqcModule::serialize(CheckpointOut &cp) const {
+    cqcCache.serializeSection(cp, "cqcCache");
+}
+
+void
+HanGuRnic::CqcModule::unserialize(CheckpointIn &cp) {
+    cqcCache.unserializeSection(cp, "cqcCache");
+}
 ///////////////////////////// HanGuRnic::CqcModule {end}//////////////////////////////
@@ -1,25 +1,42 @@
 
 #include "dev/rdma/hangu_rnic.hh"
 
+#include <algorithm>
+#include <cmath>
+
 // #include "debug/DescScheduler.hh"
 #include "base/trace.hh"
 #include "debug/HanGu.hh"
+#include "sim/stats.hh"
 
 using namespace HanGuRnicDef;
 using namespace Net;
 using namespace std;
 
-HanGuRnic::DescScheduler::DescScheduler(HanGuRnic *rNic, const std::string name):
+HanGuRnic::DescScheduler::DescScheduler(HanGuRnic *rNic, const std::string name, uint32_t laneNum):
     rNic(rNic),
     _name(name),
+    sysVtime(0),
+    ctrlStart(0),
+    ctrlConverged(false),
+    qosCtrlEvent([this]{qosCtrl();}, name),
+    queDelaySum(0),
+    queDelayNum(0),
+    quantumEvent([this]{quantumUpdate();}, name),
+    lowPriorityDescQue(laneNum),
+    wqeProcToLaunchWqeQueL(laneNum),
+    launchLane(0),
     wqePrefetchEvent([this]{wqePrefetch();}, name),
     launchWqeEvent([this]{launchWQE();}, name),
+    dbrRspEvent([this]{dbrRspProc();}, name),
     unsentBatchNum(0),
     wqePrefetchScheduleEvent([this]{wqePrefetchSchedule();}, name),
     updateEvent([this]{rxUpdate();}, name),
     createQpStatusEvent([this]{createQpStatus();}, name),
     qpcRspEvent([this]{qpcRspProc();}, name),
-    wqeProcEvent([this]{wqeProc();}, name) {
+    wqeProcEvent([this]{wqeProc();}, name),
+    latQpNum(0),
+    throttleEvent([this]{throttleRelease();}, name) {
         // HANGU_PRINT(DescScheduler, "desc scheduler init!\n");
 }
 
@@ -30,7 +47,7 @@ HanGuRnic::DescScheduler::DescScheduler(HanGuRnic *rNic, const std::string name)
 */
 void HanGuRnic::DescScheduler::qpcRspProc() {
     assert(dbQue.size() != 0);
-    DoorbellPtr db = dbQue.front();
+    DoorbellPtr db = std::move(dbQue.front());
     dbQue.pop();
     QPStatusPtr qpStatus;
     if (qpStatusTable.find(db->qpn) == qpStatusTable.end()) {
@@ -40,33 +57,27 @@ void HanGuRnic::DescScheduler::qpcRspProc() {
     bool schedule = false;
     // delete this line in the future
     assert(db->qpn == qpStatus->qpn);
-    assert(qpStatus->type == BW_QP || qpStatus->type == UD_QP || qpStatus->type == LAT_QP);
+    assert(qpStatus->type == BW_QP || qpStatus->type == UC_QP || 
+            qpStatus->type == UD_QP || qpStatus->type == LAT_QP);
     HANGU_PRINT(DescScheduler, "Before updating head. qpn: 0x%x, head: %d, tail:  %d\n", 
         qpStatus->qpn, qpStatus->head_ptr, qpStatus->tail_ptr);
-    if (qpStatus->type == LAT_QP) {
-        panic("latency QP!\n");
-        HANGU_PRINT(DescScheduler, "Inactive QP! high priority qpn: 0x%x, in que: %d, head pointer: %d, tail pointer: %d, curtick: %ld\n", 
-            db->qpn, qpStatus->in_que, qpStatus->head_ptr, qpStatus->tail_ptr, curTick());
-        assert(qpStatus->head_ptr == qpStatus->tail_ptr);
-        highPriorityQpnQue.push(db->qpn);
-        schedule = true;
-        qpStatus->in_que++;
-        // HANGU_PRINT(DescScheduler, "Inactive QP! high priority qpn: 0x%x, in que: %d\n", db->qpn, qpStatus->in_que);
+    if (qpStatus->dbr_addr) {
+        // Doorbell record mode. num in doorbell is ignored, new WQEs are got from the record
+        HANGU_PRINT(DescScheduler, "Doorbell of doorbell record QP! qpn: 0x%x\n", db->qpn);
+        dbrRead(qpStatus);
     }
     else {
         if (qpStatus->head_ptr == qpStatus->tail_ptr) { // WARNING: consider corner case!
-            lowPriorityQpnQue.push(db->qpn);
-            rNic->rescPrefetcher.prefetchQue.push(db->qpn);
-            rNic->rescPrefetcher.triggerPrefetch();
+            activateQp(qpStatus);
             schedule = true;
-            qpStatus->in_que++;
-            HANGU_PRINT(DescScheduler, "Inactive QP! low priority qpn: 0x%x, in que: %d\n", db->qpn, qpStatus->in_que);
+            HANGU_PRINT(DescScheduler, "Inactive QP! type: %d, qpn: 0x%x, in que: %d\n", 
+                qpStatus->type, db->qpn, qpStatus->in_que);
         }
         else {
             HANGU_PRINT(DescScheduler, "Active QP! Do not push QPN into QPN queue! qpn: 0x%x\n", db->qpn);
         }
+        qpStatus->head_ptr += db->num;
     }
-    qpStatus->head_ptr += db->num;
     // update QP status
     // WARNING: QP status update could lead to QP death
     qpStatusTable[qpStatus->qpn]->head_ptr = qpStatus->head_ptr;
@@ -81,37 +92,76 @@ void HanGuRnic::DescScheduler::qpcRspProc() {
 
 /**
  * @note
- * Pop QPN from QPN queue to prefetch WQE. Scheduling policy is FIFO.
+ * Push QP with new WQEs into QPN queue of its priority. 
+ * Only low priority QPs are prefetched ahead, as high priority 
+ * QPs are served as soon as they come.
+*/
+void HanGuRnic::DescScheduler::activateQp(QPStatusPtr qpStatus) {
+    if (qpStatus->type == LAT_QP) {
+        highPriorityQpnQue.push(qpStatus->qpn);
+    }
+    else {
+        lowPriorityQpnQue.push_back(qpStatus->qpn);
+        qpStatus->que_tick = curTick();
+        // backlogged QPs and groups count in fairness even if never served
+        qpNormBytes.emplace(qpStatus->qpn, 0);
+        groupNormBytes.emplace(qpStatus->group_id, 0);
+        rNic->rescPrefetcher.triggerPrefetch();
+        if (rNic->quantumPolicy->period() && !quantumEvent.scheduled()) {
+            rNic->schedule(quantumEvent, curTick() + rNic->quantumPolicy->period());
+        }
+        if (rNic->enableQos && rNic->qosCtrlPeriod && !qosCtrlEvent.scheduled()) {
+            rNic->schedule(qosCtrlEvent, curTick() + rNic->qosCtrlPeriod);
+        }
+    }
+    qpStatus->in_que++;
+}
+
+/**
+ * @note
+ * Pop QPN from QPN queue to prefetch WQE. High priority QPs are served 
+ * first, then low priority QPs according to sched_policy. 
+ * High priority QPs are not throttled by unsent batches, they are 
+ * not batched and do not count in unsentBatchNum.
 */
 void HanGuRnic::DescScheduler::wqePrefetchSchedule() {
     // HANGU_PRINT(DescScheduler, "into wqePrefetchSchedule! wqePrefetchQpStatusRReqQue size: %d\n", wqePrefetchQpStatusRReqQue.size());
-    if (unsentBatchNum > UNSENT_BATCH_NUM_THRESHOLD) {
+    if (unsentBatchNum > rNic->unsentBatchThreshold && highPriorityQpnQue.empty()) {
         HANGU_PRINT(DescScheduler, "Too many unsentBatchNum! %d\n", unsentBatchNum);
         return;
     }
     uint32_t batchSize;
     Tick bwDelay;
     uint32_t qpn;
-    if (highPriorityQpnQue.size() > 0) {
+    if (highPriorityQpnQue.empty() && lowPriorityQpnQue.empty()) {
+        // HANGU_PRINT(DescScheduler, "Empty QPN queue!\n");
+        // return;
+        panic("Empty QPN queue!\n");
+    }
+    // QPs over rate limit are set aside, and the next QP is served
+    bool found = false;
+    while (!found && highPriorityQpnQue.size() > 0) {
         qpn = highPriorityQpnQue.front();
         highPriorityQpnQue.pop();
-        wqePrefetchQpStatusRReqQue.push(qpn);
         qpStatusTable[qpn]->in_que--;
+        found = !rateThrottle(qpStatusTable[qpn]);
     }
-    else if (lowPriorityQpnQue.size() > 0) {
+    while (!found && lowPriorityQpnQue.size() > 0 && 
+            unsentBatchNum <= rNic->unsentBatchThreshold) {
         // HANGU_PRINT(DescScheduler, "Low priority QPN queue size: %d!\n", lowPriorityQpnQue.size());
-        qpn = lowPriorityQpnQue.front();
-        lowPriorityQpnQue.pop();
-        wqePrefetchQpStatusRReqQue.push(qpn);
+        qpn = popLowQpn();
         qpStatusTable[qpn]->in_que--;
-        rNic->rescPrefetcher.triggerPrefetch();
+        found = !rateThrottle(qpStatusTable[qpn]);
     }
-    else {
-        // HANGU_PRINT(DescScheduler, "Empty QPN queue!\n");
-        // return;
-        panic("Empty QPN queue!\n");
+    if (!found) {
+        // rescheduled by throttleRelease or sauProcessing
+        return;
+    }
+    wqePrefetchQpStatusRReqQue.push(qpn);
+    if (qpStatusTable[qpn]->type != LAT_QP) {
+        rNic->rescPrefetcher.triggerPrefetch();
+        unsentBatchNum++;
     }
-    unsentBatchNum++;
     batchSize = qpStatusTable[qpn]->weight * groupTable[qpStatusTable[qpn]->group_id];
     // HANGU_PRINT(DescScheduler, "Schedule wqePrefetchScheduleEvent! QPN: 0x%x, batchSize: %d, bwDelay: %d\n", 
         // qpn, batchSize, bwDelay);
@@ -151,8 +201,9 @@ void HanGuRnic::DescScheduler::wqePrefetch() {
         if (qpStatus->type == LAT_QP) {
             HANGU_PRINT(DescScheduler, "wqe prefetch! qpn: 0x%x, curtick: %ld\n", qpStatus->qpn, curTick());
         }
-        if (qpStatus->head_ptr - qpStatus->tail_ptr > MAX_PREFETCH_NUM) {
-            descNum = MAX_PREFETCH_NUM;
+        uint32_t fetchDepth = qpFetchDepth(qpStatus);
+        if (qpStatus->head_ptr - qpStatus->tail_ptr > fetchDepth) {
+            descNum = fetchDepth;
         }
         else {
             descNum = qpStatus->head_ptr - qpStatus->tail_ptr;
@@ -200,8 +251,8 @@ void HanGuRnic::DescScheduler::wqePrefetch() {
  * Process WQE responses and produce sub WQEs. Do not use wnd_start after this stage.
 */
 void HanGuRnic::DescScheduler::wqeProc() {
-    HANGU_PRINT(DescScheduler, "wqeProc in! wqeFetchInfoQue size: %d, wqeProcToLaunchWqeQueH size: %d, wqeProcToLaunchWqeQueL size: %d\n", 
-        wqeFetchInfoQue.size(), wqeProcToLaunchWqeQueH.size(), wqeProcToLaunchWqeQueL.size());
+    HANGU_PRINT(DescScheduler, "wqeProc in! wqeFetchInfoQue size: %d, wqeProcToLaunchWqeQueH size: %d\n", 
+        wqeFetchInfoQue.size(), wqeProcToLaunchWqeQueH.size());
     assert(rNic->txdescRspFifo.size());
     uint32_t descNum = rNic->wqeRspInfoQue.front().first;
     uint32_t qpn = rNic->wqeRspInfoQue.front().second;
@@ -210,7 +261,7 @@ void HanGuRnic::DescScheduler::wqeProc() {
     QPStatusPtr qpStatus = qpStatusTable[qpn];
     rNic->wqeRspInfoQue.pop();
     TxDescPtr desc;
-    uint8_t subDescNum = 0;
+    uint32_t subDescNum = 0;
     HANGU_PRINT(DescScheduler, "WQE processing begin! QPN: 0x%x, type: %d, group: %d, QP weight: %d, group granularity: %d, WQE fetch info queue size: %d\n", 
         qpStatus->qpn, qpStatus->type, qpStatus->group_id, qpStatus->weight, groupTable[qpStatus->group_id], wqeFetchInfoQue.size());
     assert(qpStatus->head_ptr >= qpStatus->tail_ptr);
@@ -226,31 +277,53 @@ void HanGuRnic::DescScheduler::wqeProc() {
         return;
     }
     // check QP type
-    if (qpStatus->type == LAT_QP) { // warning: modify here
-        // For latency sensitive QP, commit all WQEs
+    if (qpStatus->type == LAT_QP) {
+        // For latency sensitive QP, commit all WQEs at once. WQEs longer 
+        // than MAX_SUB_WQE_LEN are split, only the last piece keeps 
+        // the complete signal
+        uint32_t procSize = 0;
         for (int i = 0; i < descNum; i++) {
             desc = rNic->txdescRspFifo.front();
             rNic->txdescRspFifo.pop();
-            highPriorityDescQue.push(desc);
+            for (uint32_t offset = 0; offset < desc->len || offset == 0; offset += MAX_SUB_WQE_LEN) {
+                TxDescPtr subDesc = makePooled<TxDesc>(desc);
+                subDesc->opcode = desc->opcode;
+                subDesc->lVaddr = desc->lVaddr + offset;
+                subDesc->rdmaType.rVaddr_l = desc->rdmaType.rVaddr_l + offset;
+                subDesc->len = std::min(desc->len - offset, (uint32_t)MAX_SUB_WQE_LEN);
+                if (offset + subDesc->len < desc->len) {
+                    subDesc->cancelCompleteSignal();
+                }
+                highPriorityDescQue.push(subDesc);
+                subDescNum++;
+            }
+            HANGU_PRINT(DescScheduler, "LAT WQE split! qpn: 0x%x, len: %d, sub WQE num: %d\n", 
+                qpStatus->qpn, desc->len, subDescNum);
+            procSize += desc->len;
         }
+        rateCharge(qpStatus, procSize);
+        assert(qpStatus->tail_ptr + descNum <= qpStatus->head_ptr);
         qpStatus->tail_ptr += descNum;
-        subDescNum = descNum;
+        updateNum = descNum;
         HANGU_PRINT(DescScheduler, "received WQE response! qpn: 0x%x, curtick: %ld\n", qpStatus->qpn, curTick());
+        if (qpStatus->tail_ptr != qpStatus->head_ptr) {
+            activateQp(qpStatus);
+            assert(qpStatus->in_que == 1);
+            if (!wqePrefetchScheduleEvent.scheduled()) {
+                rNic->schedule(wqePrefetchScheduleEvent, curTick() + rNic->clockPeriod());
+            }
+        }
+        else if (qpStatus->dbr_addr) {
+            dbrRead(qpStatus);
+        }
     }
-    else if (qpStatus->type == BW_QP || qpStatus->type == UD_QP) {
+    else if (qpStatus->type == BW_QP || qpStatus->type == UC_QP || qpStatus->type == UD_QP) {
         assert(descNum >= 1);
         uint32_t procSize = 0; // data size been processed in this schedule period
-        uint32_t batchSize; // the size of data that should be transmitted in this schedule period
-        # ifdef ENABLE_QOS
-        assert(qpStatus->weight > 0);
-        assert(groupTable[qpStatus->group_id] > 0);
-        batchSize = qpStatus->weight * groupTable[qpStatus->group_id];
-        # else 
-        batchSize = 4096;
-        # endif
+        uint32_t batchSize = schedBatch(qpStatus); // the size of data that should be transmitted in this schedule period
         assert(batchSize > 0);
         for (int i = 0; i < descNum; i++) {
-            HANGU_PRINT(DescScheduler, "new BW/UD desc received by wqe proc! qpn: 0x%x\n", qpStatus->qpn);
+            HANGU_PRINT(DescScheduler, "new BW/UC/UD desc received by wqe proc! qpn: 0x%x\n", qpStatus->qpn);
             assert(rNic->txdescRspFifo.size());
             if (procSize < batchSize) {
                 TxDescPtr desc = rNic->txdescRspFifo.front();
@@ -258,10 +331,9 @@ void HanGuRnic::DescScheduler::wqeProc() {
                     qpStatus->qpn, qpStatus->fetch_offset, desc->len, batchSize, descNum, groupTable[qpStatus->group_id], qpStatus->weight);
                 HANGU_PRINT(DescScheduler, "ready to split WQE! qpn: 0x%x, tail pointer: %d, head pointer: %d, fetch offset: 0x%x\n", 
                     qpStatus->qpn, qpStatus->tail_ptr, qpStatus->head_ptr, qpStatus->fetch_offset);
-                assert(desc->len <= batchSize); // temp check to avoid message overlong in connection establishment
                 assert(qpStatus->tail_ptr < qpStatus->head_ptr);
                 assert(qpStatus->fetch_offset < desc->len);
-                TxDescPtr subDesc = make_shared<TxDesc>(desc);
+                TxDescPtr subDesc = makePooled<TxDesc>(desc);
                 subDesc->opcode = desc->opcode;
                 subDesc->lVaddr = desc->lVaddr + qpStatus->fetch_offset;
                 subDesc->rdmaType.rVaddr_l = desc->rdmaType.rVaddr_l + qpStatus->fetch_offset;
@@ -306,39 +378,33 @@ void HanGuRnic::DescScheduler::wqeProc() {
                 HANGU_PRINT(DescScheduler, "finish WQE split: type: %d, sub WQE length: %d, qpn: 0x%x, descNum: %d, sub WQE flag: 0x%x\n", 
                     qpStatus->type, subDesc->len, qpStatus->qpn, descNum, subDesc->flags);
                 assert(subDesc->opcode != 0);
-                lowPriorityDescQue.push(subDesc);
+                lowPriorityDescQue[rNic->laneOf(qpStatus->qpn)->lane].push(subDesc);
                 subDescNum++;
             }
             rNic->txdescRspFifo.pop();
         }
+        schedCharge(qpStatus, procSize);
+        rateCharge(qpStatus, procSize);
         if (qpStatus->tail_ptr != qpStatus->head_ptr) {
-            lowPriorityQpnQue.push(qpStatus->qpn);
-            rNic->rescPrefetcher.prefetchQue.push(qpStatus->qpn);
-            qpStatus->in_que++;
+            activateQp(qpStatus);
             HANGU_PRINT(DescScheduler, "push back qpn into low qpn queue, qpn: 0x%x, in_que: %d\n", qpStatus->qpn, qpStatus->in_que);
             assert(qpStatus->in_que == 1);
             if (!wqePrefetchScheduleEvent.scheduled()) {
                 rNic->schedule(wqePrefetchScheduleEvent, curTick() + rNic->clockPeriod());
             }
-            rNic->rescPrefetcher.triggerPrefetch();
         }
         else {
             HANGU_PRINT(DescScheduler, "qp[0x%x] is idle! in_que: %d\n", qpStatus->qpn, qpStatus->in_que);
             assert(qpStatus->in_que == 0);
+            // pick up WQEs posted since the last doorbell record read
+            if (qpStatus->dbr_addr) {
+                dbrRead(qpStatus);
+            }
         }
     }
     else {
         panic("Illegal QP type!\n");
     }
-    // write QPN back to low QPN queue in case of UD and UC QP
-    if ((qpStatus->type == UD_QP || qpStatus->type == UC_QP) && (qpStatus->tail_ptr < qpStatus->head_ptr)) {
-        panic("Illegal!\n");
-        lowPriorityQpnQue.push(qpStatus->qpn);
-        HANGU_PRINT(DescScheduler, "UD or UC QP prefetch: type: %d\n", qpStatus->type);
-        if (!wqePrefetchScheduleEvent.scheduled()) {
-            rNic->schedule(wqePrefetchScheduleEvent, curTick() + rNic->clockPeriod());
-        }
-    }
     // update WQE buffer
     if (updateNum != 0) {
         HANGU_PRINT(DescScheduler, "update wqe buffer! updateNum: %d, qpn: 0x%x\n", updateNum, qpStatus->qpn);
@@ -351,13 +417,13 @@ void HanGuRnic::DescScheduler::wqeProc() {
     // unlock WQE fetching
     assert(qpStatus->fetch_lock == 1);
     qpStatus->fetch_lock = 0;
-    DoorbellPtr doorbell = make_shared<DoorbellFifo>(subDescNum, qpStatus->qpn, qpStatus->type);
+    DoorbellPtr doorbell = makeOwned<DoorbellFifo>(subDescNum, qpStatus->qpn, qpStatus->type);
     if (qpStatus->type == LAT_QP) {
-        wqeProcToLaunchWqeQueH.push(doorbell);
+        wqeProcToLaunchWqeQueH.push(std::move(doorbell));
         HANGU_PRINT(DescScheduler, "pseudo doorbell into Hqueue to launchWQE, QPN: 0x%x, num: %d\n", qpStatus->qpn, subDescNum);
     }
     else {
-        wqeProcToLaunchWqeQueL.push(doorbell);
+        wqeProcToLaunchWqeQueL[rNic->laneOf(qpStatus->qpn)->lane].push(std::move(doorbell));
         HANGU_PRINT(DescScheduler, "pseudo doorbell into Lqueue to launchWQE, QPN: 0x%x, num: %d\n", qpStatus->qpn, subDescNum);
     }
     if (!launchWqeEvent.scheduled()) {
@@ -369,60 +435,134 @@ void HanGuRnic::DescScheduler::wqeProc() {
 }
 
 /**
- * @note: send sub-wqe to DDU in RDMA engine
+ * @note: bulk WQEs of a lane can be launched if the lane has a pseudo 
+ * doorbell waiting and its launch queue is under descReqLimit.
+*/
+bool HanGuRnic::DescScheduler::launchReady(uint8_t lane) {
+    return wqeProcToLaunchWqeQueL[lane].size() && (rNic->descReqLimit == 0 || 
+            rNic->rdmaEngines[lane]->txDescLaunchQue.size() < rNic->descReqLimit);
+}
+
+/**
+ * @note: send sub-wqe to DDU of the RDMA engine lane serving the QP. WQEs 
+ * of high priority QPs go to their own launch queue, which is not limited 
+ * by descReqLimit, and DDU serves it before bulk sub-WQEs. Bulk WQEs wait 
+ * in one queue for each lane, which are served round robin, so a full 
+ * lane does not block the others. launchWQE sleeps while all the lanes 
+ * are full, DDU wakes it up by laneDrained.
 */
 void HanGuRnic::DescScheduler::launchWQE() {
-    HANGU_PRINT(DescScheduler, "into launchWQE! txDescLaunchQue size: %d\n", rNic->txDescLaunchQue.size());
-    if (rNic->txDescLaunchQue.size() < DATA_REQ_LIMIT || 1) {
-        DoorbellPtr doorbell;
-        if (wqeProcToLaunchWqeQueH.size() > 0) {
-            // get pseudo doorbell
-            doorbell = wqeProcToLaunchWqeQueH.front();
-            wqeProcToLaunchWqeQueH.pop();
-            HANGU_PRINT(DescScheduler, "high priority pseudo doorbell get by launchWQE, QPN: 0x%x, num: %d, type: %d, desc launch queue size: %d\n", 
-                doorbell->qpn, doorbell->num, doorbell->opcode, rNic->txDescLaunchQue.size());
-            assert(doorbell->num != 0);
-            assert(highPriorityDescQue.size() >= doorbell->num);
-            assert(doorbell->opcode == LAT_QP);
-            for (int i = 0; i < doorbell->num; i++) {
-                rNic->txDescLaunchQue.push(highPriorityDescQue.front());
-                highPriorityDescQue.pop();
-            }
+    HANGU_PRINT(DescScheduler, "into launchWQE!\n");
+    RdmaEngine *engine = nullptr;
+    uint32_t laneNum = wqeProcToLaunchWqeQueL.size();
+    if (wqeProcToLaunchWqeQueH.size() > 0) {
+        // get pseudo doorbell
+        DoorbellPtr doorbell = std::move(wqeProcToLaunchWqeQueH.front());
+        wqeProcToLaunchWqeQueH.pop();
+        engine = rNic->laneOf(doorbell->qpn);
+        HANGU_PRINT(DescScheduler, "high priority pseudo doorbell get by launchWQE, QPN: 0x%x, num: %d, type: %d, desc launch queue size: %d\n", 
+            doorbell->qpn, doorbell->num, doorbell->opcode, engine->txDescLaunchQue.size());
+        assert(doorbell->num != 0);
+        assert(highPriorityDescQue.size() >= doorbell->num);
+        assert(doorbell->opcode == LAT_QP);
+        for (int i = 0; i < doorbell->num; i++) {
+            engine->txDescLaunchQueH.push(highPriorityDescQue.front());
+            engine->latLaunchTick.push(curTick());
+            highPriorityDescQue.pop();
         }
-        else if (wqeProcToLaunchWqeQueL.size() > 0) {
+        // bulk sub-WQEs this WQE would wait behind in one launch queue
+        engine->latBypassNum += engine->txDescLaunchQue.size();
+        HANGU_TRACE(rNic, TRACE_MOD_SCHED, TRACE_EV_WQE_LAUNCH, doorbell->qpn, 0, doorbell->num);
+        engine->df2ddFifoH.push(std::move(doorbell));
+    }
+    else {
+        // find the next lane which is able to take WQEs
+        uint8_t lane = launchLane;
+        for (uint32_t i = 0; i < laneNum && !launchReady(lane); ++i) {
+            lane = (lane + 1) % laneNum;
+        }
+        if (launchReady(lane)) {
+            launchLane = (lane + 1) % laneNum;
+            engine = rNic->rdmaEngines[lane];
+            std::queue<DoorbellPtr> &dbQueL = wqeProcToLaunchWqeQueL[lane];
+            std::queue<TxDescPtr> &descQueL = lowPriorityDescQue[lane];
             // get pseudo doorbell
-            doorbell = wqeProcToLaunchWqeQueL.front();
-            wqeProcToLaunchWqeQueL.pop();
-            HANGU_PRINT(DescScheduler, "launchWQE gets low priority pseudo doorbell, QPN: 0x%x, num: %d, type: %d, wqeProcToLaunchWqeQueL size: %d, desc launch queue size: %d\n", 
-                doorbell->qpn, doorbell->num, doorbell->opcode, wqeProcToLaunchWqeQueL.size(), rNic->txDescLaunchQue.size());
+            DoorbellPtr doorbell = std::move(dbQueL.front());
+            dbQueL.pop();
+            HANGU_PRINT(DescScheduler, "launchWQE gets low priority pseudo doorbell, QPN: 0x%x, num: %d, type: %d, lane: %d, wqeProcToLaunchWqeQueL size: %d, desc launch queue size: %d\n", 
+                doorbell->qpn, doorbell->num, doorbell->opcode, lane, dbQueL.size(), engine->txDescLaunchQue.size());
             assert(doorbell->num != 0);
-            assert(lowPriorityDescQue.size() >= doorbell->num);
+            assert(descQueL.size() >= doorbell->num);
             assert(doorbell->opcode == BW_QP || doorbell->opcode == UC_QP || doorbell->opcode == UD_QP);
             for (int i = 0; i < doorbell->num; i++) {
-                rNic->txDescLaunchQue.push(lowPriorityDescQue.front());
+                engine->txDescLaunchQue.push(descQueL.front());
                 HANGU_PRINT(DescScheduler, "Launch WQE!, QPN: 0x%x, desc num: %d, i: %d, sub-msg size: %d\n", 
-                    doorbell->qpn, doorbell->num, i, lowPriorityDescQue.front()->len);
-                lowPriorityDescQue.pop();
+                    doorbell->qpn, doorbell->num, i, descQueL.front()->len);
+                descQueL.pop();
             }
+            HANGU_TRACE(rNic, TRACE_MOD_SCHED, TRACE_EV_WQE_LAUNCH, doorbell->qpn, 0, doorbell->num);
+            engine->df2ddFifo.push(std::move(doorbell));
         }
         else {
-            panic("Empty launch wqe queue!\n");
-        }
-        rNic->rdmaEngine.df2ddFifo.push(doorbell); 
-        
-        if (!rNic->rdmaEngine.dduEvent.scheduled()) {
-            rNic->schedule(rNic->rdmaEngine.dduEvent, curTick() + rNic->clockPeriod());
+            HANGU_PRINT(DescScheduler, "no lane is able to take WQEs, launchWQE sleeps\n");
         }
     }
-    else {
-        HANGU_PRINT(DescScheduler, "txDescLaunchQue is full: %d\n", rNic->txDescLaunchQue.size());
+
+    if (engine && !engine->dduEvent.scheduled()) {
+        rNic->schedule(engine->dduEvent, curTick() + rNic->clockPeriod());
     }
 
-    if (!launchWqeEvent.scheduled() && (wqeProcToLaunchWqeQueH.size() || wqeProcToLaunchWqeQueL.size())) {
+    bool ready = wqeProcToLaunchWqeQueH.size();
+    for (uint32_t i = 0; i < laneNum && !ready; ++i) {
+        ready = launchReady(i);
+    }
+    if (!launchWqeEvent.scheduled() && ready) {
+        rNic->schedule(launchWqeEvent, curTick() + rNic->clockPeriod());
+    }
+}
+
+/**
+ * @note: called by DDU when a WQE leaves the launch queue of a lane, 
+ * wakes up launchWQE if WQEs of the lane are waiting for space.
+*/
+void HanGuRnic::DescScheduler::laneDrained(uint8_t lane) {
+    if (!launchWqeEvent.scheduled() && launchReady(lane)) {
         rNic->schedule(launchWqeEvent, curTick() + rNic->clockPeriod());
     }
 }
 
+/**
+ * @note: called by SAU when a request of the QP is sent, size is the 
+ * payload (or the length read). qosCtrl and the bandwidth and fairness 
+ * stats measure shares by it, rather than by bytes scheduled, as WQEs 
+ * of one group may wait behind others in the launch queues and send queues.
+*/
+void HanGuRnic::DescScheduler::qpSent(uint32_t qpn, uint32_t size) {
+    auto it = qpStatusTable.find(qpn);
+    if (it == qpStatusTable.end()) {
+        return;
+    }
+    QPStatusPtr qpStatus = it->second;
+    groupWinBytes[qpStatus->group_id] += size;
+    qpSentBytes.sample(qpn, size);
+    groupSentBytes[qpStatus->group_id] += size;
+    if (qpStatus->type != LAT_QP) {
+        qpNormBytes[qpn] += (double)size / qpWeight(qpStatus);
+        groupNormBytes[qpStatus->group_id] += (double)size / groupTargetShare(qpStatus->group_id);
+    }
+}
+
+/**
+ * @note
+ * Weight the driver sets for the QP. QPs share equally if QoS is disabled.
+*/
+uint32_t HanGuRnic::DescScheduler::qpWeight(QPStatusPtr qpStatus) {
+    if (!rNic->enableQos) {
+        return 1;
+    }
+    return std::max((uint32_t)qpStatus->weight, (uint32_t)1);
+}
+
 /**
  * @note
  * Update win_fetch and tail_ptr in QP status. Add QPN back to QPN queue in case of RC QP
@@ -469,7 +609,19 @@ void HanGuRnic::DescScheduler::createQpStatus() {
     assert(rNic->createQue.size());
     QPStatusPtr status = rNic->createQue.front();
     rNic->createQue.pop();
+    // QPC of the QPN is rewritten, the old QP is gone
+    if (qpStatusTable.find(status->qpn) != qpStatusTable.end()) {
+        QPStatusPtr old = qpStatusTable[status->qpn];
+        groupQpWeight[old->group_id] -= old->weight;
+        if (old->type == LAT_QP) {
+            latQpNum--;
+        }
+    }
     qpStatusTable[status->qpn] = status;
+    groupQpWeight[status->group_id] += status->weight;
+    if (status->type == LAT_QP) {
+        latQpNum++;
+    }
     HANGU_PRINT(DescScheduler, "new QP created! type: %d, qpn: 0x%x\n", status->type, status->qpn);
     assert(status->type == LAT_QP   || 
            status->type == BW_QP    || 
@@ -478,4 +630,701 @@ void HanGuRnic::DescScheduler::createQpStatus() {
     if (rNic->createQue.size()) {
         rNic->schedule(createQpStatusEvent, curTick() + rNic->clockPeriod());
     }
-}
\ No newline at end of file
+}
+
+/**
+ * @note
+ * Read doorbell record of the QP to get WQEs posted by host. It is called 
+ * when doorbell of the QP comes, or the QP runs out of WQEs, so WQEs posted 
+ * in the meantime are got in one batch. Only one read of a QP is on the fly, 
+ * triggers during the read are merged into one more read.
+*/
+void HanGuRnic::DescScheduler::dbrRead(QPStatusPtr qpStatus) {
+    assert(qpStatus->dbr_addr);
+    if (qpStatus->dbr_state != DBR_IDLE) {
+        qpStatus->dbr_pending = 1;
+        return;
+    }
+    qpStatus->dbr_state = DBR_READ;
+    postDbrRead(qpStatus);
+}
+
+void HanGuRnic::DescScheduler::postDbrRead(QPStatusPtr qpStatus) {
+    ++dbrReadNum;
+    HANGU_PRINT(DescScheduler, "read doorbell record! qpn: 0x%x, state: %d\n", 
+        qpStatus->qpn, qpStatus->dbr_state);
+    DmaReqPtr dmaReq = makePooled<DmaReq>(rNic->pciToDma(qpStatus->dbr_addr), sizeof(DbRecord), 
+            nullptr, (uint8_t *)&qpStatus->dbr_buf, 0);
+    dmaReq->cplCallback = [this, qpStatus](const DmaReqPtr &) {
+        dbrRspQue.push(qpStatus);
+        if (!dbrRspEvent.scheduled()) {
+            rNic->schedule(dbrRspEvent, curTick() + rNic->clockPeriod());
+        }
+    };
+    rNic->ccuDmaReadFifo.push(dmaReq);
+    if (!rNic->dmaEngine.dmaReadEvent.scheduled()) {
+        rNic->schedule(rNic->dmaEngine.dmaReadEvent, curTick() + rNic->clockPeriod());
+    }
+}
+
+/**
+ * @note
+ * Set armed in doorbell record, so that host rings doorbell for the next 
+ * post. The record is read again after that, in case host posted WQEs 
+ * before it sees armed.
+*/
+void HanGuRnic::DescScheduler::postDbrArm(QPStatusPtr qpStatus) {
+    HANGU_PRINT(DescScheduler, "arm doorbell record! qpn: 0x%x\n", qpStatus->qpn);
+    qpStatus->dbr_arm = 1;
+    DmaReqPtr dmaReq = makePooled<DmaReq>(rNic->pciToDma(qpStatus->dbr_addr + offsetof(DbRecord, armed)), 
+            sizeof(uint32_t), nullptr, (uint8_t *)&qpStatus->dbr_arm, 0);
+    dmaReq->cplCallback = [this, qpStatus](const DmaReqPtr &) {
+        postDbrRead(qpStatus);
+    };
+    rNic->dataDmaWriteFifo.push(dmaReq);
+    if (!rNic->dmaEngine.dmaWriteEvent.scheduled()) {
+        rNic->schedule(rNic->dmaEngine.dmaWriteEvent, curTick() + rNic->clockPeriod());
+    }
+}
+
+void HanGuRnic::DescScheduler::dbrRspProc() {
+    assert(dbrRspQue.size());
+    QPStatusPtr qpStatus = dbrRspQue.front();
+    dbrRspQue.pop();
+    uint32_t sqPi = qpStatus->dbr_buf.sqPi;
+    HANGU_PRINT(DescScheduler, "doorbell record got! qpn: 0x%x, sqPi: %d, head_ptr: %d, tail_ptr: %d, state: %d\n", 
+        qpStatus->qpn, sqPi, qpStatus->head_ptr, qpStatus->tail_ptr, qpStatus->dbr_state);
+    if (sqPi != qpStatus->head_ptr) {
+        assert(sqPi - qpStatus->head_ptr < (1U << 31));
+        // Same as doorbell processing, QP without unfinished WQE is pushed into QPN queue
+        if (qpStatus->head_ptr == qpStatus->tail_ptr) {
+            activateQp(qpStatus);
+            if (!wqePrefetchScheduleEvent.scheduled()) {
+                rNic->schedule(wqePrefetchScheduleEvent, curTick() + rNic->clockPeriod());
+            }
+        }
+        qpStatus->head_ptr = sqPi;
+        // WQEs posted after this read are got when the QP runs out of WQEs
+        qpStatus->dbr_state = DBR_IDLE;
+        qpStatus->dbr_pending = 0;
+    }
+    else if (qpStatus->dbr_pending) {
+        qpStatus->dbr_pending = 0;
+        postDbrRead(qpStatus);
+    }
+    else if (qpStatus->dbr_state == DBR_READ) {
+        // No new WQE, let host ring the doorbell next time
+        qpStatus->dbr_state = DBR_ARM;
+        postDbrArm(qpStatus);
+    }
+    else {
+        // Armed and still no new WQE, wait for the doorbell
+        qpStatus->dbr_state = DBR_IDLE;
+    }
+    if (dbrRspQue.size() && !dbrRspEvent.scheduled()) {
+        rNic->schedule(dbrRspEvent, curTick() + rNic->clockPeriod());
+    }
+}
+
+/**
+ * @note
+ * Install, update or remove (rate is 0) the token bucket of a QP or group. 
+ * A new bucket starts full.
+*/
+void HanGuRnic::DescScheduler::setRateLimit(const RateLimitInfo &info) {
+    HANGU_PRINT(DescScheduler, "set rate limit! type: %d, id: 0x%x, rate: %d Mbps, burst: %d\n", 
+        info.type, info.id, info.rate, info.burst);
+    assert(info.type == RATE_LIMIT_QP || info.type == RATE_LIMIT_GROUP);
+    if (info.rate == 0) {
+        if (info.type == RATE_LIMIT_QP) {
+            qpBucket.erase(info.id);
+        }
+        else {
+            groupBucket.erase(info.id);
+        }
+        return;
+    }
+    TokenBucket &bucket = (info.type == RATE_LIMIT_QP) ? 
+            qpBucket[info.id] : groupBucket[info.id];
+    bool created = (bucket.rate == 0);
+    refill(bucket);
+    bucket.rate  = (double)info.rate * 1000000 / 8 / SimClock::Frequency;
+    bucket.burst = info.burst;
+    if (created || bucket.tokens > bucket.burst) {
+        bucket.tokens = bucket.burst;
+    }
+    bucket.last = curTick();
+}
+
+void HanGuRnic::DescScheduler::refill(TokenBucket &bucket) {
+    bucket.tokens = std::min(bucket.burst, 
+            bucket.tokens + (curTick() - bucket.last) * bucket.rate);
+    bucket.last = curTick();
+}
+
+/**
+ * @note
+ * Ticks before the bucket has no debt, 0 if the QP or group may send now
+*/
+Tick HanGuRnic::DescScheduler::bucketWait(TokenBucket &bucket) {
+    refill(bucket);
+    if (bucket.tokens >= 0) {
+        return 0;
+    }
+    return (Tick)std::ceil(-bucket.tokens / bucket.rate);
+}
+
+/**
+ * @note
+ * A QP may be scheduled if neither its bucket nor the bucket of its group 
+ * is in debt. Otherwise it is set aside until the tokens are refilled, so 
+ * that it does not block other QPs.
+*/
+bool HanGuRnic::DescScheduler::rateThrottle(QPStatusPtr qpStatus) {
+    Tick wait = 0;
+    auto qpIt = qpBucket.find(qpStatus->qpn);
+    if (qpIt != qpBucket.end()) {
+        wait = bucketWait(qpIt->second);
+    }
+    auto groupIt = groupBucket.find(qpStatus->group_id);
+    if (groupIt != groupBucket.end()) {
+        wait = std::max(wait, bucketWait(groupIt->second));
+    }
+    if (wait == 0) {
+        return false;
+    }
+    HANGU_PRINT(DescScheduler, "QP throttled! qpn: 0x%x, group: %d, wait: %ld\n", 
+        qpStatus->qpn, qpStatus->group_id, wait);
+    ThrottledQp item = {qpStatus->qpn, curTick(), curTick() + wait};
+    throttledQpn.push_back(item);
+    ++throttleNum;
+    if (!throttleEvent.scheduled()) {
+        rNic->schedule(throttleEvent, item.release);
+    }
+    else if (throttleEvent.when() > item.release) {
+        rNic->reschedule(throttleEvent, item.release);
+    }
+    return true;
+}
+
+void HanGuRnic::DescScheduler::rateCharge(QPStatusPtr qpStatus, uint32_t size) {
+    auto qpIt = qpBucket.find(qpStatus->qpn);
+    if (qpIt != qpBucket.end()) {
+        refill(qpIt->second);
+        qpIt->second.tokens -= size;
+    }
+    auto groupIt = groupBucket.find(qpStatus->group_id);
+    if (groupIt != groupBucket.end()) {
+        refill(groupIt->second);
+        groupIt->second.tokens -= size;
+    }
+}
+
+/**
+ * @note
+ * Put QPs whose wait ends back to QPN queue. They are checked 
+ * again when scheduled, as the group tokens may be used by others.
+*/
+void HanGuRnic::DescScheduler::throttleRelease() {
+    Tick next = MaxTick;
+    for (auto it = throttledQpn.begin(); it != throttledQpn.end(); ) {
+        if (it->release <= curTick()) {
+            QPStatusPtr qpStatus = qpStatusTable[it->qpn];
+            throttleTicks += curTick() - it->start;
+            groupThrottleTicks[qpStatus->group_id] += curTick() - it->start;
+            activateQp(qpStatus);
+            it = throttledQpn.erase(it);
+        }
+        else {
+            next = std::min(next, it->release);
+            ++it;
+        }
+    }
+    if (next != MaxTick) {
+        rNic->schedule(throttleEvent, next);
+    }
+    if ((highPriorityQpnQue.size() || lowPriorityQpnQue.size()) && 
+            !wqePrefetchScheduleEvent.scheduled()) {
+        rNic->schedule(wqePrefetchScheduleEvent, curTick() + rNic->clockPeriod());
+    }
+}
+
+uint32_t HanGuRnic::DescScheduler::qpQuantum(QPStatusPtr qpStatus) {
+    if (rNic->enableQos) {
+        assert(qpStatus->weight > 0);
+        assert(groupTable[qpStatus->group_id] > 0);
+        return qpStatus->weight * groupTable[qpStatus->group_id];
+    }
+    return rNic->quantumPolicy->quantum();
+}
+
+uint32_t HanGuRnic::DescScheduler::qpFetchDepth(QPStatusPtr qpStatus) {
+    if (qpStatus->type == LAT_QP) {
+        return rNic->maxPrefetchNum;
+    }
+    return rNic->quantumPolicy->fetchDepth();
+}
+
+/**
+ * @note
+ * Feed the quantum policy with the number of backlogged bulk QPs and 
+ * their mean QPN queue wait in this period. It stops when no bulk QP 
+ * is backlogged, and activateQp starts it again.
+*/
+void HanGuRnic::DescScheduler::quantumUpdate() {
+    uint32_t activeNum = 0;
+    for (auto &item : qpStatusTable) {
+        if (item.second->type != LAT_QP && item.second->head_ptr != item.second->tail_ptr) {
+            ++activeNum;
+        }
+    }
+    Tick delay = queDelayNum ? queDelaySum / queDelayNum : 0;
+    queDelaySum = 0;
+    queDelayNum = 0;
+
+    HanGuQuantumPolicy *policy = rNic->quantumPolicy;
+    policy->update(activeNum, delay);
+    HANGU_PRINT(DescScheduler, "quantumUpdate: active QP %d, delay %ld, quantum %d, fetch depth %d\n", 
+        activeNum, delay, policy->quantum(), policy->fetchDepth());
+    HANGU_TRACE(rNic, TRACE_MOD_SCHED, TRACE_EV_QUANTUM, activeNum, policy->fetchDepth(), policy->quantum());
+
+    if (activeNum) {
+        rNic->schedule(quantumEvent, curTick() + policy->period());
+    }
+}
+
+/**
+ * @note
+ * Bytes the QP may send when it is served. FIFO gives one quantum. DRR and 
+ * WFQ add one quantum to the deficit counter, which keeps the part left 
+ * unsent (no more than one quantum) while the QP is backlogged. As WQEs 
+ * are split at any byte, the deficit is left only if the fetched WQEs 
+ * are not enough to fill the batch.
+*/
+uint32_t HanGuRnic::DescScheduler::schedBatch(QPStatusPtr qpStatus) {
+    uint32_t quantum = qpQuantum(qpStatus);
+    if (rNic->schedPolicy == HanGuSchedPolicy::fifo) {
+        return quantum;
+    }
+    qpStatus->deficit = std::min(qpStatus->deficit, quantum) + quantum;
+    return qpStatus->deficit;
+}
+
+void HanGuRnic::DescScheduler::schedCharge(QPStatusPtr qpStatus, uint32_t size) {
+    if (rNic->schedPolicy == HanGuSchedPolicy::fifo) {
+        return;
+    }
+    assert(size <= qpStatus->deficit);
+    qpStatus->deficit -= size;
+    if (qpStatus->tail_ptr == qpStatus->head_ptr) {
+        qpStatus->deficit = 0; // idle QP does not keep its deficit
+    }
+    if (rNic->schedPolicy == HanGuSchedPolicy::wfq) {
+        groupVtime[qpStatus->group_id] += ((uint64_t)size << 16) / groupShare(qpStatus->group_id);
+    }
+    HANGU_PRINT(DescScheduler, "schedCharge: qpn 0x%x, size %d, deficit %d, group %d vtime %ld\n", 
+        qpStatus->qpn, size, qpStatus->deficit, qpStatus->group_id, groupVtime[qpStatus->group_id]);
+}
+
+/**
+ * @note
+ * Share of the group is the sum of quanta of its QPs, i.e. the group weight 
+ * set by the driver. Groups share equally if QoS is disabled.
+*/
+uint64_t HanGuRnic::DescScheduler::groupShare(uint16_t groupId) {
+    if (!rNic->enableQos) {
+        return 1;
+    }
+    return std::max((uint64_t)groupTable[groupId] * groupQpWeight[groupId], (uint64_t)1);
+}
+
+/**
+ * @note
+ * Share the driver asks for, by the granularity it set. It differs 
+ * from groupShare once the controller tunes the granularity.
+*/
+uint64_t HanGuRnic::DescScheduler::groupTargetShare(uint16_t groupId) {
+    if (!rNic->enableQos) {
+        return 1;
+    }
+    return std::max((uint64_t)groupBaseGran[groupId] * groupQpWeight[groupId], (uint64_t)1);
+}
+
+/**
+ * @note
+ * Weight of a QP is changed by the driver, the QP weight sum of its 
+ * group follows, so that shares of groups stay consistent.
+*/
+void HanGuRnic::DescScheduler::setQpWeight(uint32_t qpn, uint8_t weight) {
+    if (qpStatusTable.find(qpn) == qpStatusTable.end()) {
+        panic("Cannot find qpn: %d\n", qpn);
+    }
+    QPStatusPtr qpStatus = qpStatusTable[qpn];
+    HANGU_PRINT(DescScheduler, "set QP weight! qpn: 0x%x, group: %d, weight: %d -> %d\n", 
+        qpn, qpStatus->group_id, qpStatus->weight, weight);
+    assert(groupQpWeight[qpStatus->group_id] >= qpStatus->weight);
+    groupQpWeight[qpStatus->group_id] += weight;
+    groupQpWeight[qpStatus->group_id] -= qpStatus->weight;
+    qpStatus->weight = weight;
+}
+
+/**
+ * @note
+ * Granularity from SET_GROUP command. The controller starts over 
+ * from it, as the target shares change.
+*/
+void HanGuRnic::DescScheduler::setGroupGran(uint16_t groupId, uint16_t gran) {
+    groupBaseGran[groupId] = gran;
+    groupTable[groupId] = gran;
+    ctrlStart = curTick();
+    ctrlConverged = false;
+}
+
+/**
+ * @note
+ * Closed-loop group granularity controller. Each window it compares 
+ * bytes sent for the backlogged groups with their target shares, 
+ * and scales the granularity of each group by (target / measured) ^ gain. 
+ * Bytes a group gets per round depend on its WQE sizes and fetch depth, 
+ * not only on its granularity, which is what the driver misses. The 
+ * window restarts the convergence timer if the set of backlogged groups 
+ * changes, and the controller stops when no bulk QP is backlogged.
+*/
+void HanGuRnic::DescScheduler::qosCtrl() {
+    std::vector<uint16_t> groups;
+    for (auto &item : qpStatusTable) {
+        QPStatusPtr qpStatus = item.second;
+        if (qpStatus->type != LAT_QP && qpStatus->head_ptr != qpStatus->tail_ptr) {
+            groups.push_back(qpStatus->group_id);
+        }
+    }
+    std::sort(groups.begin(), groups.end());
+    groups.erase(std::unique(groups.begin(), groups.end()), groups.end());
+    if (groups != ctrlGroups) {
+        ctrlGroups = groups;
+        ctrlStart = curTick() - rNic->qosCtrlPeriod;
+        ctrlConverged = false;
+    }
+
+    uint64_t byteSum = 0, shareSum = 0;
+    for (uint16_t groupId : groups) {
+        byteSum  += groupWinBytes[groupId];
+        shareSum += groupTargetShare(groupId);
+    }
+    double maxError = 0;
+    bool adjust = false;
+    for (uint16_t groupId : groups) {
+        if (byteSum == 0 || groupBaseGran[groupId] == 0) {
+            continue; // nothing measured, or granularity never set
+        }
+        double target   = (double)groupTargetShare(groupId) / shareSum;
+        double measured = (double)groupWinBytes[groupId] / byteSum;
+        maxError = std::max(maxError, std::fabs(measured - target));
+        if (std::fabs(measured - target) <= rNic->qosCtrlTolerance / 2) {
+            continue; // dead band, or granularity would dither around the target
+        }
+        double ratio = measured > 0 ? std::pow(target / measured, rNic->qosCtrlGain) : 2.0;
+        ratio = std::min(std::max(ratio, 0.5), 2.0);
+        double low  = std::max((double)groupBaseGran[groupId] / rNic->qosCtrlRange, 1.0);
+        double high = std::min((double)groupBaseGran[groupId] * rNic->qosCtrlRange, 65535.0);
+        uint16_t gran = std::round(std::min(std::max(groupTable[groupId] * ratio, low), high));
+        HANGU_PRINT(DescScheduler, "qosCtrl: group %d, target %f, measured %f, granularity %d -> %d\n", 
+            groupId, target, measured, groupTable[groupId], gran);
+        if (gran != groupTable[groupId]) {
+            groupTable[groupId] = gran;
+            adjust = true;
+        }
+    }
+    groupWinBytes.clear();
+
+    qosCtrlError = maxError;
+    if (adjust) {
+        ++qosCtrlAdjust;
+    }
+    if (!ctrlConverged && groups.size() && byteSum && maxError <= rNic->qosCtrlTolerance) {
+        qosConvergeTime.sample(curTick() - ctrlStart);
+        ctrlConverged = true;
+    }
+
+    if (groups.size()) {
+        rNic->schedule(qosCtrlEvent, curTick() + rNic->qosCtrlPeriod);
+    }
+}
+
+/**
+ * @note
+ * FIFO and DRR serve QPs in queue order. WFQ (start-time fair queueing) 
+ * serves the group with the smallest start tag, and QPs of the group in 
+ * queue order. Group finish tags advance by the bytes sent over the group 
+ * share, so the QP queue is searched each time, which is bounded by the 
+ * number of backlogged QPs.
+*/
+uint32_t HanGuRnic::DescScheduler::popLowQpn() {
+    assert(lowPriorityQpnQue.size());
+    auto pick = lowPriorityQpnQue.begin();
+    if (rNic->schedPolicy == HanGuSchedPolicy::wfq) {
+        uint64_t minTag = UINT64_MAX;
+        for (auto iter = lowPriorityQpnQue.begin(); iter != lowPriorityQpnQue.end(); ++iter) {
+            uint64_t tag = std::max(groupVtime[qpStatusTable[*iter]->group_id], sysVtime);
+            if (tag < minTag) {
+                minTag = tag;
+                pick = iter;
+            }
+        }
+        groupVtime[qpStatusTable[*pick]->group_id] = minTag;
+        sysVtime = minTag;
+    }
+    uint32_t qpn = *pick;
+    lowPriorityQpnQue.erase(pick);
+    rNic->rescPrefetcher.qpServed(qpn);
+    queDelaySum += curTick() - qpStatusTable[qpn]->que_tick;
+    ++queDelayNum;
+    return qpn;
+}
+
+/* Jain's fairness index over the entries backlogged since stats reset, 
+ * unserved ones count as 0 */
+template <class K>
+static double
+jainIndex(const std::unordered_map<K, double> &served) {
+    double sum = 0, sqSum = 0;
+    for (auto &item : served) {
+        sum   += item.second;
+        sqSum += item.second * item.second;
+    }
+    if (sqSum == 0) {
+        return 0;
+    }
+    return sum * sum / (served.size() * sqSum);
+}
+
+double HanGuRnic::DescScheduler::qpJainIndex() const {
+    return jainIndex(qpNormBytes);
+}
+
+double HanGuRnic::DescScheduler::groupJainIndex() const {
+    return jainIndex(groupNormBytes);
+}
+
+void HanGuRnic::DescScheduler::regStats() {
+    qpSentBytes
+        .init(0)
+        .name(_name + ".qpSentBytes")
+        .desc("Bytes sent by each QP, indexed by QPN")
+        .flags(Stats::nozero)
+        ;
+
+    groupSentBytes
+        .init(256)
+        .name(_name + ".groupSentBytes")
+        .desc("Bytes sent by each group")
+        .flags(Stats::total | Stats::nozero)
+        ;
+
+    groupSentBw
+        .name(_name + ".groupSentBw")
+        .desc("Achieved bandwidth of each group (bits/s)")
+        .precision(0)
+        .flags(Stats::nozero)
+        ;
+    groupSentBw = groupSentBytes * Stats::constant(8) / simSeconds;
+
+    qpFairness
+        .method(this, &DescScheduler::qpJainIndex)
+        .name(_name + ".qpFairness")
+        .desc("Jain's fairness index of QPs, bytes sent normalized by QP weight")
+        .flags(Stats::nozero)
+        ;
+
+    groupFairness
+        .method(this, &DescScheduler::groupJainIndex)
+        .name(_name + ".groupFairness")
+        .desc("Jain's fairness index of groups, bytes sent normalized by target group share")
+        .flags(Stats::nozero)
+        ;
+
+    throttleNum
+        .name(_name + ".throttleNum")
+        .desc("Times QPs are set aside by rate limiters")
+        ;
+
+    throttleTicks
+        .name(_name + ".throttleTicks")
+        .desc("Ticks QPs are set aside by rate limiters")
+        ;
+
+    throttleAvg
+        .name(_name + ".throttleAvg")
+        .desc("Average ticks a QP is set aside by rate limiters")
+        .precision(0)
+        ;
+    throttleAvg = throttleTicks / throttleNum;
+
+    groupThrottleTicks
+        .init(256)
+        .name(_name + ".groupThrottleTicks")
+        .desc("Ticks QPs of each group are set aside by rate limiters")
+        .flags(Stats::total | Stats::nozero)
+        ;
+
+    qosCtrlError
+        .name(_name + ".qosCtrlError")
+        .desc("Max share error of backlogged groups in controller windows, time weighted")
+        .precision(4)
+        ;
+
+    qosConvergeTime
+        .init(16)
+        .name(_name + ".qosConvergeTime")
+        .desc("Ticks the controller takes to bring group shares within qos_ctrl_tolerance")
+        .flags(Stats::nozero)
+        ;
+
+    qosCtrlAdjust
+        .name(_name + ".qosCtrlAdjust")
+        .desc("Controller windows in which group granularity is changed")
+        ;
+
+    dbrReadNum
+        .name(_name + ".dbrReadNum")
+        .desc("Doorbell record reads")
+        ;
+
+    Stats::registerResetCallback([this]() {
+        qpNormBytes.clear();
+        groupNormBytes.clear();
+        for (auto &item : qpStatusTable) {
+            QPStatusPtr qpStatus = item.second;
+            if (qpStatus->type != LAT_QP && qpStatus->head_ptr != qpStatus->tail_ptr) {
+                qpNormBytes.emplace(qpStatus->qpn, 0);
+                groupNormBytes.emplace(qpStatus->group_id, 0);
+            }
+        }
+    });
+}
+
+bool HanGuRnic::DescScheduler::isIdle() {
+    for (uint32_t i = 0; i < wqeProcToLaunchWqeQueL.size(); ++i) {
+        if (lowPriorityDescQue[i].size() || wqeProcToLaunchWqeQueL[i].size()) {
+            return false;
+        }
+    }
+    return dbQue.empty() && highPriorityQpnQue.empty() && lowPriorityQpnQue.empty() && 
+        wqeFetchInfoQue.empty() && highPriorityDescQue.empty() && 
+        dbProcQpStatusRReqQue.empty() && 
+        dbQpStatusRspQue.empty() && wqePrefetchQpStatusRReqQue.empty() && 
+        wqeProcToLaunchWqeQueH.empty() && 
+        dbrRspQue.empty() && throttledQpn.empty();
+}
+
+/**
+ * @note
+ * QP status is plain data, it is checkpointed as raw bytes. 
+ * No QPN is in QPN queues after draining, so only tables are saved.
+*/
+void HanGuRnic::DescScheduler::serialize(CheckpointOut &cp) const {
+    std::vector<uint16_t> groupId, groupGran, groupBase;
+    for (auto &item : groupTable) {
+        groupId.push_back(item.first);
+        groupGran.push_back(item.second);
+        groupBase.push_back(groupBaseGran.count(item.first) ? groupBaseGran.at(item.first) : 0);
+    }
+    SERIALIZE_CONTAINER(groupId);
+    SERIALIZE_CONTAINER(groupGran);
+    SERIALIZE_CONTAINER(groupBase);
+
+    std::vector<uint32_t> statusQpn;
+    std::vector<uint8_t> statusData;
+    for (auto &item : qpStatusTable) {
+        statusQpn.push_back(item.first);
+        rawAppend(statusData, *item.second);
+    }
+    SERIALIZE_CONTAINER(statusQpn);
+    SERIALIZE_CONTAINER(statusData);
+
+    SERIALIZE_SCALAR(unsentBatchNum);
+
+    std::vector<uint16_t> vtimeGroup;
+    std::vector<uint64_t> vtime;
+    for (auto &item : groupVtime) {
+        vtimeGroup.push_back(item.first);
+        vtime.push_back(item.second);
+    }
+    SERIALIZE_CONTAINER(vtimeGroup);
+    SERIALIZE_CONTAINER(vtime);
+    SERIALIZE_SCALAR(sysVtime);
+
+    std::vector<uint32_t> bucketQpn;
+    std::vector<uint16_t> bucketGroup;
+    std::vector<uint8_t> qpBucketData, groupBucketData;
+    for (auto &item : qpBucket) {
+        bucketQpn.push_back(item.first);
+        rawAppend(qpBucketData, item.second);
+    }
+    for (auto &item : groupBucket) {
+        bucketGroup.push_back(item.first);
+        rawAppend(groupBucketData, item.second);
+    }
+    SERIALIZE_CONTAINER(bucketQpn);
+    SERIALIZE_CONTAINER(qpBucketData);
+    SERIALIZE_CONTAINER(bucketGroup);
+    SERIALIZE_CONTAINER(groupBucketData);
+}
+
+void HanGuRnic::DescScheduler::unserialize(CheckpointIn &cp) {
+    std::vector<uint16_t> groupId, groupGran, groupBase;
+    UNSERIALIZE_CONTAINER(groupId);
+    UNSERIALIZE_CONTAINER(groupGran);
+    UNSERIALIZE_CONTAINER(groupBase);
+    groupTable.clear();
+    groupBaseGran.clear();
+    for (size_t i = 0; i < groupId.size(); ++i) {
+        groupTable[groupId[i]] = groupGran[i];
+        groupBaseGran[groupId[i]] = groupBase[i];
+    }
+
+    std::vector<uint32_t> statusQpn;
+    std::vector<uint8_t> statusData;
+    UNSERIALIZE_CONTAINER(statusQpn);
+    UNSERIALIZE_CONTAINER(statusData);
+    qpStatusTable.clear();
+    groupQpWeight.clear();
+    latQpNum = 0;
+    for (size_t i = 0; i < statusQpn.size(); ++i) {
+        QPStatusPtr status = make_shared<QPStatusItem>(0, 0, 0, 0, 0, QP_TYPE_RC);
+        rawGet(*status, statusData, i);
+        qpStatusTable[statusQpn[i]] = status;
+        groupQpWeight[status->group_id] += status->weight;
+        if (status->type == LAT_QP) {
+            latQpNum++;
+        }
+    }
+
+    UNSERIALIZE_SCALAR(unsentBatchNum);
+
+    std::vector<uint16_t> vtimeGroup;
+    std::vector<uint64_t> vtime;
+    UNSERIALIZE_CONTAINER(vtimeGroup);
+    UNSERIALIZE_CONTAINER(vtime);
+    groupVtime.clear();
+    for (size_t i = 0; i < vtimeGroup.size(); ++i) {
+        groupVtime[vtimeGroup[i]] = vtime[i];
+    }
+    UNSERIALIZE_SCALAR(sysVtime);
+
+    std::vector<uint32_t> bucketQpn;
+    std::vector<uint16_t> bucketGroup;
+    std::vector<uint8_t> qpBucketData, groupBucketData;
+    UNSERIALIZE_CONTAINER(bucketQpn);
+    UNSERIALIZE_CONTAINER(qpBucketData);
+    UNSERIALIZE_CONTAINER(bucketGroup);
+    UNSERIALIZE_CONTAINER(groupBucketData);
+    qpBucket.clear();
+    for (size_t i = 0; i < bucketQpn.size(); ++i) {
+        rawGet(qpBucket[bucketQpn[i]], qpBucketData, i);
+    }
+    groupBucket.clear();
+    for (size_t i = 0; i < bucketGroup.size(); ++i) {
+        rawGet(groupBucket[bucketGroup[i]], groupBucketData, i);
+    }
+}
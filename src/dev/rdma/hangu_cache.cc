@@ -101,8 +101,55 @@ T* HanGuRnic::Cache<T>::deleteEntry(uint32_t entryNum) {
     
     T *rtnResc = cache[entryNum].first;
     cache.erase(entryNum);
-    assert(cache.size() == capacity - 1);
+    assert(cache.size() + 1 >= capacity); /* over capacity only after restore */
     return rtnResc;
 }
+/* delete all entries in cache, the caller owns the returned entries */
+template<class T>
+void HanGuRnic::Cache<T>::deleteAll(std::vector<std::pair<uint32_t, T*>> &entries) {
+    for (auto &item : cache) {
+        entries.emplace_back(item.first, item.second.first);
+    }
+    cache.clear();
+}
+
+/* Entries are saved as raw bytes, together with their LRU sequence */
+template<class T>
+void HanGuRnic::Cache<T>::serialize(CheckpointOut &cp) const {
+    std::vector<uint32_t> entryNum;
+    std::vector<uint64_t> entrySeq;
+    std::vector<uint8_t> entryData;
+    for (auto &item : cache) {
+        entryNum.push_back(item.first);
+        entrySeq.push_back(item.second.second);
+        rawAppend(entryData, *item.second.first);
+    }
+    SERIALIZE_CONTAINER(entryNum);
+    SERIALIZE_CONTAINER(entrySeq);
+    SERIALIZE_CONTAINER(entryData);
+    SERIALIZE_SCALAR(seq_end);
+}
+
+template<class T>
+void HanGuRnic::Cache<T>::unserialize(CheckpointIn &cp) {
+    std::vector<uint32_t> entryNum;
+    std::vector<uint64_t> entrySeq;
+    std::vector<uint8_t> entryData;
+    UNSERIALIZE_CONTAINER(entryNum);
+    UNSERIALIZE_CONTAINER(entrySeq);
+    UNSERIALIZE_CONTAINER(entryData);
+    UNSERIALIZE_SCALAR(seq_end);
+    assert(entryNum.size() == entrySeq.size());
+
+    for (auto &item : cache) {
+        delete item.second.first;
+    }
+    cache.clear();
+    for (size_t i = 0; i < entryNum.size(); ++i) {
+        T *val = new T;
+        rawGet(*val, entryData, i);
+        cache.emplace(entryNum[i], make_pair(val, entrySeq[i]));
+    }
+}
 ///////////////////////////// HanGuRnic::Cache {end}//////////////////////////////
 template class HanGuRnic::Cache<QpcResc>;
\ No newline at end of file
@@ -33,6 +33,11 @@ HanGuRnic::DmaEngine::dmaWriteCplProcessing() {
     DmaReqPtr dmaReq = dmaWrReq2RspFifo.front();
     dmaWrReq2RspFifo.pop();
 
+    /* Notify the requester (if it cares) that write is finished */
+    if (dmaReq->cplCallback) {
+        dmaReq->cplCallback(dmaReq);
+    }
+
     /* Schedule myself if there's item in fifo */
     if (dmaWrReq2RspFifo.size()) {
         rnic->schedule(dmaWriteCplEvent, dmaWrReq2RspFifo.front()->schd);
@@ -98,11 +103,19 @@ HanGuRnic::DmaEngine::dmaWriteProcessing () {
             dmaReq->addr, dmaReq->size, delay, bwDelay);
             assert(dmaReq->size != 0);
 
-            /* Send dma req to dma channel
-             * this event is used to call rnic->dmaWrite() */
-            dmaWReqFifo.push(dmaReq);
-            if (!dmaChnlProcEvent.scheduled()) {
-                rnic->schedule(dmaChnlProcEvent, curTick() + rnic->clockPeriod());
+            if (rnic->fastForward) {
+                /* Functional fast-forward, write memory in place */
+                rnic->sys->physProxy.writeBlob(dmaReq->addr, dmaReq->data, dmaReq->size);
+                dmaReq->pkt = nullptr;
+                bwDelay = 0;
+                delay = 0;
+            } else {
+                /* Send dma req to dma channel
+                 * this event is used to call rnic->dmaWrite() */
+                dmaWReqFifo.push(dmaReq);
+                if (!dmaChnlProcEvent.scheduled()) {
+                    rnic->schedule(dmaChnlProcEvent, curTick() + rnic->clockPeriod());
+                }
             }
             
             /* Schedule DMA Write completion event */
@@ -145,15 +158,14 @@ HanGuRnic::DmaEngine::dmaReadCplProcessing() {
     DmaReqPtr dmaReq = dmaRdReq2RspFifo.front();
     dmaRdReq2RspFifo.pop();
     dmaReq->rdVld = 1;
-    Event *e = &rnic->qpcModule.qpcRspProcEvent;
-    if (dmaReq->event == e) { /* qpc dma read cpl pkt */
-        assert(dmaReq->size == 256);
-        rnic->qpcDmaRdCplFifo.push(dmaReq);
-    }
     readByte += dmaReq->size + 32;
 
-    /* Schedule related completion event */
-    if (!(dmaReq->event)->scheduled()) {
+    /* Notify the requester exactly once. Requester with a 
+     * callback retires the request itself, so it does not 
+     * need to poll rdVld of the head of its FIFO. */
+    if (dmaReq->cplCallback) {
+        dmaReq->cplCallback(dmaReq);
+    } else if (!(dmaReq->event)->scheduled()) {
         rnic->schedule(*(dmaReq->event), curTick() + rnic->clockPeriod());
     }
 
@@ -228,11 +240,18 @@ HanGuRnic::DmaEngine::dmaReadProcessing () {
             dmaReq->addr, dmaReq->size, delay, bwDelay);
             assert(dmaReq->size != 0);
 
-            /* Send dma req to dma channel, 
-             * this event is used to call rnic->dmaRead() */
-            dmaRReqFifo.push(dmaReq);
-            if (!dmaChnlProcEvent.scheduled()) {
-                rnic->schedule(dmaChnlProcEvent, curTick() + rnic->clockPeriod());
+            if (rnic->fastForward) {
+                /* Functional fast-forward, read memory in place */
+                rnic->sys->physProxy.readBlob(dmaReq->addr, dmaReq->data, dmaReq->size);
+                bwDelay = 0;
+                delay = 0;
+            } else {
+                /* Send dma req to dma channel, 
+                 * this event is used to call rnic->dmaRead() */
+                dmaRReqFifo.push(dmaReq);
+                if (!dmaChnlProcEvent.scheduled()) {
+                    rnic->schedule(dmaChnlProcEvent, curTick() + rnic->clockPeriod());
+                }
             }
             
             /* Schedule DMA read completion event */
@@ -281,11 +300,23 @@ HanGuRnic::DmaEngine::dmaChnlProc () {
         
         dmaReq = dmaWReqFifo.front();
         dmaWReqFifo.pop();
-        rnic->dmaWrite(dmaReq->addr, dmaReq->size, nullptr, dmaReq->data);
+        HANGU_TRACE(rnic, TRACE_MOD_DMA, TRACE_EV_DMA_WR, 0, 0, dmaReq->size);
+        if (dmaReq->pkt) {
+            /* data is a view into a received packet, which is 
+             * read by the DMA port later, release it when done */
+            EthPacketPtr pkt = dmaReq->pkt;
+            Event *releaseEvent = new EventFunctionWrapper([pkt]{ }, 
+                    "dmaPktRelease", true);
+            rnic->dmaWrite(dmaReq->addr, dmaReq->size, releaseEvent, dmaReq->data);
+            dmaReq->pkt = nullptr;
+        } else {
+            rnic->dmaWrite(dmaReq->addr, dmaReq->size, nullptr, dmaReq->data);
+        }
     } else if (dmaRReqFifo.size()) {
 
         dmaReq = dmaRReqFifo.front();
         dmaRReqFifo.pop();
+        HANGU_TRACE(rnic, TRACE_MOD_DMA, TRACE_EV_DMA_RD, 0, 0, dmaReq->size);
         rnic->dmaRead(dmaReq->addr, dmaReq->size, nullptr, dmaReq->data);
     }
     
@@ -296,34 +327,69 @@ HanGuRnic::DmaEngine::dmaChnlProc () {
         }
     }
 
+    /* DMA makes progress, (re)start the monitors */
     blocked = false;
     if (startDetect == false) {
         startDetect = true;
         if (!detectRateEvent.scheduled()) {
-            rnic->schedule(detectRateEvent, curTick() + rnic->clockPeriod());
-        }
-        if (!detectBlockEvent.scheduled()) {
-            rnic->schedule(detectBlockEvent, curTick() + rnic->clockPeriod());
+            rnic->schedule(detectRateEvent, curTick() + rnic->clockPeriod() * DMA_DETECT_PERIOD);
         }
     }
+    if (watchdogPeriod && !detectBlockEvent.scheduled()) {
+        rnic->schedule(detectBlockEvent, curTick() + watchdogPeriod);
+    }
 }
 
+/**
+ * @note
+ *      Stops when there's no DMA request in the last period, 
+ *      and restarted by dmaChnlProc on the next one.
+ */
 void HanGuRnic::DmaEngine::detectRate() {
-    rnic->schedule(detectRateEvent, curTick() + rnic->clockPeriod() * DMA_DETECT_PERIOD);
     HANGU_PRINT(DmaEngine, "detectRate: read byte: %d, rate: %.2f Gbps! write byte: %d, rate : %.2f Gbps!\n", 
         readByte, (float)readByte * 1000000000 / DMA_DETECT_PERIOD / 1024 / 1024 / 1024 * 8,
         writeByte, (float)writeByte * 1000000000 / DMA_DETECT_PERIOD / 1024 / 1024 / 1024 * 8);
+    if (readByte == 0 && writeByte == 0) {
+        startDetect = false;
+        return;
+    }
     readByte = 0;
     writeByte = 0;
+    rnic->schedule(detectRateEvent, curTick() + rnic->clockPeriod() * DMA_DETECT_PERIOD);
 }
 
+/**
+ * @note
+ *      Watchdog. If no DMA request is posted in one period while 
+ *      requests are still waiting in the pipeline, the NIC is 
+ *      considered stalled and its state is dumped. If the NIC is 
+ *      quiescent, the watchdog stops until the next DMA request.
+ */
 void HanGuRnic::DmaEngine::detectBlock() {
-    rnic->schedule(detectBlockEvent, curTick() + rnic->clockPeriod() * BLOCK_DETECT_PERIOD);
-    if (blocked == true && curTick() > START_DETECT_TICK) {
-        panic("blocked!\n");
-    }
-    else {
+    if (!blocked) {
+        if (stallReported) {
+            inform("%s: DMA resumes after stall\n", rnic->name());
+            stallReported = false;
+        }
         blocked = true;
+        rnic->schedule(detectBlockEvent, curTick() + watchdogPeriod);
+        return;
+    }
+
+    if (rnic->isQuiescent()) {
+        stallReported = false;
+        return;
+    }
+
+    if (!stallReported) {
+        stallReported = true;
+        warn("%s: no DMA progress in %ld ticks with pending requests, stalled?\n", 
+                rnic->name(), watchdogPeriod);
+        rnic->dumpState();
+        if (watchdogPanic) {
+            panic("%s: stalled!\n", rnic->name());
+        }
     }
+    rnic->schedule(detectBlockEvent, curTick() + watchdogPeriod);
 }
 ///////////////////////////// HanGuRnic::DMA Engine {end}//////////////////////////////
@@ -22,11 +22,16 @@
 
 #include "dev/rdma/hangu_driver.hh"
 
+#include "sim/sim_exit.hh"
+
 
 
 HanGuDriver::HanGuDriver(Params *p)
-  : EmulatedDriver(p), device(p->device) {
+  : EmulatedDriver(p), device(p->device), cmdqEnable(p->cmd_queue) {
     // HANGU_PRINT(HanGuDriver, "HanGu RNIC driver.\n");
+    cmdq.ready = false;
+    mttMeta = mptMeta = cqcMeta = qpcMeta = tqMeta = RescMeta();
+    device->addCqIntrHandler([this](uint32_t cqn) { cqEventProc(cqn); });
 }
 
 /**
@@ -41,6 +46,7 @@ HanGuDriver::open(ThreadContext *tc, int mode, int flags) {
     auto device_fd_entry = std::make_shared<DeviceFDEntry>(this, filename);
     int tgt_fd = process->fds->allocFD(device_fd_entry);
     cpu_id = tc->contextId();
+    openFds.emplace_back(process->name(), tgt_fd);
 
     // Configure PCI config space
     configDevice();
@@ -100,10 +106,49 @@ HanGuDriver::ioctl(ThreadContext *tc, unsigned req, Addr ioc_buf) {
         args->cur_time = curTick();
         args.copyOut(virt_proxy);
 
+        return 0;
+    } else if (HGKFD_IOC_REQ_NOTIFY_CQ == req) {
+        /* Arming CQ does not use HCR, so `GO` bit is not checked */
+        TypedBufferArg<kfd_ioctl_cq_event_args> args(ioc_buf);
+        args.copyIn(virt_proxy);
+        HANGU_PRINT(HanGuDriver, " ioctl: HGKFD_IOC_REQ_NOTIFY_CQ cqn %d\n", args->cq_num);
+
+        reqNotifyCq(virt_proxy, args->cq_num);
+        return 0;
+    } else if (HGKFD_IOC_GET_CQ_EVENT == req) {
+        TypedBufferArg<kfd_ioctl_cq_event_args> args(ioc_buf);
+        args.copyIn(virt_proxy);
+        uint32_t cqn = args->cq_num;
+        assert(cqEventCnt.find(cqn) != cqEventCnt.end());
+
+        if (cqEventCnt[cqn]) {
+            HANGU_PRINT(HanGuDriver, " ioctl: HGKFD_IOC_GET_CQ_EVENT cqn %d, event %d\n", cqn, cqEventCnt[cqn]);
+            args->event_num = cqEventCnt[cqn];
+            cqEventCnt[cqn] = 0;
+            args.copyOut(virt_proxy);
+        } else {
+            /* No event yet, block the thread until 
+             * the interrupt of this CQ comes */
+            HANGU_PRINT(HanGuDriver, " ioctl: HGKFD_IOC_GET_CQ_EVENT cqn %d, wait for event\n", cqn);
+            cqEventWaiter[cqn].push({tc, ioc_buf});
+            tc->suspend();
+        }
+        return 0;
+    } else if (HGKFD_IOC_CHECKPOINT == req) {
+        /* Posted commands are finished before the checkpoint is taken */
+        if (checkHcr(virt_proxy) || (cmdq.ready && updateCmdq(virt_proxy))) {
+            return -1;
+        }
+        HANGU_PRINT(HanGuDriver, " ioctl: HGKFD_IOC_CHECKPOINT\n");
+        exitSimLoop("checkpoint");
         return 0;
     } else if (checkHcr(virt_proxy)) {
         HANGU_PRINT(HanGuDriver, " `GO` bit is still high! Try again later.\n");
         return -1;
+    } else if (cmdq.ready && req != HGKFD_IOC_CHECK_GO && 
+            updateCmdq(virt_proxy) == CMDQ_DEPTH) {
+        HANGU_PRINT(HanGuDriver, " command queue is full! Try again later.\n");
+        return -1;
     }
     
     Addr pAddr;
@@ -124,6 +169,11 @@ HanGuDriver::ioctl(ThreadContext *tc, unsigned req, Addr ioc_buf) {
             // We don't use input parameter here
             initIcm(virt_proxy, RESC_LEN_LOG, RESC_LEN_LOG, RESC_LEN_LOG, RESC_LEN_LOG);
             initQoS(virt_proxy, process);
+
+            // Commands after INIT_ICM go through command queue
+            if (cmdqEnable) {
+                initCmdq(process, virt_proxy);
+            }
         }
         break;
       case HGKFD_IOC_ALLOC_MTT: // Input Output
@@ -240,7 +290,7 @@ HanGuDriver::ioctl(ThreadContext *tc, unsigned req, Addr ioc_buf) {
             TypedBufferArg<kfd_ioctl_write_qpc_args> args(ioc_buf);
             args.copyIn(virt_proxy);
 
-            writeQpc(virt_proxy, args);
+            writeQpc(process, virt_proxy, args);
         }
         break;
       case HGKFD_IOC_CHECK_GO: 
@@ -248,6 +298,11 @@ HanGuDriver::ioctl(ThreadContext *tc, unsigned req, Addr ioc_buf) {
             /* We don't check `go` bit here, cause it 
              * has been checked at the beginning of ioctl. */
             // HANGU_PRINT(HanGuDriver, " ioctl : HGKFD_IOC_CHECK_GO, `GO` is cleared.\n");
+            
+            /* All commands in command queue should be finished */
+            if (cmdq.ready && updateCmdq(virt_proxy)) {
+                return -1;
+            }
         }
         break;
         case HGKFD_IOC_SET_GROUP:
@@ -276,6 +331,14 @@ HanGuDriver::ioctl(ThreadContext *tc, unsigned req, Addr ioc_buf) {
             updateQpWeight(virt_proxy, args);
         }
         break;
+        case HGKFD_IOC_SET_RATE_LIMIT:
+        {
+            HANGU_PRINT(HanGuDriver, "ioctl: HGKFD_IOC_SET_RATE_LIMIT\n");
+            TypedBufferArg<kfd_ioctl_set_rate_limit_args> args(ioc_buf);
+            args.copyIn(virt_proxy);
+            setRateLimit(virt_proxy, args);
+        }
+        break;
         default:
         {
             fatal("%s: bad ioctl %d\n", req);
@@ -327,6 +390,34 @@ HanGuDriver::postHcr(PortProxy& portProxy, uint64_t inParam,
     portProxy.writeBlob(hcrAddr, &hcr, sizeof(hcr));
 }
 
+void 
+HanGuDriver::postCmd(PortProxy& portProxy, uint64_t inParam, 
+        uint32_t inMod, uint64_t outParam, uint8_t opcode) {
+    
+    if (!cmdq.ready) {
+        postHcr(portProxy, inParam, inMod, outParam, opcode);
+        return;
+    }
+
+    /* Room is checked at the beginning of ioctl */
+    assert(cmdq.pi - cmdq.ci < CMDQ_DEPTH);
+    
+    HanGuRnicDef::CmdQueEntry entry;
+    entry.inParam  = inParam;
+    entry.outParam = outParam;
+    entry.inMod    = inMod;
+    entry.opcode   = opcode;
+    entry.seq      = cmdq.pi;
+    entry.rsvd     = 0;
+    portProxy.writeBlob(cmdq.vaddr + (cmdq.pi % CMDQ_DEPTH) * sizeof(entry), &entry, sizeof(entry));
+    ++cmdq.pi;
+
+    HANGU_PRINT(HanGuDriver, " postCmd: opcode %d, pi %d, ci %d\n", opcode, cmdq.pi, cmdq.ci);
+
+    uint32_t db = (cpu_id << 16) | (cmdq.pi & 0xffff);
+    portProxy.writeBlob(hcrAddr + barCmdqDbOffset, &db, sizeof(db));
+}
+
 /* -------------------------- HCR {end} ------------------------ */
 
 
@@ -390,9 +481,9 @@ HanGuDriver::initIcm(PortProxy& portProxy, uint8_t qpcNumLog, uint8_t cqcNumLog,
     initResc.mttBase   = mttMeta.start;
     // HANGU_PRINT(HanGuDriver, " qpcMeta.start: 0x%lx, cqcMeta.start : 0x%lx, mptMeta.start : 0x%lx, mttMeta.start : 0x%lx\n", 
     //         qpcMeta.start, cqcMeta.start, mptMeta.start, mttMeta.start);
-    portProxy.writeBlob(mailbox.vaddr, &initResc, sizeof(HanGuRnicDef::InitResc));
+    portProxy.writeBlob(curMbox().vaddr, &initResc, sizeof(HanGuRnicDef::InitResc));
 
-    postHcr(portProxy, (uint64_t)mailbox.paddr, 0, 0, HanGuRnicDef::INIT_ICM);
+    postCmd(portProxy, (uint64_t)curMbox().paddr, 0, 0, HanGuRnicDef::INIT_ICM);
 }
 
 
@@ -434,10 +525,10 @@ HanGuDriver::writeIcm(PortProxy& portProxy, uint8_t rescType, RescMeta &rescMeta
     icmResc.pageNum = ICM_ALLOC_PAGE_NUM; // now we support ICM_ALLOC_PAGE_NUM pages
     icmResc.vAddr   = icmVPage << 12;
     icmResc.pAddr   = icmAddrmap[icmVPage];
-    portProxy.writeBlob(mailbox.vaddr, &icmResc, sizeof(HanGuRnicDef::InitResc));
+    portProxy.writeBlob(curMbox().vaddr, &icmResc, sizeof(HanGuRnicDef::InitResc));
     HANGU_PRINT(HanGuDriver, " pageNum %d, vAddr 0x%lx, pAddr 0x%lx\n", icmResc.pageNum, icmResc.vAddr, icmResc.pAddr);
 
-    postHcr(portProxy, (uint64_t)mailbox.paddr, 1, rescType, HanGuRnicDef::WRITE_ICM);
+    postCmd(portProxy, (uint64_t)curMbox().paddr, 1, rescType, HanGuRnicDef::WRITE_ICM);
 }
 
 /* -------------------------- ICM {end} ------------------------ */
@@ -519,8 +610,8 @@ void HanGuDriver::setGroup(PortProxy& portProxy, TypedBufferArg<kfd_ioctl_set_gr
     }
     // print all QoS weights and granularities
     printQoS(portProxy);
-    portProxy.writeBlob(mailbox.vaddr, group, sizeof(HanGuRnicDef::GroupInfo) * groupNum);
-    postHcr(portProxy, (uint64_t)mailbox.paddr, 1, groupNum, HanGuRnicDef::SET_GROUP);
+    portProxy.writeBlob(curMbox().vaddr, group, sizeof(HanGuRnicDef::GroupInfo) * groupNum);
+    postCmd(portProxy, (uint64_t)curMbox().paddr, 1, groupNum, HanGuRnicDef::SET_GROUP);
 }
 
 void HanGuDriver::printQoS(PortProxy& portProxy) {
@@ -549,7 +640,7 @@ void HanGuDriver::allocGroup(PortProxy& portProxy, TypedBufferArg<kfd_ioctl_allo
     uint16_t groupNum;
     portProxy.readBlob(qosShareParamAddr + groupNumOffset, &groupNum, sizeof(uint16_t));
     // HANGU_PRINT(HanGuDriver, "into allocGroup! groupNum: %d, args->group_num: %d\n", groupNum, args->group_num);
-    postHcr(portProxy, (uint64_t)mailbox.paddr, 1, args->group_num, HanGuRnicDef::ALLOC_GROUP);
+    postCmd(portProxy, (uint64_t)curMbox().paddr, 1, args->group_num, HanGuRnicDef::ALLOC_GROUP);
     assert(args->group_num == 1);
     args->group_id[0] = groupNum;
     groupNum += args->group_num;
@@ -572,15 +663,19 @@ void HanGuDriver::updateN(PortProxy& portProxy, TypedBufferArg<kfd_ioctl_alloc_q
 }
 
 /**
- * @note update several groups in case that some QPs change their weight
+ * @note update several groups in case that some QPs change their weight. 
+ * The new QP weights are posted with the new granularity of their groups, 
+ * so that the QP weight sums of groups in hardware follow.
 */
 void HanGuDriver::updateQpWeight(PortProxy& portProxy, TypedBufferArg<kfd_ioctl_write_qpc_args> &args) {
-    /* put QpcResc into mailbox */
-    HanGuRnicDef::GroupInfo group[MAX_QPC_BATCH];
-    memset(group, 0, sizeof(HanGuRnicDef::GroupInfo) * args->batch_size);
+    /* put QpWeightInfo into mailbox */
+    HanGuRnicDef::QpWeightInfo qpWeight[MAX_QPC_BATCH];
+    memset(qpWeight, 0, sizeof(HanGuRnicDef::QpWeightInfo) * args->batch_size);
     assert(args->batch_size < MAX_QPC_BATCH);
     int setGroupNum = 0;
     std::unordered_map<uint8_t, uint8_t> setGroup;
+    std::vector<uint32_t> setQp; /* index of QPs changing their weight in args */
+    std::unordered_map<uint8_t, uint16_t> groupGran;
     uint32_t groupWeightSum;
     portProxy.readBlob(qosShareParamAddr + groupWeightSumOffset, &groupWeightSum, sizeof(uint32_t));
     uint32_t bigN;
@@ -590,6 +685,7 @@ void HanGuDriver::updateQpWeight(PortProxy& portProxy, TypedBufferArg<kfd_ioctl_
         if (groupTable[args->groupID[i]].qpWeight[args->src_qpn[i]] != args->weight[i])
         {
             groupTable[args->groupID[i]].qpWeight[args->src_qpn[i]] = args->weight[i];
+            setQp.push_back(i);
             if (setGroup.find(args->groupID[i]) == setGroup.end()) {
                 setGroup[args->groupID[i]] = 1;
                 setGroupNum++;
@@ -607,7 +703,6 @@ void HanGuDriver::updateQpWeight(PortProxy& portProxy, TypedBufferArg<kfd_ioctl_
     assert(setGroupNum == setGroup.size());
     HANGU_PRINT(HanGuDriver, "into update QP weight! setGroupNum: %d\n", setGroupNum);
     // update group granularity
-    int i = 0;
     for (std::unordered_map<uint8_t, uint8_t>::iterator iter = setGroup.begin(); iter != setGroup.end(); iter++) {
         assert(iter->second == 1);
         uint8_t groupID = iter->first;
@@ -620,19 +715,43 @@ void HanGuDriver::updateQpWeight(PortProxy& portProxy, TypedBufferArg<kfd_ioctl_
         uint32_t granularity;
         portProxy.readBlob(qosShareParamAddr + groupWeightOffset +  groupID * 1, &groupWeight, sizeof(uint8_t));
         granularity = (double)groupWeight / groupWeightSum * bigN / qpWeightSum;
-        group[i].groupID = groupID;
-        group[i].granularity = granularity;
+        groupGran[groupID] = granularity;
         // set new QP weight sum
         portProxy.writeBlob(qosShareParamAddr + groupQPWeightSumOffset + groupID * 4, &qpWeightSum, sizeof(uint32_t));
         // set new granularity
         portProxy.writeBlob(qosShareParamAddr + groupGranularityOffset + groupID * 4, &granularity, sizeof(uint16_t));
         HANGU_PRINT(HanGuDriver, "update granularity when update QP weight! Group ID: %d, group weight: %d, group granularity: %d, big N: %d, group weight sum: %d, qp weight sum: %d\n", 
             groupID, groupWeight, granularity, bigN, groupWeightSum, qpWeightSum);
-        i++;
+    }
+    for (uint32_t i = 0; i < setQp.size(); ++i) {
+        uint32_t idx = setQp[i];
+        qpWeight[i].qpn         = args->src_qpn[idx];
+        qpWeight[i].weight      = args->weight[idx];
+        qpWeight[i].groupID     = args->groupID[idx];
+        qpWeight[i].granularity = groupGran[args->groupID[idx]];
     }
     printQoS(portProxy);
-    portProxy.writeBlob(mailbox.vaddr, group, sizeof(HanGuRnicDef::GroupInfo) * setGroupNum);
-    postHcr(portProxy, (uint64_t)mailbox.paddr, 1, setGroupNum, HanGuRnicDef::SET_GROUP);
+    portProxy.writeBlob(curMbox().vaddr, qpWeight, sizeof(HanGuRnicDef::QpWeightInfo) * setQp.size());
+    postCmd(portProxy, (uint64_t)curMbox().paddr, 1, setQp.size(), HanGuRnicDef::SET_QP_WEIGHT);
+}
+
+/**
+ * @note install token bucket rate limiters of QPs or groups
+*/
+void HanGuDriver::setRateLimit(PortProxy& portProxy, TypedBufferArg<kfd_ioctl_set_rate_limit_args> &args) {
+    HanGuRnicDef::RateLimitInfo limit[MAX_QPC_BATCH];
+    assert(args->limit_num > 0 && args->limit_num <= MAX_QPC_BATCH);
+    for (uint32_t i = 0; i < args->limit_num; ++i) {
+        assert(args->type[i] == RATE_LIMIT_QP || args->type[i] == RATE_LIMIT_GROUP);
+        limit[i].type  = args->type [i];
+        limit[i].id    = args->id   [i];
+        limit[i].rate  = args->rate [i];
+        limit[i].burst = args->burst[i];
+        HANGU_PRINT(HanGuDriver, "set rate limit! type: %d, id: 0x%x, rate: %d Mbps, burst: %d\n", 
+            limit[i].type, limit[i].id, limit[i].rate, limit[i].burst);
+    }
+    portProxy.writeBlob(curMbox().vaddr, limit, sizeof(HanGuRnicDef::RateLimitInfo) * args->limit_num);
+    postCmd(portProxy, (uint64_t)curMbox().paddr, 1, args->limit_num, HanGuRnicDef::SET_RATE_LIMIT);
 }
 /* --------------------------- Group {end}---------------------------- */
 
@@ -681,9 +800,9 @@ HanGuDriver::writeMtt(PortProxy& portProxy, TypedBufferArg<kfd_ioctl_init_mtt_ar
     for (uint32_t i = 0; i < args->batch_size; ++i) {
         mttResc[i].pAddr = args->paddr[i];
     }
-    portProxy.writeBlob(mailbox.vaddr, mttResc, sizeof(HanGuRnicDef::MttResc) * args->batch_size);
+    portProxy.writeBlob(curMbox().vaddr, mttResc, sizeof(HanGuRnicDef::MttResc) * args->batch_size);
 
-    postHcr(portProxy, (uint64_t)mailbox.paddr, args->mtt_index, args->batch_size, HanGuRnicDef::WRITE_MTT);
+    postCmd(portProxy, (uint64_t)curMbox().paddr, args->mtt_index, args->batch_size, HanGuRnicDef::WRITE_MTT);
 }
 /* -------------------------- MTT {end} ------------------------ */
 
@@ -711,9 +830,9 @@ HanGuDriver::writeMpt(PortProxy& portProxy, TypedBufferArg<kfd_ioctl_write_mpt_a
         HANGU_PRINT(HanGuDriver, " HGKFD_IOC_WRITE_MPT: mpt_index %d(%d) mtt_index %d(%d) batch_size %d\n", 
                 args->mpt_index[i], mptResc[i].key, args->mtt_index[i], mptResc[i].mttSeg, args->batch_size);
     }
-    portProxy.writeBlob(mailbox.vaddr, mptResc, sizeof(HanGuRnicDef::MptResc) * args->batch_size);
+    portProxy.writeBlob(curMbox().vaddr, mptResc, sizeof(HanGuRnicDef::MptResc) * args->batch_size);
 
-    postHcr(portProxy, (uint64_t)mailbox.paddr, args->mpt_index[0], args->batch_size, HanGuRnicDef::WRITE_MPT);
+    postCmd(portProxy, (uint64_t)curMbox().paddr, args->mpt_index[0], args->batch_size, HanGuRnicDef::WRITE_MPT);
 }
 /* -------------------------- MPT {end} ------------------------ */
 
@@ -722,6 +841,40 @@ HanGuDriver::writeMpt(PortProxy& portProxy, TypedBufferArg<kfd_ioctl_write_mpt_a
 void 
 HanGuDriver::allocCqc (TypedBufferArg<kfd_ioctl_alloc_cq_args> &args) {
     args->cq_num = allocResc(HanGuRnicDef::ICMTYPE_CQC, cqcMeta);
+    cqEventCnt[args->cq_num] = 0;
+}
+
+void 
+HanGuDriver::reqNotifyCq(PortProxy& portProxy, uint32_t cqn) {
+    uint32_t armCqn = cqn;
+    portProxy.writeBlob(hcrAddr + barArmCqOffset, &armCqn, sizeof(armCqn));
+}
+
+/**
+ * @note Handle CQ interrupt. Wake up one thread waiting for 
+ *       this CQ, or record the event if nobody waits.
+ */
+void 
+HanGuDriver::cqEventProc(uint32_t cqn) {
+    if (cqEventCnt.find(cqn) == cqEventCnt.end()) {
+        return; /* CQ of other process */
+    }
+
+    if (cqEventWaiter[cqn].empty()) {
+        ++cqEventCnt[cqn];
+        HANGU_PRINT(HanGuDriver, " cqEventProc: cqn %d, no waiter, event %d\n", cqn, cqEventCnt[cqn]);
+        return;
+    }
+
+    CqEventWaiter waiter = cqEventWaiter[cqn].front();
+    cqEventWaiter[cqn].pop();
+    HANGU_PRINT(HanGuDriver, " cqEventProc: cqn %d, wake up waiter\n", cqn);
+
+    TypedBufferArg<kfd_ioctl_cq_event_args> args(waiter.ioc_buf);
+    args->cq_num = cqn;
+    args->event_num = 1;
+    args.copyOut(waiter.tc->getVirtProxy());
+    waiter.tc->activate();
 }
     
 void 
@@ -732,9 +885,9 @@ HanGuDriver::writeCqc(PortProxy& portProxy, TypedBufferArg<kfd_ioctl_write_cqc_a
     cqcResc.lkey   = args->lkey    ;
     cqcResc.offset = args->offset  ;
     cqcResc.sizeLog= args->size_log;
-    portProxy.writeBlob(mailbox.vaddr, &cqcResc, sizeof(HanGuRnicDef::CqcResc));
+    portProxy.writeBlob(curMbox().vaddr, &cqcResc, sizeof(HanGuRnicDef::CqcResc));
 
-    postHcr(portProxy, (uint64_t)mailbox.paddr, args->cq_num, 0, HanGuRnicDef::WRITE_CQC);
+    postCmd(portProxy, (uint64_t)curMbox().paddr, args->cq_num, 0, HanGuRnicDef::WRITE_CQC);
 }
 /* -------------------------- CQC {end} ------------------------ */
 
@@ -758,7 +911,7 @@ HanGuDriver::allocQpc(TypedBufferArg<kfd_ioctl_alloc_qp_args> &args) {
 }
     
 void 
-HanGuDriver::writeQpc(PortProxy& portProxy, TypedBufferArg<kfd_ioctl_write_qpc_args> &args) {
+HanGuDriver::writeQpc(Process *process, PortProxy& portProxy, TypedBufferArg<kfd_ioctl_write_qpc_args> &args) {
     /* put QpcResc into mailbox */
     HanGuRnicDef::QpcResc qpcResc[MAX_QPC_BATCH]; // = (HanGuRnicDef::QpcResc *)mailbox.vaddr;
     memset(qpcResc, 0, sizeof(HanGuRnicDef::QpcResc) * args->batch_size);
@@ -786,7 +939,14 @@ HanGuDriver::writeQpc(PortProxy& portProxy, TypedBufferArg<kfd_ioctl_write_qpc_a
         qpcResc[i].indicator = args->indicator  [i];
         qpcResc[i].perfWeight = args->weight    [i];
         qpcResc[i].groupID = args->groupID      [i];
-        HANGU_PRINT(HanGuDriver, " writeQpc: qpn: 0x%x\n", qpcResc[i].srcQpn);
+        qpcResc[i].port    = args->port         [i];
+
+        /* RNIC reads doorbell record through physical address */
+        if (args->dbr_addr[i]) {
+            process->pTable->translate((Addr)args->dbr_addr[i], (Addr &)qpcResc[i].dbrAddr);
+        }
+        HANGU_PRINT(HanGuDriver, " writeQpc: qpn: 0x%x, dbr vaddr 0x%lx paddr 0x%lx\n", 
+                qpcResc[i].srcQpn, (uint64_t)args->dbr_addr[i], qpcResc[i].dbrAddr);
     }
 
     // update group table
@@ -799,10 +959,10 @@ HanGuDriver::writeQpc(PortProxy& portProxy, TypedBufferArg<kfd_ioctl_write_qpc_a
 
 
     HANGU_PRINT(HanGuDriver, " writeQpc: args->batch_size: %d\n", args->batch_size);
-    portProxy.writeBlob(mailbox.vaddr, qpcResc, sizeof(HanGuRnicDef::QpcResc) * args->batch_size);
+    portProxy.writeBlob(curMbox().vaddr, qpcResc, sizeof(HanGuRnicDef::QpcResc) * args->batch_size);
     HANGU_PRINT(HanGuDriver, " writeQpc: args->batch_size1: %d\n", args->batch_size);
 
-    postHcr(portProxy, (uint64_t)mailbox.paddr, args->src_qpn[0], args->batch_size, HanGuRnicDef::WRITE_QPC);
+    postCmd(portProxy, (uint64_t)curMbox().paddr, args->src_qpn[0], args->batch_size, HanGuRnicDef::WRITE_QPC);
 }
 
 
@@ -826,8 +986,277 @@ HanGuDriver::initMailbox(Process *process) {
             mailbox.vaddr, mailbox.paddr);
 }
 
+HanGuDriver::Mailbox &
+HanGuDriver::curMbox() {
+    if (cmdq.ready) {
+        return cmdq.mbox[cmdq.pi % CMDQ_DEPTH];
+    }
+    return mailbox;
+}
+
 /* -------------------------- Mailbox {end} ------------------------ */
 
+/* -------------------------- Command Queue {begin} ------------------------ */
+void 
+HanGuDriver::initCmdq(Process *process, PortProxy& portProxy) {
+
+    /* One page for the queue, and one mailbox for each entry */
+    uint32_t allocPages = 1 + CMDQ_DEPTH * MAILBOX_PAGE_NUM;
+    
+    cmdq.paddr = process->system->allocPhysPages(allocPages);
+    
+    // Assume mmap grows down, as in x86 Linux.
+    auto mem_state = process->memState;
+    cmdq.vaddr = mem_state->getMmapEnd() - (allocPages << 12);
+    mem_state->setMmapEnd(cmdq.vaddr);
+    process->pTable->map(cmdq.vaddr, cmdq.paddr, (allocPages << 12), false);
+    portProxy.memsetBlob(cmdq.vaddr, 0, 1 << 12);
+
+    for (uint32_t i = 0; i < CMDQ_DEPTH; ++i) {
+        cmdq.mbox[i].paddr = cmdq.paddr + ((1 + i * MAILBOX_PAGE_NUM) << 12);
+        cmdq.mbox[i].vaddr = cmdq.vaddr + ((1 + i * MAILBOX_PAGE_NUM) << 12);
+    }
+    cmdq.pi = 0;
+    cmdq.ci = 0;
+
+    /* Queue is identified by cpu_id */
+    uint64_t base = cmdq.paddr | cpu_id;
+    portProxy.writeBlob(hcrAddr + barCmdqBaseOffset, &base, sizeof(base));
+    cmdq.ready = true;
+
+    HANGU_PRINT(HanGuDriver, " cmdq.vaddr : 0x%x, cmdq.paddr : 0x%x, qid %d\n", 
+            cmdq.vaddr, cmdq.paddr, cpu_id);
+}
+
+uint32_t 
+HanGuDriver::updateCmdq(PortProxy& portProxy) {
+    
+    while (cmdq.ci != cmdq.pi) {
+        HanGuRnicDef::CmdCplRecord cpl;
+        portProxy.readBlob(cmdq.vaddr + HanGuRnicDef::CMDQ_CPL_OFFSET + 
+                (cmdq.ci % CMDQ_DEPTH) * sizeof(cpl), &cpl, sizeof(cpl));
+        if (cpl.seq != ((cmdq.ci + 1) & 0xffff)) {
+            break;
+        }
+        assert(cpl.status == 0);
+        ++cmdq.ci;
+    }
+    return cmdq.pi - cmdq.ci;
+}
+/* -------------------------- Command Queue {end} ------------------------ */
+
+/* -------------------------- Checkpoint {begin} ------------------------ */
+
+void
+HanGuDriver::rescMetaOut(CheckpointOut &cp, const std::string &base, 
+        const RescMeta &rescMeta) const {
+    paramOut(cp, base + ".start", rescMeta.start);
+    paramOut(cp, base + ".size", rescMeta.size);
+    paramOut(cp, base + ".entrySize", rescMeta.entrySize);
+    paramOut(cp, base + ".entryNumLog", rescMeta.entryNumLog);
+    paramOut(cp, base + ".entryNumPage", rescMeta.entryNumPage);
+    std::vector<uint8_t> bitmap;
+    if (rescMeta.bitmap) {
+        bitmap.assign(rescMeta.bitmap, rescMeta.bitmap + rescMeta.entryNumPage);
+    }
+    arrayParamOut(cp, base + ".bitmap", bitmap);
+}
+
+void
+HanGuDriver::rescMetaIn(CheckpointIn &cp, const std::string &base, 
+        RescMeta &rescMeta) {
+    paramIn(cp, base + ".start", rescMeta.start);
+    paramIn(cp, base + ".size", rescMeta.size);
+    paramIn(cp, base + ".entrySize", rescMeta.entrySize);
+    paramIn(cp, base + ".entryNumLog", rescMeta.entryNumLog);
+    paramIn(cp, base + ".entryNumPage", rescMeta.entryNumPage);
+    std::vector<uint8_t> bitmap;
+    arrayParamIn(cp, base + ".bitmap", bitmap);
+    rescMeta.bitmap = nullptr;
+    if (bitmap.size()) {
+        assert(bitmap.size() == rescMeta.entryNumPage);
+        rescMeta.bitmap = new uint8_t[rescMeta.entryNumPage];
+        memcpy(rescMeta.bitmap, bitmap.data(), rescMeta.entryNumPage);
+    }
+}
+
+void
+HanGuDriver::serialize(CheckpointOut &cp) const {
+    std::vector<std::string> fdProcess;
+    std::vector<int> fdNum;
+    for (auto &item : openFds) {
+        fdProcess.push_back(item.first);
+        fdNum.push_back(item.second);
+    }
+    SERIALIZE_CONTAINER(fdProcess);
+    SERIALIZE_CONTAINER(fdNum);
+
+    SERIALIZE_SCALAR(hcrAddr);
+    SERIALIZE_SCALAR(cpu_id);
+
+    rescMetaOut(cp, "mttMeta", mttMeta);
+    rescMetaOut(cp, "mptMeta", mptMeta);
+    rescMetaOut(cp, "cqcMeta", cqcMeta);
+    rescMetaOut(cp, "qpcMeta", qpcMeta);
+
+    std::vector<Addr> icmVPage, icmPPage;
+    for (auto &item : icmAddrmap) {
+        icmVPage.push_back(item.first);
+        icmPPage.push_back(item.second);
+    }
+    SERIALIZE_CONTAINER(icmVPage);
+    SERIALIZE_CONTAINER(icmPPage);
+
+    /* QP weights of all groups are flattened, in group order */
+    std::vector<uint16_t> groupId;
+    std::vector<uint32_t> groupQpNum, groupQpn;
+    std::vector<uint8_t> groupQpWeight;
+    for (auto &item : groupTable) {
+        groupId.push_back(item.first);
+        groupQpNum.push_back(item.second.qpWeight.size());
+        for (auto &qp : item.second.qpWeight) {
+            groupQpn.push_back(qp.first);
+            groupQpWeight.push_back(qp.second);
+        }
+    }
+    SERIALIZE_CONTAINER(groupId);
+    SERIALIZE_CONTAINER(groupQpNum);
+    SERIALIZE_CONTAINER(groupQpn);
+    SERIALIZE_CONTAINER(groupQpWeight);
+    SERIALIZE_SCALAR(qosShareParamAddr);
+
+    std::vector<uint32_t> eventCqn, eventCnt;
+    for (auto &item : cqEventCnt) {
+        eventCqn.push_back(item.first);
+        eventCnt.push_back(item.second);
+    }
+    SERIALIZE_CONTAINER(eventCqn);
+    SERIALIZE_CONTAINER(eventCnt);
+
+    /* Threads waiting for CQ events are suspended, 
+     * they are found again by context ID on restore */
+    std::vector<uint32_t> waiterCqn;
+    std::vector<ContextID> waiterCxt;
+    std::vector<Addr> waiterBuf;
+    for (auto &item : cqEventWaiter) {
+        std::queue<CqEventWaiter> que = item.second;
+        while (que.size()) {
+            waiterCqn.push_back(item.first);
+            waiterCxt.push_back(que.front().tc->contextId());
+            waiterBuf.push_back(que.front().ioc_buf);
+            que.pop();
+        }
+    }
+    SERIALIZE_CONTAINER(waiterCqn);
+    SERIALIZE_CONTAINER(waiterCxt);
+    SERIALIZE_CONTAINER(waiterBuf);
+
+    paramOut(cp, "mailbox.paddr", mailbox.paddr);
+    paramOut(cp, "mailbox.vaddr", mailbox.vaddr);
+
+    std::vector<Addr> cmdqMboxPaddr, cmdqMboxVaddr;
+    for (int i = 0; i < CMDQ_DEPTH; ++i) {
+        cmdqMboxPaddr.push_back(cmdq.mbox[i].paddr);
+        cmdqMboxVaddr.push_back(cmdq.mbox[i].vaddr);
+    }
+    paramOut(cp, "cmdq.paddr", cmdq.paddr);
+    paramOut(cp, "cmdq.vaddr", cmdq.vaddr);
+    paramOut(cp, "cmdq.pi", cmdq.pi);
+    paramOut(cp, "cmdq.ci", cmdq.ci);
+    paramOut(cp, "cmdq.ready", cmdq.ready);
+    SERIALIZE_CONTAINER(cmdqMboxPaddr);
+    SERIALIZE_CONTAINER(cmdqMboxVaddr);
+}
+
+void
+HanGuDriver::unserialize(CheckpointIn &cp) {
+    std::vector<std::string> fdProcess;
+    std::vector<int> fdNum;
+    UNSERIALIZE_CONTAINER(fdProcess);
+    UNSERIALIZE_CONTAINER(fdNum);
+    openFds.clear();
+    for (size_t i = 0; i < fdProcess.size(); ++i) {
+        Process *process = dynamic_cast<Process *>(SimObject::find(fdProcess[i].c_str()));
+        panic_if(!process, "HanGuDriver: cannot find process %s\n", fdProcess[i]);
+        process->fds->setFDEntry(fdNum[i], 
+                std::make_shared<DeviceFDEntry>(this, filename));
+        openFds.emplace_back(fdProcess[i], fdNum[i]);
+    }
+
+    UNSERIALIZE_SCALAR(hcrAddr);
+    UNSERIALIZE_SCALAR(cpu_id);
+
+    rescMetaIn(cp, "mttMeta", mttMeta);
+    rescMetaIn(cp, "mptMeta", mptMeta);
+    rescMetaIn(cp, "cqcMeta", cqcMeta);
+    rescMetaIn(cp, "qpcMeta", qpcMeta);
+
+    std::vector<Addr> icmVPage, icmPPage;
+    UNSERIALIZE_CONTAINER(icmVPage);
+    UNSERIALIZE_CONTAINER(icmPPage);
+    icmAddrmap.clear();
+    for (size_t i = 0; i < icmVPage.size(); ++i) {
+        icmAddrmap[icmVPage[i]] = icmPPage[i];
+    }
+
+    std::vector<uint16_t> groupId;
+    std::vector<uint32_t> groupQpNum, groupQpn;
+    std::vector<uint8_t> groupQpWeight;
+    UNSERIALIZE_CONTAINER(groupId);
+    UNSERIALIZE_CONTAINER(groupQpNum);
+    UNSERIALIZE_CONTAINER(groupQpn);
+    UNSERIALIZE_CONTAINER(groupQpWeight);
+    UNSERIALIZE_SCALAR(qosShareParamAddr);
+    groupTable.clear();
+    size_t qpIdx = 0;
+    for (size_t i = 0; i < groupId.size(); ++i) {
+        groupUnit &group = groupTable[groupId[i]];
+        for (uint32_t j = 0; j < groupQpNum[i]; ++j, ++qpIdx) {
+            group.qpWeight[groupQpn[qpIdx]] = groupQpWeight[qpIdx];
+        }
+    }
+
+    std::vector<uint32_t> eventCqn, eventCnt;
+    UNSERIALIZE_CONTAINER(eventCqn);
+    UNSERIALIZE_CONTAINER(eventCnt);
+    cqEventCnt.clear();
+    for (size_t i = 0; i < eventCqn.size(); ++i) {
+        cqEventCnt[eventCqn[i]] = eventCnt[i];
+    }
+
+    std::vector<uint32_t> waiterCqn;
+    std::vector<ContextID> waiterCxt;
+    std::vector<Addr> waiterBuf;
+    UNSERIALIZE_CONTAINER(waiterCqn);
+    UNSERIALIZE_CONTAINER(waiterCxt);
+    UNSERIALIZE_CONTAINER(waiterBuf);
+    cqEventWaiter.clear();
+    for (size_t i = 0; i < waiterCqn.size(); ++i) {
+        panic_if(openFds.empty(), "HanGuDriver: CQ event waiter without process\n");
+        Process *process = dynamic_cast<Process *>(SimObject::find(openFds[0].first.c_str()));
+        ThreadContext *tc = process->system->threads[waiterCxt[i]];
+        cqEventWaiter[waiterCqn[i]].push({tc, waiterBuf[i]});
+    }
+
+    paramIn(cp, "mailbox.paddr", mailbox.paddr);
+    paramIn(cp, "mailbox.vaddr", mailbox.vaddr);
+
+    std::vector<Addr> cmdqMboxPaddr, cmdqMboxVaddr;
+    paramIn(cp, "cmdq.paddr", cmdq.paddr);
+    paramIn(cp, "cmdq.vaddr", cmdq.vaddr);
+    paramIn(cp, "cmdq.pi", cmdq.pi);
+    paramIn(cp, "cmdq.ci", cmdq.ci);
+    paramIn(cp, "cmdq.ready", cmdq.ready);
+    UNSERIALIZE_CONTAINER(cmdqMboxPaddr);
+    UNSERIALIZE_CONTAINER(cmdqMboxVaddr);
+    assert(cmdqMboxPaddr.size() == CMDQ_DEPTH);
+    for (int i = 0; i < CMDQ_DEPTH; ++i) {
+        cmdq.mbox[i].paddr = cmdqMboxPaddr[i];
+        cmdq.mbox[i].vaddr = cmdqMboxVaddr[i];
+    }
+}
+/* -------------------------- Checkpoint {end} ------------------------ */
+
 HanGuDriver*
 HanGuDriverParams::create()
 {
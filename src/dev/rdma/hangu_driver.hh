@@ -63,6 +63,9 @@ class HanGuDriver final : public EmulatedDriver {
     Addr mmap(ThreadContext *tc, Addr start, uint64_t length,
               int prot, int tgtFlags, int tgtFd, int offset);
 
+    void serialize(CheckpointOut &cp) const override;
+    void unserialize(CheckpointIn &cp) override;
+
   protected:
     /**
      * RDMA agent (device) that is controled by this driver.
@@ -79,11 +82,19 @@ class HanGuDriver final : public EmulatedDriver {
     uint8_t cpu_id;
     /* -------CPU_ID{end}------- */
 
+    /* FDs opened on this driver, <process name, fd>. Process 
+     * does not checkpoint FDs, so they are re-installed on restore. */
+    std::vector<std::pair<std::string, int> > openFds;
+
     /* -------HCR {begin}------- */
     uint8_t checkHcr(PortProxy& portProxy);
 
     void postHcr(PortProxy& portProxy, 
             uint64_t inParam, uint32_t inMod, uint64_t outParam, uint8_t opcode);
+
+    // Post command through command queue if it is enabled, or through HCR
+    void postCmd(PortProxy& portProxy, 
+            uint64_t inParam, uint32_t inMod, uint64_t outParam, uint8_t opcode);
     /* -------HCR {end}------- */
 
     /* ------- Resc {begin} ------- */
@@ -99,6 +110,9 @@ class HanGuDriver final : public EmulatedDriver {
     };
 
     uint32_t allocResc(uint8_t rescType, RescMeta &rescMeta);
+
+    void rescMetaOut(CheckpointOut &cp, const std::string &base, const RescMeta &rescMeta) const;
+    void rescMetaIn(CheckpointIn &cp, const std::string &base, RescMeta &rescMeta);
     /* ------- Resc {end} ------- */
 
     /* -------ICM resources {begin}------- */
@@ -160,7 +174,7 @@ class HanGuDriver final : public EmulatedDriver {
     // allocate qp resources
     void allocQpc(TypedBufferArg<kfd_ioctl_alloc_qp_args> &args);
     
-    void writeQpc(PortProxy& portProxy, TypedBufferArg<kfd_ioctl_write_qpc_args> &args);
+    void writeQpc(Process *process, PortProxy& portProxy, TypedBufferArg<kfd_ioctl_write_qpc_args> &args);
     /* -------QPC resources {end}------- */
 
     /* -------QoS Group resources {begin}------- */
@@ -172,6 +186,7 @@ class HanGuDriver final : public EmulatedDriver {
     void setGroup(PortProxy& portProxy, TypedBufferArg<kfd_ioctl_set_group_args> &args);
     void allocGroup(PortProxy& portProxy, TypedBufferArg<kfd_ioctl_alloc_group_args> &args);
     void updateQpWeight(PortProxy& portProxy, TypedBufferArg<kfd_ioctl_write_qpc_args> &args);
+    void setRateLimit(PortProxy& portProxy, TypedBufferArg<kfd_ioctl_set_rate_limit_args> &args);
     void printQoS(PortProxy& portProxy);
     void initQoS(PortProxy& portProxy, Process* process);
     void updateN(PortProxy& portProxy, TypedBufferArg<kfd_ioctl_alloc_qp_args> &args);
@@ -187,6 +202,7 @@ class HanGuDriver final : public EmulatedDriver {
     const int groupGranularityOffset    = 1536;
 
     const int barShareAddrOffset        = 0x30;
+    const int barArmCqOffset            = 0x28;
     const int barShareAddrFlagOffset    = 0x40;
     const int qpAmountOffset            = 0xa00;
     const int qosSharePageNum           = 16;
@@ -194,6 +210,20 @@ class HanGuDriver final : public EmulatedDriver {
     const int chunkSizePerQP = 4096;
     /* -------QoS Group resources {end}------- */
 
+    /* -------CQ event {begin}------- */
+    struct CqEventWaiter {
+        ThreadContext *tc;
+        Addr ioc_buf;
+    };
+    std::unordered_map<uint32_t, uint32_t> cqEventCnt; /* <cqn, events not consumed>, only CQs of this process */
+    std::unordered_map<uint32_t, std::queue<CqEventWaiter> > cqEventWaiter; /* <cqn, suspended threads> */
+
+    void reqNotifyCq(PortProxy& portProxy, uint32_t cqn);
+
+    // called by the device when CQ interrupt is raised
+    void cqEventProc(uint32_t cqn);
+    /* -------CQ event {end}------- */
+
     /* ------------TQ resources {begin}---------- */
     RescMeta tqMeta;
     void allocTq();
@@ -209,8 +239,34 @@ class HanGuDriver final : public EmulatedDriver {
     Mailbox mailbox;
 
     void initMailbox(Process *process);
+
+    // Mailbox to be used by the next command
+    Mailbox &curMbox();
     /* -------mailbox {end} ------- */
 
+    /* -------command queue {begin} ------- */
+    /* Commands are posted into the queue without waiting 
+     * for the former ones, and retired by the device in 
+     * order. Each entry owns one mailbox. */
+    struct CmdQueue {
+        Addr paddr; // queue page, entries followed by completion records
+        Addr vaddr;
+        Mailbox mbox[CMDQ_DEPTH];
+        uint32_t pi; // next entry to post
+        uint32_t ci; // next entry to complete
+        bool ready;
+    };
+    bool cmdqEnable;
+    CmdQueue cmdq;
+    const int barCmdqBaseOffset = 0x48;
+    const int barCmdqDbOffset   = 0x50;
+
+    void initCmdq(Process *process, PortProxy& portProxy);
+
+    // Collect completion records, and return number of outstanding commands
+    uint32_t updateCmdq(PortProxy& portProxy);
+    /* -------command queue {end} ------- */
+
 };
 
 #endif // __RDMA_HANGU_DRIVER_HH__
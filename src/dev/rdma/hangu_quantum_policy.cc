@@ -0,0 +1,149 @@
+/*
+ *======================= START OF LICENSE NOTICE =======================
+ *  NO WARRANTY. THE PRODUCT IS PROVIDED BY DEVELOPER "AS IS" AND ANY
+ *  EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ *  PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL DEVELOPER BE LIABLE FOR
+ *  ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ *  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ *  GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ *  IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ *  OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THE PRODUCT, EVEN
+ *  IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *======================== END OF LICENSE NOTICE ========================
+ */
+
+#include "dev/rdma/hangu_quantum_policy.hh"
+
+#include <algorithm>
+
+#include "base/logging.hh"
+#include "sim/serialize.hh"
+
+HanGuQuantumPolicy::HanGuQuantumPolicy(const Params *p)
+  : SimObject(p), _period(p->period), _quantum(0), _fetchDepth(0) {
+}
+
+void
+HanGuQuantumPolicy::record(Tick queueDelay) {
+    quantumStat    = _quantum;
+    fetchDepthStat = _fetchDepth;
+    queueDelayStat = queueDelay;
+    quantumHist.sample(_quantum);
+}
+
+void
+HanGuQuantumPolicy::regStats() {
+    SimObject::regStats();
+
+    quantumStat
+        .name(name() + ".quantum")
+        .desc("Scheduling quantum of bulk QPs over time (bytes)")
+        .precision(0)
+        ;
+
+    fetchDepthStat
+        .name(name() + ".fetchDepth")
+        .desc("Max WQEs fetched for one QP at a time over time")
+        .precision(1)
+        ;
+
+    queueDelayStat
+        .name(name() + ".queueDelay")
+        .desc("Mean QPN queue delay measured by the scheduler over time (ticks)")
+        .precision(0)
+        ;
+
+    quantumHist
+        .init(16)
+        .name(name() + ".quantumHist")
+        .desc("Scheduling quantum chosen in each period (bytes)")
+        .flags(Stats::nozero)
+        ;
+
+    /* Time weighted averages hold the value from the start */
+    quantumStat    = _quantum;
+    fetchDepthStat = _fetchDepth;
+}
+
+HanGuFixedQuantum::HanGuFixedQuantum(const Params *p)
+  : HanGuQuantumPolicy(p) {
+    fatal_if(p->quantum == 0 || p->fetch_depth == 0,
+            "%s: quantum and fetch_depth should not be 0\n", name());
+    _quantum    = p->quantum;
+    _fetchDepth = p->fetch_depth;
+}
+
+void
+HanGuFixedQuantum::update(uint32_t activeQpNum, Tick queueDelay) {
+    record(queueDelay);
+}
+
+HanGuAdaptiveQuantum::HanGuAdaptiveQuantum(const Params *p)
+  : HanGuQuantumPolicy(p),
+    minQuantum(p->min_quantum), maxQuantum(p->max_quantum),
+    minFetchDepth(p->min_fetch_depth), maxFetchDepth(p->max_fetch_depth),
+    targetDelay(p->target_delay), linkSpeed(p->link_speed),
+    wqeBudget(p->wqe_budget), gain(p->gain), correction(1.0) {
+    fatal_if(minQuantum == 0 || minQuantum > maxQuantum,
+            "%s: needs 0 < min_quantum <= max_quantum\n", name());
+    fatal_if(minFetchDepth == 0 || minFetchDepth > maxFetchDepth,
+            "%s: needs 0 < min_fetch_depth <= max_fetch_depth\n", name());
+    fatal_if(targetDelay == 0 || _period == 0,
+            "%s: target_delay and period should not be 0\n", name());
+    fatal_if(gain <= 0 || gain > 1, "%s: gain should be in (0, 1]\n", name());
+
+    /* Start as if one QP is active */
+    _quantum    = maxQuantum;
+    _fetchDepth = std::min(std::max(wqeBudget, minFetchDepth), maxFetchDepth);
+}
+
+/**
+ * @note
+ * The correction moves at most by 2x each period, so a burst of
+ * QPs does not swing the quantum between the bounds.
+*/
+void
+HanGuAdaptiveQuantum::update(uint32_t activeQpNum, Tick queueDelay) {
+    uint32_t qpNum = std::max(activeQpNum, (uint32_t)1);
+
+    if (queueDelay != 0) {
+        double ratio = std::min(std::max((double)targetDelay / queueDelay, 0.5), 2.0);
+        correction = (1 - gain) * correction + gain * correction * ratio;
+        correction = std::min(std::max(correction, 1.0 / 64), 64.0);
+    }
+
+    double bytes = targetDelay / linkSpeed / qpNum * correction;
+    bytes = std::min(std::max(bytes, (double)minQuantum), (double)maxQuantum);
+    /* cacheline aligned, sub WQEs do not start in the middle of a line */
+    _quantum = std::max((uint32_t)bytes & ~(uint32_t)63, minQuantum);
+
+    _fetchDepth = std::min(std::max(wqeBudget / qpNum, minFetchDepth), maxFetchDepth);
+
+    record(queueDelay);
+}
+
+void
+HanGuAdaptiveQuantum::serialize(CheckpointOut &cp) const {
+    SERIALIZE_SCALAR(_quantum);
+    SERIALIZE_SCALAR(_fetchDepth);
+    SERIALIZE_SCALAR(correction);
+}
+
+void
+HanGuAdaptiveQuantum::unserialize(CheckpointIn &cp) {
+    UNSERIALIZE_SCALAR(_quantum);
+    UNSERIALIZE_SCALAR(_fetchDepth);
+    UNSERIALIZE_SCALAR(correction);
+}
+
+HanGuFixedQuantum *
+HanGuFixedQuantumParams::create() {
+    return new HanGuFixedQuantum(this);
+}
+
+HanGuAdaptiveQuantum *
+HanGuAdaptiveQuantumParams::create() {
+    return new HanGuAdaptiveQuantum(this);
+}
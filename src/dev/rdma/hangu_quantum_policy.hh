@@ -0,0 +1,110 @@
+/*
+ *======================= START OF LICENSE NOTICE =======================
+ *  NO WARRANTY. THE PRODUCT IS PROVIDED BY DEVELOPER "AS IS" AND ANY
+ *  EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ *  PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL DEVELOPER BE LIABLE FOR
+ *  ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ *  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ *  GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ *  IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ *  OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THE PRODUCT, EVEN
+ *  IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *======================== END OF LICENSE NOTICE ========================
+ */
+
+/**
+ * @file
+ * Scheduling quantum and WQE fetch depth policies of Han Gu RNIC
+ * descriptor scheduler, used if QoS is disabled.
+ */
+
+#ifndef __RDMA_HANGU_QUANTUM_POLICY_HH__
+#define __RDMA_HANGU_QUANTUM_POLICY_HH__
+
+#include <cstdint>
+
+#include "base/statistics.hh"
+#include "base/types.hh"
+#include "params/HanGuAdaptiveQuantum.hh"
+#include "params/HanGuFixedQuantum.hh"
+#include "params/HanGuQuantumPolicy.hh"
+#include "sim/sim_object.hh"
+
+/**
+ * The descriptor scheduler reads quantum() for each batch of a bulk QP,
+ * and fetchDepth() for each WQE fetch. Every period it calls update()
+ * with the number of backlogged bulk QPs and the mean time they waited
+ * in the QPN queue in this period.
+ */
+class HanGuQuantumPolicy : public SimObject {
+  public:
+    typedef HanGuQuantumPolicyParams Params;
+    HanGuQuantumPolicy(const Params *p);
+
+    virtual void update(uint32_t activeQpNum, Tick queueDelay) = 0;
+
+    uint32_t quantum() const { return _quantum; }
+    uint32_t fetchDepth() const { return _fetchDepth; }
+    /* 0 if quantum and fetch depth never change */
+    Tick period() const { return _period; }
+
+    void regStats() override;
+
+  protected:
+    const Tick _period;
+    uint32_t _quantum;    /* bytes */
+    uint32_t _fetchDepth; /* WQEs */
+
+    /* Time weighted, sampled each update */
+    Stats::Average quantumStat;
+    Stats::Average fetchDepthStat;
+    Stats::Average queueDelayStat;
+    Stats::Histogram quantumHist;
+    void record(Tick queueDelay);
+};
+
+/**
+ * sched_quantum bytes and max_prefetch_num WQEs, whatever the load is.
+ */
+class HanGuFixedQuantum : public HanGuQuantumPolicy {
+  public:
+    typedef HanGuFixedQuantumParams Params;
+    HanGuFixedQuantum(const Params *p);
+
+    void update(uint32_t activeQpNum, Tick queueDelay) override;
+};
+
+/**
+ * The quantum is the bytes sent over the link in target_delay, shared by
+ * the active QPs, so that a QP waits about target_delay for the others
+ * in the round. A correction factor, updated by the ratio of target_delay
+ * to the measured delay, covers what this estimate misses (scheduler
+ * and engine overhead, rate limiters). The WQE buffer is shared by the
+ * active QPs likewise for the fetch depth. Both are clamped to the ranges
+ * in the parameters.
+ */
+class HanGuAdaptiveQuantum : public HanGuQuantumPolicy {
+  public:
+    typedef HanGuAdaptiveQuantumParams Params;
+    HanGuAdaptiveQuantum(const Params *p);
+
+    void update(uint32_t activeQpNum, Tick queueDelay) override;
+
+    void serialize(CheckpointOut &cp) const override;
+    void unserialize(CheckpointIn &cp) override;
+
+  private:
+    const uint32_t minQuantum;
+    const uint32_t maxQuantum;
+    const uint32_t minFetchDepth;
+    const uint32_t maxFetchDepth;
+    const Tick targetDelay;
+    const double linkSpeed;  /* ticks per byte */
+    const uint32_t wqeBudget;
+    const double gain;       /* EWMA weight of the correction factor */
+    double correction;
+};
+
+#endif // __RDMA_HANGU_QUANTUM_POLICY_HH__
@@ -48,38 +48,109 @@ using namespace Net;
 using namespace std;
 
 HanGuRnic::HanGuRnic(const Params *p)
-  : RdmaNic(p), etherInt(NULL),
+  : RdmaNic(p), lagMode(p->lag_mode),
     doorbellVector      (p->reorder_cap),
     ceuProcEvent        ([this]{ ceuProc();      }, name()),
     doorbellProcEvent   ([this]{ doorbellProc(); }, name()),
     mboxEvent           ([this]{ mboxFetchCpl();    }, name()),
-    rdmaEngine          (this, name() + ".RdmaEngine", p->reorder_cap),
-    descScheduler       (this, name() + ".DescScheduler"),
-    rescPrefetcher      (this, name() + ".RescPrefetcher", p->prefetch_window_size),
+    cmdqFetchEvent      ([this]{ cmdqFetchProc();  }, name()),
+    cmdqRetireEvent     ([this]{ cmdqRetireProc(); }, name()),
+    cqeFlushEvent       ([this]{ cqeFlushProcessing(); }, name()),
+    descScheduler       (this, name() + ".DescScheduler", p->engine_lanes),
+    rescPrefetcher      (this, name() + ".RescPrefetcher", p->prefetch_window_size, 
+                            p->prefetch_min_depth, p->prefetch_max_depth, 
+                            p->prefetch_adapt_interval, p->prefetch_acc_low, 
+                            p->prefetch_late_high),
     wqeBufferManage     (this, name() + ".WqeBufferManage", p->wqe_cache_cap),
     mrRescModule        (this, name() + ".MrRescModule", p->mpt_cache_num, p->mtt_cache_num),
     cqcModule           (this, name() + ".CqcModule", p->cqc_cache_num),
+    intrModule          (this, name() + ".IntrModule", p->intr_mod_count, 
+                            p->intr_mod_time, p->intr_mod_adaptive),
     qpcModule           (this, name() + ".QpcModule", p->qpc_cache_cap, p->reorder_cap),
     dmaReadDelay        (p->dma_read_delay), dmaWriteDelay(p->dma_write_delay),
     pciBandwidth        (p->pci_speed),
     etherBandwidth      (p->ether_speed),
-    dmaEngine           (this, name() + ".DmaEngine"),
+    ffSwitchEvent       ([this]{ ffSwitchProc(); }, name()),
+    drainEvent          ([this]{ checkDrain(); }, name()),
+    dmaEngine           (this, name() + ".DmaEngine", 
+                            p->watchdog_period, p->watchdog_panic),
+    trace               (p->trace_file, p->trace_mask, p->trace_buf_size),
     LinkDelay           (p->link_delay),
     ethRxPktProcEvent   ([this]{ ethRxPktProc(); }, name()) {
 
     HANGU_PRINT(HanGuRnic, " qpc_cache_cap %d  reorder_cap %d cpuNum 0x%x\n", p->qpc_cache_cap, p->reorder_cap, p->cpu_num);
 
+    if (p->intr_mod_count > 1 && p->intr_mod_time == 0) {
+        panic("intr_mod_count > 1 needs intr_mod_time, or the last CQEs may never raise interrupt!\n");
+    }
+
+    /* Ports are created before engine lanes, which have one txsauFifo for each */
+    fatal_if(p->port_num == 0 || p->port_num > 256, 
+            "%s: port_num should be in [1, 256]\n", name());
+    for (uint32_t i = 0; i < p->port_num; ++i) {
+        ports.push_back(new EtherPort(this, i));
+        ports.back()->etherInt = new HanGuRnicInt(
+                name() + (i ? ".int" + std::to_string(i) : ".int"), this, i);
+    }
+
+    /* One lane keeps the original name, for stats and checkpoints */
+    fatal_if(p->engine_lanes == 0 || p->engine_lanes > 256, 
+            "%s: engine_lanes should be in [1, 256]\n", name());
+    for (uint32_t i = 0; i < p->engine_lanes; ++i) {
+        std::string n = name() + ".RdmaEngine" + (p->engine_lanes > 1 ? std::to_string(i) : "");
+        rdmaEngines.push_back(new RdmaEngine(this, n, i, p->reorder_cap, p->window_cap));
+    }
+
+    cqeCoalesceNum      = p->cqe_coalesce_num;
+    cqeCoalesceTimeout  = p->cqe_coalesce_timeout;
+
+    dbCoalesce = p->db_coalesce;
+    cmdqCmdNum = 0;
+
     cpuNum = p->cpu_num;
     syncCnt = 0;
     syncSucc = 0;
 
+    qpnNum               = p->qpn_num;
+    maxPrefetchNum       = p->max_prefetch_num;
+    unsentBatchThreshold = p->unsent_batch_threshold;
+    descReqLimit         = p->desc_req_limit;
+    dataReqLimit         = p->data_req_limit;
+    enablePrefetch       = p->enable_prefetch;
+    enableQos            = p->enable_qos;
+    cacheAllCqMpt        = p->cache_all_cq_mpt;
+    cacheAllQpMpt        = p->cache_all_qp_mpt;
+    schedPolicy          = p->sched_policy;
+    quantumPolicy        = p->quantum_policy;
+    qosCtrlPeriod        = p->qos_ctrl_period;
+    qosCtrlGain          = p->qos_ctrl_gain;
+    qosCtrlTolerance     = p->qos_ctrl_tolerance;
+    qosCtrlRange         = p->qos_ctrl_range;
+    fatal_if(qosCtrlPeriod && (qosCtrlRange == 0 || qosCtrlGain <= 0), 
+            "%s: qos_ctrl_range and qos_ctrl_gain should be positive\n", name());
+    latWqeReserve        = p->lat_wqe_reserve;
+    adaptiveWqeKeep      = p->adaptive_wqe_keep;
+    wqeKeepGain          = p->wqe_keep_gain;
+    fatal_if(wqeKeepGain <= 0 || wqeKeepGain > 1, 
+            "%s: wqe_keep_gain should be in (0, 1]\n", name());
+
+    fastForward    = p->fast_forward;
+    fastForwardEnd = p->fast_forward_end;
+    ffWarmCaches   = p->ff_warm_caches;
+
+    EthPacketPool::setEnabled(p->eth_pkt_pool);
+    poolAllocEnabled() = p->pool_alloc;
+
+    /* QPN indexed tables are sized for all QPs at once */
+    descScheduler.qpStatusTable.reserve(qpnNum);
+    wqeBufferManage.wqeBuffer.reserve(qpnNum);
+    wqeBufferManage.wqeBufferMetadataTable.reserve(qpnNum);
+
     for (int i = 0; i < p->reorder_cap; ++i) {
         df2ccuIdxFifo.push(i);
     }
 
-    etherInt = new HanGuRnicInt(name() + ".int", this);
-
-    mboxBuf = new uint8_t[4096];
+    mboxBuf = nullptr;
 
     // Set the MAC address
     memset(macAddr, 0, ETH_ADDR_LEN);
@@ -87,13 +158,21 @@ HanGuRnic::HanGuRnic(const Params *p)
         macAddr[ETH_ADDR_LEN - 1 - i] = (p->mac_addr >> (i * 8)) & 0xff;
         // HANGU_PRINT(PioEngine, " mac[%d] 0x%x\n", ETH_ADDR_LEN - 1 - i, macAddr[ETH_ADDR_LEN - 1 - i]);
     }
+    fatal_if(macAddr[PORT_MAC_BYTE], "%s: byte %d of mac_addr holds the port number, "
+            "it should be 0\n", name(), PORT_MAC_BYTE);
 
     BARSize[0]  = (1 << 12);
     BARAddrs[0] = 0xc000000000000000;
 }
 
 HanGuRnic::~HanGuRnic() {
-    delete etherInt;
+    for (auto etherPort : ports) {
+        delete etherPort->etherInt;
+        delete etherPort;
+    }
+    for (auto engine : rdmaEngines) {
+        delete engine;
+    }
 }
 
 void
@@ -101,10 +180,209 @@ HanGuRnic::init() {
     PciDevice::init();
 }
 
+void
+HanGuRnic::regStats() {
+    RdmaNic::regStats();
+
+    descScheduler.regStats();
+    rescPrefetcher.regStats();
+    wqeBufferManage.regStats();
+    intrModule.regStats();
+    for (auto engine : rdmaEngines) {
+        engine->regStats();
+    }
+
+    portTxBytes
+        .init(ports.size())
+        .name(name() + ".portTxBytes")
+        .desc("Bytes transmitted through each port")
+        .prereq(txBytes);
+
+    portRxBytes
+        .init(ports.size())
+        .name(name() + ".portRxBytes")
+        .desc("Bytes received through each port")
+        .prereq(rxBytes);
+
+    portFailNum
+        .name(name() + ".portFailNum")
+        .desc("Number of port failures");
+
+    dbNum
+        .name(name() + ".dbNum")
+        .desc("Doorbells received");
+
+    dbMergeNum
+        .name(name() + ".dbMergeNum")
+        .desc("Doorbells merged into a waiting doorbell of the same QP");
+
+    dbMergeRate
+        .name(name() + ".dbMergeRate")
+        .desc("Fraction of doorbells merged");
+    dbMergeRate = dbMergeNum / dbNum;
+
+    cqeNum
+        .name(name() + ".cqeNum")
+        .desc("CQEs posted to the CQE staging buffer");
+
+    cqeWriteNum
+        .name(name() + ".cqeWriteNum")
+        .desc("CQ write requests posted to TPT, coalesced CQEs write once");
+
+    cqeStageDelay
+        .name(name() + ".cqeStageDelay")
+        .desc("Ticks CQEs spent in the CQE staging buffer");
+
+    cqeSavedWrite
+        .name(name() + ".cqeSavedWrite")
+        .desc("CQ write requests saved by CQE coalescing");
+    cqeSavedWrite = cqeNum - cqeWriteNum;
+
+    cqeStageAvg
+        .name(name() + ".cqeStageAvg")
+        .desc("Average ticks a CQE spent in the CQE staging buffer");
+    cqeStageAvg = cqeStageDelay / cqeNum;
+}
+
+void
+HanGuRnic::startup() {
+    PciDevice::startup();
+
+    /* Entries which did not fit in the caches on restore */
+    qpcModule.restoreWriteBack();
+    cqcModule.cqcCache.restoreWriteBack();
+    mrRescModule.mptCache.restoreWriteBack();
+    mrRescModule.mttCache.restoreWriteBack();
+
+    /* Packets from a peer in another event queue are handed over 
+     * after the link delay, see ethRxDelay */
+    fatal_if(numMainEventQueues > 1 && (LinkDelay == 0 || LinkDelay < simQuantum), 
+            "%s: link_delay (%lu) must be non-zero and no less than sim quantum (%lu) "
+            "in parallel simulation\n", name(), LinkDelay, simQuantum);
+
+    if (fastForward && fastForwardEnd) {
+        schedule(ffSwitchEvent, std::max(curTick(), fastForwardEnd));
+    }
+
+    const std::vector<Tick> &failTick = params()->port_fail_tick;
+    for (uint8_t port = 0; port < failTick.size() && port < ports.size(); ++port) {
+        if (failTick[port] && failTick[port] >= curTick() && ports[port]->up) {
+            schedule(new EventFunctionWrapper([this, port]{ setPortUp(port, false); }, 
+                    name() + ".portFail", true), failTick[port]);
+        }
+    }
+}
+
+/**
+ * @note
+ *      Port failover hook. Packets waiting for a port are moved to 
+ *      the port each QP is sent through now (see txPort), i.e. the 
+ *      next port which is up, both when the port fails and when it 
+ *      recovers, so that packets of one QP are never queued on two 
+ *      ports at once. New packets follow txPort.
+ */
+void
+HanGuRnic::setPortUp(uint8_t port, bool up) {
+
+    assert(port < ports.size());
+    if (ports[port]->up == up) {
+        return;
+    }
+    ports[port]->up = up;
+    inform("%s: port %d is %s at tick %lu\n", name(), port, up ? "up" : "down", curTick());
+
+    if (up) {
+        if (!ports[port]->sauEvent.scheduled()) {
+            schedule(ports[port]->sauEvent, curTick() + clockPeriod());
+        }
+    }
+    else {
+        ++portFailNum;
+        if (ports[port]->sauEvent.scheduled()) {
+            deschedule(ports[port]->sauEvent);
+        }
+        /* announced again by the port taking over the MAC */
+        std::queue<EthPacketPtr>().swap(ports[port]->ctrlFifo);
+    }
+    for (auto engine : rdmaEngines) {
+        engine->reroutePkts();
+    }
+    updateRxOwner(true);
+}
+
+/**
+ * @note
+ *      Frames to the MAC of a port are accepted by the port it 
+ *      fails over to (the port itself if it is up), and only by 
+ *      it, so a frame flooded by the switch is received once. If 
+ *      announce is set, the new owner sends a frame from the MAC, 
+ *      so that the switch learns where the MAC has moved.
+ */
+void
+HanGuRnic::updateRxOwner(bool announce) {
+    for (uint8_t port = 0; port < ports.size(); ++port) {
+        uint8_t owner = txPort(port);
+        if (owner == ports[port]->rxOwner) {
+            continue;
+        }
+        ports[port]->rxOwner = owner;
+        if (!announce || !ports[owner]->up) {
+            continue;
+        }
+        uint32_t len = ETH_ADDR_LEN * 2 + PKT_BTH_SZ;
+        EthPacketPtr pkt = EthPacketPool::alloc(len);
+        pkt->length = len;
+        pkt->simLength = len;
+        memset(pkt->data, 0, len);
+        memset(pkt->data, 0xff, ETH_ADDR_LEN); /* broadcast, dropped by peers */
+        memcpy(pkt->data + ETH_ADDR_LEN, macAddr, ETH_ADDR_LEN);
+        pkt->data[ETH_ADDR_LEN + PORT_MAC_BYTE] = port;
+        ports[owner]->ctrlFifo.push(pkt);
+        if (!ports[owner]->sauEvent.scheduled()) {
+            schedule(ports[owner]->sauEvent, curTick() + clockPeriod());
+        }
+    }
+}
+
+/**
+ * @note
+ *      Fast-forward runs the same pipeline, so PSNs, queue offsets 
+ *      and cached resources stay consistent on switching. Writing 
+ *      back caches is delayed until the pipeline is quiescent, as 
+ *      requests may be in flight when switching at a given tick.
+ */
+void
+HanGuRnic::ffSwitchProc() {
+    if (fastForward) {
+        fastForward = false;
+        inform("%s: switch from fast-forward to timing mode\n", name());
+    }
+
+    if (ffWarmCaches) {
+        return;
+    }
+
+    if (!isQuiescent()) {
+        schedule(ffSwitchEvent, curTick() + clockPeriod() * DRAIN_CHECK_PERIOD);
+        return;
+    }
+
+    qpcModule.flushCache();
+    cqcModule.cqcCache.flush();
+    mrRescModule.mptCache.flush();
+    mrRescModule.mttCache.flush();
+    ffWarmCaches = true; /* caches are flushed only once */
+}
+
 Port &
 HanGuRnic::getPort(const std::string &if_name, PortID idx) {
     if (if_name == "interface")
-        return *etherInt;
+        return *ports[0]->etherInt;
+    if (if_name == "ext_interface") {
+        fatal_if(idx + 1 >= (PortID)ports.size(), 
+                "%s: ext_interface[%d] is beyond port_num\n", name(), idx);
+        return *ports[idx + 1]->etherInt;
+    }
     return RdmaNic::getPort(if_name, idx);
 }
 
@@ -166,7 +444,7 @@ HanGuRnic::read(PacketPtr pkt) {
     }
 
     pkt->makeAtomicResponse();
-    return pioDelay;
+    return fastForward ? 0 : pioDelay;
 }
 
 Tick
@@ -206,9 +484,23 @@ HanGuRnic::write(PacketPtr pkt) {
         
         regs.db._data = pkt->getLE<uint64_t>();
         
-        DoorbellPtr dbell = make_shared<DoorbellFifo>(regs.db.opcode(), 
-            regs.db.num(), regs.db.qpn(), regs.db.offset());
-        pio2ccuDbFifo.push(dbell);
+        HANGU_TRACE(this, TRACE_MOD_PIO, TRACE_EV_DOORBELL, regs.db.qpn(), 0, regs.db.num());
+
+        /* If the QP has a doorbell waiting in the fifo, merge into it. 
+         * WQEs of the same SQ are contiguous, so only num is summed */
+        ++dbNum;
+        auto iter = pio2ccuDbMap.find(regs.db.qpn());
+        if (dbCoalesce && iter != pio2ccuDbMap.end()) {
+            iter->second->num += regs.db.num();
+            ++dbMergeNum;
+            HANGU_PRINT(HanGuRnic, " PioEngine.write: Doorbell merged, qpn 0x%x, num %d\n", 
+                    regs.db.qpn(), iter->second->num);
+        } else {
+            DoorbellPtr dbell = makeOwned<DoorbellFifo>(regs.db.opcode(), 
+                regs.db.num(), regs.db.qpn(), regs.db.offset());
+            pio2ccuDbMap[dbell->qpn] = dbell.get();
+            pio2ccuDbFifo.push(std::move(dbell));
+        }
 
         /* Record last tick */
         this->tick = curTick();
@@ -240,18 +532,48 @@ HanGuRnic::write(PacketPtr pkt) {
 
         HANGU_PRINT(HanGuRnic, " PioEngine.write: sync bit end, value %#X, syncCnt %d\n", pkt->getLE<uint32_t>(), syncCnt); 
     } 
+    else if (daddr == 0x28 && pkt->getSize() == sizeof(uint32_t)) { /* arm CQ */
+        
+        HANGU_PRINT(HanGuRnic, " PioEngine.write: arm CQ, cqn %d\n", pkt->getLE<uint32_t>()); 
+        intrModule.armCq(pkt->getLE<uint32_t>());
+    }
     else if (daddr == 0x30 && pkt->getSize() == sizeof(uint64_t))
     {
         // write shared parameter address
         regs.qosShareAddr = pkt->getLE<uint64_t>();
         HANGU_PRINT(HanGuRnic, "QoS shared address set: 0x%s\n", regs.qosShareAddr);
     }
+    else if (daddr == 0x48 && pkt->getSize() == sizeof(uint64_t)) { /* command queue base */
+
+        /* Page aligned base address, with qid in the low 12 bits */
+        uint64_t val = pkt->getLE<uint64_t>();
+        uint16_t qid = val & 0xfff;
+        auto iter = cmdQueMap.find(qid);
+        assert(iter == cmdQueMap.end() || iter->second->elemQue.empty());
+        cmdQueMap[qid] = make_shared<CmdQueState>(val & ~((uint64_t)0xfff));
+
+        HANGU_PRINT(HanGuRnic, " PioEngine.write: command queue %d set, base 0x%lx\n", qid, val & ~((uint64_t)0xfff));
+    }
+    else if (daddr == 0x50 && pkt->getSize() == sizeof(uint32_t)) { /* command queue doorbell */
+
+        /* qid in high 16 bits, producer index in low 16 bits */
+        uint32_t val = pkt->getLE<uint32_t>();
+        auto iter = cmdQueMap.find(val >> 16);
+        assert(iter != cmdQueMap.end());
+        iter->second->pi = val & 0xffff;
+
+        HANGU_PRINT(HanGuRnic, " PioEngine.write: command queue %d doorbell, pi %d\n", val >> 16, val & 0xffff);
+
+        if (!cmdqFetchEvent.scheduled()) {
+            schedule(cmdqFetchEvent, curTick() + clockPeriod());
+        }
+    }
     else {
         panic("Write request to unknown address : %#x && size 0x%x\n", daddr, pkt->getSize());
     }
 
     pkt->makeAtomicResponse();
-    return pioDelay;
+    return fastForward ? 0 : pioDelay;
 }
 ///////////////////////////// HanGuRnic::PIO relevant {end}//////////////////////////////
 
@@ -261,73 +583,91 @@ void
 HanGuRnic::mboxFetchCpl () {
 
     HANGU_PRINT(CcuEngine, " CcuEngine.CEU.mboxFetchCpl!\n");
-    switch (regs.cmdCtrl.op()) {
+    cmdProc(regs.cmdCtrl.op(), regs.outParam._data, regs.modifier, mboxBuf);
+    delete[] mboxBuf;
+    mboxBuf = nullptr;
+    regs.cmdCtrl.go(0); // Set command indicator as finished.
+
+    HANGU_PRINT(CcuEngine, " CcuEngine.CEU.mboxFetchCpl: `GO` bit is down!\n");
+}
+
+/**
+ * @note
+ *      The mailbox is owned by the caller, allocated by allocMbox and 
+ *      freed once cmdProc returns. Commands copy what they keep.
+ */
+void
+HanGuRnic::cmdProc (uint8_t op, uint64_t outParam, uint32_t modifier, uint8_t *mbox) {
+
+    HANGU_TRACE(this, TRACE_MOD_PIO, TRACE_EV_CMD, 0, modifier, op);
+
+    switch (op) {
       case INIT_ICM :
-        HANGU_PRINT(CcuEngine, " CcuEngine.CEU.mboxFetchCpl: INIT_ICM command!\n");
-        regs.mptBase   = ((InitResc *)mboxBuf)->mptBase;
-        regs.mttBase   = ((InitResc *)mboxBuf)->mttBase;
-        regs.qpcBase   = ((InitResc *)mboxBuf)->qpcBase;
-        regs.cqcBase   = ((InitResc *)mboxBuf)->cqcBase;
-        regs.mptNumLog = ((InitResc *)mboxBuf)->mptNumLog;
-        regs.qpcNumLog = ((InitResc *)mboxBuf)->qpsNumLog;
-        regs.cqcNumLog = ((InitResc *)mboxBuf)->cqsNumLog;
+        HANGU_PRINT(CcuEngine, " CcuEngine.CEU.cmdProc: INIT_ICM command!\n");
+        regs.mptBase   = ((InitResc *)mbox)->mptBase;
+        regs.mttBase   = ((InitResc *)mbox)->mttBase;
+        regs.qpcBase   = ((InitResc *)mbox)->qpcBase;
+        regs.cqcBase   = ((InitResc *)mbox)->cqcBase;
+        regs.mptNumLog = ((InitResc *)mbox)->mptNumLog;
+        regs.qpcNumLog = ((InitResc *)mbox)->qpsNumLog;
+        regs.cqcNumLog = ((InitResc *)mbox)->cqsNumLog;
         mrRescModule.mptCache.setBase(regs.mptBase);
         mrRescModule.mttCache.setBase(regs.mttBase);
         qpcModule.setBase(regs.qpcBase);
         cqcModule.cqcCache.setBase(regs.cqcBase);
         break;
       case WRITE_ICM:
-        // HANGU_PRINT(CcuEngine, " CcuEngine.CEU.mboxFetchCpl: WRITE_ICM command! outparam %d, mod %d\n", 
-        //         regs.outParam.oparaml(), regs.modifier);
+        // HANGU_PRINT(CcuEngine, " CcuEngine.CEU.cmdProc: WRITE_ICM command! outparam %d, mod %d\n", 
+        //         (uint32_t)outParam, modifier);
         
-        switch (regs.outParam.oparaml()) {
+        switch ((uint32_t)outParam) {
           case ICMTYPE_MPT:
-            HANGU_PRINT(CcuEngine, " CcuEngine.CEU.mboxFetchCpl: ICMTYPE_MPT command!\n");
-            mrRescModule.mptCache.icmStore((IcmResc *)mboxBuf, regs.modifier);
+            HANGU_PRINT(CcuEngine, " CcuEngine.CEU.cmdProc: ICMTYPE_MPT command!\n");
+            mrRescModule.mptCache.icmStore((IcmResc *)mbox, modifier);
             break;
           case ICMTYPE_MTT:
-            HANGU_PRINT(CcuEngine, " CcuEngine.CEU.mboxFetchCpl: ICMTYPE_MTT command!\n");
-            mrRescModule.mttCache.icmStore((IcmResc *)mboxBuf, regs.modifier);
+            HANGU_PRINT(CcuEngine, " CcuEngine.CEU.cmdProc: ICMTYPE_MTT command!\n");
+            mrRescModule.mttCache.icmStore((IcmResc *)mbox, modifier);
             break;
           case ICMTYPE_QPC:
-            HANGU_PRINT(CcuEngine, " CcuEngine.CEU.mboxFetchCpl: ICMTYPE_QPC command!\n");
-            qpcModule.icmStore((IcmResc *)mboxBuf, regs.modifier);
+            HANGU_PRINT(CcuEngine, " CcuEngine.CEU.cmdProc: ICMTYPE_QPC command!\n");
+            qpcModule.icmStore((IcmResc *)mbox, modifier);
             break;
           case ICMTYPE_CQC:
-            HANGU_PRINT(CcuEngine, " CcuEngine.CEU.mboxFetchCpl: ICMTYPE_CQC command!\n");
-            cqcModule.cqcCache.icmStore((IcmResc *)mboxBuf, regs.modifier);
+            HANGU_PRINT(CcuEngine, " CcuEngine.CEU.cmdProc: ICMTYPE_CQC command!\n");
+            cqcModule.cqcCache.icmStore((IcmResc *)mbox, modifier);
             break;
           default: /* ICM mapping do not belong any Resources. */
             panic("ICM mapping do not belong any Resources.\n");
         }
         break;
       case WRITE_MPT:
-        HANGU_PRINT(CcuEngine, " CcuEngine.CEU.mboxFetchCpl: WRITE_MPT command! mod %d ouParam %d\n", regs.modifier, regs.outParam._data);
-        for (int i = 0; i < regs.outParam._data; ++i) {
-            MptResc *tmp = (((MptResc *)mboxBuf) + i);
-            HANGU_PRINT(CcuEngine, " CcuEngine.CEU.mboxFetchCpl: WRITE_MPT command! mpt_index 0x%x tmp_addr 0x%lx\n", tmp->key, (uintptr_t)tmp);
+        HANGU_PRINT(CcuEngine, " CcuEngine.CEU.cmdProc: WRITE_MPT command! mod %d ouParam %d\n", modifier, outParam);
+        for (int i = 0; i < outParam; ++i) {
+            MptResc *tmp = (((MptResc *)mbox) + i);
+            HANGU_PRINT(CcuEngine, " CcuEngine.CEU.cmdProc: WRITE_MPT command! mpt_index 0x%x tmp_addr 0x%lx\n", tmp->key, (uintptr_t)tmp);
             mrRescModule.mptCache.rescWrite(tmp->key, tmp);
-            #ifdef CACHE_ALL_CQ_MPT
-            mrRescModule.cqMpt[tmp->key] = tmp;
-            #endif
-            #ifdef CACHE_ALL_QP_MPT
-            mrRescModule.qpMpt[tmp->key] = tmp;
-            #endif
+            if (cacheAllCqMpt) {
+                mrRescModule.cqMpt[tmp->key] = new MptResc(*tmp);
+            }
+            if (cacheAllQpMpt) {
+                mrRescModule.qpMpt[tmp->key] = new MptResc(*tmp);
+            }
         }
         break;
       case WRITE_MTT:
-        HANGU_PRINT(CcuEngine, " CcuEngine.CEU.mboxFetchCpl: WRITE_MTT command!\n");
-        for (int i = 0; i < regs.outParam._data; ++i) {
-            mrRescModule.mttCache.rescWrite(regs.modifier + i, ((MttResc *)mboxBuf) + i);
+        HANGU_PRINT(CcuEngine, " CcuEngine.CEU.cmdProc: WRITE_MTT command!\n");
+        for (int i = 0; i < outParam; ++i) {
+            mrRescModule.mttCache.rescWrite(modifier + i, ((MttResc *)mbox) + i);
         }
         break;
       case WRITE_QPC:
-        HANGU_PRINT(CcuEngine, " CcuEngine.CEU.mboxFetchCpl: WRITE_QPC command! 0x%lx\n", (uintptr_t)mboxBuf);
-        for (int i = 0; i < regs.outParam._data; ++i) {
-            CxtReqRspPtr qpcReq = make_shared<CxtReqRsp>(CXT_CREQ_QP, CXT_CHNL_TX, 0); /* last param is useless here */
+        HANGU_PRINT(CcuEngine, " CcuEngine.CEU.cmdProc: WRITE_QPC command! 0x%lx\n", (uintptr_t)mbox);
+        for (int i = 0; i < outParam; ++i) {
+            CxtReqRspPtr qpcReq = makePooled<CxtReqRsp>(CXT_CREQ_QP, CXT_CHNL_TX, 0); /* last param is useless here */
             qpcReq->txQpcReq = new QpcResc;
-            memcpy(qpcReq->txQpcReq, (((QpcResc *)mboxBuf) + i), sizeof(QpcResc));
-            HANGU_PRINT(CcuEngine, " CcuEngine.CEU.mboxFetchCpl: WRITE_QPC command! i %d qpn 0x%x(%d), addr 0x%lx\n", 
+            memcpy(qpcReq->txQpcReq, (((QpcResc *)mbox) + i), sizeof(QpcResc));
+            HANGU_PRINT(CcuEngine, " CcuEngine.CEU.cmdProc: WRITE_QPC command! i %d qpn 0x%x(%d), addr 0x%lx\n", 
                     i, qpcReq->txQpcReq->srcQpn, qpcReq->txQpcReq->srcQpn&QPN_MASK, (uintptr_t)qpcReq->txQpcReq);
             qpcReq->num = qpcReq->txQpcReq->srcQpn;
             assert(qpcReq->txQpcReq->sqSizeLog == PAGE_SIZE_LOG);
@@ -341,6 +681,7 @@ HanGuRnic::mboxFetchCpl () {
                 qpcReq->txQpcReq->srcQpn,
                 qpcReq->txQpcReq->groupID,
                 qpcReq->txQpcReq->qpType);
+            qpStatus->dbr_addr = qpcReq->txQpcReq->dbrAddr;
             // delete this line later
             // HANGU_PRINT(CcuEngine, "write QPC, qpn: %d, indicator: %d, weight: %d\n", 
             //     qpcReq->txQpcReq->srcQpn, qpcReq->txQpcReq->indicator, qpcReq->txQpcReq->perfWeight);
@@ -355,90 +696,107 @@ HanGuRnic::mboxFetchCpl () {
                 schedule(wqeBufferManage.createWqeBufferEvent, curTick() + clockPeriod());
             }
         }
-        delete[] mboxBuf;
         break;
       case WRITE_CQC:
-        HANGU_PRINT(CcuEngine, " CcuEngine.CEU.mboxFetchCpl: WRITE_CQC command! regs_mod %d mb 0x%lx\n", regs.modifier,  (uintptr_t)mboxBuf);
-        cqcModule.cqcCache.rescWrite(regs.modifier, (CqcResc *)mboxBuf);
+        HANGU_PRINT(CcuEngine, " CcuEngine.CEU.cmdProc: WRITE_CQC command! regs_mod %d mb 0x%lx\n", modifier,  (uintptr_t)mbox);
+        cqcModule.cqcCache.rescWrite(modifier, (CqcResc *)mbox);
         break;
       case SET_GROUP:
-        HANGU_PRINT(CcuEngine, " CcuEngine.CEU.mboxFetchCpl: SET_GROUP command!\n");
+        HANGU_PRINT(CcuEngine, " CcuEngine.CEU.cmdProc: SET_GROUP command!\n");
         GroupInfo* groupInfo;
-        for (int i = 0; i < regs.outParam._data; ++i) {
-            groupInfo = (GroupInfo *)mboxBuf + i;
-            descScheduler.groupTable[groupInfo->groupID] = groupInfo->granularity;
+        for (int i = 0; i < outParam; ++i) {
+            groupInfo = (GroupInfo *)mbox + i;
+            descScheduler.setGroupGran(groupInfo->groupID, groupInfo->granularity);
         }
-        delete mboxBuf;
         break;
       case ALLOC_GROUP: // do nothing for ALLOC_GROUP in hardware
         break;
+      case SET_RATE_LIMIT:
+        HANGU_PRINT(CcuEngine, " CcuEngine.CEU.cmdProc: SET_RATE_LIMIT command!\n");
+        for (int i = 0; i < outParam; ++i) {
+            descScheduler.setRateLimit(((RateLimitInfo *)mbox)[i]);
+        }
+        break;
+      case SET_QP_WEIGHT:
+        HANGU_PRINT(CcuEngine, " CcuEngine.CEU.cmdProc: SET_QP_WEIGHT command!\n");
+        for (int i = 0; i < outParam; ++i) {
+            QpWeightInfo &info = ((QpWeightInfo *)mbox)[i];
+            descScheduler.setQpWeight(info.qpn, info.weight);
+            descScheduler.setGroupGran(info.groupID, info.granularity);
+        }
+        break;
       default:
-        panic("Bad inputed command: %d\n", regs.cmdCtrl.op());
+        panic("Bad inputed command: %d\n", op);
     }
-    regs.cmdCtrl.go(0); // Set command indicator as finished.
-
-    HANGU_PRINT(CcuEngine, " CcuEngine.CEU.mboxFetchCpl: `GO` bit is down!\n");
-
-    // delete[] mboxBuf;
 }
 
-void
-HanGuRnic::ceuProc () {
-    
-    HANGU_PRINT(CcuEngine, " CcuEngine.ceuProc!\n");
+uint8_t *
+HanGuRnic::allocMbox (uint8_t op, uint64_t outParam, uint32_t modifier, int &size) {
 
-    int size;
-    switch (regs.cmdCtrl.op()) {
+    switch (op) {
       case INIT_ICM :
         size = sizeof(InitResc); // MBOX_INIT_SZ;
-        mboxBuf = (uint8_t *)new InitResc;
-        HANGU_PRINT(CcuEngine, " CcuEngine.ceuProc: INIT_ICM command!\n");
+        HANGU_PRINT(CcuEngine, " CcuEngine.allocMbox: INIT_ICM command!\n");
         break;
       case WRITE_ICM:
-        HANGU_PRINT(CcuEngine, " CcuEngine.ceuProc: WRITE_ICM command!\n");
-        size = regs.modifier * sizeof(IcmResc); // regs.modifier * MBOX_ICM_ENTRY_SZ;
-        mboxBuf = (uint8_t *)new IcmResc[regs.modifier];
+        HANGU_PRINT(CcuEngine, " CcuEngine.allocMbox: WRITE_ICM command!\n");
+        size = modifier * sizeof(IcmResc); // modifier * MBOX_ICM_ENTRY_SZ;
         break;
       case WRITE_MPT:
-        HANGU_PRINT(CcuEngine, " CcuEngine.ceuProc: WRITE_MPT command!\n");
-        size = regs.outParam._data * sizeof(MptResc);
-        mboxBuf = (uint8_t *)new MptResc[regs.outParam._data];
+        HANGU_PRINT(CcuEngine, " CcuEngine.allocMbox: WRITE_MPT command!\n");
+        size = outParam * sizeof(MptResc);
         break;
       case WRITE_MTT:
-        HANGU_PRINT(CcuEngine, " CcuEngine.ceuProc: WRITE_MTT command!\n");
-        size = regs.outParam._data * sizeof(MttResc);
-        mboxBuf = (uint8_t *)new MttResc[regs.outParam._data];
+        HANGU_PRINT(CcuEngine, " CcuEngine.allocMbox: WRITE_MTT command!\n");
+        size = outParam * sizeof(MttResc);
         break;
       case WRITE_QPC:
-        HANGU_PRINT(CcuEngine, " CcuEngine.ceuProc: WRITE_QPC command! batch_size %ld\n", regs.outParam._data);
-        size = regs.outParam._data * sizeof(QpcResc);
-        mboxBuf = (uint8_t *)new QpcResc[regs.outParam._data];
+        HANGU_PRINT(CcuEngine, " CcuEngine.allocMbox: WRITE_QPC command! batch_size %ld\n", outParam);
+        size = outParam * sizeof(QpcResc);
         break;
       case WRITE_CQC:
-        HANGU_PRINT(CcuEngine, " CcuEngine.ceuProc: WRITE_CQC command!\n");
+        HANGU_PRINT(CcuEngine, " CcuEngine.allocMbox: WRITE_CQC command!\n");
         size = sizeof(CqcResc); // MBOX_CQC_ENTRY_SZ;
-        mboxBuf = (uint8_t *)new CqcResc;
         break;
       case SET_GROUP:
-        HANGU_PRINT(CcuEngine, " CcuEngine.ceuProc: SET_GROUP command!\n");
-        size = regs.outParam._data * sizeof(GroupInfo);
-        mboxBuf = (uint8_t *)new GroupInfo[regs.outParam._data];
-        HANGU_PRINT(CcuEngine, "ceuProc: data: %d, size: %d\n", regs.outParam._data, size);
+        HANGU_PRINT(CcuEngine, " CcuEngine.allocMbox: SET_GROUP command!\n");
+        size = outParam * sizeof(GroupInfo);
+        HANGU_PRINT(CcuEngine, "allocMbox: data: %d, size: %d\n", outParam, size);
         break;
       case ALLOC_GROUP:
-        HANGU_PRINT(CcuEngine, " CcuEngine.ceuProc: SET_GROUP command!\n");
-        size = regs.outParam._data * sizeof(uint8_t);
-        mboxBuf = (uint8_t *)new GroupInfo;
+        HANGU_PRINT(CcuEngine, " CcuEngine.allocMbox: SET_GROUP command!\n");
+        size = outParam * sizeof(uint8_t);
+        break;
+      case SET_RATE_LIMIT:
+        HANGU_PRINT(CcuEngine, " CcuEngine.allocMbox: SET_RATE_LIMIT command!\n");
+        size = outParam * sizeof(RateLimitInfo);
+        break;
+      case SET_QP_WEIGHT:
+        HANGU_PRINT(CcuEngine, " CcuEngine.allocMbox: SET_QP_WEIGHT command!\n");
+        size = outParam * sizeof(QpWeightInfo);
         break;
       default:
         size = 0;
         panic("Bad input command.\n");
     }
 
+    /* Plain bytes, so that the mailbox of any command 
+     * is freed in the same way after cmdProc */
+    return new uint8_t[size];
+}
+
+void
+HanGuRnic::ceuProc () {
+    
+    HANGU_PRINT(CcuEngine, " CcuEngine.ceuProc!\n");
+
+    int size;
+    mboxBuf = allocMbox(regs.cmdCtrl.op(), regs.outParam._data, regs.modifier, size);
+
     assert(size > 0 && size <= (MAILBOX_PAGE_NUM << 12)); /* size should not be zero */
 
     /* read mailbox through dma engine */
-    DmaReqPtr dmaReq = make_shared<DmaReq>(pciToDma(regs.inParam._data), size, 
+    DmaReqPtr dmaReq = makePooled<DmaReq>(pciToDma(regs.inParam._data), size, 
             &mboxEvent, mboxBuf, 0); /* last param is useless here */
     ccuDmaReadFifo.push(dmaReq);
     if (!dmaEngine.dmaReadEvent.scheduled()) {
@@ -467,13 +825,14 @@ HanGuRnic::doorbellProc () {
     }
     /* read doorbell info */
     assert(pio2ccuDbFifo.size());
-    DoorbellPtr dbell = pio2ccuDbFifo.front();
+    DoorbellPtr dbell = std::move(pio2ccuDbFifo.front());
     pio2ccuDbFifo.pop();
-    descScheduler.dbQue.push(dbell);
+    pio2ccuDbMap.erase(dbell->qpn);
+    HANGU_PRINT(CcuEngine, " CCU.doorbellProc: db.qpn: 0x%x\n", dbell->qpn);
+    descScheduler.dbQue.push(std::move(dbell));
     if (!descScheduler.qpcRspEvent.scheduled()) {
         schedule(descScheduler.qpcRspEvent, curTick() + clockPeriod());
     }
-    HANGU_PRINT(CcuEngine, " CCU.doorbellProc: db.qpn: 0x%x\n", dbell->qpn);
     /* If there still has elem in fifo, schedule myself again */
     if (pio2ccuDbFifo.size()) {
         if (!doorbellProcEvent.scheduled()) {
@@ -482,15 +841,131 @@ HanGuRnic::doorbellProc () {
     }
     HANGU_PRINT(CcuEngine, " CCU.doorbellProc: out!\n");
 }
+
+/**
+ * @note
+ *      Fetch one command queue entry, then its mailbox. 
+ *      Entries are fetched as long as there are at most 
+ *      CMDQ_DEPTH entries not retired.
+ */
+void
+HanGuRnic::postCmdqFetch(uint16_t qid, CmdQueStatePtr cmdq) {
+
+    CmdQueElemPtr elem = make_shared<CmdQueElem>(cmdq->fetchIdx);
+    cmdq->elemQue.push(elem);
+    ++cmdq->fetchIdx;
+
+    HANGU_PRINT(CcuEngine, " CCU.postCmdqFetch: qid %d, idx %d\n", qid, elem->idx);
+
+    Addr entryAddr = cmdq->base + (elem->idx % CMDQ_DEPTH) * sizeof(CmdQueEntry);
+    DmaReqPtr dmaReq = makePooled<DmaReq>(pciToDma(entryAddr), sizeof(CmdQueEntry), 
+            nullptr, (uint8_t *)&elem->entry, 0);
+    dmaReq->cplCallback = [this, elem](const DmaReqPtr &) {
+        
+        /* Entry is fetched, then fetch the mailbox */
+        int size;
+        elem->mbox = allocMbox(elem->entry.opcode, elem->entry.outParam, elem->entry.inMod, size);
+        assert(size > 0 && size <= (MAILBOX_PAGE_NUM << 12));
+        
+        DmaReqPtr mboxReq = makePooled<DmaReq>(pciToDma(elem->entry.inParam), size, 
+                nullptr, elem->mbox, 0);
+        mboxReq->cplCallback = [this, elem](const DmaReqPtr &) {
+            elem->vld = true;
+            if (!cmdqRetireEvent.scheduled()) {
+                schedule(cmdqRetireEvent, curTick() + clockPeriod());
+            }
+        };
+        ccuDmaReadFifo.push(mboxReq);
+        if (!dmaEngine.dmaReadEvent.scheduled()) {
+            schedule(dmaEngine.dmaReadEvent, curTick() + clockPeriod());
+        }
+    };
+    ccuDmaReadFifo.push(dmaReq);
+    if (!dmaEngine.dmaReadEvent.scheduled()) {
+        schedule(dmaEngine.dmaReadEvent, curTick() + clockPeriod());
+    }
+}
+
+void
+HanGuRnic::cmdqFetchProc() {
+
+    for (auto &item : cmdQueMap) {
+        CmdQueStatePtr cmdq = item.second;
+        while (cmdq->fetchIdx != cmdq->pi && 
+                (uint16_t)(cmdq->fetchIdx - cmdq->retireIdx) < CMDQ_DEPTH) {
+            postCmdqFetch(item.first, cmdq);
+        }
+    }
+}
+
+/**
+ * @note
+ *      Commands of one queue are executed in order, cause 
+ *      later commands may depend on former ones (e.g. WRITE_MPT 
+ *      after WRITE_ICM). A completion record is written back 
+ *      for each retired entry.
+ */
+void
+HanGuRnic::cmdqRetireProc() {
+
+    for (auto &item : cmdQueMap) {
+        CmdQueStatePtr cmdq = item.second;
+        while (cmdq->elemQue.size() && cmdq->elemQue.front()->vld) {
+            CmdQueElemPtr elem = cmdq->elemQue.front();
+            cmdq->elemQue.pop();
+            assert(elem->idx == cmdq->retireIdx);
+
+            HANGU_PRINT(CcuEngine, " CCU.cmdqRetireProc: qid %d, idx %d, opcode %d\n", 
+                    item.first, elem->idx, elem->entry.opcode);
+            cmdProc(elem->entry.opcode, elem->entry.outParam, elem->entry.inMod, elem->mbox);
+            delete[] elem->mbox;
+            elem->mbox = nullptr;
+            ++cmdq->retireIdx;
+            ++cmdqCmdNum;
+
+            /* Write completion record, seq is 1-based, 
+             * so that zeroed records are not taken as finished */
+            elem->cpl.seq = (uint16_t)(elem->idx + 1);
+            elem->cpl.status = 0;
+            Addr cplAddr = cmdq->base + CMDQ_CPL_OFFSET + 
+                    (elem->idx % CMDQ_DEPTH) * sizeof(CmdCplRecord);
+            /* The record is copied into a packet buffer owned by the 
+             * request, so it lives until the DMA port has read it */
+            EthPacketPtr cplBuf = EthPacketPool::alloc(sizeof(CmdCplRecord));
+            memcpy(cplBuf->data, &elem->cpl, sizeof(CmdCplRecord));
+            DmaReqPtr dmaReq = makePooled<DmaReq>(pciToDma(cplAddr), sizeof(CmdCplRecord), 
+                    nullptr, cplBuf->data, 0);
+            dmaReq->pkt = cplBuf;
+            dataDmaWriteFifo.push(dmaReq);
+            if (!dmaEngine.dmaWriteEvent.scheduled()) {
+                schedule(dmaEngine.dmaWriteEvent, curTick() + clockPeriod());
+            }
+        }
+    }
+
+    /* Retired entries leave room for fetching */
+    if (!cmdqFetchEvent.scheduled()) {
+        schedule(cmdqFetchEvent, curTick() + clockPeriod());
+    }
+}
 ///////////////////////////// HanGuRnic::CCU relevant {end}//////////////////////////////
 
 
 ///////////////////////////// Ethernet Link Interaction {begin}//////////////////////////////
 
+/**
+ * @note
+ *      The link is free again after refusing a packet 
+ *      (e.g. DistEtherLink is busy), retry sending at once.
+ */
 void
-HanGuRnic::ethTxDone() {
+HanGuRnic::ethTxDone(uint8_t port) {
 
-    DPRINTF(HanGuRnic, "Enter ethTxDone!\n");
+    DPRINTF(HanGuRnic, "Enter ethTxDone! port %d\n", port);
+
+    if (!ports[port]->sauEvent.scheduled()) {
+        schedule(ports[port]->sauEvent, curTick() + clockPeriod());
+    }
 }
 
 bool
@@ -503,22 +978,55 @@ HanGuRnic::isMacEqual(uint8_t *devSrcMac, uint8_t *pktDstMac) {
     return true;
 }
 
+/**
+ * @note
+ *      Called by the link peer. If the peer runs in another event 
+ *      queue (parallel simulation), the packet is handed over to my 
+ *      event queue after the link delay, which is the lookahead of 
+ *      the hand-off, so LinkDelay must be no less than sim quantum.
+ */
 bool
-HanGuRnic::ethRxDelay(EthPacketPtr pkt) {
+HanGuRnic::ethRxDelay(EthPacketPtr pkt, uint8_t port) {
 
     HANGU_PRINT(HanGuRnic, " ethRxDelay!\n");
-    
-    /* dest addr is not local, then abandon it */
-    if (isMacEqual(macAddr, pkt->data) == false) {
+
+    if (eventQueue() != curEventQueue()) {
+        /* LinkDelay is checked against sim quantum in startup */
+        schedule(new EventFunctionWrapper([this, pkt, port]{ ethRxAccept(pkt, curTick(), port); }, 
+                name() + ".rxHandoff", true), curTick() + LinkDelay);
+        return true;
+    }
+
+    return ethRxAccept(pkt, fastForward ? curTick() : curTick() + LinkDelay, port);
+}
+
+bool
+HanGuRnic::ethRxAccept(EthPacketPtr pkt, Tick sched, uint8_t port) {
+
+    /* dest addr is not local, or not owned by the port (a flooded 
+     * copy, see updateRxOwner), or the port is down, then abandon it */
+    uint8_t dstMac[ETH_ADDR_LEN];
+    memcpy(dstMac, pkt->data, ETH_ADDR_LEN);
+    uint8_t dstPort = dstMac[PORT_MAC_BYTE];
+    dstMac[PORT_MAC_BYTE] = 0;
+    if (isMacEqual(macAddr, dstMac) == false) {
+        return true;
+    }
+    /* The peer addresses the port mirroring its tx port, 
+     * which I do not have if it has more ports than me */
+    fatal_if(dstPort >= ports.size(), "%s: frame to port %d, but I have %d ports. "
+            "port_num should be the same on both ends of a connection\n", 
+            name(), dstPort, ports.size());
+    if (ports[dstPort]->rxOwner != port || !ports[port]->up) {
         return true;
     }
 
     /* Update statistic */
     rxBytes += pkt->length;
     rxPackets++;
+    portRxBytes[port] += pkt->length;
 
     /* post rx pkt to ethRxPktProc */
-    Tick sched = curTick() + LinkDelay;
     ethRxDelayFifo.emplace(pkt, sched);
     if (!ethRxPktProcEvent.scheduled()) {
         schedule(ethRxPktProcEvent, sched);
@@ -574,10 +1082,13 @@ HanGuRnic::ethRxPktProc() {
     }
     HANGU_PRINT(HanGuRnic, " ethRxPktProc: Receiving packet from wire, trans_type: 0x%x, srv: 0x%x.\n", type, srv);
     
-    /* Schedule RAU for pkt receiving */
-    rxFifo.push(pkt);
-    if (!rdmaEngine.rauEvent.scheduled()) {
-        schedule(rdmaEngine.rauEvent, curTick() + clockPeriod());
+    /* RAU arbiter, dispatch pkt to the lane of its dest QP, 
+     * both requests and ACKs carry the local QPN as dest QPN. 
+     * Then schedule RAU of the lane for pkt receiving */
+    RdmaEngine *engine = laneOf(bth->op_destQpn & 0xFFFFFF);
+    engine->rxFifo.push(pkt);
+    if (!engine->rauEvent.scheduled()) {
+        schedule(engine->rauEvent, curTick() + clockPeriod());
     }
 
     /* Schedule myself if there is element in ethRxDelayFifo */
@@ -594,10 +1105,110 @@ HanGuRnic::ethRxPktProc() {
 ///////////////////////////// Ethernet Link Interaction {end}//////////////////////////////
 
 
+bool
+HanGuRnic::isQuiescent() {
+    for (auto &item : cmdQueMap) {
+        if (item.second->elemQue.size() || 
+                item.second->pi != item.second->retireIdx) {
+            return false;
+        }
+    }
+    return pio2ccuDbFifo.empty() && descReqFifo.empty() && 
+            txdescRspFifo.empty() && 
+            cqWreqFifo.empty() && cqeStageMap.empty() && dataReqFifo.empty() && 
+            txCqcReqFifo.empty() && rxCqcReqFifo.empty() && 
+            descScheduler.dbQue.empty() && descDmaReadFifo.empty() && dataDmaReadFifo.empty() && 
+            cqDmaWriteFifo.empty() && dataDmaWriteFifo.empty() && 
+            ccuDmaReadFifo.empty() && cacheDmaAccessFifo.empty() && 
+            dmaEngine.dmaRReqFifo.empty() && dmaEngine.dmaWReqFifo.empty() && 
+            dmaEngine.dmaRdReq2RspFifo.empty() && dmaEngine.dmaWrReq2RspFifo.empty() && 
+            txFifo.empty() && ethRxDelayFifo.empty() && 
+            updateQue.empty() && createQue.empty() && createWqeBufferQue.empty() && 
+            wqeRspInfoQue.empty() && wqeBufferUpdateQue.empty() && 
+            memPrefetchInfoQue.empty() && mptPrefetchQue.empty() && 
+            qpcDmaRdCplFifo.empty() && 
+            df2ccuIdxFifo.size() == doorbellVector.size() && 
+            !ceuProcEvent.scheduled() && !mboxEvent.scheduled() && 
+            !cmdqFetchEvent.scheduled() && !cmdqRetireEvent.scheduled() && 
+            enginesIdle() && descScheduler.isIdle() && rescPrefetcher.isIdle() && 
+            wqeBufferManage.isIdle() && mrRescModule.isIdle() && 
+            cqcModule.isIdle() && intrModule.isIdle() && qpcModule.isIdle();
+}
+
+bool
+HanGuRnic::enginesIdle() {
+    for (auto engine : rdmaEngines) {
+        if (!engine->isIdle()) {
+            return false;
+        }
+    }
+    for (auto etherPort : ports) {
+        if (etherPort->sauEvent.scheduled() || etherPort->ctrlFifo.size()) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void
+HanGuRnic::dumpState() {
+    inform("%s: doorbell %d, descReq %d, txdescRsp %d, schedDb %d\n", 
+            name(), pio2ccuDbFifo.size(), descReqFifo.size(), txdescRspFifo.size(), 
+            descScheduler.dbQue.size());
+    inform("%s: cqWreq %d, dataReq %d, txCqcReq %d, rxCqcReq %d\n", 
+            name(), cqWreqFifo.size(), dataReqFifo.size(), 
+            txCqcReqFifo.size(), rxCqcReqFifo.size());
+    for (auto engine : rdmaEngines) {
+        inform("%s: launch %d, rx %d, rxdescRsp %d, txdataRsp %d, rxdataRsp %d, "
+                "txCqcRsp %d, rxCqcRsp %d\n", 
+                engine->name(), engine->txDescLaunchQue.size(), engine->rxFifo.size(), 
+                engine->rxdescRspFifo.size(), engine->txdataRspFifo.size(), 
+                engine->rxdataRspFifo.size(), engine->txCqcRspFifo.size(), 
+                engine->rxCqcRspFifo.size());
+    }
+    inform("%s: dma descRd %d, dataRd %d, cqWr %d, dataWr %d, ccuRd %d, cache %d, "
+            "chnlRd %d, chnlWr %d, rdPending %d, wrPending %d\n", 
+            name(), descDmaReadFifo.size(), dataDmaReadFifo.size(), cqDmaWriteFifo.size(), 
+            dataDmaWriteFifo.size(), ccuDmaReadFifo.size(), cacheDmaAccessFifo.size(), 
+            dmaEngine.dmaRReqFifo.size(), dmaEngine.dmaWReqFifo.size(), 
+            dmaEngine.dmaRdReq2RspFifo.size(), dmaEngine.dmaWrReq2RspFifo.size());
+    inform("%s: ether tx %d, rxDelay %d\n", 
+            name(), txFifo.size(), ethRxDelayFifo.size());
+}
+
+void
+HanGuRnic::checkDrain() {
+    if (drainState() != DrainState::Draining) {
+        return;
+    }
+
+    if (isQuiescent()) {
+        DPRINTF(Drain, "HanGuRnic done draining\n");
+        signalDrainDone();
+    } else {
+        schedule(drainEvent, curTick() + clockPeriod() * DRAIN_CHECK_PERIOD);
+    }
+}
+
+/**
+ * @note Requests in the pipeline are not checkpointed, so draining 
+ *       waits until all of them retire. The CPUs stop posting new 
+ *       requests while draining, but packets from other nodes still 
+ *       come in, so the pipeline is polled until it is quiescent.
+ *       Unacknowledged packets in the send windows are checkpointed, 
+ *       they do not block draining.
+ */
 DrainState
 HanGuRnic::drain() {
-    
-    DPRINTF(HanGuRnic, "HanGuRnic not drained\n");
+    if (isQuiescent()) {
+        DPRINTF(Drain, "HanGuRnic drained\n");
+        return DrainState::Drained;
+    }
+
+    DPRINTF(Drain, "HanGuRnic not drained\n");
+    if (!drainEvent.scheduled()) {
+        schedule(drainEvent, curTick() + clockPeriod() * DRAIN_CHECK_PERIOD);
+    }
     return DrainState::Draining;
 }
 
@@ -605,6 +1216,19 @@ void
 HanGuRnic::drainResume() {
     Drainable::drainResume();
 
+    if (drainEvent.scheduled()) {
+        deschedule(drainEvent);
+    }
+
+    /* CPU switching drains the system, leave fast-forward 
+     * once the memory system is out of atomic mode */
+    if (fastForward && fastForwardEnd == 0 && !sys->isAtomicMode()) {
+        if (ffSwitchEvent.scheduled()) {
+            deschedule(ffSwitchEvent);
+        }
+        ffSwitchProc();
+    }
+
     DPRINTF(HanGuRnic, "resuming from drain");
 }
 
@@ -614,6 +1238,39 @@ HanGuRnic::serialize(CheckpointOut &cp) const {
 
     regs.serialize(cp);
 
+    /* Command queues, fetched entries are all retired after draining */
+    std::vector<uint16_t> cmdqId, cmdqPi, cmdqFetchIdx, cmdqRetireIdx;
+    std::vector<uint64_t> cmdqBase;
+    for (auto &item : cmdQueMap) {
+        cmdqId.push_back(item.first);
+        cmdqBase.push_back(item.second->base);
+        cmdqPi.push_back(item.second->pi);
+        cmdqFetchIdx.push_back(item.second->fetchIdx);
+        cmdqRetireIdx.push_back(item.second->retireIdx);
+    }
+    SERIALIZE_CONTAINER(cmdqId);
+    SERIALIZE_CONTAINER(cmdqBase);
+    SERIALIZE_CONTAINER(cmdqPi);
+    SERIALIZE_CONTAINER(cmdqFetchIdx);
+    SERIALIZE_CONTAINER(cmdqRetireIdx);
+
+    std::vector<uint8_t> portUp;
+    for (auto etherPort : ports) {
+        portUp.push_back(etherPort->up);
+    }
+    SERIALIZE_CONTAINER(portUp);
+
+    for (auto engine : rdmaEngines) {
+        engine->serializeSection(cp, engine->name().substr(name().size() + 1));
+    }
+    descScheduler.serializeSection(cp, "DescScheduler");
+    rescPrefetcher.serializeSection(cp, "RescPrefetcher");
+    wqeBufferManage.serializeSection(cp, "WqeBufferManage");
+    mrRescModule.serializeSection(cp, "MrRescModule");
+    cqcModule.serializeSection(cp, "CqcModule");
+    intrModule.serializeSection(cp, "IntrModule");
+    qpcModule.serializeSection(cp, "QpcModule");
+
     DPRINTF(HanGuRnic, "Get into HanGuRnic serialize.\n");
 }
 
@@ -623,6 +1280,45 @@ HanGuRnic::unserialize(CheckpointIn &cp) {
 
     regs.unserialize(cp);
 
+    std::vector<uint16_t> cmdqId, cmdqPi, cmdqFetchIdx, cmdqRetireIdx;
+    std::vector<uint64_t> cmdqBase;
+    UNSERIALIZE_CONTAINER(cmdqId);
+    UNSERIALIZE_CONTAINER(cmdqBase);
+    UNSERIALIZE_CONTAINER(cmdqPi);
+    UNSERIALIZE_CONTAINER(cmdqFetchIdx);
+    UNSERIALIZE_CONTAINER(cmdqRetireIdx);
+    cmdQueMap.clear();
+    for (size_t i = 0; i < cmdqId.size(); ++i) {
+        CmdQueStatePtr cmdq = make_shared<CmdQueState>(cmdqBase[i]);
+        cmdq->pi        = cmdqPi[i];
+        cmdq->fetchIdx  = cmdqFetchIdx[i];
+        cmdq->retireIdx = cmdqRetireIdx[i];
+        cmdQueMap[cmdqId[i]] = cmdq;
+    }
+
+    std::vector<uint8_t> portUp;
+    UNSERIALIZE_CONTAINER(portUp);
+    fatal_if(portUp.size() != ports.size(), 
+            "%s: checkpoint has %d ports, but port_num is %d\n", 
+            name(), portUp.size(), ports.size());
+    for (size_t i = 0; i < ports.size(); ++i) {
+        ports[i]->up = portUp[i];
+    }
+    updateRxOwner(false);
+
+    /* ICM page tables are restored before cache entries, 
+     * in case entries are written back on restore. */
+    for (auto engine : rdmaEngines) {
+        engine->unserializeSection(cp, engine->name().substr(name().size() + 1));
+    }
+    descScheduler.unserializeSection(cp, "DescScheduler");
+    rescPrefetcher.unserializeSection(cp, "RescPrefetcher");
+    wqeBufferManage.unserializeSection(cp, "WqeBufferManage");
+    mrRescModule.unserializeSection(cp, "MrRescModule");
+    cqcModule.unserializeSection(cp, "CqcModule");
+    intrModule.unserializeSection(cp, "IntrModule");
+    qpcModule.unserializeSection(cp, "QpcModule");
+
     DPRINTF(HanGuRnic, "Get into HanGuRnic unserialize.\n");
 }
 
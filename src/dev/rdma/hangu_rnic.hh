@@ -27,13 +27,17 @@
 #ifndef __RDMA_HANGU_RNIC_HH__
 #define __RDMA_HANGU_RNIC_HH__
 
+#include <chrono>
 #include <deque>
 #include <queue>
 #include <string>
 #include <list>
 #include <unordered_map>
+#include <unordered_set>
 
+#include "dev/rdma/hangu_quantum_policy.hh"
 #include "dev/rdma/hangu_rnic_defs.hh"
+#include "dev/rdma/hangu_trace.hh"
 
 #include "base/inet.hh"
 #include "debug/EthernetDesc.hh"
@@ -44,6 +48,7 @@
 #include "dev/net/etherpkt.hh"
 #include "dev/net/pktfifo.hh"
 #include "dev/pci/device.hh"
+#include "enums/HanGuSchedPolicy.hh"
 #include "params/HanGuRnic.hh"
 
 // #include "dev/rdma/resc_cache.hh"
@@ -55,17 +60,47 @@ class HanGuRnicInt;
 
 class HanGuRnic : public RdmaNic {
     private:
-        HanGuRnicInt *etherInt;
+        /* Ethernet port, each one has its own SAU pacing */
+        struct EtherPort {
+            EtherPort(HanGuRnic *rnic, uint8_t id)
+              : etherInt(nullptr), up(true), sauLane(0), rxOwner(id),
+                sauEvent([rnic, id]{ rnic->sauProcessing(id); }, rnic->name()) { }
+            HanGuRnicInt *etherInt;
+            bool up;         /* link is up, cleared by setPortUp() on failure */
+            uint8_t sauLane; /* next lane served by SAU of this port */
+            uint8_t rxOwner; /* port accepting frames to my MAC, another one if I am down */
+            std::queue<EthPacketPtr> ctrlFifo; /* MAC announcements, sent before data */
+            EventFunctionWrapper sauEvent;
+        };
+        std::vector<EtherPort *> ports;
+        bool lagMode; /* QPs are hashed across ports, ignoring QPC port */
+
+        /* Each port has its own MAC, the NIC MAC (LID) with the port 
+         * number in byte 1, so port 0 uses the NIC MAC. Frames to a 
+         * port which is down are accepted by the port it fails over 
+         * to, which announces the MAC to the switch. */
+        static const int PORT_MAC_BYTE = 1;
+        void updateRxOwner(bool announce);
+        Stats::Vector portTxBytes;
+        Stats::Vector portRxBytes;
+        Stats::Scalar portFailNum;
 
         // device registers
         Regs regs;
 
-        // packet fifos, interact with Ethernet Link
-        std::queue<EthPacketPtr> rxFifo;
+        // packet fifos, interact with Ethernet Link, 
+        // rx packets are dispatched to rxFifo of the engine lanes
         std::queue<EthPacketPtr> txFifo;
 
         /* --------------------PIO <-> CCU {begin}-------------------- */
         std::queue<DoorbellPtr> pio2ccuDbFifo;
+        /* Doorbells still in pio2ccuDbFifo, <qpn, doorbell>. 
+         * Used to merge doorbells of the same QP, owned by the FIFO. */
+        std::unordered_map<uint32_t, DoorbellFifo *> pio2ccuDbMap;
+        bool dbCoalesce;
+        Stats::Scalar dbNum; /* number of doorbells received */
+        Stats::Scalar dbMergeNum; /* number of doorbells merged */
+        Stats::Formula dbMergeRate;
         /* --------------------PIO <-> CCU {end}-------------------- */
 
         /* --------------------CCU <-> RDMA Engine {begin}-------------------- */
@@ -77,7 +112,7 @@ class HanGuRnic : public RdmaNic {
         // Descriptor relevant
         std::queue<MrReqRspPtr>descReqFifo; // tx(DFU) & rx(RPU) descriptor req post to this fifo.
         std::queue<TxDescPtr> txdescRspFifo; /* Store descriptor, **not list** */
-        std::queue<RxDescPtr> rxdescRspFifo;
+        /* rx descriptor and data responses go to RdmaEngine lanes */
         // std::queue<MrReqRspPtr> txdescRspFifo;
         // std::queue<MrReqRspPtr> rxdescRspFifo;
 
@@ -86,8 +121,6 @@ class HanGuRnic : public RdmaNic {
 
         // Data processing fifo
         std::queue<MrReqRspPtr> dataReqFifo;   // DPU, rgrru, rpu -> TPT
-        std::queue<MrReqRspPtr> txdataRspFifo; // TPT -> rgrru
-        std::queue<MrReqRspPtr> rxdataRspFifo; // TPT -> RPCPLU
 
         /* --------------------TPT <-> RDMA Engine {end}-------------------- */
 
@@ -99,13 +132,9 @@ class HanGuRnic : public RdmaNic {
          */
         std::queue<CxtReqRspPtr> txCqcReqFifo;
         std::queue<CxtReqRspPtr> rxCqcReqFifo;
-
-        std::queue<CxtReqRspPtr> txCqcRspFifo; /* CqcModule -(update rsp)-> scu */
-        std::queue<CxtReqRspPtr> rxCqcRspFifo; /* CqcModule -(update rsp)-> rcu */
         /* --------------------CqcModule <-> RDMA Engine {end}-------------------- */
 
         /* --------------------DescScheduler <-> RDMA Engine {begin}---------------------------*/
-        std::queue<TxDescPtr> txDescLaunchQue;
         std::queue<std::pair<uint32_t, uint32_t>> updateQue;
         /* --------------------DescScheduler <-> RDMA Engine {end}-----------------------------*/
 
@@ -153,13 +182,32 @@ class HanGuRnic : public RdmaNic {
         void mboxFetchCpl(); // Event of CCU after mailbox being fetched.
         EventFunctionWrapper mboxEvent;
 
-        uint8_t* mboxBuf;
-        
+        uint8_t* mboxBuf; /* mailbox of the HCR command, freed after cmdProc */
+
+        // Allocate mailbox buffer for the command, and return its size
+        uint8_t *allocMbox(uint8_t op, uint64_t outParam, uint32_t modifier, int &size);
+
+        // Execute one command whose mailbox is fetched, shared by HCR and command queue
+        void cmdProc(uint8_t op, uint64_t outParam, uint32_t modifier, uint8_t *mbox);
+
+        /* Command queues, <qid, queue>. Entries of one queue are fetched
+         * in a pipelined manner, and retired in order. */
+        std::unordered_map<uint16_t, CmdQueStatePtr> cmdQueMap;
+
+        void postCmdqFetch(uint16_t qid, CmdQueStatePtr cmdq);
+        void cmdqFetchProc(); // Fetch entries of all command queues
+        EventFunctionWrapper cmdqFetchEvent;
+
+        void cmdqRetireProc(); // Execute fetched entries in order, and write completion records
+        EventFunctionWrapper cmdqRetireEvent;
+
+        uint64_t cmdqCmdNum; /* number of commands from command queues */
+
         /* -----------------------CCU Relevant {end}----------------------- */
 
         /* -----------------------RDMA Engine Relevant{begin}----------------------- */
 
-        class RdmaEngine {
+        class RdmaEngine : public Serializable {
             protected:
 
                 /* Point to the rnic I am belong to */
@@ -168,6 +216,11 @@ class HanGuRnic : public RdmaNic {
                 /* Name of this Module */
                 std::string _name;
 
+            public:
+                /* Lane id, QPs with qpn % lane number == lane are served by me */
+                const uint8_t lane;
+
+            protected:
 
                 /* dfu -> ddu */
                 // std::queue<DoorbellPtr> df2ddFifo;
@@ -176,6 +229,15 @@ class HanGuRnic : public RdmaNic {
                 /* DDU owns */
                 DoorbellPtr dduDbell; /* Doorbell stored for DDU use. This is NOT the PIO doorbell */
                 bool allowNewDb;
+                bool dduDbellHigh;         /* dduDbell is from df2ddFifoH */
+                DoorbellPtr dduPreempted;  /* bulk doorbell preempted by LAT_QP, resumed later */
+                bool dduHasWork();
+
+                /* LAT_QP launch stats */
+                Stats::Scalar latLaunchNum;
+                Stats::Scalar latPreemptNum;
+                Stats::Histogram latLaunchWait;
+                Stats::Formula latBypassAvg;
 
                 /* ddu -> dpu */
                 std::vector<TxDescPtr> dd2dpVector;
@@ -219,8 +281,19 @@ class HanGuRnic : public RdmaNic {
                 // scu owns
                 // bool isPostCqcReq;
 
-                /* {rg&rru ->sau} && {rpu -> sau} */
-                std::queue<EthPacketPtr> txsauFifo;
+                /* Packet waiting for a port, <pkt, home port of the QP, 
+                 * requester QPN and bytes charged to its group when the 
+                 * packet is sent, 0 for ACK and read response> */
+                struct SauPkt {
+                    EthPacketPtr pkt;
+                    uint8_t  home;
+                    uint32_t qpn;
+                    uint32_t len;
+                };
+
+                /* {rg&rru ->sau} && {rpu -> sau}, one fifo for each port */
+                std::vector<std::queue<SauPkt> > txsauFifo;
+                void postTxPkt(EthPacketPtr txPkt, uint8_t home, uint32_t qpn=0, uint32_t len=0);
 
                 /* rau owns */
                 bool isAckPkt(EthPacketPtr rxPkt);
@@ -244,6 +317,12 @@ class HanGuRnic : public RdmaNic {
                 // std::unordered_map<uint32_t, std::pair<uint32_t, QpcResc*> > rcvQpcList; /* <qpn, <cnt, qpc> > */
                 std::queue<std::pair<EthPacketPtr, QpcResc*> > rp2rcvRpFifo;
 
+                /* Transport resource usage, UC uses neither send window nor ACK */
+                Stats::Scalar winPktNum;  /* packets posted to send window */
+                Stats::Scalar ackTxNum;   /* ACKs generated by rcvRpu and wrRpu */
+                Stats::Scalar ucRxNum;
+                Stats::Scalar ucDropNum;  /* UC packets behind expPsn */
+
 
                 // wrRpu owns
                 void wrRpuProcessing(EthPacketPtr rxPkt, QpcResc* qpc);
@@ -252,36 +331,45 @@ class HanGuRnic : public RdmaNic {
                 void rdRpuProcessing (EthPacketPtr rxPkt, QpcResc* qpc);
 
                 // rdRpu -> rdRpCpl
-                std::queue<EthPacketPtr> rp2rpCplFifo;
+                std::queue<std::pair<EthPacketPtr, uint8_t> > rp2rpCplFifo; /* <pkt, home port> */
 
                 // rpu -> rcu
                 std::queue<CqDescPtr> rp2rcFifo;
 
                 int onFlyPacketNum;
                 uint64_t sauSendByte;
+                uint64_t sauSendPkt;
                 bool startDetect;
+                
+                /* Host (wall clock) time of last detection, for host side packet rate */
+                std::chrono::steady_clock::time_point detectHostTime;
 
             public:
 
-                RdmaEngine (HanGuRnic *rnic, const std::string n, uint32_t elemCap)
+                RdmaEngine (HanGuRnic *rnic, const std::string n, uint8_t lane, uint32_t elemCap, 
+                        uint32_t windowCap)
                 : rnic(rnic),
                     _name(n),
+                    lane(lane),
                     allowNewDb(true),
+                    dduDbellHigh(false),
+                    dduPreempted(nullptr),
                     dd2dpVector(elemCap),
                     windowSize(0),
-                    windowCap(WINDOW_CAP),
+                    windowCap(windowCap),
                     windowFull(false),
                     messageEnd(true),
+                    txsauFifo(rnic->ports.size()),
                     rs2rpVector(elemCap),
                     onFlyPacketNum(0),
                     sauSendByte(0),
+                    sauSendPkt(0),
                     startDetect(false),
                     dfuEvent ([this]{ dfuProcessing(); }, n),
                     dduEvent ([this]{ dduProcessing(); }, n),
                     dpuEvent ([this]{ dpuProcessing(); }, n),
                     rgrrEvent([this]{ rgrrProcessing();}, n),
                     scuEvent ([this]{ scuProcessing(); }, n),
-                    sauEvent ([this]{ sauProcessing(); }, n),
                     rauEvent ([this]{ rauProcessing(); }, n),
                     rpuEvent ([this]{ rpuProcessing(); }, n),
                     rcvRpuEvent  ([this]{rcvRpuProcessing();  }, n),
@@ -297,6 +385,15 @@ class HanGuRnic : public RdmaNic {
 
                 std::string name() { return _name; }
 
+                /* No packet or descriptor is in process */
+                bool isIdle();
+
+                /* Checkpoint send windows */
+                void serialize(CheckpointOut &cp) const override;
+                void unserialize(CheckpointIn &cp) override;
+
+                void regStats();
+
                 // event for tx packet
                 void dfuProcessing(); // Descriptor Fetching Unit
                 EventFunctionWrapper dfuEvent;
@@ -313,8 +410,17 @@ class HanGuRnic : public RdmaNic {
                 void scuProcessing(); // Send Completion Unit
                 EventFunctionWrapper scuEvent;
                 
-                void sauProcessing(); // Send Arbiter Unit, directly post data to link layer
-                EventFunctionWrapper sauEvent;
+                /* Send one packet in txsauFifo of the port to link layer, 
+                 * called by the Send Arbiter Unit of the port shared by all 
+                 * lanes. Return the time the link takes to send it. */
+                Tick sauProcessing(uint8_t port);
+                bool sauPending(uint8_t port) { return txsauFifo[port].size(); }
+
+                /* Move packets waiting for a port to the port their QP 
+                 * is sent through now (see txPort), after a port fails 
+                 * or recovers. All queued packets of a QP are in one 
+                 * fifo and keep in order. */
+                void reroutePkts();
 
                 
                 // event for rx packet
@@ -337,13 +443,68 @@ class HanGuRnic : public RdmaNic {
                 EventFunctionWrapper detectNetRateEvent;
 
                 std::queue<DoorbellPtr> df2ddFifo; // TODO: move this FIFO to Top level and change its name
+                std::queue<DoorbellPtr> df2ddFifoH; /* doorbells of LAT_QP, for txDescLaunchQueH */
+                std::queue<Tick> latLaunchTick;     /* tick each WQE enters txDescLaunchQueH */
+                Stats::Scalar latBypassNum;         /* counted by DescScheduler.launchWQE */
+
+                /* DescScheduler -> ddu */
+                std::queue<TxDescPtr> txDescLaunchQue;
+                std::queue<TxDescPtr> txDescLaunchQueH; /* WQEs of LAT_QP, preempt txDescLaunchQue */
+
+                /* RAU arbiter -> rau, packets whose dest QP is in this lane */
+                std::queue<EthPacketPtr> rxFifo;
+
+                /* Response ports of resource modules, requests 
+                 * are tagged with the lane id to be routed back */
+                std::queue<CxtReqRspPtr> txQpcRspFifo; /* QpcModule -> dpu */
+                std::queue<CxtReqRspPtr> rxQpcRspFifo; /* QpcModule -> rpu */
+                std::queue<CxtReqRspPtr> txCqcRspFifo; /* CqcModule -(update rsp)-> scu */
+                std::queue<CxtReqRspPtr> rxCqcRspFifo; /* CqcModule -(update rsp)-> rcu */
+                std::queue<MrReqRspPtr> txdataRspFifo; /* TPT -> rgrru */
+                std::queue<MrReqRspPtr> rxdataRspFifo; /* TPT -> RPCPLU */
+                std::queue<RxDescPtr> rxdescRspFifo;   /* TPT -> rcvRpu */
         };
 
-        RdmaEngine rdmaEngine;
+        /* RDMA engine lanes, QPs are sharded to lanes by QPN */
+        std::vector<RdmaEngine *> rdmaEngines;
+        RdmaEngine *laneOf(uint32_t qpn) { return rdmaEngines[qpn % rdmaEngines.size()]; }
+
+        /* Send Arbiter Unit of the port shared by the lanes, round 
+         * robin over their txsauFifo, directly post data to link layer */
+        void sauProcessing(uint8_t port);
+
+        /* Port of the QP, QPC port or LAG hash */
+        uint8_t homePort(QpcResc *qpc);
+        /* Port to send packets of the home port, the next port which 
+         * is up if it is down */
+        uint8_t txPort(uint8_t home);
+
+        /* No packet or descriptor is in process in all lanes */
+        bool enginesIdle();
+
+        /* scu & rcu of all lanes -> CQE staging buffer, coalesce CQE 
+         * writes of one CQ, whichever lane its QPs are served by */
+        std::unordered_map<uint32_t, CqeStageBufPtr> cqeStageMap; /* <cqn, staged CQEs> */
+        std::queue<std::pair<uint32_t, Tick> > cqeTimeoutQue; /* <cqn, stage tick> in time order */
+        uint32_t cqeCoalesceNum; /* max CQEs in one burst, 1 disables coalescing */
+        Tick cqeCoalesceTimeout;
+        Stats::Scalar cqeNum;        /* CQEs posted by scu & rcu */
+        Stats::Scalar cqeWriteNum;   /* CQ write requests posted to TPT */
+        Stats::Scalar cqeStageDelay; /* accumulated time CQEs spent in staging buffer */
+        Stats::Formula cqeSavedWrite;
+        Stats::Formula cqeStageAvg;
+        void stageCqe(uint8_t chnl, CqcResc *cqc, CqDescPtr cqDesc);
+        void postCqeWreq(uint8_t chnl, uint32_t cqn, uint32_t lkey, uint32_t offset, uint8_t *cqeBuf, uint32_t len);
+
+        void cqeFlushProcessing(); // Flush staged CQEs on timeout
+        EventFunctionWrapper cqeFlushEvent;
+
+        /* Write back all staged CQEs of the CQ */
+        void flushCqe(uint32_t cqn);
         /* -----------------------RDMA Engine Relevant{end}----------------------- */
 
         /* -------------------WQE Scheduler Relevant{begin}---------------------- */
-        class DescScheduler {
+        class DescScheduler : public Serializable {
             private:
                 HanGuRnic *rNic;
                 std::string _name;
@@ -354,22 +515,94 @@ class HanGuRnic : public RdmaNic {
                 void wqeProc();
                 void rxUpdate();
                 void launchWQE();
+                bool launchReady(uint8_t lane);
                 void createQpStatus();
+                void dbrRead(QPStatusPtr qpStatus);
+                void postDbrRead(QPStatusPtr qpStatus);
+                void postDbrArm(QPStatusPtr qpStatus);
+                void dbrRspProc();
+                void activateQp(QPStatusPtr qpStatus);
+
+                /* QP scheduling, see sched_policy in Rnic.py */
+                uint32_t qpQuantum(QPStatusPtr qpStatus);
+                uint32_t qpFetchDepth(QPStatusPtr qpStatus);
+                uint32_t schedBatch(QPStatusPtr qpStatus);
+                void schedCharge(QPStatusPtr qpStatus, uint32_t size);
+                uint32_t popLowQpn();
+                uint64_t groupShare(uint16_t groupId);
+                uint64_t sysVtime; /* WFQ system virtual time */
+                std::unordered_map<uint16_t, uint64_t> groupVtime; /* WFQ finish tag of groups */
+                std::unordered_map<uint16_t, uint32_t> groupQpWeight; /* sum of QP weights in groups */
+
+                /* Bytes sent over fair share of QPs and groups since stats reset */
+                std::unordered_map<uint32_t, double> qpNormBytes;
+                std::unordered_map<uint16_t, double> groupNormBytes;
+                double qpJainIndex() const;
+                double groupJainIndex() const;
+
+                uint32_t qpWeight(QPStatusPtr qpStatus);
+
+                Stats::SparseHistogram qpSentBytes;
+                Stats::Vector groupSentBytes;
+                Stats::Formula groupSentBw;
+                Stats::Value qpFairness;
+                Stats::Value groupFairness;
+
+                /* Token bucket rate limiters of QPs and groups */
+                std::unordered_map<uint32_t, TokenBucket> qpBucket;
+                std::unordered_map<uint16_t, TokenBucket> groupBucket;
+                std::list<ThrottledQp> throttledQpn; /* QPs waiting for tokens */
+                void refill(TokenBucket &bucket);
+                Tick bucketWait(TokenBucket &bucket);
+                bool rateThrottle(QPStatusPtr qpStatus);
+                void rateCharge(QPStatusPtr qpStatus, uint32_t size);
+                void throttleRelease();
+
+                Stats::Scalar throttleNum;
+                Stats::Scalar throttleTicks;
+                Stats::Formula throttleAvg;
+                Stats::Vector groupThrottleTicks;
+
+                /* Closed-loop group granularity controller, see qos_ctrl_period in Rnic.py */
+                std::unordered_map<uint16_t, uint16_t> groupBaseGran; /* granularity set by the driver */
+                std::unordered_map<uint16_t, uint64_t> groupWinBytes; /* bytes sent in this window */
+                std::vector<uint16_t> ctrlGroups; /* backlogged groups of the last window */
+                Tick ctrlStart;     /* start of the window the current target is set */
+                bool ctrlConverged;
+                uint64_t groupTargetShare(uint16_t groupId);
+                void qosCtrl();
+                EventFunctionWrapper qosCtrlEvent;
+
+                Stats::Average qosCtrlError;
+                Stats::Histogram qosConvergeTime;
+                Stats::Scalar qosCtrlAdjust;
+
+                /* Load measured for the quantum policy, see quantumUpdate */
+                Tick queDelaySum;   /* QPN queue wait of bulk QPs in this period */
+                uint32_t queDelayNum;
+                void quantumUpdate();
+                EventFunctionWrapper quantumEvent;
+
                 uint16_t sqSize = PAGE_SIZE;
                 uint16_t rqSize;
                 uint64_t scheduleCnt;
                 // std::queue<uint32_t> leastPriorityQpnQue;
                 std::queue<TxDescPtr> highPriorityDescQue;
-                std::queue<TxDescPtr> lowPriorityDescQue;
+                std::vector<std::queue<TxDescPtr> > lowPriorityDescQue; /* one for each engine lane */
                 std::queue<DoorbellPtr> dbProcQpStatusRReqQue;
                 std::queue<std::pair<DoorbellPtr, QPStatusPtr>> dbQpStatusRspQue;
                 std::queue<uint32_t> wqePrefetchQpStatusRReqQue;
                 std::queue<DoorbellPtr> wqeProcToLaunchWqeQueH;
-                std::queue<DoorbellPtr> wqeProcToLaunchWqeQueL;
+                std::vector<std::queue<DoorbellPtr> > wqeProcToLaunchWqeQueL; /* one for each engine lane */
+                uint8_t launchLane; /* next lane launchWQE serves, round robin */
                 EventFunctionWrapper wqePrefetchEvent;
                 EventFunctionWrapper launchWqeEvent;
+                /* doorbell record read response */
+                std::queue<QPStatusPtr> dbrRspQue;
+                EventFunctionWrapper dbrRspEvent;
+                Stats::Scalar dbrReadNum;
             public:
-                DescScheduler(HanGuRnic *rNic, std::string name);
+                DescScheduler(HanGuRnic *rNic, std::string name, uint32_t laneNum);
                 int unsentBatchNum;
                 EventFunctionWrapper wqePrefetchScheduleEvent;
                 EventFunctionWrapper updateEvent;
@@ -378,11 +611,22 @@ class HanGuRnic : public RdmaNic {
                 EventFunctionWrapper wqeProcEvent;
                 std::queue<DoorbellPtr> dbQue;
                 std::queue<uint32_t> highPriorityQpnQue;
-                std::queue<uint32_t> lowPriorityQpnQue;
+                std::deque<uint32_t> lowPriorityQpnQue; /* not FIFO under WFQ, see popLowQpn */
                 std::queue<std::pair<uint32_t, QPStatusPtr>> wqeFetchInfoQue;
                 // std::queue<std::pair<uint32_t, uint32_t>> wqeFetchInfoQue;
                 std::unordered_map<uint16_t, uint16_t> groupTable;
                 std::unordered_map<uint32_t, QPStatusPtr> qpStatusTable;
+                uint32_t latQpNum; /* number of LAT_QP, WQE buffer reserve applies if any */
+                EventFunctionWrapper throttleEvent;
+                void setRateLimit(const RateLimitInfo &info);
+                void setGroupGran(uint16_t groupId, uint16_t gran);
+                void setQpWeight(uint32_t qpn, uint8_t weight);
+                void laneDrained(uint8_t lane);
+                void qpSent(uint32_t qpn, uint32_t size);
+                bool isIdle();
+                void regStats();
+                void serialize(CheckpointOut &cp) const override;
+                void unserialize(CheckpointIn &cp) override;
                 std::string name() {
                     return _name;
                 }
@@ -391,7 +635,7 @@ class HanGuRnic : public RdmaNic {
         /* -------------------WQE Scheduler Relevant{end}------------------------ */
 
         /* -------------------Prefetch Relevant{begin}------------------------ */
-        class RescPrefetcher {
+        class RescPrefetcher : public Serializable {
             private:
                 uint16_t prefetchNum;
                 HanGuRnic *rNic;
@@ -401,15 +645,55 @@ class HanGuRnic : public RdmaNic {
                 uint64_t prefetchCnt;
                 // uint64_t prefetchQueTick
                 void qpcPfetchRspProc();
-                int prefetchWindowSize;
+
+                /* Lookahead over the low priority QPN queue, depth 
+                 * in QPs, self-throttled by prefetch accuracy */
+                uint32_t depth;
+                uint32_t minDepth;
+                uint32_t maxDepth;
+                uint32_t adaptInterval; /* prefetches resolved between depth adjustments */
+                double accLow;
+                double lateHigh;
+                std::unordered_set<uint32_t> lookaheadQpn; /* QPs in the queue already prefetched */
+
+                /* Entries prefetched and not used or evicted yet, per PF_* resource */
+                std::unordered_set<uint32_t> pfTrack[PF_RESC_NUM];
+                uint32_t ivUseful;  /* resolved in this adjustment interval */
+                uint32_t ivLate;
+                uint32_t ivEvicted;
+                void adaptDepth();
+
+                Stats::Vector pfIssued;
+                Stats::Vector pfUseful;
+                Stats::Vector pfLate;
+                Stats::Vector pfEvicted;
+                Stats::Formula pfAccuracy;
+                Stats::Formula pfTimely;
+                Stats::Average pfDepth;
+                Stats::Scalar pfDepthAdjust;
             public:
-                RescPrefetcher(HanGuRnic *rNic, std::string name, int windowSize);
-                std::queue<uint32_t> prefetchQue;
+                RescPrefetcher(HanGuRnic *rNic, std::string name, uint32_t depth, 
+                        uint32_t minDepth, uint32_t maxDepth, uint32_t adaptInterval, 
+                        double accLow, double lateHigh);
                 EventFunctionWrapper prefetchProcEvent;
                 EventFunctionWrapper prefetchMemProcEvent;
                 EventFunctionWrapper qpcPfetchRspProcEvent;
                 void triggerPrefetch();
+                void qpServed(uint32_t qpn);
                 std::unordered_map<uint32_t, bool> mrPrefetchFlag;
+                std::queue<CxtReqRspPtr> qpcPfetchRspFifo; /* QpcModule -> qpcPfetchRspProc */
+
+                /* Prefetch accounting, called by the resource modules. 
+                 * pfUse is called on demand access, ready if the entry 
+                 * is in the cache (or WQE buffer) by then. */
+                void pfIssue(uint8_t resc, uint32_t idx);
+                void pfUse(uint8_t resc, uint32_t idx, bool ready);
+                void pfEvict(uint8_t resc, uint32_t idx);
+
+                bool isIdle() { return qpcPfetchRspFifo.empty(); }
+                void regStats();
+                void serialize(CheckpointOut &cp) const override;
+                void unserialize(CheckpointIn &cp) override;
                 std::string name() {
                     return _name;
                 }
@@ -418,7 +702,7 @@ class HanGuRnic : public RdmaNic {
         /* -------------------Prefetch Relevant{end}-------------------------- */
 
         /* -------------------WQE Buffer Manage {begin}-------------------------------- */
-        class WqeBufferManage {
+        class WqeBufferManage : public Serializable {
             private:
                 HanGuRnic *rNic;
                 std::string _name;
@@ -428,13 +712,18 @@ class HanGuRnic : public RdmaNic {
                 int descBufferCap;
                 int descBufferUsed;
                 uint64_t accessNum;
-                uint64_t hitNum;
-                uint64_t missNum;
+                Stats::Scalar hitNum;   /* WQE fetches served from the buffer */
+                Stats::Scalar missNum;  /* WQE fetches waiting for WQEs to be read */
+                Stats::Formula hitRate;
+                Ewma avgMissCost; /* over all QPs, for QPs not missed yet */
+                Ewma avgScore;    /* keepNum weights, see adaptKeepNum */
+                int adaptKeepNum(uint32_t qpn, int activeNum, int fetchDepth, bool samplePost);
                 EventFunctionWrapper wqeReqReturnEvent;
                 std::queue<WqeRspPtr> wqeReturnQue;
                 void wqeReadReqProcess();
                 void wqeReadRspProcess();
                 void createWqeBuffer();
+                int latDescUsed();
                 uint16_t sqSize = PAGE_SIZE;
             public:
                 WqeBufferManage(HanGuRnic *rNic, std::string name, int wqeCacheNum);
@@ -453,6 +742,10 @@ class HanGuRnic : public RdmaNic {
                 void wqePrefetchProc();
                 void wqeBufferUpdate();
                 void triggerMemPrefetch(uint32_t qpn);
+                bool isIdle();
+                void regStats();
+                void serialize(CheckpointOut &cp) const override;
+                void unserialize(CheckpointIn &cp) override;
                 std::string name() {
                     return _name;
                 }
@@ -462,7 +755,7 @@ class HanGuRnic : public RdmaNic {
         
         /* -----------------------Cache {begin}------------------------ */
         template <class T, class S>
-        class RescCache {
+        class RescCache : public Serializable {
             private:
 
                 struct CacheRdPkt {
@@ -476,7 +769,7 @@ class HanGuRnic : public RdmaNic {
                     T       *rescDma; /* addr used to get resc through DMA read */
                     S        reqPkt ; /* temp store the request pkt */
                     DmaReqPtr dmaReq; /* DMA read request pkt, to fetch missed resource (cache), 
-                                        we only use its isValid to fetch the rsp */
+                                        we only use its rdVld to fetch the rsp */
                     T       *rspResc; /* addr used to rsp the requester !TODO: delete it later */
                     const std::function<bool(T&)> rescUpdate;
                 };
@@ -525,14 +818,19 @@ class HanGuRnic : public RdmaNic {
                 EventFunctionWrapper fetchCplEvent;
                 
                 /* read req -> read rsp Fifo
-                * Used only in Read Cache miss. */
-                std::queue<CacheRdPkt> rreq2rrspFifo;
+                * Used only in Read Cache miss. 
+                * Returned entries may retire out of order. */
+                std::list<CacheRdPkt> rreq2rrspFifo;
+                auto findRetirable() -> typename std::list<CacheRdPkt>::iterator;
 
                 int hitNum;
                 int missNum;
                 int maxParam;
                 std::unordered_map<uint32_t, uint64_t> replaceParam;
 
+                /* Entries restored beyond the capacity, written back at startup */
+                std::vector<std::pair<uint32_t, T> > restoreWb;
+
                 void recordMissHit(CacheRdPkt &pkt, bool hit);
 
             public:
@@ -546,7 +844,7 @@ class HanGuRnic : public RdmaNic {
                     hitNum(0),
                     missNum(0),
                     maxParam(0) { 
-                    icmPage = new uint64_t [ICM_MAX_PAGE_NUM]; 
+                    icmPage = new uint64_t [ICM_MAX_PAGE_NUM](); 
                     rescSz = sizeof(T); 
                     // hitNum = 0;
                     // missNum = 0;
@@ -567,6 +865,25 @@ class HanGuRnic : public RdmaNic {
                 /* Outer module uses to get cache entry (so don't delete the element) */
                 std::queue<std::pair<T *, S> > rrspFifo;
 
+                /* No read request is in process */
+                bool isIdle() { return reqFifo.empty() && rreq2rrspFifo.empty() && rrspFifo.empty(); }
+
+                /* Write back all cached entries and empty the cache */
+                void flush();
+
+                /* Entry is in the cache, prefetch of it is skipped */
+                bool isCached(uint32_t rescIdx) const { return cache.find(rescIdx) != cache.end(); }
+
+                /* Called with the index of each replaced entry, if set */
+                std::function<void(uint32_t)> evictNotify;
+
+                /* Checkpoint ICM page table and cached entries */
+                void serialize(CheckpointOut &cp) const override;
+                void unserialize(CheckpointIn &cp) override;
+
+                /* Write back entries which did not fit in the cache on restore */
+                void restoreWriteBack();
+
                 std::string name() { return _name; }
         };
         /* -----------------------Cache {end}------------------------ */
@@ -669,7 +986,7 @@ class HanGuRnic : public RdmaNic {
         // /* -----------------------Cache {end}------------------------ */
 
         /* -----------------------TPT Relevant{begin}----------------------- */
-        class MrRescModule {
+        class MrRescModule : public Serializable {
             protected:
 
                 /* Point to the device I am in */
@@ -680,8 +997,8 @@ class HanGuRnic : public RdmaNic {
 
                 uint8_t chnlIdx;
                 
-                /* Temp store dma read request pkt until read rsp is back */
-                std::queue<std::pair<MrReqRspPtr, DmaReqPtr> > dmaReq2RspFifo;
+                /* DMA read rsp which is back, pushed by DMA completion callback */
+                std::queue<std::pair<MrReqRspPtr, DmaReqPtr> > dmaRrspFifo;
                 void dmaReqProcess(uint64_t pAddr, MrReqRspPtr tptReq, uint32_t offset, uint32_t length);
                 /**
                  * tx descriptor (read rsp) -(schedule to)-> rdmaEngine.ddu
@@ -744,6 +1061,10 @@ class HanGuRnic : public RdmaNic {
                 std::unordered_map<uint32_t, MptResc *> qpMpt;
                 std::queue<std::pair<MrReqRspPtr, MptResc *>> qpMptRspQue;
 
+                bool isIdle();
+                void serialize(CheckpointOut &cp) const override;
+                void unserialize(CheckpointIn &cp) override;
+
                 std::string name() { return _name; }
         };
 
@@ -751,7 +1072,7 @@ class HanGuRnic : public RdmaNic {
         /* -----------------------TPT Relevant{end}----------------------- */
         
         /* -----------------------CQC Management Module {begin}----------------------- */
-        class CqcModule {
+        class CqcModule : public Serializable {
             protected:
 
                 /* Pointer to the device I am in */
@@ -787,14 +1108,79 @@ class HanGuRnic : public RdmaNic {
 
                 RescCache<CqcResc, CxtReqRspPtr> cqcCache;
 
+                bool isIdle() { return cqcCache.isIdle(); }
+                void serialize(CheckpointOut &cp) const override;
+                void unserialize(CheckpointIn &cp) override;
+
                 std::string name() { return _name; }
         };
 
         CqcModule cqcModule;
         /* -----------------------CQC Management Module {end}----------------------- */
 
+        /* -----------------------CQ Interrupt Module {begin}----------------------- */
+        class IntrModule : public Serializable {
+            protected:
+
+                /* Pointer to the device I am in */
+                HanGuRnic *rnic;
+
+                /* Name of myself */
+                std::string _name;
+
+                std::unordered_map<uint32_t, CqIntrStatePtr> cqIntrTable; /* <cqn, interrupt state> */
+
+                /* Moderation policy */
+                uint32_t modCount; /* raise interrupt after modCount CQEs */
+                Tick modTime;      /* or after modTime since the first pending CQE */
+                bool adaptive;     /* tune modCount according to interrupt interval */
+
+                /* moderation timer, <cqn, first CQE tick> in time order */
+                std::queue<std::pair<uint32_t, Tick> > modTimerQue;
+                void modTimerProc();
+                EventFunctionWrapper modTimerEvent;
+
+                CqIntrStatePtr getIntrState(uint32_t cqn);
+                void checkIntr(uint32_t cqn);
+                void raiseIntr(uint32_t cqn);
+
+                Stats::Scalar cqeNum;  /* CQEs written back */
+                Stats::Scalar intrNum; /* interrupts raised */
+                Stats::Formula cqePerIntr;
+
+            public:
+
+                IntrModule (HanGuRnic *i, const std::string n, 
+                        uint32_t modCount, Tick modTime, bool adaptive)
+                : rnic(i),
+                    _name(n),
+                    modCount(modCount),
+                    modTime(modTime),
+                    adaptive(adaptive),
+                    modTimerEvent([this]{ modTimerProc();}, n),
+                    cqeWriteCplEvent([this]{ cqeWriteCplProc();}, n) { }
+
+                /* Arm the CQ, raise one interrupt for the next CQE(s) */
+                void armCq(uint32_t cqn);
+
+                /* DMA Engine -> IntrModule, CQE write back finished, <cqn, DMA request> */
+                std::queue<std::pair<uint32_t, DmaReqPtr> > cqeWriteCplFifo;
+                void cqeWriteCplProc();
+                EventFunctionWrapper cqeWriteCplEvent;
+
+                bool isIdle() { return modTimerQue.empty() && cqeWriteCplFifo.empty(); }
+                void regStats();
+                void serialize(CheckpointOut &cp) const override;
+                void unserialize(CheckpointIn &cp) override;
+
+                std::string name() { return _name; }
+        };
+
+        IntrModule intrModule;
+        /* -----------------------CQ Interrupt Module {end}----------------------- */
+
         /* -----------------------ICM Management Module {begin}------------------- */
-        class IcmManage {
+        class IcmManage : public Serializable {
             /* Name of myself */
             std::string _name;
 
@@ -807,7 +1193,7 @@ class HanGuRnic : public RdmaNic {
         
             public:
                 IcmManage (const std::string n, uint32_t entrySz)
-                : _name(n) { baseAddr = 0; icmPage = new uint64_t [ICM_MAX_PAGE_NUM]; rescSz = entrySz; }
+                : _name(n) { baseAddr = 0; icmPage = new uint64_t [ICM_MAX_PAGE_NUM](); rescSz = entrySz; }
 
                 // Convert resource number into physical address.
                 uint64_t num2phyAddr(uint32_t num) {
@@ -835,7 +1221,16 @@ class HanGuRnic : public RdmaNic {
                             ++idx;
                         }
                     }
-                    delete[] icmResc;
+                }
+
+                void serialize(CheckpointOut &cp) const override {
+                    SERIALIZE_SCALAR(baseAddr);
+                    icmPageOut(cp, icmPage);
+                }
+
+                void unserialize(CheckpointIn &cp) override {
+                    UNSERIALIZE_SCALAR(baseAddr);
+                    icmPageIn(cp, icmPage);
                 }
 
                 std::string name() { return _name; }
@@ -844,7 +1239,7 @@ class HanGuRnic : public RdmaNic {
                 
         /* -----------------------QPC Cache {begin}---------------------- */
         template <class T>
-        class Cache {
+        class Cache : public Serializable {
             private:
                 /* Name of myself */
                 std::string _name;
@@ -880,6 +1275,16 @@ class HanGuRnic : public RdmaNic {
                 /* delete entry in cache */
                 T* deleteEntry(uint32_t entryNum);
 
+                /* return true if cache holds more entries than capacity, 
+                 * only after restoring from a larger cache */
+                bool lookupOver() { return cache.size() > capacity; }
+
+                /* remove all entries, and return them with their entry number */
+                void deleteAll(std::vector<std::pair<uint32_t, T*>> &entries);
+
+                void serialize(CheckpointOut &cp) const override;
+                void unserialize(CheckpointIn &cp) override;
+
                 std::string name() { return _name; }
         };
         /* -----------------------QPC Cache {end}---------------------- */
@@ -991,7 +1396,7 @@ class HanGuRnic : public RdmaNic {
         /* -----------------------PendingStruct {end}---------------------- */
 
         /* -----------------------QPC Management Module {begin}----------------------- */
-        class QpcModule {
+        class QpcModule : public Serializable {
             private:
 
                 /* Pointer to the device I am in */
@@ -1113,8 +1518,7 @@ class HanGuRnic : public RdmaNic {
                 /* --------QpcModule -(rsp)-> RDMA Engine or CCU {begin}-------- */
                 std::queue<CxtReqRspPtr> qpcRspFifo[3];
                 std::queue<CxtReqRspPtr> txQpAddrRspFifo; // QP Cxt -(rrsp)-> DFU(RDMA Engine)
-                std::queue<CxtReqRspPtr> txQpcRspFifo;
-                std::queue<CxtReqRspPtr> rxQpcRspFifo;
+                /* tx & rx QPC rsp go to txQpcRspFifo & rxQpcRspFifo of the engine lane */
                 /* --------QpcModule -(rsp)-> RDMA Engine or CCU {end}-------- */
 
                 /* -------- Icm related interface{begin}-------- */
@@ -1124,6 +1528,17 @@ class HanGuRnic : public RdmaNic {
                 void icmStore(IcmResc *icmResc, uint32_t chunkNum) { qpcIcm.icmStore(icmResc, chunkNum); }
                 /* -------- Icm related interface{end}-------- */
 
+                /* Write back all cached QPCs and empty the cache */
+                void flushCache();
+
+                /* QPCs restored beyond the cache capacity, written back at startup */
+                std::vector<std::pair<uint32_t, QpcResc *> > restoreWb;
+                void restoreWriteBack();
+
+                bool isIdle();
+                void serialize(CheckpointOut &cp) const override;
+                void unserialize(CheckpointIn &cp) override;
+
                 std::string name() { return _name; }
         };
 
@@ -1145,12 +1560,19 @@ class HanGuRnic : public RdmaNic {
 
                 uint64_t readByte;
                 uint64_t writeByte;
-                bool startDetect;
-                bool blocked;
+                bool startDetect; /* rate detection is running, stops when DMA is idle */
+                bool blocked;     /* no DMA request is posted since last watchdog check */
+
+                /* Watchdog, checks DMA progress every watchdogPeriod 
+                 * while the NIC has pending work, 0 disables it */
+                Tick watchdogPeriod;
+                bool watchdogPanic; /* panic after dumping state on stall */
+                bool stallReported;
 
             public:
 
-                DmaEngine (HanGuRnic *i, const std::string n) 
+                DmaEngine (HanGuRnic *i, const std::string n, 
+                        Tick watchdogPeriod, bool watchdogPanic) 
                 : rnic(i),
                     _name(n),
                     readIdx(0),
@@ -1159,6 +1581,9 @@ class HanGuRnic : public RdmaNic {
                     writeByte(0),
                     startDetect(false),
                     blocked(false),
+                    watchdogPeriod(watchdogPeriod),
+                    watchdogPanic(watchdogPanic),
+                    stallReported(false),
                     dmaWriteCplEvent([this]{ dmaWriteCplProcessing(); }, n),
                     dmaReadCplEvent([this]{ dmaReadCplProcessing(); }, n),
                     dmaChnlProcEvent([this]{ dmaChnlProc(); }, n),
@@ -1191,6 +1616,7 @@ class HanGuRnic : public RdmaNic {
                 void detectRate();
                 EventFunctionWrapper detectRateEvent;
 
+                /* Watchdog of DMA progress */
                 void detectBlock();
                 EventFunctionWrapper detectBlockEvent;
 
@@ -1222,6 +1648,35 @@ class HanGuRnic : public RdmaNic {
         uint32_t cpuNum;
         uint32_t syncCnt;
         uint8_t  syncSucc;
+
+        /* Tuning parameters, see Rnic.py */
+        uint32_t qpnNum;            /* max QP number */
+        uint32_t maxPrefetchNum;    /* max WQEs fetched for one QP at a time */
+        int      unsentBatchThreshold; /* max WQE batches scheduled but not sent */
+        uint32_t descReqLimit;      /* max WQEs waiting for launch, 0 is unlimited */
+        uint32_t dataReqLimit;      /* max data requests in RDMA engine, 0 is unlimited */
+        bool     enablePrefetch;
+        bool     enableQos;
+        bool     cacheAllCqMpt;     /* keep MPTs of CQs out of MPT cache */
+        bool     cacheAllQpMpt;     /* keep MPTs of WQE buffers out of MPT cache */
+        HanGuSchedPolicy schedPolicy; /* QP scheduling policy */
+        HanGuQuantumPolicy *quantumPolicy; /* quantum & fetch depth of bulk QPs */
+        Tick     qosCtrlPeriod;     /* group granularity controller window, 0 disables it */
+        double   qosCtrlGain;
+        double   qosCtrlTolerance;  /* converged group share error */
+        uint32_t qosCtrlRange;      /* max granularity tuning factor */
+        uint32_t latWqeReserve;     /* WQE buffer entries reserved for LAT_QP */
+        bool     adaptiveWqeKeep;   /* size keepNum of each QP by its history */
+        double   wqeKeepGain;       /* EWMA weight of the keepNum history */
+
+        /* Functional fast-forward, see Rnic.py */
+        bool     fastForward;       /* DMA, PCIe, PIO and rx link take no time */
+        Tick     fastForwardEnd;    /* switch to timing mode at this tick, 0 on drain resume */
+        bool     ffWarmCaches;      /* keep caches warmed by fast-forward */
+
+        /* Leave fast-forward, and flush caches if they should be cold */
+        void ffSwitchProc();
+        EventFunctionWrapper ffSwitchEvent;
         
         // void txWire(); // Post TX pkt from FIFO to Wire
 
@@ -1234,6 +1689,16 @@ class HanGuRnic : public RdmaNic {
          * handle the drain event if so.
          */
         void checkDrain();
+        EventFunctionWrapper drainEvent; /* polls checkDrain() while draining */
+
+    public:
+        /* No request is waiting in the pipeline FIFOs or in process */
+        bool isQuiescent();
+
+        /* Print pipeline FIFO occupancy, used by the watchdog */
+        void dumpState();
+
+    private:
 
 
         uint8_t macAddr[ETH_ADDR_LEN];
@@ -1250,6 +1715,9 @@ class HanGuRnic : public RdmaNic {
 
         DmaEngine dmaEngine;
 
+        /* Binary event trace, see HANGU_TRACE */
+        HanGuTrace trace;
+
         typedef HanGuRnicParams Params;
         const Params *
         params() const {
@@ -1259,6 +1727,8 @@ class HanGuRnic : public RdmaNic {
         HanGuRnic(const Params *params);
         ~HanGuRnic();
         void init() override;
+        void startup() override;
+        void regStats() override;
 
         Port &getPort(const std::string &if_name,
                     PortID idx=InvalidPortID) override;
@@ -1272,8 +1742,15 @@ class HanGuRnic : public RdmaNic {
 
         
         /* Ethernet callback */
-        void ethTxDone(); // When TX done
-        bool ethRxDelay(EthPacketPtr packet);
+        void ethTxDone(uint8_t port); // When TX done
+        bool ethRxDelay(EthPacketPtr packet, uint8_t port);
+        /* Accept the packet in my event queue, process it at sched */
+        bool ethRxAccept(EthPacketPtr packet, Tick sched, uint8_t port);
+
+        /* Port failover hook. Packets of a failed port are sent 
+         * through other ports, which also take over its MAC, and 
+         * move back when it recovers. */
+        void setPortUp(uint8_t port, bool up);
 
         /* related to link delay processing */
         Tick LinkDelay;
@@ -1293,13 +1770,14 @@ class HanGuRnic : public RdmaNic {
 class HanGuRnicInt : public EtherInt {
     private:
         HanGuRnic *dev; // device the interface belonged to
+        uint8_t port;   // port id of the interface in the device
 
     public:
-        HanGuRnicInt(const std::string &name, HanGuRnic *d)
-            : EtherInt(name), dev(d) { }
+        HanGuRnicInt(const std::string &name, HanGuRnic *d, uint8_t port)
+            : EtherInt(name), dev(d), port(port) { }
 
-        virtual bool recvPacket(EthPacketPtr pkt) { return dev->ethRxDelay(pkt); }
-        virtual void sendDone() { dev->ethTxDone(); }
+        virtual bool recvPacket(EthPacketPtr pkt) { return dev->ethRxDelay(pkt, port); }
+        virtual void sendDone() { dev->ethTxDone(port); }
 };
 
 #endif //__RDMA_HANGU_RNIC_HH__
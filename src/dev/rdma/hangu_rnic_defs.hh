@@ -27,13 +27,16 @@
 
 #ifndef __HANGU_RNIC_DEFS_HH__
 #define __HANGU_RNIC_DEFS_HH__
+#include<functional>
 #include<memory>
 #include "base/bitfield.hh"
 #include "dev/net/etherpkt.hh"
 #include "debug/HanGu.hh"
 #include "sim/eventq.hh"
+#include "sim/serialize.hh"
 #include "dev/rdma/kfd_ioctl.h"
 #include <queue>
+#include <vector>
 
 #ifdef COLOR
 
@@ -48,10 +51,8 @@
         } while (0)
 #endif
 
-#define QPN_NUM   (512 * 3)
-
-#define MAX_PREFETCH_NUM 8
 #define MAX_COMMIT_SZ 4096
+#define MAX_SUB_WQE_LEN 16384 // max length of one sub WQE, handled by RdmaEngine as one unit
 #define MAX_MSG_RATE 60
 #define MAX_BW 100
 #define WQE_BUFFER_CAPACITY 120
@@ -65,31 +66,158 @@
 
 // QoS related parameters
 #define LEAST_QPN_QUE_CAP 64
-#define DESC_REQ_LIMIT 5
-#define DATA_REQ_LIMIT 6
 // #define RGU_SAU_LIM 1
 #define BIGN 20480
-#define WINDOW_CAP 20
 // #define MAX_SUBWQE_SIZE 1024
-#define PREFETCH_WINDOW 12
-#define UNSENT_BATCH_NUM_THRESHOLD 4
 
 #define DMA_DETECT_PERIOD 5000 // ns
 #define NET_DETECT_PERIOD 5000
-#define BLOCK_DETECT_PERIOD 1000000 // 
-#define START_DETECT_TICK 10000000000
-
-#define CACHE_ALL_CQ_MPT
-// #define CACHE_ALL_QP_MPT
-#define ENABLE_PREFETCH
+#define DRAIN_CHECK_PERIOD 1000 // cycles, poll pipeline state while draining
 
-// #define ENABLE_QOS
+#define POOL_MAX_FREE 65536 // max free objects kept by one request object pool
+#define CQE_BURST_SZ 64 // max bytes of one coalesced CQE write, one cacheline
+#define MAX_INTR_MOD_COUNT 64 // upper bound of adaptive interrupt moderation count
 
 #define PAGE_SIZE_LOG 12
 #define PAGE_SIZE (1 << PAGE_SIZE_LOG)
 
 namespace HanGuRnicDef {
 
+/**
+ * Allocator recycling the memory of request objects. Used through 
+ * makePooled(), the object and its shared_ptr control block are 
+ * allocated together, and put into a per-type free list when the 
+ * last reference drops, instead of going back to the heap.
+ * Free lists are per thread, so that simulation threads do not 
+ * contend on them.
+ */
+template <typename T>
+class PoolAllocator {
+  public:
+    typedef T value_type;
+
+    PoolAllocator() = default;
+    template <typename U>
+    PoolAllocator(const PoolAllocator<U> &) { }
+
+    T *allocate(std::size_t n) {
+        std::vector<T *> &fl = freeList();
+        if (n == 1 && fl.size()) {
+            T *p = fl.back();
+            fl.pop_back();
+            return p;
+        }
+        return static_cast<T *>(::operator new(n * sizeof(T)));
+    }
+
+    void deallocate(T *p, std::size_t n) {
+        std::vector<T *> &fl = freeList();
+        if (n == 1 && fl.size() < POOL_MAX_FREE) {
+            fl.push_back(p);
+        } else {
+            ::operator delete(p);
+        }
+    }
+
+    template <typename U>
+    bool operator==(const PoolAllocator<U> &) const { return true; }
+    template <typename U>
+    bool operator!=(const PoolAllocator<U> &) const { return false; }
+
+  private:
+    /* Never freed, objects may be released during static destruction */
+    static std::vector<T *> &freeList() {
+        static thread_local std::vector<T *> *fl = new std::vector<T *>;
+        return *fl;
+    }
+};
+
+/* Request object pools are on, see pool_alloc in Rnic.py */
+inline bool &poolAllocEnabled() {
+    static bool enabled = true;
+    return enabled;
+}
+
+/* make_shared() for hot request objects, memory is drawn from PoolAllocator */
+template <typename T, typename... Args>
+std::shared_ptr<T> makePooled(Args&&... args) {
+    if (!poolAllocEnabled()) {
+        return std::make_shared<T>(std::forward<Args>(args)...);
+    }
+    return std::allocate_shared<T>(PoolAllocator<T>(), std::forward<Args>(args)...);
+}
+
+/* Deleter of single-owner request objects, memory goes back to where it came from */
+template <typename T>
+struct PoolDeleter {
+    bool pooled;
+    void operator()(T *p) const {
+        p->~T();
+        if (pooled) {
+            PoolAllocator<T>().deallocate(p, 1);
+        } else {
+            ::operator delete(p);
+        }
+    }
+};
+
+/* Handle of request objects with one owner at a time, handed off 
+ * between FIFOs by std::move, so there is no refcount to update */
+template <typename T>
+using PooledPtr = std::unique_ptr<T, PoolDeleter<T>>;
+
+template <typename T, typename... Args>
+PooledPtr<T> makeOwned(Args&&... args) {
+    bool pooled = poolAllocEnabled();
+    T *p = pooled ? PoolAllocator<T>().allocate(1) : 
+            static_cast<T *>(::operator new(sizeof(T)));
+    new (p) T(std::forward<Args>(args)...);
+    return PooledPtr<T>(p, PoolDeleter<T>{pooled});
+}
+
+/**
+ * @note Checkpoint helpers. Resources (QPC, MPT, ...) and descriptors
+ *       are plain structs shared with the driver, so they are
+ *       checkpointed as raw bytes, appended to one byte array.
+ */
+template <typename T>
+void rawAppend(std::vector<uint8_t> &buf, const T &val) {
+    const uint8_t *p = (const uint8_t *)&val;
+    buf.insert(buf.end(), p, p + sizeof(T));
+}
+
+template <typename T>
+void rawGet(T &val, const std::vector<uint8_t> &buf, size_t idx) {
+    assert((idx + 1) * sizeof(T) <= buf.size());
+    memcpy((void *)&val, buf.data() + idx * sizeof(T), sizeof(T));
+}
+
+/* ICM page table is sparse, only mapped pages are checkpointed */
+inline void icmPageOut(CheckpointOut &cp, const uint64_t *icmPage) {
+    std::vector<uint32_t> icmIdx;
+    std::vector<uint64_t> icmAddr;
+    for (uint32_t i = 0; i < ICM_MAX_PAGE_NUM; ++i) {
+        if (icmPage[i]) {
+            icmIdx.push_back(i);
+            icmAddr.push_back(icmPage[i]);
+        }
+    }
+    arrayParamOut(cp, "icmIdx", icmIdx);
+    arrayParamOut(cp, "icmAddr", icmAddr);
+}
+
+inline void icmPageIn(CheckpointIn &cp, uint64_t *icmPage) {
+    std::vector<uint32_t> icmIdx;
+    std::vector<uint64_t> icmAddr;
+    arrayParamIn(cp, "icmIdx", icmIdx);
+    arrayParamIn(cp, "icmAddr", icmAddr);
+    assert(icmIdx.size() == icmAddr.size());
+    memset(icmPage, 0, ICM_MAX_PAGE_NUM * sizeof(uint64_t));
+    for (size_t i = 0; i < icmIdx.size(); ++i) {
+        icmPage[icmIdx[i]] = icmAddr[i];
+    }
+}
+
 struct QpcResc;
 struct CqcResc;
 
@@ -112,6 +240,54 @@ const uint8_t WRITE_CQC = 0x06;
 const uint8_t SET_GROUP = 0x07;
 // const uint8_t SET_ALL_GROUP = 0x08;
 const uint8_t ALLOC_GROUP = 0x08;
+const uint8_t SET_RATE_LIMIT = 0x09;
+const uint8_t SET_QP_WEIGHT = 0x0a;
+
+/* Command queue in host memory, an alternative of HCR.
+ * One page holds CMDQ_DEPTH entries, followed by
+ * CMDQ_DEPTH completion records. */
+struct CmdQueEntry {
+    uint64_t inParam; /* mailbox paddr */
+    uint64_t outParam;
+    uint32_t inMod;
+    uint32_t opcode;
+    uint32_t seq;
+    uint32_t rsvd;
+};
+struct CmdCplRecord {
+    uint32_t seq;    /* index of the finished entry plus 1 (16 bits) */
+    uint32_t status; /* 0 for success */
+};
+const uint32_t CMDQ_CPL_OFFSET = CMDQ_DEPTH * sizeof(CmdQueEntry);
+
+struct CmdQueElem {
+    CmdQueElem (uint16_t idx) {
+        this->idx  = idx;
+        this->mbox = nullptr;
+        this->vld  = false;
+    }
+    uint16_t    idx;
+    CmdQueEntry entry;
+    uint8_t    *mbox;
+    bool        vld;   /* entry and mailbox are both fetched */
+    CmdCplRecord cpl;
+};
+typedef std::shared_ptr<CmdQueElem> CmdQueElemPtr;
+
+struct CmdQueState {
+    CmdQueState (Addr base) {
+        this->base      = base;
+        this->pi        = 0;
+        this->fetchIdx  = 0;
+        this->retireIdx = 0;
+    }
+    Addr     base;
+    uint16_t pi;        /* producer index rung by the driver */
+    uint16_t fetchIdx;  /* next entry to fetch */
+    uint16_t retireIdx; /* next entry to retire */
+    std::queue<CmdQueElemPtr> elemQue; /* fetching or fetched entries, in order */
+};
+typedef std::shared_ptr<CmdQueState> CmdQueStatePtr;
 
 struct Doorbell {
     uint8_t  opcode;
@@ -127,26 +303,38 @@ const uint8_t OPCODE_RDMA_WRITE = 0x03;
 const uint8_t OPCODE_RDMA_READ  = 0x04;
 
 struct DoorbellFifo {
-    DoorbellFifo (uint8_t  opcode, uint8_t  num, 
+    DoorbellFifo (uint8_t  opcode, uint32_t num, 
             uint32_t qpn, uint32_t offset) {
         this->opcode = opcode;
         this->num = num;
         this->qpn = qpn;
         this->offset = offset;
     }
-    DoorbellFifo (uint8_t num, uint32_t qpn, uint8_t type) 
+    DoorbellFifo (uint32_t num, uint32_t qpn, uint8_t type) 
     {
         this->num = num;
         this->qpn = qpn;
         this->opcode = type;
     }
     uint8_t  opcode; // for pseudo doorbell, this field indicates the type of QP
-    uint8_t  num;
+    uint32_t num; // doorbells of the same QP may be merged, so it may exceed 255
     uint32_t qpn;
     uint32_t offset;
     // Addr     qpAddr;
 };
-typedef std::shared_ptr<DoorbellFifo> DoorbellPtr;
+typedef PooledPtr<DoorbellFifo> DoorbellPtr;
+
+/**
+ * @note Doorbell record in host memory. This struct must BE IDENTICAL to the 
+ *       difinition in libhgrnic!!!!
+ *       Host updates sqPi after posting WQEs, and rings the doorbell only if 
+ *       armed is set. RNIC reads the record when the QP runs out of WQEs, and 
+ *       sets armed if there's no new WQE.
+ */
+struct DbRecord {
+    uint32_t sqPi;  /* SQ producer index, number of WQEs posted, written by host */
+    uint32_t armed; /* written by RNIC */
+};
 
 
 /* Mailbox offset in CEU command */
@@ -215,12 +403,14 @@ struct QpcResc {
     uint32_t    sndWqeBaseLkey; // send wqe base lkey
     uint32_t    rcvWqeBaseLkey; // receive wqe base lkey
     uint32_t    qkey;
-    uint32_t    reserved[50];
+    uint64_t    dbrAddr; // physical address of doorbell record, 0 if it is not used
+    uint32_t    reserved[48];
 
     uint8_t     indicator; // 1: latency-sensitive; 2: bandwidth-sensitive; 3: message rate sensitive
     uint8_t     perfWeight;
     uint16_t    groupID;
     uint8_t     qosReserve;
+    uint8_t     port; // Ethernet port the QP is bound to, unless in LAG mode
 };
 
 const uint8_t QP_TYPE_RC = 0x00;
@@ -228,6 +418,11 @@ const uint8_t QP_TYPE_UC = 0x01;
 const uint8_t QP_TYPE_RD = 0x02;
 const uint8_t QP_TYPE_UD = 0x03;
 
+/* PSN is 24 bits, psn is older than expPsn (duplicated or stale) */
+inline bool psnBehind(uint32_t psn, uint32_t expPsn) {
+    return ((psn - expPsn) & 0xFFFFFF) >= 0x800000;
+}
+
 // WRITE_CQ
 struct CqcResc {
     uint32_t cqn;
@@ -373,6 +568,40 @@ struct CqDesc {
 // const uint8_t CQ_ENTRY_SZ = 12;
 typedef std::shared_ptr<CqDesc> CqDescPtr;
 
+/* CQEs staged for one CQ, written back in one DMA burst */
+struct CqeStageBuf {
+    CqeStageBuf(uint8_t chnl, uint32_t lkey, uint32_t offset, Tick stageTick) {
+        this->chnl      = chnl;
+        this->lkey      = lkey;
+        this->offset    = offset;
+        this->stageTick = stageTick;
+    }
+    uint8_t  chnl;      /* TPT write channel of the first staged CQE */
+    uint32_t lkey;      /* lkey of the CQ */
+    uint32_t offset;    /* CQ offset of the first staged CQE */
+    Tick     stageTick; /* time the first CQE was staged, used for timeout */
+    std::vector<CqDesc> cqeList;
+    std::vector<Tick> tickList; /* stage time of each CQE */
+};
+typedef std::shared_ptr<CqeStageBuf> CqeStageBufPtr;
+
+/* Interrupt (MSI-X vector) state of one CQ */
+struct CqIntrState {
+    CqIntrState(uint32_t modCount) {
+        this->armed         = false;
+        this->pendingCqeNum = 0;
+        this->firstCqeTick  = 0;
+        this->lastIntrTick  = 0;
+        this->modCount      = modCount;
+    }
+    bool     armed;         /* armed by the host, disarmed after one interrupt */
+    uint32_t pendingCqeNum; /* CQEs written back since last interrupt */
+    Tick     firstCqeTick;  /* write back time of the first pending CQE */
+    Tick     lastIntrTick;  /* time of last interrupt */
+    uint32_t modCount;      /* CQE count threshold, tuned if moderation is adaptive */
+};
+typedef std::shared_ptr<CqIntrState> CqIntrStatePtr;
+
 
 /* Descriptor read & Data read&write request */
 struct MrReqRsp {
@@ -385,6 +614,8 @@ struct MrReqRsp {
         this->length = len;
         this->offset = vaddr;
         this->qpn = 0xffffffff;
+        this->cqn = 0;
+        this->lane = 0;
         this->wrDataReq = nullptr;
     }
     MrReqRsp(uint8_t type, uint8_t chnl, uint32_t lkey, 
@@ -396,6 +627,8 @@ struct MrReqRsp {
         this->offset = vaddr;
         this->wrDataReq = nullptr;
         this->qpn = qpn;
+        this->cqn = 0;
+        this->lane = 0;
     }
 
     uint8_t  type  ; /* 1 - wreq; 2 - rreq, 3 - rrsp; */
@@ -414,8 +647,11 @@ struct MrReqRsp {
     uint32_t dmaRspNum;     /* number of responded DMA requests */ 
     uint32_t sentPktNum;    /* number of Ethernet packet that has finished */
     uint32_t qpn;
+    uint32_t cqn;           /* CQ of CQE write requests */
+    uint8_t  lane;          /* RDMA engine lane the response goes to */
     uint64_t reqTick;
     struct MptResc *mpt;
+    EthPacketPtr pkt; /* received packet holding wrDataReq, if the data is a view into it */
     union {
         TxDesc  *txDescRsp;
         RxDesc  *rxDescRsp;
@@ -449,6 +685,8 @@ struct CxtReqRsp {
         this->num  = num;
         this->sz   = sz;
         this->idx  = idx;
+        this->lane = 0;
+        this->psn  = 0;
         this->txCqcRsp = nullptr;
     }
     uint8_t type; // 1: qp wreq; 2: qp rreq; 3: qp rrsp; 4: cq rreq; 5: cq rrsp; 6: sq addr req
@@ -456,6 +694,8 @@ struct CxtReqRsp {
     uint32_t num; // Resource num (QPN or CQN).
     uint32_t sz; // request number of the resources, used in qpc read (TX)
     uint8_t  idx; // used to uniquely identify the req pkt */
+    uint8_t  lane; // RDMA engine lane the rsp goes to
+    uint32_t psn;  // PSN of the rx packet, used in qpc read (RX) of UC QP
     uint64_t reqTick;
     union {
         QpcResc  *txQpcRsp;
@@ -478,6 +718,13 @@ const uint8_t CXT_PFCH_QP = 0x08;
 const uint8_t CXT_CHNL_TX = 0x01;
 const uint8_t CXT_CHNL_RX = 0x02;
 
+/* Resources tracked by the prefetcher, see RescPrefetcher */
+const uint8_t PF_QPC = 0x00;
+const uint8_t PF_WQE = 0x01;
+const uint8_t PF_MPT = 0x02;
+const uint8_t PF_MTT = 0x03; /* first MTT of the MPT */
+const uint8_t PF_RESC_NUM = 0x04;
+
 struct DF2DD {
     uint8_t  opcode;
     uint8_t  num;
@@ -501,6 +748,12 @@ struct RA2RG {
     EthPacketPtr txPkt;
 };
 
+struct DmaReq;
+typedef std::shared_ptr<DmaReq> DmaReqPtr;
+/* Completion callback of one DMA request, called exactly once 
+ * when the request is finished by DmaEngine */
+typedef std::function<void(const DmaReqPtr&)> DmaCplCallback;
+
 struct DmaReq {
     DmaReq (Addr addr, int size, Event *event, uint8_t *data, uint32_t chnl=0) {
         this->addr  = addr;
@@ -520,8 +773,9 @@ struct DmaReq {
     uint32_t     chnl  ; /* channel number the request belongs to, see below DMA_REQ_* for details */
     Tick         schd  ; /* when to schedule the event */
     uint8_t      reqType; /* type of request: 0 for read request, 1 for write request */
+    EthPacketPtr pkt   ; /* packet owning data, kept until the DMA port finishes the write */
+    DmaCplCallback cplCallback; /* if set, called on completion instead of scheduling event */
 };
-typedef std::shared_ptr<DmaReq> DmaReqPtr;
 
 struct PendingElem {
     uint8_t idx;
@@ -733,6 +987,11 @@ struct Regs : public Serializable {
 };
 
 // WQE Scheduler relevant
+// state of doorbell record reading
+const uint8_t DBR_IDLE = 0x00; // RNIC is not reading the record
+const uint8_t DBR_READ = 0x01; // reading the record for new WQEs
+const uint8_t DBR_ARM  = 0x02; // armed is written, reading the record again in case of race
+
 struct QPStatusItem {
     QPStatusItem(uint32_t key, uint8_t weight, uint8_t qos_type, uint32_t qpn, uint8_t group_id, uint8_t service_type) {
         this->key                   = key;
@@ -749,6 +1008,12 @@ struct QPStatusItem {
         // this->current_msg_offset    = 0;
         this->fetch_lock            = 0;
         this->in_que                = 0;
+        this->deficit               = 0;
+        this->que_tick              = 0;
+        this->dbr_addr              = 0;
+        this->dbr_state             = DBR_IDLE;
+        this->dbr_pending           = 0;
+        this->dbr_arm               = 1;
         assert(service_type != QP_TYPE_RD);
         switch (service_type) {
             case QP_TYPE_RC:
@@ -785,9 +1050,17 @@ struct QPStatusItem {
     uint8_t group_id;
     uint8_t in_least_que; // This segment indicates the existance in the least priority queue
     uint8_t in_que; // This segment indicates the existance in the low priority queue
+    uint32_t deficit; // DRR deficit counter, bytes the QP may still send
+    Tick que_tick; // when the QP was pushed into the low priority QPN queue
     // This indicates whether it is allowed to fetch WQEs for this QP. 
     // Lock it when send WQE read request; unlock it when WQE splitting is finished.
     uint8_t fetch_lock; 
+    // doorbell record, only used if dbr_addr is not 0
+    uint64_t dbr_addr;
+    uint8_t  dbr_state; // see DBR_* below
+    uint8_t  dbr_pending; // another read is needed after the ongoing one
+    DbRecord dbr_buf; // DMA buffer of doorbell record read
+    uint32_t dbr_arm; // DMA buffer of armed field write
 };
 typedef std::shared_ptr<QPStatusItem> QPStatusPtr;
 
@@ -796,6 +1069,36 @@ struct GroupInfo {
     uint16_t granularity;
 };
 
+/* New weight of one QP, and granularity of its group 
+ * recalculated by the driver with this weight */
+struct QpWeightInfo {
+    uint32_t qpn;
+    uint8_t  weight;
+    uint8_t  groupID;
+    uint16_t granularity;
+};
+
+struct RateLimitInfo {
+    uint8_t  type;  /* RATE_LIMIT_QP or RATE_LIMIT_GROUP */
+    uint32_t id;    /* QPN or group ID */
+    uint32_t rate;  /* in Mbps, 0 removes the limiter */
+    uint32_t burst; /* in bytes */
+};
+
+/* Token bucket of QP or group rate limiter */
+struct TokenBucket {
+    double rate;   /* bytes per tick */
+    double burst;  /* bytes */
+    double tokens; /* bytes, negative when scheduled bytes exceed them */
+    Tick   last;   /* last refill */
+};
+
+struct ThrottledQp {
+    uint32_t qpn;
+    Tick     start;   /* set aside at */
+    Tick     release; /* tokens refilled at */
+};
+
 struct WqeBufferUnit {
     TxDesc desc;
     uint16_t next;
@@ -805,6 +1108,17 @@ struct WqeBufferUnit {
 };
 typedef std::shared_ptr<WqeBufferUnit> WqeBufferUnitPtr;
 
+/* EWMA, the first sample sets the average */
+struct Ewma {
+    double avg;
+    bool sampled;
+    Ewma() : avg(0), sampled(false) { }
+    void sample(double val, double gain) {
+        avg = sampled ? avg + gain * (val - avg) : val;
+        sampled = true;
+    }
+};
+
 struct WqeBufferMetadata {
     uint16_t avaiNum;       // WQE number available in the buffer, unit: WQE
     uint16_t fetchReqNum;   // WQE number requested, excluding prefetch, unit: WQE
@@ -812,21 +1126,22 @@ struct WqeBufferMetadata {
     uint16_t pendingReqNum; // pending WQE request number, including fetch and prefetch, unit: WQE
     uint64_t replaceParam;
     bool replaceLock;
-    WqeBufferMetadata() {
-        this->avaiNum = 0;
-        this->fetchReqNum = 0;
-        this->keepNum = 0;
-        this->pendingReqNum = 0;
-        this->replaceParam = 0;
-        this->replaceLock = false;
-    }
-    WqeBufferMetadata(uint16_t keepNum, uint64_t replaceParam) {
+    /* per QP history for adaptive keepNum */
+    uint32_t lastHead;      // head_ptr at the last prefetch, or when the metadata is created
+    Ewma postRate;          // WQEs posted between two prefetches, unit: WQE
+    Ewma consumeRate;       // WQEs requested each time the QP is served, unit: WQE
+    Ewma missCost;          // time waited for WQEs on a miss, unit: tick
+    Tick missTick;          // start of the miss being waited for, 0 if none
+    WqeBufferMetadata() : WqeBufferMetadata(0, 0, 0) { }
+    WqeBufferMetadata(uint16_t keepNum, uint64_t replaceParam, uint32_t headPtr) {
         this->avaiNum = 0;
         this->fetchReqNum = 0;
         this->keepNum = keepNum;
         this->pendingReqNum = 0;
         this->replaceParam = replaceParam;
         this->replaceLock = false;
+        this->lastHead = headPtr;
+        this->missTick = 0;
     }
 };
 typedef std::shared_ptr<WqeBufferMetadata> WqeBufferMetadataPtr;
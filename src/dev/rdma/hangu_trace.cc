@@ -0,0 +1,60 @@
+/*
+ *======================= START OF LICENSE NOTICE =======================
+ *  NO WARRANTY. THE PRODUCT IS PROVIDED BY DEVELOPER "AS IS" AND ANY
+ *  EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ *  PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL DEVELOPER BE LIABLE FOR
+ *  ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ *  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ *  GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ *  IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ *  OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THE PRODUCT, EVEN
+ *  IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *======================== END OF LICENSE NOTICE ========================
+ */
+
+#include "dev/rdma/hangu_trace.hh"
+
+#include "base/logging.hh"
+#include "base/output.hh"
+#include "sim/core.hh"
+
+HanGuTrace::HanGuTrace(const std::string &file, uint32_t mask, uint32_t bufCap)
+  : mask(0), stream(nullptr), bufUsed(0), recNum(0) {
+
+    if (file.empty() || mask == 0) {
+        return;
+    }
+    assert(bufCap);
+
+    stream = simout.create(file, true)->stream();
+    this->mask = mask;
+    buf.resize(bufCap);
+
+    TraceHeader header;
+    header.magic   = HANGU_TRACE_MAGIC;
+    header.version = HANGU_TRACE_VERSION;
+    header.recSize = sizeof(TraceRecord);
+    header.mask    = mask;
+    header.rsvd    = 0;
+    stream->write((const char *)&header, sizeof(header));
+
+    /* Records still in buffer are written when simulation exits */
+    registerExitCallback([this]() { flush(); });
+}
+
+HanGuTrace::~HanGuTrace() {
+    flush();
+}
+
+void
+HanGuTrace::flush() {
+    if (!stream || bufUsed == 0) {
+        return;
+    }
+    stream->write((const char *)buf.data(), bufUsed * sizeof(TraceRecord));
+    stream->flush();
+    recNum += bufUsed;
+    bufUsed = 0;
+}
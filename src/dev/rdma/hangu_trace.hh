@@ -0,0 +1,140 @@
+/*
+ *======================= START OF LICENSE NOTICE =======================
+ *  NO WARRANTY. THE PRODUCT IS PROVIDED BY DEVELOPER "AS IS" AND ANY
+ *  EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ *  PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL DEVELOPER BE LIABLE FOR
+ *  ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ *  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ *  GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ *  IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ *  OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THE PRODUCT, EVEN
+ *  IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *======================== END OF LICENSE NOTICE ========================
+ */
+
+/**
+ * @file
+ * Binary event trace of Han Gu RNIC.
+ */
+
+#ifndef __RDMA_HANGU_TRACE_HH__
+#define __RDMA_HANGU_TRACE_HH__
+
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "base/types.hh"
+#include "sim/core.hh"
+
+/* Bump when TraceRecord or the IDs below change, 
+ * and keep scripts/hangu_trace.py in sync. */
+#define HANGU_TRACE_MAGIC   0x48475452 /* "HGTR" */
+#define HANGU_TRACE_VERSION 1
+
+/* Module IDs, each one has a bit in the trace mask */
+enum HanGuTraceModule : uint8_t {
+    TRACE_MOD_PIO    = 0,  /* doorbell & command */
+    TRACE_MOD_SCHED  = 1,  /* DescScheduler & WqeBufferManage */
+    TRACE_MOD_TX     = 2,  /* RdmaEngine tx pipeline */
+    TRACE_MOD_RX     = 3,  /* RdmaEngine rx pipeline */
+    TRACE_MOD_MR     = 4,  /* MrRescModule */
+    TRACE_MOD_QPC    = 5,  /* QpcModule */
+    TRACE_MOD_CQC    = 6,  /* CqcModule */
+    TRACE_MOD_DMA    = 7,  /* DmaEngine */
+    TRACE_MOD_INTR   = 8,  /* IntrModule */
+    TRACE_MOD_NUM
+};
+
+/* Event IDs */
+enum HanGuTraceEvent : uint16_t {
+    TRACE_EV_DOORBELL   = 1,  /* qpn, len: WQE num */
+    TRACE_EV_CMD        = 2,  /* psn: modifier, len: opcode */
+    TRACE_EV_WQE_LAUNCH = 3,  /* qpn, len: WQE num */
+    TRACE_EV_PKT_TX     = 4,  /* qpn: dst qpn, psn, len: bytes */
+    TRACE_EV_PKT_RX     = 5,  /* qpn: dst qpn, psn, len: bytes */
+    TRACE_EV_ACK_RX     = 6,  /* qpn: dst qpn, psn, len: bytes */
+    TRACE_EV_MR_REQ     = 7,  /* qpn, psn: channel, len: bytes */
+    TRACE_EV_QPC_REQ    = 8,  /* qpn, psn: channel, len: request type */
+    TRACE_EV_QPC_RSP    = 9,  /* qpn, psn: response fifo, len: request type */
+    TRACE_EV_CQC_REQ    = 10, /* qpn: cqn, psn: channel */
+    TRACE_EV_DMA_RD     = 11, /* len: bytes */
+    TRACE_EV_DMA_WR     = 12, /* len: bytes */
+    TRACE_EV_CQE        = 13, /* qpn: cqn, len: bytes */
+    TRACE_EV_INTR       = 14, /* qpn: cqn, len: CQE num */
+    TRACE_EV_QUANTUM    = 15, /* qpn: active QP num, psn: fetch depth, len: quantum */
+    TRACE_EV_PKT_DROP   = 16, /* qpn, psn, len: bytes */
+};
+
+/* One fixed-size trace record, written as is */
+struct TraceRecord {
+    uint64_t tick;
+    uint32_t qpn;
+    uint32_t psn;
+    uint32_t len;
+    uint16_t event;
+    uint8_t  module;
+    uint8_t  rsvd;
+};
+static_assert(sizeof(TraceRecord) == 24, "TraceRecord layout is part of the file format");
+
+/* File header, followed by TraceRecords */
+struct TraceHeader {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t recSize;
+    uint32_t mask;
+    uint32_t rsvd;
+};
+
+/**
+ * Records are put into an in-memory buffer, and appended to the 
+ * trace file in one write when the buffer is full, or on exit. 
+ * Disabled modules cost one mask test per trace point.
+ */
+class HanGuTrace {
+  public:
+    HanGuTrace(const std::string &file, uint32_t mask, uint32_t bufCap);
+    ~HanGuTrace();
+
+    bool enabled(uint8_t module) const { return mask & (1u << module); }
+
+    void record(uint8_t module, uint16_t event, 
+            uint32_t qpn, uint32_t psn, uint32_t len) {
+        TraceRecord &rec = buf[bufUsed];
+        rec.tick   = curTick();
+        rec.qpn    = qpn;
+        rec.psn    = psn;
+        rec.len    = len;
+        rec.event  = event;
+        rec.module = module;
+        rec.rsvd   = 0;
+        if (++bufUsed == buf.size()) {
+            flush();
+        }
+    }
+
+    /* Append buffered records to the trace file */
+    void flush();
+
+    uint64_t recordNum() const { return recNum + bufUsed; }
+
+  private:
+    uint32_t mask; /* 0 if tracing is disabled */
+    std::ostream *stream;
+    std::vector<TraceRecord> buf;
+    uint32_t bufUsed;
+    uint64_t recNum; /* records flushed */
+};
+
+/* Trace point, rnic is the HanGuRnic the event occurs in */
+#define HANGU_TRACE(rnic, mod, ev, qpn, psn, len) do {              \
+            if ((rnic)->trace.enabled(mod)) {                     \
+                (rnic)->trace.record(mod, ev, qpn, psn, len);     \
+            }                                                     \
+        } while (0)
+
+#endif // __RDMA_HANGU_TRACE_HH__
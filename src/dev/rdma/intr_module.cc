@@ -0,0 +1,215 @@
+#include "dev/rdma/hangu_rnic.hh"
+
+
+#include <algorithm>
+#include <memory>
+#include <queue>
+
+#include "base/trace.hh"
+#include "debug/HanGu.hh"
+#include "sim/stats.hh"
+#include "sim/system.hh"
+
+using namespace HanGuRnicDef;
+using namespace Net;
+using namespace std;
+
+///////////////////////////// HanGuRnic::IntrModule {begin}//////////////////////////////
+CqIntrStatePtr
+HanGuRnic::IntrModule::getIntrState(uint32_t cqn) {
+    if (cqIntrTable.find(cqn) == cqIntrTable.end()) {
+        cqIntrTable[cqn] = make_shared<CqIntrState>(modCount);
+    }
+    return cqIntrTable[cqn];
+}
+
+/**
+ * @note
+ *      Arm the CQ, the next CQE(s) written back raise one interrupt.
+ *      CQEs written before arming are not counted, the host is
+ *      supposed to poll the CQ once more after arming. Staged CQEs
+ *      of this CQ are written back immediately, so that the host
+ *      would not wait for the coalescing timeout.
+ */
+void
+HanGuRnic::IntrModule::armCq(uint32_t cqn) {
+
+    CqIntrStatePtr state = getIntrState(cqn);
+    state->armed = true;
+    state->pendingCqeNum = 0;
+
+    HANGU_PRINT(IntrModule, " IntrModule.armCq: cqn %d\n", cqn);
+
+    rnic->flushCqe(cqn);
+}
+
+/**
+ * @note
+ *      Called when one CQE write (maybe coalesced) is
+ *      finished by the DMA engine.
+ */
+void
+HanGuRnic::IntrModule::cqeWriteCplProc() {
+
+    assert(cqeWriteCplFifo.size());
+    uint32_t cqn = cqeWriteCplFifo.front().first;
+    DmaReqPtr dmaReq = cqeWriteCplFifo.front().second;
+    cqeWriteCplFifo.pop();
+
+    uint32_t num = dmaReq->size / sizeof(CqDesc);
+    cqeNum += num;
+    HANGU_TRACE(rnic, TRACE_MOD_INTR, TRACE_EV_CQE, cqn, 0, dmaReq->size);
+
+    CqIntrStatePtr state = getIntrState(cqn);
+    if (state->armed) {
+        if (state->pendingCqeNum == 0) {
+            state->firstCqeTick = curTick();
+            if (modTime) {
+                modTimerQue.emplace(cqn, curTick());
+                if (!modTimerEvent.scheduled()) {
+                    rnic->schedule(modTimerEvent, curTick() + modTime);
+                }
+            }
+        }
+        state->pendingCqeNum += num;
+
+        HANGU_PRINT(IntrModule, " IntrModule.cqeWriteCplProc: cqn %d, CQE num %d, pending %d\n",
+                cqn, num, state->pendingCqeNum);
+
+        checkIntr(cqn);
+    }
+
+    if (cqeWriteCplFifo.size() && !cqeWriteCplEvent.scheduled()) {
+        rnic->schedule(cqeWriteCplEvent, curTick() + rnic->clockPeriod());
+    }
+}
+
+/* Raise interrupt if the CQ is armed and moderation threshold is reached */
+void
+HanGuRnic::IntrModule::checkIntr(uint32_t cqn) {
+
+    CqIntrStatePtr state = getIntrState(cqn);
+    if (!state->armed || state->pendingCqeNum == 0) {
+        return;
+    }
+
+    /* modTime 0 means no time threshold */
+    if (state->pendingCqeNum >= state->modCount ||
+            (modTime && curTick() - state->firstCqeTick >= modTime)) {
+        raiseIntr(cqn);
+    }
+}
+
+void
+HanGuRnic::IntrModule::raiseIntr(uint32_t cqn) {
+
+    CqIntrStatePtr state = getIntrState(cqn);
+    Tick interval = curTick() - state->lastIntrTick;
+
+    /* Adaptive moderation: interrupts come faster than modTime
+     * means high completion rate, so coalesce more CQEs. */
+    if (adaptive && modTime) {
+        if (interval < modTime) {
+            state->modCount = min(state->modCount * 2, (uint32_t)MAX_INTR_MOD_COUNT);
+        } else if (interval > modTime * 4 && state->modCount > 1) {
+            state->modCount /= 2;
+        }
+    }
+
+    ++intrNum;
+    HANGU_TRACE(rnic, TRACE_MOD_INTR, TRACE_EV_INTR, cqn, 0, state->pendingCqeNum);
+    HANGU_PRINT(IntrModule, " IntrModule.raiseIntr: cqn %d, CQE num %d, interval %ld, modCount %d\n",
+            cqn, state->pendingCqeNum, interval, state->modCount);
+
+    state->armed = false;
+    state->pendingCqeNum = 0;
+    state->lastIntrTick = curTick();
+
+    /* MSI-X message, deliver to the drivers, 
+     * the driver owning this CQ handles it */
+    for (auto &handler : rnic->cqIntrHandler) {
+        handler(cqn);
+    }
+}
+
+void
+HanGuRnic::IntrModule::modTimerProc() {
+
+    while (modTimerQue.size() &&
+            modTimerQue.front().second + modTime <= curTick()) {
+        uint32_t cqn = modTimerQue.front().first;
+        Tick firstCqeTick = modTimerQue.front().second;
+        modTimerQue.pop();
+
+        /* Interrupt may have been raised since then */
+        CqIntrStatePtr state = getIntrState(cqn);
+        if (state->pendingCqeNum && state->firstCqeTick == firstCqeTick) {
+            checkIntr(cqn);
+        }
+    }
+
+    if (modTimerQue.size() && !modTimerEvent.scheduled()) {
+        rnic->schedule(modTimerEvent, modTimerQue.front().second + modTime);
+    }
+}
+
+void
+HanGuRnic::IntrModule::regStats() {
+    cqeNum
+        .name(_name + ".cqeNum")
+        .desc("CQEs written back to CQs");
+
+    intrNum
+        .name(_name + ".intrNum")
+        .desc("CQ interrupts raised");
+
+    cqePerIntr
+        .name(_name + ".cqePerIntr")
+        .desc("CQEs written back per CQ interrupt");
+    cqePerIntr = cqeNum / intrNum;
+}
+
+/* Moderation timers are expired after draining, only CQ states are saved */
+void
+HanGuRnic::IntrModule::serialize(CheckpointOut &cp) const {
+    std::vector<uint32_t> intrCqn, intrPendingCqeNum, intrModCount;
+    std::vector<bool> intrArmed;
+    std::vector<Tick> intrFirstCqeTick, intrLastIntrTick;
+    for (auto &item : cqIntrTable) {
+        intrCqn.push_back(item.first);
+        intrArmed.push_back(item.second->armed);
+        intrPendingCqeNum.push_back(item.second->pendingCqeNum);
+        intrFirstCqeTick.push_back(item.second->firstCqeTick);
+        intrLastIntrTick.push_back(item.second->lastIntrTick);
+        intrModCount.push_back(item.second->modCount);
+    }
+    SERIALIZE_CONTAINER(intrCqn);
+    SERIALIZE_CONTAINER(intrArmed);
+    SERIALIZE_CONTAINER(intrPendingCqeNum);
+    SERIALIZE_CONTAINER(intrFirstCqeTick);
+    SERIALIZE_CONTAINER(intrLastIntrTick);
+    SERIALIZE_CONTAINER(intrModCount);
+}
+
+void
+HanGuRnic::IntrModule::unserialize(CheckpointIn &cp) {
+    std::vector<uint32_t> intrCqn, intrPendingCqeNum, intrModCount;
+    std::vector<bool> intrArmed;
+    std::vector<Tick> intrFirstCqeTick, intrLastIntrTick;
+    UNSERIALIZE_CONTAINER(intrCqn);
+    UNSERIALIZE_CONTAINER(intrArmed);
+    UNSERIALIZE_CONTAINER(intrPendingCqeNum);
+    UNSERIALIZE_CONTAINER(intrFirstCqeTick);
+    UNSERIALIZE_CONTAINER(intrLastIntrTick);
+    UNSERIALIZE_CONTAINER(intrModCount);
+    cqIntrTable.clear();
+    for (size_t i = 0; i < intrCqn.size(); ++i) {
+        CqIntrStatePtr state = make_shared<CqIntrState>(intrModCount[i]);
+        state->armed         = intrArmed[i];
+        state->pendingCqeNum = intrPendingCqeNum[i];
+        state->firstCqeTick  = intrFirstCqeTick[i];
+        state->lastIntrTick  = intrLastIntrTick[i];
+        cqIntrTable[intrCqn[i]] = state;
+    }
+}
+///////////////////////////// HanGuRnic::IntrModule {end}//////////////////////////////
@@ -52,6 +52,9 @@
 /* mailbox page number */
 #define MAILBOX_PAGE_NUM 32
 
+/* command queue depth, each entry owns one mailbox */
+#define CMDQ_DEPTH 8
+
 /* max group number*/
 #define MAX_GROUP_NUM 4096
 /* -------software-hardware interface{end}------- */
@@ -174,6 +177,8 @@ struct kfd_ioctl_write_qpc_args {
     uint8_t  indicator [MAX_QPC_BATCH];
     uint8_t  weight    [MAX_QPC_BATCH];
     uint16_t groupID   [MAX_QPC_BATCH];
+    uint64_t dbr_addr  [MAX_QPC_BATCH]; /* virtual addr of doorbell record, 0 if it is not used */
+    uint8_t  port      [MAX_QPC_BATCH]; /* Ethernet port of the QP, ignored in LAG mode */
 };
 
 struct kfd_ioctl_get_time_args {
@@ -204,6 +209,27 @@ struct kfd_ioctl_update_group_args {
     uint16_t granularity;
 };
 
+struct kfd_ioctl_cq_event_args {
+    /* Input */
+    uint32_t cq_num;
+
+    /* Output */
+    uint32_t event_num; /* number of CQ events consumed by this call */
+};
+
+/* Rate limiter type */
+#define RATE_LIMIT_QP    0
+#define RATE_LIMIT_GROUP 1
+
+struct kfd_ioctl_set_rate_limit_args {
+    /* Input */
+    uint32_t limit_num;
+    uint8_t  type [MAX_QPC_BATCH]; /* RATE_LIMIT_QP or RATE_LIMIT_GROUP */
+    uint32_t id   [MAX_QPC_BATCH]; /* QPN or group ID */
+    uint32_t rate [MAX_QPC_BATCH]; /* in Mbps, 0 removes the limiter */
+    uint32_t burst[MAX_QPC_BATCH]; /* token bucket depth, in bytes */
+};
+
 
 #define HGKFD_IOCTL_BASE 'K'
 #define HGKFD_IO(nr)			( _IO(HGKFD_IOCTL_BASE, nr)         )
@@ -253,7 +279,19 @@ struct kfd_ioctl_update_group_args {
 #define HGKFD_IOC_UPDATE_QP_WEIGHT \
         HGKFD_IOWR(0x0e, struct kfd_ioctl_update_group_args)
 
+#define HGKFD_IOC_REQ_NOTIFY_CQ \
+        HGKFD_IOW(0x0f, struct kfd_ioctl_cq_event_args)
+
+#define HGKFD_IOC_GET_CQ_EVENT \
+        HGKFD_IOWR(0x10, struct kfd_ioctl_cq_event_args)
+
+#define HGKFD_IOC_SET_RATE_LIMIT \
+        HGKFD_IOW(0x11, struct kfd_ioctl_set_rate_limit_args)
+
+#define HGKFD_IOC_CHECKPOINT \
+        HGKFD_IOW(0x12, void)
+
 #define HGKFD_COMMAND_START    0x01
-#define HGKFD_COMMAND_END      0x0b
+#define HGKFD_COMMAND_END      0x13
 
 #endif
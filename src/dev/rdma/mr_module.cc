@@ -41,8 +41,11 @@ HanGuRnic::MrRescModule::MrRescModule (HanGuRnic *i, const std::string n,
     onFlyMptPrefetchReqNum(0),
     transReqEvent([this]{ transReqProcessing();}, n),
     mptCache(i, mptCacheNum, n + ".MptCache"),
-    mttCache(i, mttCacheNum, n + ".MttCache")
-    { }
+    mttCache(i, mttCacheNum, n + ".MttCache") {
+    /* Prefetched entries replaced before use */
+    mptCache.evictNotify = [i](uint32_t idx) { i->rescPrefetcher.pfEvict(PF_MPT, idx); };
+    mttCache.evictNotify = [i](uint32_t idx) { i->rescPrefetcher.pfEvict(PF_MTT, idx); };
+}
 
 
 bool 
@@ -57,18 +60,18 @@ HanGuRnic::MrRescModule::isMRMatching (MptResc * mptResc, MrReqRspPtr mrReq) {
 void 
 HanGuRnic::MrRescModule::mptReqProcess (MrReqRspPtr mrReq) {
     mrReq->reqTick = curTick();
+    HANGU_TRACE(rnic, TRACE_MOD_MR, TRACE_EV_MR_REQ, mrReq->qpn, mrReq->chnl, mrReq->length);
+    if (mrReq->chnl == MR_RCHNL_TX_DATA) {
+        rnic->rescPrefetcher.pfUse(PF_MPT, mrReq->lkey, mptCache.isCached(mrReq->lkey));
+    }
 
     /* Read MPT entry */
     // mptCache.rescRead(mrReq->lkey, &mptRspEvent, mrReq);
-    if (
-        #ifdef CACHE_ALL_CQ_MPT
-        mrReq->chnl == TPT_WCHNL_TX_CQUE || mrReq->chnl == TPT_WCHNL_RX_CQUE ||
-        #endif
-        #ifdef CACHE_ALL_QP_MPT
-        mrReq->chnl == MR_RCHNL_RX_DESC || mrReq->chnl == MR_RCHNL_TX_DESC ||
-        mrReq->chnl == MR_RCHNL_TX_DESC_PREFETCH || mrReq->chnl == MR_RCHNL_TX_DESC_FETCH ||
-        #endif
-        0
+    if ((rnic->cacheAllCqMpt && 
+            (mrReq->chnl == TPT_WCHNL_TX_CQUE || mrReq->chnl == TPT_WCHNL_RX_CQUE)) || 
+        (rnic->cacheAllQpMpt && 
+            (mrReq->chnl == MR_RCHNL_RX_DESC || mrReq->chnl == MR_RCHNL_TX_DESC ||
+             mrReq->chnl == MR_RCHNL_TX_DESC_PREFETCH || mrReq->chnl == MR_RCHNL_TX_DESC_FETCH))
     ) {
         if (cqMpt.find(mrReq->lkey) == cqMpt.end()) {
             mptCache.rescRead(mrReq->lkey, &mptRspEvent, mrReq);
@@ -100,6 +103,10 @@ HanGuRnic::MrRescModule::mptReqProcess (MrReqRspPtr mrReq) {
 void 
 HanGuRnic::MrRescModule::mttReqProcess (uint64_t mttIdx, MrReqRspPtr mrReq) {
     
+    if (mrReq->chnl == MR_RCHNL_TX_DATA) {
+        rnic->rescPrefetcher.pfUse(PF_MTT, mttIdx, mttCache.isCached(mttIdx));
+    }
+
     /* Read MTT entry */
     mttCache.rescRead(mttIdx, &mttRspEvent, mrReq);
     onFlyMttRdReqNum++;
@@ -118,14 +125,22 @@ HanGuRnic::MrRescModule::dmaReqProcess (uint64_t pAddr, MrReqRspPtr mrReq, uint3
         switch (mrReq->chnl) {
           case TPT_WCHNL_TX_CQUE:
           case TPT_WCHNL_RX_CQUE:
-            dmaWreq = make_shared<DmaReq>(rnic->pciToDma(pAddr), mrReq->length, 
+            /* IntrModule is notified when the CQE write is finished */
+            dmaWreq = makePooled<DmaReq>(rnic->pciToDma(pAddr), mrReq->length, 
                     nullptr, mrReq->data + offset, 0); /* last parameter is useless here */
+            dmaWreq->cplCallback = [this, cqn = mrReq->cqn](const DmaReqPtr &dmaReq) {
+                rnic->intrModule.cqeWriteCplFifo.emplace(cqn, dmaReq);
+                if (!rnic->intrModule.cqeWriteCplEvent.scheduled()) {
+                    rnic->schedule(rnic->intrModule.cqeWriteCplEvent, curTick() + rnic->clockPeriod());
+                }
+            };
             rnic->cqDmaWriteFifo.push(dmaWreq);
             break;
           case TPT_WCHNL_TX_DATA:
           case TPT_WCHNL_RX_DATA:
-            dmaWreq = make_shared<DmaReq>(rnic->pciToDma(pAddr), length, 
+            dmaWreq = makePooled<DmaReq>(rnic->pciToDma(pAddr), length, 
                     nullptr, mrReq->data + offset, 0); /* last parameter is useless here */
+            dmaWreq->pkt = mrReq->pkt;
             rnic->dataDmaWriteFifo.push(dmaWreq);
 
             break;
@@ -145,8 +160,8 @@ HanGuRnic::MrRescModule::dmaReqProcess (uint64_t pAddr, MrReqRspPtr mrReq, uint3
             case MR_RCHNL_TX_DESC_FETCH:
             case MR_RCHNL_TX_DESC_PREFETCH:
                 /* Post desc dma req to DMA engine */
-                dmaRdReq = make_shared<DmaReq>(rnic->pciToDma(pAddr), mrReq->length, 
-                        &dmaRrspEvent, mrReq->data + offset, 0); /* last parameter is useless here */
+                dmaRdReq = makePooled<DmaReq>(rnic->pciToDma(pAddr), mrReq->length, 
+                        nullptr, mrReq->data + offset, 0); /* last parameter is useless here */
                 rnic->descDmaReadFifo.push(dmaRdReq);
                 // update on fly request count
                 onFlyDescDmaRdReqNum++;
@@ -156,8 +171,8 @@ HanGuRnic::MrRescModule::dmaReqProcess (uint64_t pAddr, MrReqRspPtr mrReq, uint3
             case MR_RCHNL_TX_DATA:
             case MR_RCHNL_RX_DATA:
                 /* Post data dma req to DMA engine */
-                dmaRdReq = make_shared<DmaReq>(rnic->pciToDma(pAddr), length, 
-                        &dmaRrspEvent, mrReq->data + offset, 0); /* last parameter is useless here */
+                dmaRdReq = makePooled<DmaReq>(rnic->pciToDma(pAddr), length, 
+                        nullptr, mrReq->data + offset, 0); /* last parameter is useless here */
                 rnic->dataDmaReadFifo.push(dmaRdReq);
                 // update on fly request count
                 onFlyDataDmaRdReqNum++;
@@ -168,10 +183,17 @@ HanGuRnic::MrRescModule::dmaReqProcess (uint64_t pAddr, MrReqRspPtr mrReq, uint3
                 panic("Illegal MR request channel: %d!\n", mrReq->chnl);
         }
 
-        /* Push to Fifo, and dmaRrspProcessing 
-         * will fetch for processing */   
-        dmaReq2RspFifo.emplace(mrReq, dmaRdReq);
-        HANGU_PRINT(MrResc, "push DMA read req into dmaReq2RspFifo, fifo asize: %d, type: %d, mttnum: %d\n", dmaReq2RspFifo.size(), mrReq->chnl, mrReq->mttNum);
+        /* When the read rsp is back, push it to dmaRrspFifo, and 
+         * dmaRrspProcessing will fetch for processing. Rsp of 
+         * different requests may come back in any order, MR response 
+         * order is kept by pendingMrReqQueue. */
+        dmaRdReq->cplCallback = [this, mrReq](const DmaReqPtr &dmaReq) {
+            dmaRrspFifo.emplace(mrReq, dmaReq);
+            if (!dmaRrspEvent.scheduled()) {
+                rnic->schedule(dmaRrspEvent, curTick() + rnic->clockPeriod());
+            }
+        };
+        HANGU_PRINT(MrResc, "post DMA read req, type: %d, mttnum: %d\n", mrReq->chnl, mrReq->mttNum);
         assert(dmaRdReq->size != 0);
 
         /* Schedule for fetch cached resources through dma read. */
@@ -209,7 +231,7 @@ void HanGuRnic::MrRescModule::mrRspProcessing() {
     pendingMrReqQueue[chnl].pop();
     Event *event;
     RxDescPtr rxDesc;
-    TxDescPtr txDesc;
+    TxDesc *txDesc;
     switch (mrReqRsp->chnl) {
         // WQE fetching and prefetching are impossible to be out-of-order
         case MR_RCHNL_TX_DESC:
@@ -218,7 +240,7 @@ void HanGuRnic::MrRescModule::mrRspProcessing() {
             event = &rnic->wqeBufferManage.wqeReadRspEvent;
             rnic->wqeBufferManage.wqeRspQue.push(mrReqRsp);
             for (uint32_t i = 0; (i * sizeof(TxDesc)) < mrReqRsp->length; ++i) {
-                txDesc = make_shared<TxDesc>(mrReqRsp->txDescRsp + i);
+                txDesc = mrReqRsp->txDescRsp + i;
                 HANGU_PRINT(MrResc, "channel: %d, txDesc length: %d, lVaddr: 0x%x, opcode: %d, qpn: 0x%x\n", 
                     mrReqRsp->chnl, txDesc->len, txDesc->lVaddr, txDesc->opcode, mrReqRsp->qpn);
                 assert(txDesc->len != 0);
@@ -232,27 +254,27 @@ void HanGuRnic::MrRescModule::mrRspProcessing() {
                 rnic->txdescRspFifo.size(), mrReqRsp->length);
             break;
         case MR_RCHNL_RX_DESC:
-            event = &rnic->rdmaEngine.rcvRpuEvent;
+            event = &rnic->rdmaEngines[mrReqRsp->lane]->rcvRpuEvent;
             for (uint32_t i = 0; (i * sizeof(RxDesc)) < mrReqRsp->length; ++i) {
-                rxDesc = make_shared<RxDesc>(mrReqRsp->rxDescRsp + i);
+                rxDesc = makePooled<RxDesc>(mrReqRsp->rxDescRsp + i);
                 assert((rxDesc->len != 0) && (rxDesc->lVaddr != 0));
-                rnic->rxdescRspFifo.push(rxDesc);
+                rnic->rdmaEngines[mrReqRsp->lane]->rxdescRspFifo.push(rxDesc);
             }
             delete mrReqRsp->rxDescRsp;
-            HANGU_PRINT(MrResc, "dmaRrspProcessing: rnic->rxdescRspFifo.size() is %d!\n", 
-                    rnic->rxdescRspFifo.size());
+            HANGU_PRINT(MrResc, "dmaRrspProcessing: rxdescRspFifo.size() is %d!\n", 
+                    rnic->rdmaEngines[mrReqRsp->lane]->rxdescRspFifo.size());
             break;
         case MR_RCHNL_TX_DATA:
-            event = &rnic->rdmaEngine.rgrrEvent;
-            rnic->txdataRspFifo.push(mrReqRsp);
+            event = &rnic->rdmaEngines[mrReqRsp->lane]->rgrrEvent;
+            rnic->rdmaEngines[mrReqRsp->lane]->txdataRspFifo.push(mrReqRsp);
             onFlyDataMrRdReqNum--;
             HANGU_PRINT(MrResc, "MR module receives a complete data MR response, on-fly request count: %d, txdataRspFifo size: %d\n", 
-                onFlyDataMrRdReqNum, rnic->txdataRspFifo.size());
+                onFlyDataMrRdReqNum, rnic->rdmaEngines[mrReqRsp->lane]->txdataRspFifo.size());
             assert(onFlyDataMrRdReqNum >= 0);
             break;
         case MR_RCHNL_RX_DATA:
-            event = &rnic->rdmaEngine.rdCplRpuEvent;
-            rnic->rxdataRspFifo.push(mrReqRsp);
+            event = &rnic->rdmaEngines[mrReqRsp->lane]->rdCplRpuEvent;
+            rnic->rdmaEngines[mrReqRsp->lane]->rxdataRspFifo.push(mrReqRsp);
             break;
         default:
             panic("TPT CHNL error, there should only exist RCHNL type!\n");
@@ -279,25 +301,23 @@ void HanGuRnic::MrRescModule::mrRspProcessing() {
 void 
 HanGuRnic::MrRescModule::dmaRrspProcessing() {
 
-    HANGU_PRINT(MrResc, "dmaRrspProcessing! FIFO size: %d\n", dmaReq2RspFifo.size());
+    HANGU_PRINT(MrResc, "dmaRrspProcessing! FIFO size: %d\n", dmaRrspFifo.size());
 
-    /* If empty, just return */
-    if (dmaReq2RspFifo.empty() || 0 == dmaReq2RspFifo.front().second->rdVld) {
-        HANGU_PRINT(MrResc, "DMA read response not ready!\n");
-        return;
-    }
+    /* Only scheduled by DMA completion, so there must be a rsp */
+    assert(dmaRrspFifo.size());
+    assert(dmaRrspFifo.front().second->rdVld);
 
     /* Get dma rrsp data */
-    MrReqRspPtr tptRsp = dmaReq2RspFifo.front().first;
+    MrReqRspPtr tptRsp = dmaRrspFifo.front().first;
     HANGU_PRINT(MrResc, "DMA read response received by MR module, MR request length: %d, DMA request length: %d, dmaRspNum: %d, mttNum: %d, mttRspNum: %d, qpn: 0x%x\n", 
-        tptRsp->length, dmaReq2RspFifo.front().second->size, tptRsp->dmaRspNum, tptRsp->mttNum, tptRsp->mttRspNum, tptRsp->qpn);
+        tptRsp->length, dmaRrspFifo.front().second->size, tptRsp->dmaRspNum, tptRsp->mttNum, tptRsp->mttRspNum, tptRsp->qpn);
     assert(tptRsp->dmaRspNum < tptRsp->mttNum);
     assert(tptRsp->dmaRspNum < tptRsp->mttRspNum);
     tptRsp->dmaRspNum++;
-    dmaReq2RspFifo.pop();
+    dmaRrspFifo.pop();
 
     if (tptRsp->type == DMA_TYPE_WREQ) {
-        panic("mrReq type error, write type req cannot put into dmaReq2RspFifo\n");
+        panic("mrReq type error, write type req cannot put into dmaRrspFifo\n");
     }
     tptRsp->type = DMA_TYPE_RRSP;
 
@@ -338,8 +358,8 @@ HanGuRnic::MrRescModule::dmaRrspProcessing() {
         }
     }
 
-    /* Schedule myself if next elem in FIFO is ready */
-    if (dmaReq2RspFifo.size() && dmaReq2RspFifo.front().second->rdVld) {
+    /* Schedule myself if more rsp came back in the meantime */
+    if (dmaRrspFifo.size()) {
         if (!dmaRrspEvent.scheduled()) { /* Schedule myself */
             rnic->schedule(dmaRrspEvent, curTick() + rnic->clockPeriod());
         }
@@ -377,20 +397,18 @@ HanGuRnic::MrRescModule::mptRspProcessing() {
     assert(onFlyMptRdReqNum >= 0);
 
     // cache all CQ MPT
-    #ifdef CACHE_ALL_CQ_MPT
-    if (reqPkt->chnl == TPT_WCHNL_TX_CQUE || reqPkt->chnl == TPT_WCHNL_RX_CQUE) {
+    if (rnic->cacheAllCqMpt && 
+        (reqPkt->chnl == TPT_WCHNL_TX_CQUE || reqPkt->chnl == TPT_WCHNL_RX_CQUE)) {
         cqMpt[mptResc->key] = mptResc;
     }
-    #endif
-    #ifdef CACHE_ALL_QP_MPT
-    if (reqPkt->chnl == MR_RCHNL_TX_DESC || 
-        reqPkt->chnl == MR_RCHNL_RX_DESC || 
-        reqPkt->chnl == MR_RCHNL_TX_DESC_PREFETCH || 
-        reqPkt->chnl == MR_RCHNL_TX_DESC_FETCH
+    if (rnic->cacheAllQpMpt && 
+        (reqPkt->chnl == MR_RCHNL_TX_DESC || 
+         reqPkt->chnl == MR_RCHNL_RX_DESC || 
+         reqPkt->chnl == MR_RCHNL_TX_DESC_PREFETCH || 
+         reqPkt->chnl == MR_RCHNL_TX_DESC_FETCH)
     ) {
         qpMpt[mptResc->key] = mptResc;
     }
-    #endif
 
     if (reqPkt->chnl == MR_RCHNL_TX_MPT_PREFETCH) {
         assert(rnic->rescPrefetcher.mrPrefetchFlag[mptResc->key] == true);
@@ -419,6 +437,10 @@ HanGuRnic::MrRescModule::mptRspProcessing() {
     else {
         reqPkt->mttNum = (reqPkt->length + (reqPkt->offset % PAGE_SIZE)) / PAGE_SIZE + 1;
     }
+    if (reqPkt->chnl == MR_RCHNL_TX_MPT_PREFETCH) {
+        /* only the first MTT of the request is prefetched */
+        reqPkt->mttNum = 1;
+    }
     reqPkt->mttRspNum   = 0;
     reqPkt->dmaRspNum   = 0;
     reqPkt->sentPktNum  = 0;
@@ -434,6 +456,12 @@ HanGuRnic::MrRescModule::mptRspProcessing() {
     /* Post mtt req */
     // modified by mazhenlong
     for (int i = 0; i < reqPkt->mttNum; i++) {
+        if (reqPkt->chnl == MR_RCHNL_TX_MPT_PREFETCH) {
+            if (mttCache.isCached(mttIdx + i)) {
+                continue;
+            }
+            rnic->rescPrefetcher.pfIssue(PF_MTT, mttIdx + i);
+        }
         mttReqProcess(mttIdx + i, reqPkt);
     }
 
@@ -616,4 +644,61 @@ HanGuRnic::MrRescModule::transReqProcessing() {
         }
     }
 }
+bool
+HanGuRnic::MrRescModule::isIdle() {
+    for (auto &item : pendingMrReqQueue) {
+        if (item.second.size()) {
+            return false;
+        }
+    }
+    return dmaRrspFifo.empty() && cqMptRspQue.empty() && qpMptRspQue.empty() && 
+            mptCache.isIdle() && mttCache.isIdle();
+}
+
+/* MPT entries held outside of mptCache are saved as raw bytes */
+void
+HanGuRnic::MrRescModule::serialize(CheckpointOut &cp) const {
+    mptCache.serializeSection(cp, "mptCache");
+    mttCache.serializeSection(cp, "mttCache");
+
+    std::vector<uint32_t> cqMptKey, qpMptKey;
+    std::vector<uint8_t> cqMptData, qpMptData;
+    for (auto &item : cqMpt) {
+        cqMptKey.push_back(item.first);
+        rawAppend(cqMptData, *item.second);
+    }
+    for (auto &item : qpMpt) {
+        qpMptKey.push_back(item.first);
+        rawAppend(qpMptData, *item.second);
+    }
+    SERIALIZE_CONTAINER(cqMptKey);
+    SERIALIZE_CONTAINER(cqMptData);
+    SERIALIZE_CONTAINER(qpMptKey);
+    SERIALIZE_CONTAINER(qpMptData);
+}
+
+void
+HanGuRnic::MrRescModule::unserialize(CheckpointIn &cp) {
+    mptCache.unserializeSection(cp, "mptCache");
+    mttCache.unserializeSection(cp, "mttCache");
+
+    std::vector<uint32_t> cqMptKey, qpMptKey;
+    std::vector<uint8_t> cqMptData, qpMptData;
+    UNSERIALIZE_CONTAINER(cqMptKey);
+    UNSERIALIZE_CONTAINER(cqMptData);
+    UNSERIALIZE_CONTAINER(qpMptKey);
+    UNSERIALIZE_CONTAINER(qpMptData);
+    cqMpt.clear();
+    qpMpt.clear();
+    for (size_t i = 0; i < cqMptKey.size(); ++i) {
+        MptResc *mpt = new MptResc;
+        rawGet(*mpt, cqMptData, i);
+        cqMpt[cqMptKey[i]] = mpt;
+    }
+    for (size_t i = 0; i < qpMptKey.size(); ++i) {
+        MptResc *mpt = new MptResc;
+        rawGet(*mpt, qpMptData, i);
+        qpMpt[qpMptKey[i]] = mpt;
+    }
+}
 ///////////////////////////// HanGuRnic::Translation & Protection Table {end}//////////////////////////////
@@ -40,8 +40,8 @@ HanGuRnic::PendingStruct::pushElemProc() {
     pushFifo.pop();
 
     HANGU_PRINT(CxtResc, " PendingStruct.pushElemProc: qpn %d idx %d chnl %d\n", pElem->qpn, pElem->idx, pElem->chnl);
-    assert((pElem->qpn & QPN_MASK) <= QPN_NUM);
-    assert((pElem->reqPkt->num & QPN_MASK) <= QPN_NUM);
+    assert((pElem->qpn & QPN_MASK) <= rnic->qpnNum);
+    assert((pElem->reqPkt->num & QPN_MASK) <= rnic->qpnNum);
     assert(qpcReq != nullptr);
 
     /* post pElem to pendingFifo */
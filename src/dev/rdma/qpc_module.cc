@@ -21,6 +21,7 @@ using namespace std;
 ///////////////////////////// HanGuRnic::QpcModule {begin}//////////////////////////////
 bool 
 HanGuRnic::QpcModule::postQpcReq(CxtReqRspPtr qpcReq) {
+    HANGU_TRACE(rnic, TRACE_MOD_QPC, TRACE_EV_QPC_REQ, qpcReq->num, qpcReq->chnl, qpcReq->type);
     assert( (qpcReq->type == CXT_RREQ_QP) || 
             (qpcReq->type == CXT_RREQ_SQ) ||
             (qpcReq->type == CXT_CREQ_QP) ||
@@ -50,6 +51,8 @@ bool qpcTxUpdate (QpcResc &resc, uint32_t sz) {
     if (resc.qpType == QP_TYPE_RC) {
         resc.ackPsn += sz;
         resc.sndPsn += sz;
+    } else if (resc.qpType == QP_TYPE_UC) {
+        resc.sndPsn += sz; /* no ACK for UC */
     }
     resc.sndWqeOffset += sz * sizeof(TxDesc);
     if (resc.sndWqeOffset + sizeof(TxDesc) > (1 << resc.sqSizeLog)) {
@@ -59,10 +62,23 @@ bool qpcTxUpdate (QpcResc &resc, uint32_t sz) {
     return true;
 }
 
-bool qpcRxUpdate (QpcResc &resc) {
+/**
+ * @note
+ * UC packet behind expPsn is dropped by RPU (see rpuProcessing), 
+ * it consumes no receive WQE. A packet beyond expPsn means packets 
+ * before it are lost, it is accepted and expPsn is resynchronized 
+ * to it, so that the following packets are accepted.
+*/
+bool qpcRxUpdate (QpcResc &resc, uint32_t psn) {
     if (resc.qpType == QP_TYPE_RC) {
         resc.expPsn += 1;
         HANGU_PRINT(CxtResc, "RC QP qpcRxUpdate, QPN: 0x%x, dst QPN: 0x%x, epsn: %d\n", resc.srcQpn, resc.destQpn, resc.expPsn);
+    } else if (resc.qpType == QP_TYPE_UC) {
+        if (psnBehind(psn, resc.expPsn)) {
+            return true;
+        }
+        resc.expPsn = psn + 1;
+        HANGU_PRINT(CxtResc, "UC QP qpcRxUpdate, QPN: 0x%x, psn: %d, epsn: %d\n", resc.srcQpn, psn, resc.expPsn);
     }
     resc.rcvWqeOffset += sizeof(RxDesc);
     if (resc.rcvWqeOffset + sizeof(RxDesc) > (1 << resc.rqSizeLog)) {
@@ -80,6 +96,7 @@ HanGuRnic::QpcModule::hitProc(uint8_t chnlNum, CxtReqRspPtr qpcReq) {
 
     HANGU_PRINT(CxtResc, " QpcModule.qpcReqProc.readProc.hitProc: qpn 0x%x hit, chnlNum %d idx %d\n", 
             qpcReq->txQpcRsp->srcQpn, chnlNum, qpcReq->idx);
+    HANGU_TRACE(rnic, TRACE_MOD_QPC, TRACE_EV_QPC_RSP, qpcReq->num, chnlNum, qpcReq->type);
 
     /* Post rsp to related fifo, schedule related rsp receiving module */
     Event *e;
@@ -92,15 +109,17 @@ HanGuRnic::QpcModule::hitProc(uint8_t chnlNum, CxtReqRspPtr qpcReq) {
         uint32_t sz = qpcReq->sz;
         qpcCache.updateEntry(qpcReq->num, [sz](QpcResc &qpc) { return qpcTxUpdate(qpc, sz); });
 
-        txQpcRspFifo.push(qpcReq);
-        e = &rnic->rdmaEngine.dpuEvent;
+        rnic->rdmaEngines[qpcReq->lane]->txQpcRspFifo.push(qpcReq);
+        e = &rnic->rdmaEngines[qpcReq->lane]->dpuEvent;
     } else if (chnlNum == 2) { // rxQpcRspFifo
         /* update after read */
-        qpcCache.updateEntry(qpcReq->num, [](QpcResc &qpc) { return qpcRxUpdate(qpc); });
+        uint32_t psn = qpcReq->psn;
+        qpcCache.updateEntry(qpcReq->num, [psn](QpcResc &qpc) { return qpcRxUpdate(qpc, psn); });
 
-        rxQpcRspFifo.push(qpcReq);
-        e = &rnic->rdmaEngine.rpuEvent;
+        rnic->rdmaEngines[qpcReq->lane]->rxQpcRspFifo.push(qpcReq);
+        e = &rnic->rdmaEngines[qpcReq->lane]->rpuEvent;
     } else if (chnlNum == 3) {
+        rnic->rescPrefetcher.qpcPfetchRspFifo.push(qpcReq);
         e = &rnic->rescPrefetcher.qpcPfetchRspProcEvent;
     }
     else {
@@ -118,8 +137,15 @@ HanGuRnic::QpcModule::readProc(uint8_t chnlNum, CxtReqRspPtr qpcReq) {
     assert(qpcReq->txQpcRsp != nullptr);
     if (qpcReq->type == CXT_PFCH_QP) {
         if (qpcCache.lookupHit(qpcReq->num)) {
+            delete qpcReq->txQpcRsp;
             return true;
         }
+        if (qpnHashMap.find(qpcReq->num) == qpnHashMap.end()) {
+            rnic->rescPrefetcher.pfIssue(PF_QPC, qpcReq->num);
+        }
+    } else {
+        /* late if the prefetch is still pending in qpnHashMap */
+        rnic->rescPrefetcher.pfUse(PF_QPC, qpcReq->num, qpcCache.lookupHit(qpcReq->num));
     }
     accessNum++;
     /* Lookup qpnHashMap to learn that if there's 
@@ -131,7 +157,7 @@ HanGuRnic::QpcModule::readProc(uint8_t chnlNum, CxtReqRspPtr qpcReq) {
         HANGU_PRINT(CxtResc, " QpcModule.qpcReqProc.readProc: qpnMap.size() %d get_size() %d\n", 
                 qpnHashMap.size(), pendStruct.get_size());
         /* save req to pending fifo */
-        PendingElemPtr pElem =  make_shared<PendingElem>(qpcReq->idx, chnlNum, qpcReq, false); // new PendingElem(qpcReq->idx, chnlNum, qpcReq, false);
+        PendingElemPtr pElem =  makePooled<PendingElem>(qpcReq->idx, chnlNum, qpcReq, false); // new PendingElem(qpcReq->idx, chnlNum, qpcReq, false);
         pendStruct.push_elem(pElem);
         HANGU_PRINT(CxtResc, " QpcModule.qpcReqProc.readProc: qpnMap.size() %d get_size() %d\n", 
                 qpnHashMap.size(), pendStruct.get_size());
@@ -152,7 +178,7 @@ HanGuRnic::QpcModule::readProc(uint8_t chnlNum, CxtReqRspPtr qpcReq) {
         /* save req to pending fifo */
         HANGU_PRINT(CxtResc, " QpcModule.qpcReqProc.readProc: qpnMap.size() %d get_size() %d\n", 
                 qpnHashMap.size(), pendStruct.get_size());
-        PendingElemPtr pElem = make_shared<PendingElem>(qpcReq->idx, chnlNum, qpcReq, true);
+        PendingElemPtr pElem = makePooled<PendingElem>(qpcReq->idx, chnlNum, qpcReq, true);
         pendStruct.push_elem(pElem);
         HANGU_PRINT(CxtResc, " QpcModule.qpcReqProc.readProc: qpnMap.size() %d get_size() %d\n", 
                 qpnHashMap.size(), pendStruct.get_size());
@@ -222,7 +248,7 @@ HanGuRnic::QpcModule::qpcAccess() {
             }
             HANGU_PRINT(CxtResc, " QpcModule.qpcReqProc.qpcAccess: qpn: 0x%x, chnlIdx %d, idx %d rtnCnt %d\n", 
                     qpcReq->num, this->chnlIdx, qpcReq->idx, rtnCnt);
-            assert((qpcReq->num & QPN_MASK) <= QPN_NUM);
+            assert((qpcReq->num & QPN_MASK) <= rnic->qpnNum);
             readProc(this->chnlIdx, qpcReq);
             /* Point to next chnl */
             ++this->chnlIdx;
@@ -249,6 +275,7 @@ HanGuRnic::QpcModule::writeOne(CxtReqRspPtr qpcReq) {
         /* get replaced qpc */
         uint32_t wbQpn = qpcCache.replaceEntry();
         QpcResc* qpc = qpcCache.deleteEntry(wbQpn);
+        rnic->rescPrefetcher.pfEvict(PF_QPC, wbQpn);
         HANGU_PRINT(CxtResc, " QpcModule.writeOne: get replaced qpc 0x%x(%d)\n", wbQpn, (wbQpn & RESC_LIM_MASK));
         
         /* get related icm addr */
@@ -265,7 +292,7 @@ HanGuRnic::QpcModule::writeOne(CxtReqRspPtr qpcReq) {
 
 void 
 HanGuRnic::QpcModule::storeMem(uint64_t paddr, QpcResc *qpc) {
-    DmaReqPtr dmaReq = make_shared<DmaReq>(paddr, sizeof(QpcResc), 
+    DmaReqPtr dmaReq = makePooled<DmaReq>(paddr, sizeof(QpcResc), 
             nullptr, (uint8_t *)qpc, 0); /* last param is useless here */
     dmaReq->reqType = 1; /* this is a write request */
     rnic->cacheDmaAccessFifo.push(dmaReq);
@@ -283,12 +310,20 @@ HanGuRnic::QpcModule::loadMem(CxtReqRspPtr qpcReq) {
     PendingElemPtr pElem = pendStruct.front_elem();
     HANGU_PRINT(CxtResc, " QpcModule.loadMem: qpn 0x%x chnl %d has_dma %d, idx %d\n", 
             pElem->qpn, pElem->chnl, pElem->has_dma, pElem->idx);
-    assert((pElem->qpn & QPN_MASK) <= QPN_NUM);
+    assert((pElem->qpn & QPN_MASK) <= rnic->qpnNum);
 
     /* get qpc request icm addr, and post read request to ICM memory */
     uint64_t paddr = qpcIcm.num2phyAddr(qpcReq->num);
-    DmaReqPtr dmaReq = make_shared<DmaReq>(paddr, sizeof(QpcResc), 
-            &qpcRspProcEvent, (uint8_t *)qpcReq->txQpcReq, 0); /* last param is useless here */
+    DmaReqPtr dmaReq = makePooled<DmaReq>(paddr, sizeof(QpcResc), 
+            nullptr, (uint8_t *)qpcReq->txQpcReq, 0); /* last param is useless here */
+    /* qpc dma read cpl pkt is retired in order by pendStruct */
+    dmaReq->cplCallback = [this](const DmaReqPtr &rsp) {
+        assert(rsp->size == sizeof(QpcResc));
+        rnic->qpcDmaRdCplFifo.push(rsp);
+        if (!qpcRspProcEvent.scheduled()) {
+            rnic->schedule(qpcRspProcEvent, curTick() + rnic->clockPeriod());
+        }
+    };
     rnic->cacheDmaAccessFifo.push(dmaReq);
     if (!rnic->dmaEngine.dmaReadEvent.scheduled()) {
         rnic->schedule(rnic->dmaEngine.dmaReadEvent, curTick() + rnic->clockPeriod());
@@ -439,4 +474,58 @@ HanGuRnic::QpcModule::qpcReqProc() {
         }
     }
 }
+void
+HanGuRnic::QpcModule::flushCache() {
+    std::vector<std::pair<uint32_t, QpcResc *>> entries;
+    qpcCache.deleteAll(entries);
+    for (auto &item : entries) {
+        storeMem(qpcIcm.num2phyAddr(item.first), item.second);
+    }
+    HANGU_PRINT(CxtResc, " QpcModule.flushCache: write back %d qpc\n", entries.size());
+}
+
+bool
+HanGuRnic::QpcModule::isIdle() {
+    return !isReqValidRun() && pendStruct.get_size() == 0 && 
+            qpnHashMap.empty() && txQpAddrRspFifo.empty() && 
+            qpcRspFifo[0].empty() && qpcRspFifo[1].empty() && 
+            qpcRspFifo[2].empty();
+}
+
+void
+HanGuRnic::QpcModule::serialize(CheckpointOut &cp) const {
+    SERIALIZE_SCALAR(accessNum);
+    SERIALIZE_SCALAR(missNum);
+    SERIALIZE_SCALAR(hitNum);
+
+    qpcIcm.serializeSection(cp, "qpcIcm");
+    qpcCache.serializeSection(cp, "qpcCache");
+}
+
+void
+HanGuRnic::QpcModule::unserialize(CheckpointIn &cp) {
+    UNSERIALIZE_SCALAR(accessNum);
+    UNSERIALIZE_SCALAR(missNum);
+    UNSERIALIZE_SCALAR(hitNum);
+
+    qpcIcm.unserializeSection(cp, "qpcIcm");
+    qpcCache.unserializeSection(cp, "qpcCache");
+
+    /* Restored into a smaller cache, keep the excess entries until 
+     * startup, no DMA may be issued while restoring. */
+    restoreWb.clear();
+    while (qpcCache.lookupOver()) {
+        uint32_t wbQpn = qpcCache.replaceEntry();
+        restoreWb.emplace_back(wbQpn, qpcCache.deleteEntry(wbQpn));
+    }
+}
+
+void
+HanGuRnic::QpcModule::restoreWriteBack() {
+    for (auto &item : restoreWb) {
+        storeMem(qpcIcm.num2phyAddr(item.first), item.second);
+        HANGU_PRINT(CxtResc, " QpcModule.restoreWriteBack: write back qpc 0x%x\n", item.first);
+    }
+    restoreWb.clear();
+}
 ///////////////////////////// HanGuRnic::QpcModule {end}//////////////////////////////
@@ -50,8 +50,7 @@ HanGuRnic::RdmaEngine::dfuProcessing () {
     /* Get doorbell rrelated to the qpc
      * If the index fifo is empty, reschedule ccu.dfu event */
     assert(rnic->doorbellVector[idx] != nullptr);
-    DoorbellPtr dbell = rnic->doorbellVector[idx];
-    rnic->doorbellVector[idx] = nullptr;
+    DoorbellPtr dbell = std::move(rnic->doorbellVector[idx]);
     rnic->df2ccuIdxFifo.push(idx);
     if ((rnic->df2ccuIdxFifo.size() == 1) && rnic->pio2ccuDbFifo.size()) { 
         if (!rnic->doorbellProcEvent.scheduled()) {
@@ -68,7 +67,7 @@ HanGuRnic::RdmaEngine::dfuProcessing () {
             qpcRsp->txQpcRsp->sndWqeBaseLkey, dbell->qpn, dbell->num, dbell->opcode, dbell->offset);
 
     /* Post Descriptor read request to MR Module */
-    MrReqRspPtr descReq = make_shared<MrReqRsp>(DMA_TYPE_RREQ, MR_RCHNL_TX_DESC,
+    MrReqRspPtr descReq = makePooled<MrReqRsp>(DMA_TYPE_RREQ, MR_RCHNL_TX_DESC,
             qpcRsp->txQpcRsp->sndWqeBaseLkey, 
             txDescLenSel(dbell->num) << 5, dbell->offset);
     descReq->txDescRsp = new TxDesc[dbell->num];
@@ -87,10 +86,22 @@ HanGuRnic::RdmaEngine::dfuProcessing () {
     HANGU_PRINT(RdmaEngine, " RdmaEngine.dfuProcessing: out!\n");
 }
 
+/**
+ * @note DDU has a doorbell in process, or one to start.
+ */
+bool
+HanGuRnic::RdmaEngine::dduHasWork () {
+    return !allowNewDb || df2ddFifoH.size() || dduPreempted || df2ddFifo.size();
+}
+
 /**
  * @note Called by dduEvent, I am scheduled by MrRescModule.dmaRrspProcessing
  *       and myself.
  *       
+ *       Doorbells of LAT_QP are served first. A bulk doorbell in process is 
+ *       preempted at sub-WQE (packet) boundary by them, and resumed when 
+ *       no LAT_QP doorbell is left.
+ *       
  *       This function is used to read QPC from CxtRescModule. We request the 
  *       QPC even if last cycle we request the same QPC (though this QPC is 
  *       decayed). We did this beacuse we hope Context Module knows the QPC 
@@ -103,8 +114,9 @@ HanGuRnic::RdmaEngine::dduProcessing () {
     
     // HANGU_PRINT(RdmaEngine, " RdmaEngine.dduProcessing!\n");
 
-    // make sure that on fly data request number does not exceed DATA_REQ_LIMIT
-    if ((std::count(dd2dpVector.begin(), dd2dpVector.end(), nullptr) > dd2dpVector.size() - DATA_REQ_LIMIT) || 1)
+    // make sure that on fly data request number does not exceed dataReqLimit
+    if (rnic->dataReqLimit == 0 || 
+        dd2dpVector.size() - std::count(dd2dpVector.begin(), dd2dpVector.end(), nullptr) < rnic->dataReqLimit)
     {
         /* If there's no valid idx, exit the schedule */
         if (dp2ddIdxFifo.size() == 0) {
@@ -114,13 +126,37 @@ HanGuRnic::RdmaEngine::dduProcessing () {
 
         if (this->allowNewDb) {
             /* Fetch Doorbell from DFU fifo */
-            assert(df2ddFifo.size());
             assert(this->dduDbell == nullptr);
-            this->dduDbell = df2ddFifo.front();
-            df2ddFifo.pop();
+            if (df2ddFifoH.size()) {
+                this->dduDbell = std::move(df2ddFifoH.front());
+                df2ddFifoH.pop();
+                this->dduDbellHigh = true;
+            }
+            else if (dduPreempted) {
+                this->dduDbell = std::move(dduPreempted);
+                this->dduDbellHigh = false;
+            }
+            else {
+                assert(df2ddFifo.size());
+                this->dduDbell = std::move(df2ddFifo.front());
+                df2ddFifo.pop();
+                this->dduDbellHigh = false;
+            }
             this->allowNewDb = false;
             HANGU_PRINT(RdmaEngine, " RdmaEngine.dduProcessing: Get one Doorbell!\n");
         }
+        else if (!dduDbellHigh && df2ddFifoH.size())
+        {
+            /* Preempt the bulk doorbell, its left sub-WQEs wait in txDescLaunchQue */
+            assert(dduPreempted == nullptr);
+            dduPreempted = std::move(this->dduDbell);
+            this->dduDbell = std::move(df2ddFifoH.front());
+            df2ddFifoH.pop();
+            this->dduDbellHigh = true;
+            ++latPreemptNum;
+            HANGU_PRINT(RdmaEngine, " RdmaEngine.dduProcessing: preempt qpn 0x%x by qpn 0x%x\n", 
+                    dduPreempted->qpn, dduDbell->qpn);
+        }
         else 
         {
             HANGU_PRINT(RdmaEngine, " Not allow new DB!\n");
@@ -131,14 +167,26 @@ HanGuRnic::RdmaEngine::dduProcessing () {
         //                                      * txDescFifo should have items */
         // TxDescPtr txDesc = rnic->txdescRspFifo.front();
         // rnic->txdescRspFifo.pop();
-        assert(rnic->txDescLaunchQue.size());
-        TxDescPtr txDesc = rnic->txDescLaunchQue.front();
-        rnic->txDescLaunchQue.pop();
+        TxDescPtr txDesc;
+        if (dduDbellHigh) {
+            assert(txDescLaunchQueH.size());
+            txDesc = txDescLaunchQueH.front();
+            txDescLaunchQueH.pop();
+            latLaunchWait.sample(curTick() - latLaunchTick.front());
+            latLaunchTick.pop();
+            ++latLaunchNum;
+        }
+        else {
+            assert(txDescLaunchQue.size());
+            txDesc = txDescLaunchQue.front();
+            txDescLaunchQue.pop();
+            rnic->descScheduler.laneDrained(lane);
+        }
 
         /* Put one descriptor to waiting Memory */
         HANGU_PRINT(RdmaEngine, " RdmaEngine.dduProcessing: desc->len 0x%x, desc->lkey 0x%x, desc->lvaddr 0x%x, desc->opcode 0x%x, desc->flags 0x%x, dduDbell->qpn 0x%x, dduDbell->num: %d\n", 
                 txDesc->len, txDesc->lkey, txDesc->lVaddr, txDesc->opcode, txDesc->flags, dduDbell->qpn, dduDbell->num);
-        HANGU_PRINT(RdmaEngine, "WQE left in queue: %d\n", rnic->txDescLaunchQue.size());
+        HANGU_PRINT(RdmaEngine, "WQE left in queue: %d\n", txDescLaunchQue.size());
         uint8_t idx = dp2ddIdxFifo.front();
         dp2ddIdxFifo.pop();
         assert(dd2dpVector[idx] == nullptr);
@@ -150,8 +198,9 @@ HanGuRnic::RdmaEngine::dduProcessing () {
         // }
 
         /* Post qp read request to QpcModule */
-        CxtReqRspPtr qpcRdReq = make_shared<CxtReqRsp>(CXT_RREQ_QP, CXT_CHNL_TX, dduDbell->qpn, 1, idx); /* dduDbell->num */
+        CxtReqRspPtr qpcRdReq = makePooled<CxtReqRsp>(CXT_RREQ_QP, CXT_CHNL_TX, dduDbell->qpn, 1, idx); /* dduDbell->num */
         qpcRdReq->txQpcRsp = new QpcResc;
+        qpcRdReq->lane = lane;
         rnic->qpcModule.postQpcReq(qpcRdReq);
 
         /* update allowNewDb */
@@ -164,28 +213,28 @@ HanGuRnic::RdmaEngine::dduProcessing () {
     }
     else
     {
-        HANGU_PRINT(RdmaEngine, " RdmaEngine.dduProcessing: on fly data request number exceeds DATA_REQ_LIMIT: %d\n", 
+        HANGU_PRINT(RdmaEngine, " RdmaEngine.dduProcessing: on fly data request number exceeds dataReqLimit: %d\n", 
             std::count(dd2dpVector.begin(), dd2dpVector.end(), nullptr));
     }
 
     /* Schedule myself again if there's new descriptor
      * or there remains descriptors to post */
-    if (dp2ddIdxFifo.size() && rnic->txDescLaunchQue.size() && 
-            ((allowNewDb && df2ddFifo.size()) || (!allowNewDb))) 
+    if (dp2ddIdxFifo.size() && dduHasWork()) 
     {
         if (!dduEvent.scheduled()) { /* Schedule myself */
             rnic->schedule(dduEvent, curTick() + rnic->clockPeriod());
         }
     }
     else {
-        HANGU_PRINT(RdmaEngine, "dp2ddIdxFifo.size: %d, rnic->txDescLaunchQue.size: %d, allowNewDb: %B, df2ddFifo.size: %d\n", 
-            dp2ddIdxFifo.size(), rnic->txDescLaunchQue.size(), allowNewDb, df2ddFifo.size());
+        HANGU_PRINT(RdmaEngine, "dp2ddIdxFifo.size: %d, txDescLaunchQue.size: %d, allowNewDb: %B, df2ddFifo.size: %d\n", 
+            dp2ddIdxFifo.size(), txDescLaunchQue.size(), allowNewDb, df2ddFifo.size());
     }
 
     if (startDetect == false) { 
         startDetect = true;
+        detectHostTime = std::chrono::steady_clock::now();
         if (!detectNetRateEvent.scheduled()) {
-            rnic->schedule(detectNetRateEvent, curTick() + rnic->clockPeriod());
+            rnic->schedule(detectNetRateEvent, curTick() + rnic->clockPeriod() * NET_DETECT_PERIOD);
         }
     }
 
@@ -198,6 +247,7 @@ HanGuRnic::RdmaEngine::getRdmaHeadSize (uint8_t opcode, uint8_t qpType) {
       case OPCODE_SEND :
         switch (qpType) {
           case QP_TYPE_RC:
+          case QP_TYPE_UC:
             return PKT_BTH_SZ;
           case QP_TYPE_UD:
             return PKT_BTH_SZ + PKT_DETH_SZ;
@@ -206,6 +256,8 @@ HanGuRnic::RdmaEngine::getRdmaHeadSize (uint8_t opcode, uint8_t qpType) {
             return 0;
         }
       case OPCODE_RDMA_WRITE:
+        assert(qpType == QP_TYPE_RC || qpType == QP_TYPE_UC);
+        return PKT_BTH_SZ + PKT_RETH_SZ;
       case OPCODE_RDMA_READ:
         assert(qpType == QP_TYPE_RC);
         return PKT_BTH_SZ + PKT_RETH_SZ;
@@ -226,13 +278,14 @@ HanGuRnic::RdmaEngine::dpuProcessing () {
 
     HANGU_PRINT(RdmaEngine, " RdmaEngine.dpuProcessing!\n");
 
-    if (dp2rgFifo.size() < DATA_REQ_LIMIT || 1) {
+    if (rnic->dataReqLimit == 0 || dp2rgFifo.size() < rnic->dataReqLimit) {
         /* Get Context from Context Module */
-        assert(rnic->qpcModule.txQpcRspFifo.size());
-        CxtReqRspPtr dpuQpc = rnic->qpcModule.txQpcRspFifo.front();
-        rnic->qpcModule.txQpcRspFifo.pop();
+        assert(txQpcRspFifo.size());
+        CxtReqRspPtr dpuQpc = txQpcRspFifo.front();
+        txQpcRspFifo.pop();
         assert((dpuQpc->txQpcRsp->qpType == QP_TYPE_RC) ||
-                (dpuQpc->txQpcRsp->qpType == QP_TYPE_UD)); /* we should only use RC and UD type QP */
+                (dpuQpc->txQpcRsp->qpType == QP_TYPE_UC) ||
+                (dpuQpc->txQpcRsp->qpType == QP_TYPE_UD)); /* we should only use RC, UC and UD type QP */
 
         /* Get one descriptor entry from RdmaEngine.dduProcessing */
         HANGU_PRINT(RdmaEngine, " RdmaEngine.dpuProcessing: num 0x%x, idx %d\n", dpuQpc->num, dpuQpc->idx);
@@ -240,7 +293,7 @@ HanGuRnic::RdmaEngine::dpuProcessing () {
         assert(dd2dpVector[idx] != nullptr);
         TxDescPtr desc = dd2dpVector[idx];
         dd2dpVector[idx] = nullptr;
-        assert(desc->len <= 16384); // TO DO: the final step is to remove this
+        assert(desc->len <= MAX_SUB_WQE_LEN);
         HANGU_PRINT(RdmaEngine, " RdmaEngine.dpuProcessing:"
                     " Get descriptor entry from RdmaEngine.dduProcessing, qpn: 0x%x, len: %d, lkey: %d, opcode: %d, rkey: %d\n", 
                     dpuQpc->txQpcRsp->srcQpn, desc->len, desc->lkey, desc->opcode, desc->rdmaType.rkey);
@@ -251,15 +304,17 @@ HanGuRnic::RdmaEngine::dpuProcessing () {
         // bug fix: 20240301
         if ((dp2ddIdxFifo.size() == 1) && 
             //  rnic->txdescRspFifo.size() && 
-             ((allowNewDb && df2ddFifo.size()) || (!allowNewDb))) {
+             dduHasWork()) {
             if (!dduEvent.scheduled()) {
                 rnic->schedule(dduEvent, curTick() + rnic->clockPeriod());
             }
         }
 
         /* Generate request packet (RDMA read/write, send) */
-        EthPacketPtr txPkt = std::make_shared<EthPacketData>(16384); // TODO: modify size here
-        txPkt->length = ETH_ADDR_LEN * 2 + getRdmaHeadSize(desc->opcode, dpuQpc->txQpcRsp->qpType); /* ETH_ADDR_LEN * 2 means length of 2 MAC addr */
+        uint32_t headLen = ETH_ADDR_LEN * 2 + getRdmaHeadSize(desc->opcode, dpuQpc->txQpcRsp->qpType); /* ETH_ADDR_LEN * 2 means length of 2 MAC addr */
+        EthPacketPtr txPkt = EthPacketPool::alloc(
+                (desc->opcode == OPCODE_RDMA_READ) ? headLen : headLen + desc->len);
+        txPkt->length = headLen;
 
         /* Post Descriptor & QPC & request packet pointer to RdmaEngine.rguProcessing */
         DP2RGPtr dp2rg = make_shared<DP2RG>();
@@ -278,9 +333,10 @@ HanGuRnic::RdmaEngine::dpuProcessing () {
                 /* Post Data read request to Data Read Request FIFO.
                 * Fetch data from host memory */
                 // HANGU_PRINT(RdmaEngine, " RdmaEngine.dpuProcessing: Push Data read request to MrRescModule.transReqProcessing: len %d vaddr 0x%x\n", desc->len, desc->lVaddr);
-                rreq = make_shared<MrReqRsp>(DMA_TYPE_RREQ, MR_RCHNL_TX_DATA,
+                rreq = makePooled<MrReqRsp>(DMA_TYPE_RREQ, MR_RCHNL_TX_DATA,
                         desc->lkey, desc->len, (uint32_t)(desc->lVaddr&0xFFF), dp2rg->qpc->srcQpn);
                 rreq->rdDataRsp = txPkt->data + txPkt->length; /* Address Rsp data (from host memory) should be located */
+                rreq->lane = lane;
                 rnic->dataReqFifo.push(rreq);
                 if (!rnic->mrRescModule.transReqEvent.scheduled()) {
                     rnic->schedule(rnic->mrRescModule.transReqEvent, curTick() + rnic->clockPeriod());
@@ -305,7 +361,7 @@ HanGuRnic::RdmaEngine::dpuProcessing () {
     }
 
     /* Recall myself if there's new descriptor and QPC */
-    if (rnic->qpcModule.txQpcRspFifo.size()) {
+    if (txQpcRspFifo.size()) {
         if (!dpuEvent.scheduled()) { /* Schedule myself */
             rnic->schedule(dpuEvent, curTick() + rnic->clockPeriod());
         }
@@ -332,13 +388,14 @@ HanGuRnic::RdmaEngine::rdmaReadRsp(EthPacketPtr rxPkt, WindowElemPtr winElem) {
     HANGU_PRINT(RdmaEngine, " RdmaEngine.RGRRU.rdmaReadRsp\n");
 
     // Post Data Wrte request to fifo
-    MrReqRspPtr dataWreq = make_shared<MrReqRsp>(
+    MrReqRspPtr dataWreq = makePooled<MrReqRsp>(
                 DMA_TYPE_WREQ, TPT_WCHNL_TX_DATA,
                 winElem->txDesc->lkey, 
                 winElem->txDesc->len, 
                 (uint32_t)(winElem->txDesc->lVaddr & 0xFFF));
-    dataWreq->wrDataReq = new uint8_t[dataWreq->length]; /* copy data, because the packet will be deleted soon */
-    memcpy(dataWreq->wrDataReq, rxPkt->data + ETH_ADDR_LEN * 2 + PKT_BTH_SZ + PKT_AETH_SZ, dataWreq->length);
+    /* no copy, the packet is kept until the data is written to memory */
+    dataWreq->wrDataReq = rxPkt->data + ETH_ADDR_LEN * 2 + PKT_BTH_SZ + PKT_AETH_SZ;
+    dataWreq->pkt = rxPkt;
     rnic->dataReqFifo.push(dataWreq);
 
     HANGU_PRINT(RdmaEngine, " RdmaEngine.RGRRU.RRU.rdmaReadRsp: RDMA read Data is: %s\n", dataWreq->wrDataReq);
@@ -366,13 +423,14 @@ HanGuRnic::RdmaEngine::postTxCpl(uint8_t qpType, uint32_t qpn,
     }
     
     /* Post related info into scu Fifo */
-    CqDescPtr cqDesc = make_shared<CqDesc>(qpType, 
+    CqDescPtr cqDesc = makePooled<CqDesc>(qpType, 
             desc->opcode, desc->len, qpn, cqn);
     rg2scFifo.push(cqDesc);
 
     /* Post Cqc req to CqcModule */
-    CxtReqRspPtr cqcRdReq = make_shared<CxtReqRsp>(CXT_RREQ_CQ, CXT_CHNL_TX, cqn);
+    CxtReqRspPtr cqcRdReq = makePooled<CxtReqRsp>(CXT_RREQ_CQ, CXT_CHNL_TX, cqn);
     cqcRdReq->txCqcRsp = new CqcResc;
+    cqcRdReq->lane = lane;
     rnic->cqcModule.postCqcReq(cqcRdReq);
 
     HANGU_PRINT(RdmaEngine, " RdmaEngine.RGRRU.postTxCpl: out!\n");
@@ -555,11 +613,11 @@ HanGuRnic::RdmaEngine::rguProcessing () {
     // txPktToSend->length = ETH_ADDR_LEN * 2 + getRdmaHeadSize(desc->opcode, qpc->qpType); /* ETH_ADDR_LEN * 2 means length of 2 MAC addr */
     
     if (desc->opcode == OPCODE_SEND || desc->opcode == OPCODE_RDMA_WRITE) {
-        HANGU_PRINT(RdmaEngine, "rguProcessing: txdataRspFifo size: %d\n", rnic->txdataRspFifo.size());
+        HANGU_PRINT(RdmaEngine, "rguProcessing: txdataRspFifo size: %d\n", txdataRspFifo.size());
 
-        assert(rnic->txdataRspFifo.size());
-        rspData = rnic->txdataRspFifo.front();
-        rnic->txdataRspFifo.pop();
+        assert(txdataRspFifo.size());
+        rspData = txdataRspFifo.front();
+        txdataRspFifo.pop();
         assert(rspData->sentPktNum < rspData->mttNum);
         assert(rspData->qpn == qpc->srcQpn);
 
@@ -587,7 +645,7 @@ HanGuRnic::RdmaEngine::rguProcessing () {
 
     // Set MAC address
     uint64_t dmac, lmac;
-    if (qpc->qpType == QP_TYPE_RC) {
+    if (qpc->qpType == QP_TYPE_RC || qpc->qpType == QP_TYPE_UC) {
         dmac = qpc->dLid;
         lmac = qpc->lLid;
     } else if (qpc->qpType == QP_TYPE_UD) {
@@ -614,7 +672,7 @@ HanGuRnic::RdmaEngine::rguProcessing () {
         HANGU_PRINT(RdmaEngine, " RdmaEngine.RGRRU.rguProcessing: Need ACK (RC type)!\n");
 
         /* Post Packet to send window */
-        WindowElemPtr winElem = make_shared<WindowElem>(txPkt, qpc->srcQpn, 
+        WindowElemPtr winElem = makePooled<WindowElem>(txPkt, qpc->srcQpn, 
                 qpc->sndPsn, desc);
         if (sndWindowList.find(qpc->srcQpn) == sndWindowList.end()) { // sndWindowList[qpc->srcQpn] == nullptr
             sndWindowList[qpc->srcQpn] = new WinMapElem;
@@ -640,6 +698,7 @@ HanGuRnic::RdmaEngine::rguProcessing () {
         /* Update the state of send window.  
          * If window is full, block RC transmission */
         ++windowSize;
+        ++winPktNum;
         windowFull = (windowSize >= windowCap);
 
         HANGU_PRINT(RdmaEngine, "need ACK! RdmaEngine.RGRRU.rguProcessing: qpn: 0x%x, first psn: %d, last psn: %d, windowSize %d\n", 
@@ -648,10 +707,7 @@ HanGuRnic::RdmaEngine::rguProcessing () {
     
     /* Post Send Packet. Schedule RdmaEngine.sauProcessing 
      * to Send Packet through Ethernet Interface. */
-    txsauFifo.push(txPkt);
-    if (!sauEvent.scheduled()) {
-        rnic->schedule(sauEvent, curTick() + rnic->clockPeriod());
-    }
+    postTxPkt(txPkt, rnic->homePort(qpc), qpc->srcQpn, desc->len);
     messageEnd = true; /* Just ignore it now. */
 
     // update on fly packet number, ONLY FOR RC CONNECTIONS
@@ -660,7 +716,7 @@ HanGuRnic::RdmaEngine::rguProcessing () {
     }
 
     /* Update QPC */
-    if (qpc->qpType == QP_TYPE_RC) {
+    if (qpc->qpType == QP_TYPE_RC || qpc->qpType == QP_TYPE_UC) {
         ++qpc->sndPsn;
     }
 
@@ -697,7 +753,7 @@ HanGuRnic::RdmaEngine::rguProcessing () {
 
 bool
 HanGuRnic::RdmaEngine::isReqGen() {
-    return dp2rgFifo.size() && (rnic->txdataRspFifo.size() ||
+    return dp2rgFifo.size() && (txdataRspFifo.size() ||
             (dp2rgFifo.front()->desc->opcode == OPCODE_RDMA_READ));
 }
 
@@ -794,6 +850,38 @@ void HanGuRnic::RdmaEngine::setRdmaHead(TxDescPtr desc, QpcResc* qpc, uint8_t* p
                 ((RETH *) pktPtr)->rVaddr_l, ((RETH *) pktPtr)->rVaddr_h, 
                 ((RETH *) pktPtr)->rKey, ((RETH *) pktPtr)->len);
     } 
+    else if (qpc->qpType == QP_TYPE_UC && 
+            (desc->opcode == OPCODE_SEND || desc->opcode == OPCODE_RDMA_WRITE))  { /* UC Send & RDMA Write */
+
+        HANGU_PRINT(RdmaEngine, " RdmaEngine.RGRRU.rguProcessing: UC send or RDMA Write!\n");
+
+        /* Add BTH header, no ACK is requested, so the packet 
+         * does not enter send window and completes on transmit. 
+         * PSN is still carried for the receiver to detect loss. */
+        uint8_t trans = (desc->opcode == OPCODE_SEND) ? 
+                PKT_TRANS_SEND_ONLY : PKT_TRANS_RWRITE_ONLY;
+        bthOp = ((qpc->qpType << 5) | trans) << 24;
+        if (desc->isQueUpdate()) {
+            needAck = 0x02;
+        }
+        else {
+            needAck = 0x00;
+        }
+        ((BTH *) pktPtr)->op_destQpn = bthOp | qpc->destQpn;
+        ((BTH *) pktPtr)->needAck_psn = (needAck << 24) | qpc->sndPsn;
+        HANGU_PRINT(RdmaEngine, " RdmaEngine.RGRRU.rguProcessing: "
+                "BTH head: 0x%x 0x%x\n", 
+                ((BTH *) pktPtr)->op_destQpn, ((BTH *) pktPtr)->needAck_psn);
+        pktPtr += PKT_BTH_SZ;
+
+        if (desc->opcode == OPCODE_RDMA_WRITE) {
+            // Add RETH header
+            ((RETH *) pktPtr)->rVaddr_l = desc->rdmaType.rVaddr_l;
+            ((RETH *) pktPtr)->rVaddr_h = desc->rdmaType.rVaddr_h;
+            ((RETH *) pktPtr)->rKey = desc->rdmaType.rkey;
+            ((RETH *) pktPtr)->len = desc->len;
+        }
+    }
     else if (qpc->qpType == QP_TYPE_RC && desc->opcode == OPCODE_RDMA_READ)  { /* RC RDMA Read */
         
         HANGU_PRINT(RdmaEngine, " RdmaEngine.RGRRU.rguProcessing: RC RDMA Write!\n");
@@ -869,8 +957,8 @@ void HanGuRnic::RdmaEngine::setRdmaHead(TxDescPtr desc, QpcResc* qpc, uint8_t* p
 void
 HanGuRnic::RdmaEngine::rgrrProcessing () {
 
-    // HANGU_PRINT(RdmaEngine, " RdmaEngine.rgrrProcessing: dp2rgFifo.size %d rnic->txdataRspFifo %d\n", 
-    //         dp2rgFifo.size(), rnic->txdataRspFifo.size());
+    // HANGU_PRINT(RdmaEngine, " RdmaEngine.rgrrProcessing: dp2rgFifo.size %d txdataRspFifo %d\n", 
+    //         dp2rgFifo.size(), txdataRspFifo.size());
     // HANGU_PRINT(RdmaEngine, " RdmaEngine.rgrrProcessing: isRspRecv %d isReqGen %d windowSize %d\n", 
     //         isRspRecv(), isReqGen(), windowSize);
     
@@ -899,33 +987,20 @@ HanGuRnic::RdmaEngine::scuProcessing () {
 
     HANGU_PRINT(RdmaEngine, " RdmaEngine.scuProcessing!\n");
 
-    assert(rnic->txCqcRspFifo.size());
+    assert(txCqcRspFifo.size());
     
     HANGU_PRINT(RdmaEngine, " RdmaEngine.scuProcessing: cq offset: %d, cq lkey %d, qpn 0x%x, cqn 0x%x, transtype: %d\n", 
-            rnic->txCqcRspFifo.front()->txCqcRsp->offset, 
-            rnic->txCqcRspFifo.front()->txCqcRsp->lkey, 
+            txCqcRspFifo.front()->txCqcRsp->offset, 
+            txCqcRspFifo.front()->txCqcRsp->lkey, 
             rg2scFifo.front()->qpn, rg2scFifo.front()->cqn, rg2scFifo.front()->transType);
     
-    /* Get Cq addr lkey, and post CQ WC to TPT */
-    MrReqRspPtr cqWreq = make_shared<MrReqRsp>(DMA_TYPE_WREQ, TPT_WCHNL_TX_CQUE,
-            rnic->txCqcRspFifo.front()->txCqcRsp->lkey, sizeof(CqDesc), 
-            rnic->txCqcRspFifo.front()->txCqcRsp->offset);
-    rnic->txCqcRspFifo.pop();
-    cqWreq->cqDescReq = new CqDesc(rg2scFifo.front()->srvType, 
-                                    rg2scFifo.front()->transType, 
-                                    rg2scFifo.front()->byteCnt, 
-                                    rg2scFifo.front()->qpn, 
-                                    rg2scFifo.front()->cqn);
+    /* Get Cq addr lkey, and stage CQ WC before posting to TPT */
+    rnic->stageCqe(TPT_WCHNL_TX_CQUE, txCqcRspFifo.front()->txCqcRsp, rg2scFifo.front());
+    txCqcRspFifo.pop();
     rg2scFifo.pop();
-    rnic->cqWreqFifo.push(cqWreq);
-
-    // Schedule tarnsReq event(TPT) to post CQ WC to TPT
-    if (!rnic->mrRescModule.transReqEvent.scheduled()) { // If not scheduled yet, schedule the event.
-        rnic->schedule(rnic->mrRescModule.transReqEvent, curTick() + rnic->clockPeriod());
-    }
 
     /* Schedule myself if still has elem in fifo */
-    if (!rnic->txCqcRspFifo.empty() && !rg2scFifo.empty()) {
+    if (!txCqcRspFifo.empty() && !rg2scFifo.empty()) {
         if (!scuEvent.scheduled()) {
             rnic->schedule(scuEvent, curTick() + rnic->clockPeriod());
         }
@@ -938,24 +1013,33 @@ HanGuRnic::RdmaEngine::scuProcessing () {
 }
 
 
-void
-HanGuRnic::RdmaEngine::sauProcessing () {
+Tick
+HanGuRnic::RdmaEngine::sauProcessing (uint8_t port) {
 
-    HANGU_PRINT(RdmaEngine, " RdmaEngine.sauProcessing! txsauFifo size: %d\n", txsauFifo.size());
+    std::queue<SauPkt> &txsauFifo = this->txsauFifo[port];
+    HANGU_PRINT(RdmaEngine, " RdmaEngine.sauProcessing! port %d, txsauFifo size: %d\n", port, txsauFifo.size());
 
     if (txsauFifo.empty()) {
-        return;
+        return rnic->clockPeriod();
     }
 
+    /* Address the port of the peer mirroring my tx port, from 
+     * the MAC of my tx port (see PORT_MAC_BYTE). The packet may 
+     * have been moved here from a failed port. */
+    EthPacketPtr txPkt = txsauFifo.front().pkt;
+    txPkt->data[PORT_MAC_BYTE] = port;
+    txPkt->data[ETH_ADDR_LEN + PORT_MAC_BYTE] = port;
+
     /**
-     * unit: ps
+     * unit: ps, no serialization delay in fast-forward
      */
-    Tick bwDelay = txsauFifo.front()->length * rnic->etherBandwidth;
+    Tick bwDelay = rnic->fastForward ? rnic->clockPeriod() : 
+            txPkt->length * rnic->etherBandwidth;
 
     /* Used only for Debug Print */
-    // uint8_t *dmac = txsauFifo.front()->data;
-    // uint8_t *smac = txsauFifo.front()->data + ETH_ADDR_LEN;
-    BTH *bth = (BTH *)(txsauFifo.front()->data + ETH_ADDR_LEN * 2);
+    // uint8_t *dmac = txPkt->data;
+    // uint8_t *smac = txPkt->data + ETH_ADDR_LEN;
+    BTH *bth = (BTH *)(txPkt->data + ETH_ADDR_LEN * 2);
     uint8_t type = (bth->op_destQpn >> 24) & 0x1f;
     uint8_t srv  = bth->op_destQpn >> 29;
     // for (int i = 0; i < ETH_ADDR_LEN; ++i) {
@@ -965,57 +1049,151 @@ HanGuRnic::RdmaEngine::sauProcessing () {
 
     }
     HANGU_PRINT(RdmaEngine, " RdmaEngine.sauProcessing, type: %d, srv: %d, op_destQpn: 0x%x, BW %dps/byte, len %d, bwDelay %d, txsauFifo size: %d\n", 
-            type, srv, bth->op_destQpn, rnic->etherBandwidth, txsauFifo.front()->length, bwDelay, txsauFifo.size());
-
-    // if this is the end of a subWQE batch, self-minus unsentBatchNum to control the pop rate of descScheduler
-    if (bth->needAck_psn >> 25 == 1) {
-        assert(rnic->descScheduler.unsentBatchNum > 0);
-        rnic->descScheduler.unsentBatchNum--;
-        HANGU_PRINT(RdmaEngine, "type: %d\n", type);
-        assert(type == PKT_TRANS_SEND_ONLY || type == PKT_TRANS_RWRITE_ONLY || type == PKT_TRANS_RREAD_ONLY);
-        HANGU_PRINT(RdmaEngine, " RdmaEngine.sauProcessing, finish a batch! unsentBatchNum: %d, op_destQpn: 0x%x\n", rnic->descScheduler.unsentBatchNum, bth->op_destQpn);
-    }
-    if (rnic->descScheduler.unsentBatchNum < UNSENT_BATCH_NUM_THRESHOLD) {
-        if ((rnic->descScheduler.highPriorityQpnQue.size() > 0 || rnic->descScheduler.lowPriorityQpnQue.size() > 0) && 
-            !rnic->descScheduler.wqePrefetchScheduleEvent.scheduled()) {
-            rnic->schedule(rnic->descScheduler.wqePrefetchScheduleEvent, curTick() + rnic->clockPeriod());
-        }
-    }
+            type, srv, bth->op_destQpn, rnic->etherBandwidth, txPkt->length, bwDelay, txsauFifo.size());
 
-    if (rnic->etherInt->sendPacket(txsauFifo.front())) {
+    if (rnic->ports[port]->etherInt->sendPacket(txPkt)) {
         
         HANGU_PRINT(RdmaEngine, " RdmaEngine.sauProcessing: TxFIFO: Successful transmit!\n");
 
-        rnic->txBytes += txsauFifo.front()->length;
+        // if this is the end of a subWQE batch, self-minus unsentBatchNum to control the pop rate of descScheduler.
+        // Only once the packet is sent, it stays at the head of txsauFifo and is retried otherwise.
+        if (bth->needAck_psn >> 25 == 1) {
+            assert(rnic->descScheduler.unsentBatchNum > 0);
+            rnic->descScheduler.unsentBatchNum--;
+            HANGU_PRINT(RdmaEngine, "type: %d\n", type);
+            assert(type == PKT_TRANS_SEND_ONLY || type == PKT_TRANS_RWRITE_ONLY || type == PKT_TRANS_RREAD_ONLY);
+            HANGU_PRINT(RdmaEngine, " RdmaEngine.sauProcessing, finish a batch! unsentBatchNum: %d, op_destQpn: 0x%x\n", rnic->descScheduler.unsentBatchNum, bth->op_destQpn);
+        }
+        if (rnic->descScheduler.unsentBatchNum < rnic->unsentBatchThreshold) {
+            if ((rnic->descScheduler.highPriorityQpnQue.size() > 0 || rnic->descScheduler.lowPriorityQpnQue.size() > 0) && 
+                !rnic->descScheduler.wqePrefetchScheduleEvent.scheduled()) {
+                rnic->schedule(rnic->descScheduler.wqePrefetchScheduleEvent, curTick() + rnic->clockPeriod());
+            }
+        }
+        HANGU_TRACE(rnic, TRACE_MOD_TX, TRACE_EV_PKT_TX, bth->op_destQpn & 0xFFFFFF, 
+                bth->needAck_psn & 0xFFFFFF, txPkt->length);
+
+        rnic->txBytes += txPkt->length;
         rnic->txPackets++;
+        rnic->portTxBytes[port] += txPkt->length;
 
-        sauSendByte += txsauFifo.front()->length;
+        sauSendByte += txPkt->length;
+        ++sauSendPkt;
+
+        /* Request is delivered to the link, charge its QP and group for QoS control and stats */
+        if (txsauFifo.front().len) {
+            rnic->descScheduler.qpSent(txsauFifo.front().qpn, txsauFifo.front().len);
+        }
 
         txsauFifo.pop();
     }
 
-    /* Reschedule RdmaEngine.sauProcessing, 
+    HANGU_PRINT(RdmaEngine, " RdmaEngine.sauProcessing: out\n");
+    return bwDelay;
+}
+
+/**
+ * @note Send Arbiter Unit of one port, shared by the engine lanes. 
+ * Serve lanes with packet to send through the port in round robin, 
+ * one packet each time, and wait for the link to send it before the 
+ * next one. Ports are paced independently. Nothing is sent through 
+ * a port which is down, its packets are moved by setPortUp().
+ */
+void
+HanGuRnic::sauProcessing (uint8_t port) {
+
+    EtherPort *etherPort = ports[port];
+    if (!etherPort->up) {
+        return;
+    }
+
+    Tick delay = 0;
+    if (etherPort->ctrlFifo.size()) {
+        EthPacketPtr pkt = etherPort->ctrlFifo.front();
+        delay = fastForward ? clockPeriod() : pkt->length * etherBandwidth;
+        if (etherPort->etherInt->sendPacket(pkt)) {
+            etherPort->ctrlFifo.pop();
+        }
+    }
+    for (size_t i = 0; i < rdmaEngines.size() && delay == 0; ++i) {
+        RdmaEngine *engine = rdmaEngines[etherPort->sauLane];
+        etherPort->sauLane = (etherPort->sauLane + 1) % rdmaEngines.size();
+        if (engine->sauPending(port)) {
+            delay = engine->sauProcessing(port);
+            break;
+        }
+    }
+
+    /* Reschedule sauProcessing after the packet is sent, 
      * no matter if it has been scheduled */
-    // if (sauEvent.scheduled()) {
-    //     rnic->reschedule(sauEvent, curTick() + bwDelay);
-    // } else {
-    //     rnic->schedule(sauEvent, curTick() + bwDelay);
-    // }
-    // if (txsauFifo.size()) {
-    //     if (!sauEvent.scheduled()) {
-    //         rnic->schedule(sauEvent, curTick() + rnic->clockPeriod());
-    //     }
-    // }
-    if (txsauFifo.size()) {
-        if (sauEvent.scheduled()) {
-            rnic->reschedule(sauEvent, curTick() + bwDelay);
+    bool pending = etherPort->ctrlFifo.size();
+    for (auto engine : rdmaEngines) {
+        pending = pending || engine->sauPending(port);
+    }
+    if (pending) {
+        if (etherPort->sauEvent.scheduled()) {
+            reschedule(etherPort->sauEvent, curTick() + delay);
         }
         else {
-            rnic->schedule(sauEvent, curTick() + bwDelay);
+            schedule(etherPort->sauEvent, curTick() + delay);
         }
     }
+}
 
-    HANGU_PRINT(RdmaEngine, " RdmaEngine.sauProcessing: out\n");
+/**
+ * @note Port of the QP. In LAG mode QPs are hashed across ports by 
+ * QPN, otherwise the port in QPC is used.
+ */
+uint8_t
+HanGuRnic::homePort(QpcResc *qpc) {
+    return (lagMode ? qpc->srcQpn : qpc->port) % ports.size();
+}
+
+/**
+ * @note If the home port is down, the QP fails over to the next port 
+ * which is up, so QPs of the ports which are up are not moved.
+ */
+uint8_t
+HanGuRnic::txPort(uint8_t home) {
+
+    uint8_t portNum = ports.size();
+    for (uint8_t i = 0; i < portNum; ++i) {
+        uint8_t p = (home + i) % portNum;
+        if (ports[p]->up) {
+            return p;
+        }
+    }
+    return home; /* all ports are down, wait for one to recover */
+}
+
+void
+HanGuRnic::RdmaEngine::postTxPkt(EthPacketPtr txPkt, uint8_t home, uint32_t qpn, uint32_t len) {
+    uint8_t port = rnic->txPort(home);
+    txsauFifo[port].push({txPkt, home, qpn, len});
+    Event &e = rnic->ports[port]->sauEvent;
+    if (!e.scheduled()) {
+        rnic->schedule(e, curTick() + rnic->clockPeriod());
+    }
+}
+
+void
+HanGuRnic::RdmaEngine::reroutePkts() {
+    for (uint8_t port = 0; port < txsauFifo.size(); ++port) {
+        std::queue<SauPkt> stay;
+        while (txsauFifo[port].size()) {
+            auto &item = txsauFifo[port].front();
+            if (rnic->txPort(item.home) == port) {
+                stay.push(item);
+            }
+            else {
+                postTxPkt(item.pkt, item.home, item.qpn, item.len);
+            }
+            txsauFifo[port].pop();
+        }
+        /* packets moved to the ports done are behind their own ones, 
+         * they are of different QPs */
+        txsauFifo[port].swap(stay);
+    }
 }
 
 bool 
@@ -1031,19 +1209,21 @@ HanGuRnic::RdmaEngine::isAckPkt(EthPacketPtr rxPkt) {
 void
 HanGuRnic::RdmaEngine::rauProcessing () {
     
-    assert(rnic->rxFifo.size());
-    EthPacketPtr rxPkt = rnic->rxFifo.front();
+    assert(rxFifo.size());
+    EthPacketPtr rxPkt = rxFifo.front();
     BTH *bth = (BTH *)(rxPkt->data + ETH_ADDR_LEN * 2);
     // for (int i = 0; i < rxPkt->length; ++i) {
     //     HANGU_PRINT(RdmaEngine, " RdmaEngine.rauProcessing: data[%d]: 0x%x\n", i, (rxPkt->data)[i]);
     // }
 
-    HANGU_PRINT(RdmaEngine, " RdmaEngine.rauProcessing: op_destQpn: 0x%x, rxFifo size: %d\n", bth->op_destQpn, rnic->rxFifo.size());
+    HANGU_PRINT(RdmaEngine, " RdmaEngine.rauProcessing: op_destQpn: 0x%x, rxFifo size: %d\n", bth->op_destQpn, rxFifo.size());
     
     
     if (((bth->op_destQpn >> 24) & 0x1F) == PKT_TRANS_ACK) { /* ACK packet, transform to RG&RRU */
         /* pop ethernet pkt from RX channel */
-        rnic->rxFifo.pop();
+        rxFifo.pop();
+        HANGU_TRACE(rnic, TRACE_MOD_RX, TRACE_EV_ACK_RX, bth->op_destQpn & 0xFFFFFF, 
+                bth->needAck_psn & 0xFFFFFF, rxPkt->length);
         
         ra2rgFifo.push(rxPkt);
         
@@ -1052,12 +1232,14 @@ HanGuRnic::RdmaEngine::rauProcessing () {
             rnic->schedule(rgrrEvent, curTick() + rnic->clockPeriod());
         }
 
-        HANGU_PRINT(RdmaEngine, " RdmaEngine.rauProcessing: Receive ACK packet, pass to RdmaEngine.RGRRU.rruProcessing! rxFifo size: %d\n", rnic->rxFifo.size());
+        HANGU_PRINT(RdmaEngine, " RdmaEngine.rauProcessing: Receive ACK packet, pass to RdmaEngine.RGRRU.rruProcessing! rxFifo size: %d\n", rxFifo.size());
 
     } else if (rp2raIdxFifo.size()) { /* Incomming request packet, pass to RPU */
         
         /* pop ethernet pkt from RX channel */
-        rnic->rxFifo.pop();
+        rxFifo.pop();
+        HANGU_TRACE(rnic, TRACE_MOD_RX, TRACE_EV_PKT_RX, bth->op_destQpn & 0xFFFFFF, 
+                bth->needAck_psn & 0xFFFFFF, rxPkt->length);
 
         /* read available idx */
         uint8_t idx = rp2raIdxFifo.front();
@@ -1067,13 +1249,15 @@ HanGuRnic::RdmaEngine::rauProcessing () {
                 "Receive request packet, pass to RdmaEngine.rpuProcessing. idx %d\n", idx);
         
         /* Post qpc rd req to qpcModule */
-        CxtReqRspPtr rxQpcRdReq = make_shared<CxtReqRsp>(
+        CxtReqRspPtr rxQpcRdReq = makePooled<CxtReqRsp>(
                                 CXT_RREQ_QP, 
                                 CXT_CHNL_RX, 
                                 (bth->op_destQpn & 0xFFFFFF), 
                                 1, 
                                 idx);
         rxQpcRdReq->rxQpcRsp = new QpcResc;
+        rxQpcRdReq->lane = lane;
+        rxQpcRdReq->psn  = bth->needAck_psn & 0xFFFFFF;
         rnic->qpcModule.postQpcReq(rxQpcRdReq);
 
         /* Post RX pkt to RPU */
@@ -1087,7 +1271,7 @@ HanGuRnic::RdmaEngine::rauProcessing () {
     }
 
     /* If there still has elem in fifo, schedule myself again */
-    if (rnic->rxFifo.size() && (rp2raIdxFifo.size() || isAckPkt(rnic->rxFifo.front()))) {
+    if (rxFifo.size() && (rp2raIdxFifo.size() || isAckPkt(rxFifo.front()))) {
         if (!rauEvent.scheduled()) {
             rnic->schedule(rauEvent, curTick() + rnic->clockPeriod());
         }
@@ -1116,9 +1300,9 @@ HanGuRnic::RdmaEngine::rcvRpuProcessing () {
     HANGU_PRINT(RdmaEngine, " RdmaEngine.RPU.rcvRpuProcessing!\n");
 
     /* Get rx descriptor from MrRescModule.dmaRrspProcessing */
-    assert(rnic->rxdescRspFifo.size());
-    RxDescPtr rxDesc = rnic->rxdescRspFifo.front();
-    rnic->rxdescRspFifo.pop();
+    assert(rxdescRspFifo.size());
+    RxDescPtr rxDesc = rxdescRspFifo.front();
+    rxdescRspFifo.pop();
     HANGU_PRINT(RdmaEngine, " RdmaEngine.RPU.rcvRpuProcessing: len %d, lkey %d, lVaddr 0x%lx\n", rxDesc->len, rxDesc->lkey, rxDesc->lVaddr);
     HANGU_PRINT(RdmaEngine, " RdmaEngine.RPU.rcvRpuProcessing: Get rx descriptor!\n");
 
@@ -1131,17 +1315,18 @@ HanGuRnic::RdmaEngine::rcvRpuProcessing () {
         qpcCopy->srcQpn);
 
     /* Write received data back to memory through MR Module */
-    MrReqRspPtr dataWreq = make_shared<MrReqRsp>(
+    MrReqRspPtr dataWreq = makePooled<MrReqRsp>(
                 DMA_TYPE_WREQ, TPT_WCHNL_RX_DATA,
                 rxDesc->lkey,
                 rxDesc->len,
                 (uint32_t)(rxDesc->lVaddr&0xFFF));
-    dataWreq->wrDataReq = new uint8_t[dataWreq->length];
-    if (qpcCopy->qpType == QP_TYPE_RC) { /* copy data, because the packet will be deleted soon */
-        memcpy(dataWreq->wrDataReq, rxPkt->data + ETH_ADDR_LEN * 2 + PKT_BTH_SZ, dataWreq->length);
+    /* no copy, the packet is kept until the data is written to memory */
+    if (qpcCopy->qpType == QP_TYPE_UD) {
+        dataWreq->wrDataReq = rxPkt->data + ETH_ADDR_LEN * 2 + PKT_BTH_SZ + PKT_DETH_SZ;
     } else {
-        memcpy(dataWreq->wrDataReq, rxPkt->data + ETH_ADDR_LEN * 2 + PKT_BTH_SZ + PKT_DETH_SZ, dataWreq->length);
+        dataWreq->wrDataReq = rxPkt->data + ETH_ADDR_LEN * 2 + PKT_BTH_SZ;
     }
+    dataWreq->pkt = rxPkt;
     rnic->dataReqFifo.push(dataWreq);
     if (!rnic->mrRescModule.transReqEvent.scheduled()) {
         rnic->schedule(rnic->mrRescModule.transReqEvent, curTick() + rnic->clockPeriod());
@@ -1156,7 +1341,7 @@ HanGuRnic::RdmaEngine::rcvRpuProcessing () {
     /* RC QP generate ack */
     if (qpcCopy->qpType == QP_TYPE_RC) {
         
-        EthPacketPtr txPkt = std::make_shared<EthPacketData>(16384);
+        EthPacketPtr txPkt = EthPacketPool::alloc(ETH_ADDR_LEN * 2 + PKT_BTH_SZ + PKT_AETH_SZ);
         txPkt->length = ETH_ADDR_LEN * 2 + PKT_BTH_SZ + PKT_AETH_SZ;
         txPkt->simLength = 0;
 
@@ -1177,14 +1362,12 @@ HanGuRnic::RdmaEngine::rcvRpuProcessing () {
 
         /* Post Send Packet
          * Schedule SAU to Send out ACK Packet through Ethernet Interface. */
-        txsauFifo.push(txPkt);
-        if (!sauEvent.scheduled()) {
-            rnic->schedule(sauEvent, curTick() + rnic->clockPeriod());
-        }
+        postTxPkt(txPkt, rnic->homePort(qpcCopy));
+        ++ackTxNum;
     }
 
     /* Post related info into rcuProcessing for further processing */
-    CqDescPtr cqDesc = make_shared<CqDesc>(qpcCopy->qpType, 
+    CqDescPtr cqDesc = makePooled<CqDesc>(qpcCopy->qpType, 
             OPCODE_RECV, rxDesc->len, qpcCopy->srcQpn, qpcCopy->cqn);
     rp2rcFifo.push(cqDesc);
     /* We don't schedule it here, cause it should be 
@@ -1194,14 +1377,15 @@ HanGuRnic::RdmaEngine::rcvRpuProcessing () {
     // }
     
     /* Post Cqc read request to CqcModule */
-    CxtReqRspPtr rxCqcRdReq = make_shared<CxtReqRsp>(CXT_RREQ_CQ, CXT_CHNL_RX, qpcCopy->cqn);
+    CxtReqRspPtr rxCqcRdReq = makePooled<CxtReqRsp>(CXT_RREQ_CQ, CXT_CHNL_RX, qpcCopy->cqn);
     rxCqcRdReq->txCqcRsp = new CqcResc;
+    rxCqcRdReq->lane = lane;
     rnic->cqcModule.postCqcReq(rxCqcRdReq);
 
     delete qpcCopy;
 
     /* schedule myself if there's still has elem in input fifo */
-    if (rp2rcvRpFifo.size() && rnic->rxdescRspFifo.size()) {
+    if (rp2rcvRpFifo.size() && rxdescRspFifo.size()) {
         if (!rcvRpuEvent.scheduled()) {
             rnic->schedule(rcvRpuEvent, curTick() + rnic->clockPeriod());
         }
@@ -1221,13 +1405,13 @@ HanGuRnic::RdmaEngine::wrRpuProcessing (EthPacketPtr rxPkt, QpcResc* qpc) {
     HANGU_PRINT(RdmaEngine, " RdmaEngine.RPU.wrRPU: Parse received RDMA write packet!\n");
     
     /* Write data back to memory through TPT */
-    MrReqRspPtr dataWreq = make_shared<MrReqRsp>(
+    MrReqRspPtr dataWreq = makePooled<MrReqRsp>(
                 DMA_TYPE_WREQ, TPT_WCHNL_RX_DATA,
                 reth->rKey,
                 reth->len,
                 (uint32_t)(reth->rVaddr_l & 0xFFF));
-    dataWreq->wrDataReq = new uint8_t[dataWreq->length];
-    memcpy(dataWreq->wrDataReq, data, dataWreq->length); /* copy data, because the packet will be deleted soon */
+    dataWreq->wrDataReq = data; /* no copy, the packet is kept until the data is written to memory */
+    dataWreq->pkt = rxPkt;
     rnic->dataReqFifo.push(dataWreq);
     if (!rnic->mrRescModule.transReqEvent.scheduled()) {
         rnic->schedule(rnic->mrRescModule.transReqEvent, curTick() + rnic->clockPeriod());
@@ -1239,7 +1423,7 @@ HanGuRnic::RdmaEngine::wrRpuProcessing (EthPacketPtr rxPkt, QpcResc* qpc) {
     /* RC QP generate ack */
     if (qpc->qpType == QP_TYPE_RC) {
         
-        EthPacketPtr txPkt = std::make_shared<EthPacketData>(16384);
+        EthPacketPtr txPkt = EthPacketPool::alloc(ETH_ADDR_LEN * 2 + PKT_BTH_SZ + PKT_AETH_SZ);
         txPkt->length = ETH_ADDR_LEN * 2 + PKT_BTH_SZ + PKT_AETH_SZ;
         txPkt->simLength = 0;
 
@@ -1262,10 +1446,8 @@ HanGuRnic::RdmaEngine::wrRpuProcessing (EthPacketPtr rxPkt, QpcResc* qpc) {
         /** Post Send Packet
          * Schedule sau to start Send Packet through Ethernet Interface.
          */
-        txsauFifo.push(txPkt);
-        if (!sauEvent.scheduled()) {
-            rnic->schedule(sauEvent, curTick() + rnic->clockPeriod());
-        }
+        postTxPkt(txPkt, rnic->homePort(qpc));
+        ++ackTxNum;
     }
 
     // /* Update QPC in receive side, 
@@ -1291,7 +1473,7 @@ HanGuRnic::RdmaEngine::rdRpuProcessing (EthPacketPtr rxPkt, QpcResc* qpc) {
             " Parse received RDMA read packet! len: %d, rKey: 0x%x, vaddr: 0x%x\n", reth->len, reth->rKey, reth->rVaddr_l);
 
     /* Generate RDMA read response packet */
-    EthPacketPtr txPkt = std::make_shared<EthPacketData>(16384);
+    EthPacketPtr txPkt = EthPacketPool::alloc(ETH_ADDR_LEN * 2 + PKT_BTH_SZ + PKT_AETH_SZ + reth->len);
     txPkt->length = ETH_ADDR_LEN * 2 + PKT_BTH_SZ + PKT_AETH_SZ;
     txPkt->simLength = 0;
 
@@ -1313,12 +1495,13 @@ HanGuRnic::RdmaEngine::rdRpuProcessing (EthPacketPtr rxPkt, QpcResc* qpc) {
     HANGU_PRINT(RdmaEngine, " RdmaEngine.RPU.rdRpuProcessing: Generate RDMA read response packet!\n");
     
     /* Read data from memory through MrRescModule.transReqProcessing */
-    MrReqRspPtr dataRreq = make_shared<MrReqRsp>(
+    MrReqRspPtr dataRreq = makePooled<MrReqRsp>(
                 DMA_TYPE_RREQ, MR_RCHNL_RX_DATA,
                 reth->rKey,
                 reth->len,
                 (uint32_t)(reth->rVaddr_l & 0xFFF)); /* offset, within 4KB */
     dataRreq->rdDataRsp = pktPtr;
+    dataRreq->lane = lane;
     rnic->dataReqFifo.push(dataRreq);
     if (!rnic->mrRescModule.transReqEvent.scheduled()) {
         rnic->schedule(rnic->mrRescModule.transReqEvent, curTick() + rnic->clockPeriod());
@@ -1328,7 +1511,7 @@ HanGuRnic::RdmaEngine::rdRpuProcessing (EthPacketPtr rxPkt, QpcResc* qpc) {
 
 
     /* Post response packet to RdmaEngine.RPU.rdCplRpuProcessing */
-    rp2rpCplFifo.push(txPkt);
+    rp2rpCplFifo.emplace(txPkt, rnic->homePort(qpc));
     /* We don't schedule it here, cause it should be 
     * scheduled by MR Module */
     // if (!rdCplRpuEvent.scheduled()) { /* Schedule RdmaEngine.RPU.rdCplRpuProcessing */
@@ -1349,10 +1532,11 @@ HanGuRnic::RdmaEngine::rdCplRpuProcessing () {
     HANGU_PRINT(RdmaEngine, " RdmaEngine.RPU.rdRPUCpl!\n");
     
     // Get rsp pkt
-    assert(!rnic->rxdataRspFifo.empty());
+    assert(!rxdataRspFifo.empty());
     assert(!rp2rpCplFifo.empty());
-    rnic->rxdataRspFifo.pop();
-    EthPacketPtr txPkt = rp2rpCplFifo.front();
+    rxdataRspFifo.pop();
+    EthPacketPtr txPkt = rp2rpCplFifo.front().first;
+    uint8_t home = rp2rpCplFifo.front().second;
     rp2rpCplFifo.pop();
     HANGU_PRINT(RdmaEngine, " RdmaEngine.RPU.rdRPUCpl: data %s!\n", 
             (char *)(txPkt->data + ETH_ADDR_LEN * 2 + PKT_BTH_SZ + PKT_AETH_SZ));
@@ -1361,10 +1545,7 @@ HanGuRnic::RdmaEngine::rdCplRpuProcessing () {
     /** Post Send Packet
      * Schedule sau to start Send Packet through Ethernet Interface.
      */
-    txsauFifo.push(txPkt);
-    if (!sauEvent.scheduled()) {
-        rnic->schedule(sauEvent, curTick() + rnic->clockPeriod());
-    }
+    postTxPkt(txPkt, home);
 
     HANGU_PRINT(RdmaEngine, " RdmaEngine.RPU.rdRPUCpl: out!\n");
 }
@@ -1380,10 +1561,10 @@ HanGuRnic::RdmaEngine::rpuProcessing () {
     HANGU_PRINT(RdmaEngine, " RdmaEngine.rpuProcessing!\n");
 
     /* Get QP context from CxtRescModule.cxtRspProcessing */
-    assert(rnic->qpcModule.rxQpcRspFifo.size());
-    QpcResc* qpc = rnic->qpcModule.rxQpcRspFifo.front()->rxQpcRsp;
-    uint8_t idx = rnic->qpcModule.rxQpcRspFifo.front()->idx;
-    rnic->qpcModule.rxQpcRspFifo.pop();
+    assert(rxQpcRspFifo.size());
+    QpcResc* qpc = rxQpcRspFifo.front()->rxQpcRsp;
+    uint8_t idx = rxQpcRspFifo.front()->idx;
+    rxQpcRspFifo.pop();
     HANGU_PRINT(RdmaEngine, " RdmaEngine.rpuProcessing: Get QPC from cxtRspProcessing. srcQpn: %d, dstQpn %d, qpc->rcvWqeOffset: %d, idx %d\n", 
             qpc->srcQpn, qpc->destQpn, qpc->rcvWqeOffset, idx);
     
@@ -1402,12 +1583,33 @@ HanGuRnic::RdmaEngine::rpuProcessing () {
 
     /* reschedule rau if rp2raIdxFifo is empty && new rx pkt is comming */
     rp2raIdxFifo.push(idx);
-    if ((rp2raIdxFifo.size() == 1) && rnic->rxFifo.size()) {
+    if ((rp2raIdxFifo.size() == 1) && rxFifo.size()) {
         if (!rauEvent.scheduled()) {
             rnic->schedule(rauEvent, curTick() + rnic->clockPeriod());
         }
     }
 
+    /* UC QP drops packet behind expPsn, the same check as 
+     * qpcRxUpdate, which has not consumed a receive WQE for it. 
+     * Packet ahead of expPsn is accepted, expPsn is resynchronized. */
+    if (qpc->qpType == QP_TYPE_UC) {
+        ++ucRxNum;
+        if (psnBehind(bth->needAck_psn & 0xFFFFFF, qpc->expPsn)) {
+            HANGU_PRINT(RdmaEngine, " RdmaEngine.rpuProcessing: UC drop, qpn 0x%x, psn %d, epsn %d\n", 
+                    qpc->srcQpn, bth->needAck_psn & 0xFFFFFF, qpc->expPsn);
+            HANGU_TRACE(rnic, TRACE_MOD_RX, TRACE_EV_PKT_DROP, qpc->srcQpn, 
+                    bth->needAck_psn & 0xFFFFFF, rxPkt->length);
+            ++ucDropNum;
+            delete qpc;
+            if (rxQpcRspFifo.size()) {
+                if (!rpuEvent.scheduled()) { /* Schedule RdmaEngine.rpuProcessing */
+                    rnic->schedule(rpuEvent, curTick() + rnic->clockPeriod());
+                }
+            }
+            return;
+        }
+    }
+
     MrReqRspPtr descReq;
     uint8_t pkt_opcode = (bth->op_destQpn >> 24) & 0x1F;
     QpcResc* qpcCopy;
@@ -1416,9 +1618,10 @@ HanGuRnic::RdmaEngine::rpuProcessing () {
         HANGU_PRINT(RdmaEngine, " RdmaEngine.rpuProcessing: PKT_TRANS_SEND_ONLY\n");
         
         /* Post rx descriptor Read request to mrRescModule.transReqProcessing  */
-        descReq = make_shared<MrReqRsp>(DMA_TYPE_RREQ, MR_RCHNL_RX_DESC,
+        descReq = makePooled<MrReqRsp>(DMA_TYPE_RREQ, MR_RCHNL_RX_DESC,
                 qpc->rcvWqeBaseLkey, rxDescLenSel() * sizeof(RxDesc), qpc->rcvWqeOffset);
         descReq->rxDescRsp = new RxDesc;
+        descReq->lane = lane;
         rnic->descReqFifo.push(descReq);
         if (!rnic->mrRescModule.transReqEvent.scheduled()) { /* Scheduled MR module to read RX descriptor */
             rnic->schedule(rnic->mrRescModule.transReqEvent, curTick() + rnic->clockPeriod());
@@ -1472,7 +1675,7 @@ HanGuRnic::RdmaEngine::rpuProcessing () {
     delete qpc; /* qpc is useless */
 
     /* if we have elem in input fifo, schedule myself again */
-    if (rnic->qpcModule.rxQpcRspFifo.size()) {
+    if (rxQpcRspFifo.size()) {
         if (!rpuEvent.scheduled()) { /* Schedule RdmaEngine.rpuProcessing */
             rnic->schedule(rpuEvent, curTick() + rnic->clockPeriod());
         }
@@ -1486,30 +1689,17 @@ HanGuRnic::RdmaEngine::rcuProcessing () {
 
     HANGU_PRINT(RdmaEngine, " RdmaEngine.rcuProcessing\n");
     
-    /* Get CQ addr lkey, and post CQ Work Completion to MR Module */
-    assert(rnic->rxCqcRspFifo.size());
-    MrReqRspPtr cqWreq = make_shared<MrReqRsp>(DMA_TYPE_WREQ, TPT_WCHNL_RX_CQUE,
-            rnic->rxCqcRspFifo.front()->txCqcRsp->lkey, sizeof(CqDesc), 
-            rnic->rxCqcRspFifo.front()->txCqcRsp->offset);
-    rnic->rxCqcRspFifo.pop();
-
-    HANGU_PRINT(RdmaEngine, " RdmaEngine.rcuProcessing: cq lkey %d, cq offset %d\n", cqWreq->lkey, cqWreq->offset);
-
-    cqWreq->cqDescReq = new CqDesc(rp2rcFifo.front()->srvType, 
-                                    rp2rcFifo.front()->transType, 
-                                    rp2rcFifo.front()->byteCnt, 
-                                    rp2rcFifo.front()->qpn, 
-                                    rp2rcFifo.front()->cqn);
-    rp2rcFifo.pop();
-
+    /* Get CQ addr lkey, and stage CQ Work Completion before posting to MR Module */
+    assert(rxCqcRspFifo.size());
+    HANGU_PRINT(RdmaEngine, " RdmaEngine.rcuProcessing: cq lkey %d, cq offset %d\n", 
+            rxCqcRspFifo.front()->txCqcRsp->lkey, rxCqcRspFifo.front()->txCqcRsp->offset);
 
-    rnic->cqWreqFifo.push(cqWreq);
-    if (!rnic->mrRescModule.transReqEvent.scheduled()) { // If not scheduled yet, schedule the event.
-        rnic->schedule(rnic->mrRescModule.transReqEvent, curTick() + rnic->clockPeriod());
-    }
+    rnic->stageCqe(TPT_WCHNL_RX_CQUE, rxCqcRspFifo.front()->txCqcRsp, rp2rcFifo.front());
+    rxCqcRspFifo.pop();
+    rp2rcFifo.pop();
 
     /* schedule myself if there's still has elem in input fifo */
-    if (rp2rcFifo.size() && rnic->rxCqcRspFifo.size()) {
+    if (rp2rcFifo.size() && rxCqcRspFifo.size()) {
         if (!rcuEvent.scheduled()) {
             rnic->schedule(rcuEvent, curTick() + rnic->clockPeriod());
         }
@@ -1518,11 +1708,302 @@ HanGuRnic::RdmaEngine::rcuProcessing () {
     HANGU_PRINT(RdmaEngine, " RdmaEngine.rcuProcessing: out\n");
 }
 
+/**
+ * @note
+ *      Stage one CQE in the staging buffer of its CQ, shared by 
+ *      the lanes. CQEs of one CQ are written back in one DMA burst when 
+ *      (1) the next CQE would cross the end of the cacheline of the 
+ *          CQ ring the burst ends in, or cqeCoalesceNum CQEs are staged, 
+ *      (2) the next CQE is not contiguous with the staged ones (CQ wraps), 
+ *      (3) cqeCoalesceTimeout elapses since the first CQE was staged, 
+ *      (4) flushCqe() is called explicitly, e.g. when the CQ is armed.
+ */
+void
+HanGuRnic::stageCqe(uint8_t chnl, CqcResc *cqc, CqDescPtr cqDesc) {
+
+    uint32_t cqn = cqDesc->cqn;
+    uint32_t burstNum = min((uint32_t)(CQE_BURST_SZ / sizeof(CqDesc)), cqeCoalesceNum);
+    ++cqeNum;
+
+    /* Coalescing disabled, post CQE directly */
+    if (burstNum <= 1) {
+        postCqeWreq(chnl, cqn, cqc->lkey, cqc->offset, (uint8_t *)(new CqDesc(*cqDesc)), sizeof(CqDesc));
+        return;
+    }
+
+    /* CQE is not contiguous with staged CQEs, write back staged ones first */
+    if (cqeStageMap.find(cqn) != cqeStageMap.end()) {
+        CqeStageBufPtr stageBuf = cqeStageMap[cqn];
+        if (stageBuf->lkey != cqc->lkey || 
+                stageBuf->offset + stageBuf->cqeList.size() * sizeof(CqDesc) != cqc->offset) {
+            HANGU_PRINT(RdmaEngine, " HanGuRnic.stageCqe: CQE not contiguous, flush! cqn %d, staged offset %d, num %d, offset %d\n", 
+                    cqn, stageBuf->offset, stageBuf->cqeList.size(), cqc->offset);
+            flushCqe(cqn);
+        }
+    }
+
+    if (cqeStageMap.find(cqn) == cqeStageMap.end()) {
+        cqeStageMap[cqn] = make_shared<CqeStageBuf>(chnl, cqc->lkey, cqc->offset, curTick());
+        cqeTimeoutQue.emplace(cqn, curTick());
+        if (!cqeFlushEvent.scheduled()) {
+            schedule(cqeFlushEvent, curTick() + cqeCoalesceTimeout);
+        }
+    }
+    CqeStageBufPtr stageBuf = cqeStageMap[cqn];
+    stageBuf->cqeList.push_back(*cqDesc);
+    stageBuf->tickList.push_back(curTick());
+
+    HANGU_PRINT(RdmaEngine, " HanGuRnic.stageCqe: cqn %d, offset %d, staged num %d\n", 
+            cqn, cqc->offset, stageBuf->cqeList.size());
+
+    /* Cut the burst at the cacheline boundary of the CQ ring. The ring 
+     * is page aligned, so its lines are at multiples of CQE_BURST_SZ. 
+     * A burst starting with a CQE across a boundary ends with the 
+     * line that CQE ends in. */
+    uint32_t lineEnd = (stageBuf->offset + sizeof(CqDesc) - 1) / CQE_BURST_SZ * CQE_BURST_SZ + CQE_BURST_SZ;
+    uint32_t burstEnd = stageBuf->offset + stageBuf->cqeList.size() * sizeof(CqDesc);
+    if (stageBuf->cqeList.size() >= burstNum || burstEnd + sizeof(CqDesc) > lineEnd) {
+        flushCqe(cqn);
+    }
+}
+
+void
+HanGuRnic::flushCqe(uint32_t cqn) {
+
+    if (cqeStageMap.find(cqn) == cqeStageMap.end()) {
+        return;
+    }
+    CqeStageBufPtr stageBuf = cqeStageMap[cqn];
+    cqeStageMap.erase(cqn);
+    assert(stageBuf->cqeList.size());
+
+    uint32_t len = stageBuf->cqeList.size() * sizeof(CqDesc);
+    uint8_t *cqeBuf = new uint8_t[len];
+    memcpy(cqeBuf, stageBuf->cqeList.data(), len);
+    for (auto stageTick : stageBuf->tickList) {
+        cqeStageDelay += curTick() - stageTick;
+    }
+
+    postCqeWreq(stageBuf->chnl, cqn, stageBuf->lkey, stageBuf->offset, cqeBuf, len);
+
+    HANGU_PRINT(RdmaEngine, " HanGuRnic.flushCqe: cqn %d, offset %d, CQE num %d\n", 
+            cqn, stageBuf->offset, stageBuf->cqeList.size());
+}
+
+void
+HanGuRnic::postCqeWreq(uint8_t chnl, uint32_t cqn, uint32_t lkey, uint32_t offset, uint8_t *cqeBuf, uint32_t len) {
+
+    MrReqRspPtr cqWreq = makePooled<MrReqRsp>(DMA_TYPE_WREQ, chnl, lkey, len, offset);
+    cqWreq->cqn = cqn;
+    cqWreq->wrDataReq = cqeBuf;
+    cqWreqFifo.push(cqWreq);
+    ++cqeWriteNum;
+
+    // Schedule tarnsReq event(TPT) to post CQ WC to TPT
+    if (!mrRescModule.transReqEvent.scheduled()) { // If not scheduled yet, schedule the event.
+        schedule(mrRescModule.transReqEvent, curTick() + clockPeriod());
+    }
+}
+
+/**
+ * @note
+ *      Write back the CQEs which stay in the staging buffer 
+ *      longer than cqeCoalesceTimeout. cqeTimeoutQue is in 
+ *      time order, so only the head is checked.
+ */
+void
+HanGuRnic::cqeFlushProcessing() {
+
+    while (cqeTimeoutQue.size() && 
+            cqeTimeoutQue.front().second + cqeCoalesceTimeout <= curTick()) {
+        uint32_t cqn = cqeTimeoutQue.front().first;
+        Tick stageTick = cqeTimeoutQue.front().second;
+        cqeTimeoutQue.pop();
+
+        /* The buffer may have been flushed and restaged since then */
+        if (cqeStageMap.find(cqn) != cqeStageMap.end() && 
+                cqeStageMap[cqn]->stageTick == stageTick) {
+            HANGU_PRINT(RdmaEngine, " HanGuRnic.cqeFlushProcessing: timeout! cqn %d\n", cqn);
+            flushCqe(cqn);
+        }
+    }
+
+    if (cqeTimeoutQue.size() && !cqeFlushEvent.scheduled()) {
+        schedule(cqeFlushEvent, cqeTimeoutQue.front().second + cqeCoalesceTimeout);
+    }
+}
+
+/**
+ * @note
+ *      Stops when nothing is sent in the last period, 
+ *      and restarted by dduProcessing on the next doorbell.
+ */
 void HanGuRnic::RdmaEngine::detectNetRate() {
-    rnic->schedule(detectNetRateEvent, curTick() + rnic->clockPeriod() * NET_DETECT_PERIOD);
     HANGU_PRINT(DmaEngine, "net sendRate: byte: %d, rate : %.2f Gbps!\n", 
         sauSendByte, (float)sauSendByte * 1000000000 / NET_DETECT_PERIOD / 1024 / 1024 / 1024 * 8);
+    
+    /* Simulation speed, in packets per host second */
+    auto now = std::chrono::steady_clock::now();
+    HANGU_PRINT(DmaEngine, "net host rate: pkt: %ld, %.0f pkt/s, pkt buffer pool: alloc %ld, reuse %ld\n", 
+        sauSendPkt, sauSendPkt / std::chrono::duration<double>(now - detectHostTime).count(), 
+        EthPacketPool::allocNum(), EthPacketPool::reuseNum());
+    detectHostTime = now;
+    if (sauSendByte == 0) {
+        startDetect = false;
+        return;
+    }
     sauSendByte = 0;
+    sauSendPkt = 0;
+    rnic->schedule(detectNetRateEvent, curTick() + rnic->clockPeriod() * NET_DETECT_PERIOD);
+}
+
+bool HanGuRnic::RdmaEngine::isIdle() {
+    return df2ddFifo.empty() && df2ddFifoH.empty() && dduPreempted == nullptr && dp2rgFifo.empty() && rg2scFifo.empty() && 
+            ra2rgFifo.empty() && rp2rcvRpFifo.empty() && 
+            rp2rpCplFifo.empty() && rp2rcFifo.empty() && 
+            dp2ddIdxFifo.size() == dd2dpVector.size() && 
+            rp2raIdxFifo.size() == rs2rpVector.size() && 
+            txDescLaunchQue.empty() && txDescLaunchQueH.empty() && rxFifo.empty() && 
+            txQpcRspFifo.empty() && rxQpcRspFifo.empty() && 
+            txCqcRspFifo.empty() && rxCqcRspFifo.empty() && 
+            txdataRspFifo.empty() && rxdataRspFifo.empty() && rxdescRspFifo.empty() && 
+            std::all_of(txsauFifo.begin(), txsauFifo.end(), 
+                    [](const std::queue<SauPkt> &fifo) { return fifo.empty(); });
+}
+
+/**
+ * @note
+ *      Packets in send windows wait for ACKs from the remote node, 
+ *      which may be checkpointed later than this node, so they are 
+ *      saved rather than drained. Other FIFOs are empty after draining.
+ */
+void HanGuRnic::RdmaEngine::serialize(CheckpointOut &cp) const {
+    SERIALIZE_SCALAR(allowNewDb);
+    SERIALIZE_SCALAR(windowSize);
+    SERIALIZE_SCALAR(windowFull);
+    SERIALIZE_SCALAR(messageEnd);
+    SERIALIZE_SCALAR(onFlyPacketNum);
+
+    std::vector<uint32_t> winQpn, winFirstPsn, winLastPsn, winCqn, winElemNum;
+    std::vector<uint32_t> elemQpn, elemPsn;
+    std::vector<uint8_t> elemDesc;
+    int pktIdx = 0;
+    for (auto &item : sndWindowList) {
+        winQpn.push_back(item.first);
+        winFirstPsn.push_back(item.second->firstPsn);
+        winLastPsn.push_back(item.second->lastPsn);
+        winCqn.push_back(item.second->cqn);
+        winElemNum.push_back(item.second->list->size());
+        for (auto &elem : *(item.second->list)) {
+            elemQpn.push_back(elem->qpn);
+            elemPsn.push_back(elem->psn);
+            rawAppend(elemDesc, *(elem->txDesc));
+            elem->txPkt->serialize(csprintf("winPkt%d", pktIdx++), cp);
+        }
+    }
+    SERIALIZE_CONTAINER(winQpn);
+    SERIALIZE_CONTAINER(winFirstPsn);
+    SERIALIZE_CONTAINER(winLastPsn);
+    SERIALIZE_CONTAINER(winCqn);
+    SERIALIZE_CONTAINER(winElemNum);
+    SERIALIZE_CONTAINER(elemQpn);
+    SERIALIZE_CONTAINER(elemPsn);
+    SERIALIZE_CONTAINER(elemDesc);
+}
+
+void HanGuRnic::RdmaEngine::unserialize(CheckpointIn &cp) {
+    UNSERIALIZE_SCALAR(allowNewDb);
+    UNSERIALIZE_SCALAR(windowSize);
+    UNSERIALIZE_SCALAR(windowFull);
+    UNSERIALIZE_SCALAR(messageEnd);
+    UNSERIALIZE_SCALAR(onFlyPacketNum);
+
+    std::vector<uint32_t> winQpn, winFirstPsn, winLastPsn, winCqn, winElemNum;
+    std::vector<uint32_t> elemQpn, elemPsn;
+    std::vector<uint8_t> elemDesc;
+    UNSERIALIZE_CONTAINER(winQpn);
+    UNSERIALIZE_CONTAINER(winFirstPsn);
+    UNSERIALIZE_CONTAINER(winLastPsn);
+    UNSERIALIZE_CONTAINER(winCqn);
+    UNSERIALIZE_CONTAINER(winElemNum);
+    UNSERIALIZE_CONTAINER(elemQpn);
+    UNSERIALIZE_CONTAINER(elemPsn);
+    UNSERIALIZE_CONTAINER(elemDesc);
+
+    for (auto &item : sndWindowList) {
+        delete item.second->list;
+        delete item.second;
+    }
+    sndWindowList.clear();
+
+    int pktIdx = 0;
+    for (size_t i = 0; i < winQpn.size(); ++i) {
+        WinMapElem *winMap = new WinMapElem;
+        winMap->list     = new WinList;
+        winMap->firstPsn = winFirstPsn[i];
+        winMap->lastPsn  = winLastPsn[i];
+        winMap->cqn      = winCqn[i];
+        for (uint32_t j = 0; j < winElemNum[i]; ++j) {
+            EthPacketPtr txPkt = std::make_shared<EthPacketData>();
+            txPkt->unserialize(csprintf("winPkt%d", pktIdx), cp);
+            TxDescPtr txDesc = makePooled<TxDesc>();
+            rawGet(*txDesc, elemDesc, pktIdx);
+            winMap->list->push_back(makePooled<WindowElem>(txPkt, 
+                    elemQpn[pktIdx], elemPsn[pktIdx], txDesc));
+            ++pktIdx;
+        }
+        sndWindowList[winQpn[i]] = winMap;
+    }
+}
+
+void HanGuRnic::RdmaEngine::regStats() {
+    latLaunchNum
+        .name(_name + ".latLaunchNum")
+        .desc("WQEs of latency sensitive QPs launched")
+        ;
+
+    latPreemptNum
+        .name(_name + ".latPreemptNum")
+        .desc("Bulk doorbells preempted by latency sensitive QPs in DDU")
+        ;
+
+    latBypassNum
+        .name(_name + ".latBypassNum")
+        .desc("Bulk sub-WQEs waiting for launch bypassed by latency sensitive WQEs")
+        ;
+
+    latBypassAvg
+        .name(_name + ".latBypassAvg")
+        .desc("Average head-of-line bulk sub-WQEs bypassed per latency sensitive WQE")
+        .precision(2)
+        ;
+    latBypassAvg = latBypassNum / latLaunchNum;
+
+    latLaunchWait
+        .init(16)
+        .name(_name + ".latLaunchWait")
+        .desc("Ticks latency sensitive WQEs wait in launch queue (head-of-line blocking)")
+        .flags(Stats::nozero)
+        ;
+    winPktNum
+        .name(_name + ".winPktNum")
+        .desc("Packets posted to send window, waiting for ACK")
+        ;
+
+    ackTxNum
+        .name(_name + ".ackTxNum")
+        .desc("ACK packets generated for received RC requests")
+        ;
+
+    ucRxNum
+        .name(_name + ".ucRxNum")
+        .desc("UC request packets received")
+        ;
+
+    ucDropNum
+        .name(_name + ".ucDropNum")
+        .desc("UC request packets dropped for PSN behind the expected PSN")
+        ;
 }
 
 ///////////////////////////// HanGuRnic::RDMA Engine relevant {end}//////////////////////////////
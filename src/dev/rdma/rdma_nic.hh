@@ -27,6 +27,9 @@
 #ifndef __RDMA_RDMANIC_HH__
 #define __RDMA_RDMANIC_HH__
 
+#include <functional>
+#include <vector>
+
 #include "base/statistics.hh"
 #include "dev/pci/device.hh"
 #include "params/RdmaNic.hh"
@@ -49,7 +52,14 @@ class RdmaNic : public PciDevice {
   public:
     void regStats();
 
+    /* Handlers registered by the drivers (one per process), 
+     * called when a CQ interrupt (MSI-X) is raised */
+    typedef std::function<void(uint32_t cqn)> CqIntrHandler;
+    void addCqIntrHandler(const CqIntrHandler &handler) { cqIntrHandler.push_back(handler); }
+
   protected:
+    std::vector<CqIntrHandler> cqIntrHandler;
+
     Stats::Scalar txBytes;
     Stats::Scalar rxBytes;
     Stats::Scalar txPackets;
@@ -2,6 +2,7 @@
 #include <algorithm>
 #include <memory>
 #include <queue>
+#include <unordered_set>
 // #include "dev/rdma/hangu_rnic_defs.hh"
 
 #include "base/inet.hh"
@@ -52,7 +53,7 @@ uint32_t HanGuRnic::RescCache<T, S>::lruReplaceScheme() {
 template <class T, class S>
 void HanGuRnic::RescCache<T, S>::storeReq(uint64_t addr, T *resc) {
     HANGU_PRINT(RescCache, " storeReq enter\n");
-    DmaReqPtr dmaReq = make_shared<DmaReq>(rnic->pciToDma(addr), rescSz, 
+    DmaReqPtr dmaReq = makePooled<DmaReq>(rnic->pciToDma(addr), rescSz, 
             nullptr, (uint8_t *)resc, 0); /* rnic->dmaWriteDelay is useless here */
     dmaReq->reqType = 1; /* this is a write request */
     rnic->cacheDmaAccessFifo.push(dmaReq);
@@ -68,31 +69,53 @@ void HanGuRnic::RescCache<T, S>::fetchReq(uint64_t addr, Event *cplEvent,
     HANGU_PRINT(RescCache, "fetchReq: enter\n");
     T *rescDma = new T; /* This is the origin of resc pointer in cache */
     /* Post dma read request to DmaEngine.dmaReadProcessing */
-    DmaReqPtr dmaReq = make_shared<DmaReq>(rnic->pciToDma(addr), rescSz, 
-            &fetchCplEvent, (uint8_t *)rescDma, 0); /* last parameter is useless here */
+    DmaReqPtr dmaReq = makePooled<DmaReq>(rnic->pciToDma(addr), rescSz, 
+            nullptr, (uint8_t *)rescDma, 0); /* last parameter is useless here */
+    dmaReq->cplCallback = [this](const DmaReqPtr &) {
+        if (!fetchCplEvent.scheduled()) {
+            rnic->schedule(fetchCplEvent, curTick() + rnic->clockPeriod());
+        }
+    };
     rnic->cacheDmaAccessFifo.push(dmaReq);
     if (!rnic->dmaEngine.dmaReadEvent.scheduled()) {
         rnic->schedule(rnic->dmaEngine.dmaReadEvent, curTick() + rnic->clockPeriod());
     }
     /* push event to fetchRsp */
-    rreq2rrspFifo.emplace(cplEvent, rescIdx, rescDma, reqPkt, dmaReq, rspResc, rescUpdate);
+    rreq2rrspFifo.emplace_back(cplEvent, rescIdx, rescDma, reqPkt, dmaReq, rspResc, rescUpdate);
     HANGU_PRINT(RescCache, "fetchReq: fifo size %d\n", rreq2rrspFifo.size());
 }
 
+/**
+ * @note Find the oldest fetch whose data is back and can retire. 
+ *      Fetches of different resources may retire out of order, 
+ *      while fetches of the same resource retire in request order, 
+ *      so that rescUpdate is applied in order.
+ */
+template <class T, class S>
+auto HanGuRnic::RescCache<T, S>::findRetirable() -> typename std::list<CacheRdPkt>::iterator {
+    std::unordered_set<uint32_t> blockedIdx;
+    auto iter = rreq2rrspFifo.begin();
+    for (; iter != rreq2rrspFifo.end(); ++iter) {
+        if (iter->dmaReq->rdVld && blockedIdx.find(iter->rescIdx) == blockedIdx.end()) {
+            break;
+        }
+        blockedIdx.insert(iter->rescIdx);
+    }
+    return iter;
+}
+
 template <class T, class S>
 void HanGuRnic::RescCache<T, S>::fetchRsp() {
     HANGU_PRINT(RescCache, "fetchRsp: capacity: %d, size %d, rescSz %d\n", capacity, cache.size(), sizeof(T));
-    if (rreq2rrspFifo.empty()) {
-        return ;
-    }
-    CacheRdPkt rrsp = rreq2rrspFifo.front();
-    if (rrsp.dmaReq->rdVld == 0) {
+    auto iter = findRetirable();
+    if (iter == rreq2rrspFifo.end()) { /* returned fetch is blocked by an older one */
         return;
     }
+    CacheRdPkt rrsp = *iter;
     if (std::is_same<T, MptResc>::value) {
         HANGU_PRINT(RescCache, "fetchRsp: MPT[%d] request time until fetchRsp: %ld\n", rrsp.reqPkt->chnl, curTick() - rrsp.reqPkt->reqTick);
     }
-    rreq2rrspFifo.pop();
+    rreq2rrspFifo.erase(iter);
     HANGU_PRINT(RescCache, "fetchRsp: rescNum %d, dma_addr 0x%lx, rsp_addr 0x%lx, fifo size %d\n", 
             rrsp.rescIdx, (uint64_t)rrsp.rescDma, (uint64_t)rrsp.rspResc, rreq2rrspFifo.size());
     if (cache.find(rrsp.rescIdx) != cache.end()) { /* It has already been fetched */
@@ -125,6 +148,9 @@ void HanGuRnic::RescCache<T, S>::fetchRsp() {
                         rep->srcQpn, rep->sndWqeBaseLkey);
             }
             cache.erase(wbRescNum);
+            if (evictNotify) {
+                evictNotify(wbRescNum);
+            }
             cache.emplace(rrsp.rescIdx, *(rrsp.rescDma));
             HANGU_PRINT(RescCache, "fetchRsp: capacity %d size %d, replaced idx %d pAddr 0x%lx\n", 
                     capacity, cache.size(), wbRescNum, pAddr);
@@ -153,10 +179,11 @@ void HanGuRnic::RescCache<T, S>::fetchRsp() {
         HANGU_PRINT(RescCache, "fetchRsp: rescUpdate is not null\n");
         rrsp.rescUpdate(cache[rrsp.rescIdx]);
     }
-    /* Schdeule myself if we have valid elem */
+    /* Schdeule myself if we have valid elem, i.e. more than one 
+     * fetch returned in the same cycle, or the one just retired 
+     * blocked younger fetch of the same resource */
     if (rreq2rrspFifo.size()) {
-        CacheRdPkt rrsp = rreq2rrspFifo.front();
-        if (rrsp.dmaReq->rdVld) {
+        if (findRetirable() != rreq2rrspFifo.end()) {
             if (!fetchCplEvent.scheduled()) {
                 rnic->schedule(fetchCplEvent, curTick() + rnic->clockPeriod());
             }
@@ -190,7 +217,6 @@ void HanGuRnic::RescCache<T, S>::icmStore(IcmResc *icmResc, uint32_t chunkNum) {
             ++idx;
         }
     }
-    delete[] icmResc;
 }
 
 template <class T, class S>
@@ -246,6 +272,9 @@ void HanGuRnic::RescCache<T, S>::rescWrite(uint32_t rescIdx, T *resc, const std:
         memcpy(writeReq, &(cache[wbRescNum]), sizeof(T));
         storeReq(pAddr, writeReq);
         cache.erase(wbRescNum);
+        if (evictNotify) {
+            evictNotify(wbRescNum);
+        }
         cache.emplace(rescIdx, *resc);
         HANGU_PRINT(RescCache, "rescWrite: wbRescNum %d, ICM_paddr_base 0x%x, new_index %d\n", wbRescNum, pAddr, rescIdx);
         HANGU_PRINT(RescCache, " RescCache: capacity %d size %d\n", capacity, cache.size());
@@ -425,6 +454,95 @@ void HanGuRnic::RescCache<T, S>::recordMissHit(CacheRdPkt &pkt, bool hit) {
     }
 }
 
+/**
+ * @note Only called when no request is in process, 
+ *      e.g. on leaving fast-forward with cold caches.
+ */
+template <class T, class S>
+void HanGuRnic::RescCache<T, S>::flush() {
+    for (auto &item : cache) {
+        T *wbReq = new T;
+        memcpy(wbReq, &(item.second), sizeof(T));
+        storeReq(rescNum2phyAddr(item.first), wbReq);
+    }
+    HANGU_PRINT(RescCache, "flush: write back %d entries\n", cache.size());
+    cache.clear();
+    replaceParam.clear();
+}
+
+/**
+ * @note Cached entries are checkpointed as raw bytes, together with 
+ *      their LRU order. If the checkpoint is restored into a smaller 
+ *      cache, least recently used entries are written back to ICM.
+ */
+template <class T, class S>
+void HanGuRnic::RescCache<T, S>::serialize(CheckpointOut &cp) const {
+    SERIALIZE_SCALAR(baseAddr);
+    icmPageOut(cp, icmPage);
+
+    std::vector<uint32_t> rescIdx;
+    std::vector<uint64_t> rescParam;
+    std::vector<uint8_t> rescData;
+    for (auto &item : cache) {
+        rescIdx.push_back(item.first);
+        rescParam.push_back(replaceParam.at(item.first));
+        rawAppend(rescData, item.second);
+    }
+    SERIALIZE_CONTAINER(rescIdx);
+    SERIALIZE_CONTAINER(rescParam);
+    SERIALIZE_CONTAINER(rescData);
+    SERIALIZE_SCALAR(maxParam);
+    SERIALIZE_SCALAR(hitNum);
+    SERIALIZE_SCALAR(missNum);
+}
+
+template <class T, class S>
+void HanGuRnic::RescCache<T, S>::unserialize(CheckpointIn &cp) {
+    UNSERIALIZE_SCALAR(baseAddr);
+    icmPageIn(cp, icmPage);
+
+    std::vector<uint32_t> rescIdx;
+    std::vector<uint64_t> rescParam;
+    std::vector<uint8_t> rescData;
+    UNSERIALIZE_CONTAINER(rescIdx);
+    UNSERIALIZE_CONTAINER(rescParam);
+    UNSERIALIZE_CONTAINER(rescData);
+    UNSERIALIZE_SCALAR(maxParam);
+    UNSERIALIZE_SCALAR(hitNum);
+    UNSERIALIZE_SCALAR(missNum);
+    assert(rescIdx.size() == rescParam.size());
+
+    cache.clear();
+    replaceParam.clear();
+    for (size_t i = 0; i < rescIdx.size(); ++i) {
+        T resc;
+        rawGet(resc, rescData, i);
+        cache.emplace(rescIdx[i], resc);
+        replaceParam[rescIdx[i]] = rescParam[i];
+    }
+
+    /* Restored into a smaller cache, keep the excess entries until 
+     * startup, no DMA may be issued while restoring. */
+    restoreWb.clear();
+    while (cache.size() > capacity) {
+        uint32_t wbRescNum = lruReplaceScheme();
+        restoreWb.emplace_back(wbRescNum, cache[wbRescNum]);
+        cache.erase(wbRescNum);
+        replaceParam.erase(wbRescNum);
+    }
+}
+
+template <class T, class S>
+void HanGuRnic::RescCache<T, S>::restoreWriteBack() {
+    for (auto &item : restoreWb) {
+        T *wbReq = new T;
+        memcpy(wbReq, &(item.second), sizeof(T));
+        storeReq(rescNum2phyAddr(item.first), wbReq);
+        HANGU_PRINT(RescCache, "restoreWriteBack: write back idx %d, capacity %d\n", item.first, capacity);
+    }
+    restoreWb.clear();
+}
+
 ///////////////////////////// HanGuRnic::Resource Cache {end}//////////////////////////////
 
 template class HanGuRnic::RescCache<CqcResc, CxtReqRspPtr>;
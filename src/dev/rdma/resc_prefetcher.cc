@@ -8,26 +8,56 @@ using namespace HanGuRnicDef;
 using namespace Net;
 using namespace std;
 
-HanGuRnic::RescPrefetcher::RescPrefetcher(HanGuRnic *rNic, const std::string name, int prefetchWindowSize):
+HanGuRnic::RescPrefetcher::RescPrefetcher(HanGuRnic *rNic, const std::string name, uint32_t depth, 
+        uint32_t minDepth, uint32_t maxDepth, uint32_t adaptInterval, double accLow, double lateHigh):
     rNic(rNic),
     _name(name),
     prefetchCnt(0),
-    prefetchWindowSize(prefetchWindowSize),
+    depth(depth),
+    minDepth(minDepth),
+    maxDepth(maxDepth),
+    adaptInterval(adaptInterval),
+    accLow(accLow),
+    lateHigh(lateHigh),
+    ivUseful(0),
+    ivLate(0),
+    ivEvicted(0),
     prefetchProcEvent([this]{prefetchProc();}, name),
     prefetchMemProcEvent([this]{prefetchMemProc();}, name),
     qpcPfetchRspProcEvent([this]{qpcPfetchRspProc();}, name) {
+    fatal_if(minDepth == 0 || minDepth > maxDepth, 
+            "%s: needs 0 < prefetch_min_depth <= prefetch_max_depth\n", name);
+    this->depth = std::min(std::max(depth, minDepth), maxDepth);
 }
 
-// launch prefetch signal, prefetch QPC, WQE, MPT
+/**
+ * @note
+ * Walk the next depth QPs of the low priority QPN queue, and prefetch 
+ * QPC and WQEs of the first one not prefetched yet. MPT and the first 
+ * MTT follow once its WQEs are in WQE buffer (see triggerMemPrefetch). 
+ * Under WFQ the queue order is not the serving order, but QPs near 
+ * the head are still served first in the long run.
+*/
 void HanGuRnic::RescPrefetcher::prefetchProc() {
-    assert(prefetchQue.size() > 0);
-    uint32_t qpn = prefetchQue.front();
-    HANGU_PRINT(RescPrefetcher, "prefetchProc: launch prefetch! qpn: 0x%x\n", qpn);
-    prefetchQue.pop();
+    auto &que = rNic->descScheduler.lowPriorityQpnQue;
+    uint32_t qpn = 0;
+    bool found = false;
+    uint32_t cnt = 0;
+    for (auto iter = que.begin(); iter != que.end() && cnt < depth; ++iter, ++cnt) {
+        if (lookaheadQpn.insert(*iter).second) {
+            qpn = *iter;
+            found = true;
+            break;
+        }
+    }
+    if (!found) {
+        // rescheduled once the queue moves or grows
+        return;
+    }
+    HANGU_PRINT(RescPrefetcher, "prefetchProc: launch prefetch! qpn: 0x%x, depth: %d\n", qpn, depth);
     prefetchCnt++;
-    // triggerPrefetch();
     // prefetch QPC
-    CxtReqRspPtr qpcRdReq = make_shared<CxtReqRsp>(CXT_PFCH_QP, CXT_CHNL_TX, qpn, 1, 0);
+    CxtReqRspPtr qpcRdReq = makePooled<CxtReqRsp>(CXT_PFCH_QP, CXT_CHNL_TX, qpn, 1, 0);
     qpcRdReq->txQpcRsp = new QpcResc;
     rNic->qpcModule.postQpcReq(qpcRdReq);
     // prefetch WQE
@@ -53,15 +83,16 @@ void HanGuRnic::RescPrefetcher::prefetchMemProc() {
         rNic->memPrefetchLkeyQue.pop();
         // this MPT is not supposed to being prefetched, 
         // or otherwise it will cause a lot of redundant prefetch request
-        if (mrPrefetchFlag[lkey] == false) { 
+        if (mrPrefetchFlag[lkey] == false && !rNic->mrRescModule.mptCache.isCached(lkey)) { 
             mrPrefetchFlag[lkey] = true;
+            pfIssue(PF_MPT, lkey);
             if (i == 0) {
                 offset = rNic->descScheduler.qpStatusTable[qpn]->fetch_offset;
             }
             else {
                 offset = 0;
             }
-            mrReq = make_shared<MrReqRsp>(DMA_TYPE_RREQ, MR_RCHNL_TX_MPT_PREFETCH, lkey, 0, offset, qpn);
+            mrReq = makePooled<MrReqRsp>(DMA_TYPE_RREQ, MR_RCHNL_TX_MPT_PREFETCH, lkey, 0, offset, qpn);
             rNic->mptPrefetchQue.push(mrReq);
         }
     }
@@ -76,15 +107,209 @@ void HanGuRnic::RescPrefetcher::prefetchMemProc() {
 // }
 
 void HanGuRnic::RescPrefetcher::triggerPrefetch() {
-    #ifdef ENABLE_PREFETCH
-    if ((rNic->descScheduler.lowPriorityQpnQue.size() < prefetchQue.size() + PREFETCH_WINDOW) && 
-        prefetchQue.size() != 0 &&
+    if (rNic->enablePrefetch && 
+        rNic->descScheduler.lowPriorityQpnQue.size() != 0 &&
         !prefetchProcEvent.scheduled()) {
         rNic->schedule(prefetchProcEvent, curTick() + rNic->clockPeriod());
     }
-    #endif
 }
 
+/* QP leaves the QPN queue, it is prefetched again if it comes back. 
+ * The lookahead window slides by one, so the QP entering it is prefetched. */
+void HanGuRnic::RescPrefetcher::qpServed(uint32_t qpn) {
+    lookaheadQpn.erase(qpn);
+    triggerPrefetch();
+}
+
+/* QPC is in QPC cache now, the response itself is useless */
 void HanGuRnic::RescPrefetcher::qpcPfetchRspProc() {
-    // do nothing
-}
\ No newline at end of file
+    assert(qpcPfetchRspFifo.size());
+    CxtReqRspPtr qpcRsp = qpcPfetchRspFifo.front();
+    qpcPfetchRspFifo.pop();
+    HANGU_PRINT(RescPrefetcher, "qpcPfetchRspProc: qpn: 0x%x\n", qpcRsp->num);
+    delete qpcRsp->txQpcRsp;
+    if (qpcPfetchRspFifo.size() && !qpcPfetchRspProcEvent.scheduled()) {
+        rNic->schedule(qpcPfetchRspProcEvent, curTick() + rNic->clockPeriod());
+    }
+}
+
+void HanGuRnic::RescPrefetcher::pfIssue(uint8_t resc, uint32_t idx) {
+    pfTrack[resc].insert(idx);
+    pfIssued[resc]++;
+}
+
+void HanGuRnic::RescPrefetcher::pfUse(uint8_t resc, uint32_t idx, bool ready) {
+    if (pfTrack[resc].erase(idx) == 0) {
+        return;
+    }
+    if (ready) {
+        pfUseful[resc]++;
+        ivUseful++;
+    }
+    else {
+        pfLate[resc]++;
+        ivLate++;
+    }
+    adaptDepth();
+}
+
+void HanGuRnic::RescPrefetcher::pfEvict(uint8_t resc, uint32_t idx) {
+    if (pfTrack[resc].erase(idx) == 0) {
+        return;
+    }
+    pfEvicted[resc]++;
+    ivEvicted++;
+    adaptDepth();
+}
+
+/**
+ * @note
+ * AIMD on the lookahead depth, over each adaptInterval resolved 
+ * prefetches. Evicted-before-use prefetches mean the lookahead runs 
+ * too far ahead for the caches, so the depth is halved if accuracy 
+ * is low. Late prefetches mean it does not run far enough to cover 
+ * the fetch latency, so the depth grows by one.
+*/
+void HanGuRnic::RescPrefetcher::adaptDepth() {
+    uint32_t total = ivUseful + ivLate + ivEvicted;
+    if (adaptInterval == 0 || total < adaptInterval) {
+        return;
+    }
+    double accuracy = (double)(ivUseful + ivLate) / total;
+    double lateness = (ivUseful + ivLate) ? (double)ivLate / (ivUseful + ivLate) : 0;
+    uint32_t newDepth = depth;
+    if (accuracy < accLow) {
+        newDepth = std::max(depth / 2, minDepth);
+    }
+    else if (lateness > lateHigh) {
+        newDepth = std::min(depth + 1, maxDepth);
+    }
+    HANGU_PRINT(RescPrefetcher, "adaptDepth: accuracy %f, lateness %f, depth %d -> %d\n", 
+            accuracy, lateness, depth, newDepth);
+    if (newDepth != depth) {
+        depth = newDepth;
+        pfDepthAdjust++;
+        triggerPrefetch();
+    }
+    pfDepth = depth;
+    ivUseful  = 0;
+    ivLate    = 0;
+    ivEvicted = 0;
+}
+
+void HanGuRnic::RescPrefetcher::regStats() {
+    pfIssued
+        .init(PF_RESC_NUM)
+        .name(_name + ".pfIssued")
+        .desc("Prefetches issued for entries not cached")
+        ;
+
+    pfUseful
+        .init(PF_RESC_NUM)
+        .name(_name + ".pfUseful")
+        .desc("Prefetched entries in cache when first used")
+        ;
+
+    pfLate
+        .init(PF_RESC_NUM)
+        .name(_name + ".pfLate")
+        .desc("Prefetched entries used before the prefetch completed")
+        ;
+
+    pfEvicted
+        .init(PF_RESC_NUM)
+        .name(_name + ".pfEvicted")
+        .desc("Prefetched entries evicted before use")
+        ;
+
+    pfAccuracy
+        .name(_name + ".pfAccuracy")
+        .desc("Fraction of resolved prefetches which are used")
+        .precision(3)
+        ;
+    pfAccuracy = (pfUseful + pfLate) / (pfUseful + pfLate + pfEvicted);
+
+    pfTimely
+        .name(_name + ".pfTimely")
+        .desc("Fraction of used prefetches which completed in time")
+        .precision(3)
+        ;
+    pfTimely = pfUseful / (pfUseful + pfLate);
+
+    const char *rescName[PF_RESC_NUM] = {"qpc", "wqe", "mpt", "mtt"};
+    for (int i = 0; i < PF_RESC_NUM; ++i) {
+        pfIssued.subname(i, rescName[i]);
+        pfUseful.subname(i, rescName[i]);
+        pfLate.subname(i, rescName[i]);
+        pfEvicted.subname(i, rescName[i]);
+        pfAccuracy.subname(i, rescName[i]);
+        pfTimely.subname(i, rescName[i]);
+    }
+
+    pfDepth
+        .name(_name + ".pfDepth")
+        .desc("Lookahead depth of the prefetcher over time (QPs)")
+        .precision(1)
+        ;
+
+    pfDepthAdjust
+        .name(_name + ".pfDepthAdjust")
+        .desc("Lookahead depth adjustments")
+        ;
+
+    /* Time weighted average holds the value from the start */
+    pfDepth = depth;
+}
+
+/**
+ * @note
+ * Prefetch tracking is kept across checkpoint, so that accuracy 
+ * accounting and the lookahead depth continue after restore.
+*/
+void HanGuRnic::RescPrefetcher::serialize(CheckpointOut &cp) const {
+    std::vector<uint32_t> pfQpn(lookaheadQpn.begin(), lookaheadQpn.end());
+    SERIALIZE_CONTAINER(pfQpn);
+
+    std::vector<uint32_t> mrPfQpn;
+    for (auto &item : mrPrefetchFlag) {
+        if (item.second) {
+            mrPfQpn.push_back(item.first);
+        }
+    }
+    SERIALIZE_CONTAINER(mrPfQpn);
+    SERIALIZE_SCALAR(prefetchCnt);
+
+    for (int i = 0; i < PF_RESC_NUM; ++i) {
+        std::vector<uint32_t> track(pfTrack[i].begin(), pfTrack[i].end());
+        arrayParamOut(cp, csprintf("pfTrack%d", i), track);
+    }
+    SERIALIZE_SCALAR(depth);
+    SERIALIZE_SCALAR(ivUseful);
+    SERIALIZE_SCALAR(ivLate);
+    SERIALIZE_SCALAR(ivEvicted);
+}
+
+void HanGuRnic::RescPrefetcher::unserialize(CheckpointIn &cp) {
+    std::vector<uint32_t> pfQpn;
+    UNSERIALIZE_CONTAINER(pfQpn);
+    lookaheadQpn = std::unordered_set<uint32_t>(pfQpn.begin(), pfQpn.end());
+
+    std::vector<uint32_t> mrPfQpn;
+    UNSERIALIZE_CONTAINER(mrPfQpn);
+    mrPrefetchFlag.clear();
+    for (auto qpn : mrPfQpn) {
+        mrPrefetchFlag[qpn] = true;
+    }
+    UNSERIALIZE_SCALAR(prefetchCnt);
+
+    for (int i = 0; i < PF_RESC_NUM; ++i) {
+        std::vector<uint32_t> track;
+        arrayParamIn(cp, csprintf("pfTrack%d", i), track);
+        pfTrack[i] = std::unordered_set<uint32_t>(track.begin(), track.end());
+    }
+    UNSERIALIZE_SCALAR(depth);
+    UNSERIALIZE_SCALAR(ivUseful);
+    UNSERIALIZE_SCALAR(ivLate);
+    UNSERIALIZE_SCALAR(ivEvicted);
+    pfDepth = depth;
+}
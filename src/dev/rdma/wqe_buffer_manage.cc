@@ -1,5 +1,8 @@
 #include "dev/rdma/hangu_rnic.hh"
 
+#include <algorithm>
+#include <cmath>
+
 #include "base/trace.hh"
 #include "debug/HanGu.hh"
 
@@ -14,8 +17,6 @@ HanGuRnic::WqeBufferManage::WqeBufferManage(HanGuRnic *rNic, const std::string n
     descBufferCap(wqeCacheNum),
     descBufferUsed(0),
     accessNum(0),
-    hitNum(0),
-    missNum(0),
     wqeReqReturnEvent([this]{wqeReqReturn();}, name),
     wqeReadReqProcessEvent([this]{wqeReadReqProcess();}, name),
     wqeBufferUpdateEvent([this]{wqeBufferUpdate();}, name),
@@ -37,19 +38,26 @@ void HanGuRnic::WqeBufferManage::wqeReadReqProcess() {
     rNic->descScheduler.wqeFetchInfoQue.pop();
     // assert(wqeBufferMetadataTable.find(qpStatus->qpn) != wqeBufferMetadataTable.end());
     if (wqeBufferMetadataTable.find(qpStatus->qpn) == wqeBufferMetadataTable.end()) {
-        wqeBufferMetadataTable[qpStatus->qpn] = std::make_shared<WqeBufferMetadata>();
+        wqeBufferMetadataTable[qpStatus->qpn] = std::make_shared<WqeBufferMetadata>(0, 0, qpStatus->head_ptr);
         HANGU_PRINT(WqeBufferManage, "wqeReadReqProcess: create WQE buffer metadata! qpn: 0x%x\n", qpStatus->qpn);
     }
     wqeBufferMetadataTable[qpStatus->qpn]->replaceParam = maxReplaceParam;
     maxReplaceParam++;
+    rNic->rescPrefetcher.pfUse(PF_WQE, qpStatus->qpn, 
+            descNum <= wqeBufferMetadataTable[qpStatus->qpn]->avaiNum);
+    wqeBufferMetadataTable[qpStatus->qpn]->consumeRate.sample(descNum, rNic->wqeKeepGain);
+    if (descNum > wqeBufferMetadataTable[qpStatus->qpn]->avaiNum && 
+            wqeBufferMetadataTable[qpStatus->qpn]->fetchReqNum == 0) {
+        wqeBufferMetadataTable[qpStatus->qpn]->missTick = curTick();
+    }
     HANGU_PRINT(WqeBufferManage, "wqeReadReqProcess: fetch wqe! qpn: 0x%x, descNum: %d, head: %d, tail: %d\n", 
         qpStatus->qpn, descNum, qpStatus->head_ptr, qpStatus->tail_ptr);
     assert(descNum <= qpStatus->head_ptr - qpStatus->tail_ptr);
     
     if (descNum > wqeBufferMetadataTable[qpStatus->qpn]->avaiNum + wqeBufferMetadataTable[qpStatus->qpn]->pendingReqNum) { // WQEs in the buffer is not sufficient
         missNum++;
-        HANGU_PRINT(WqeBufferManage, "wqeReadReqProcess: WQEs in buffer, pending req not sufficient! Launch more req! qpn: 0x%x, hitNum: %d, missNum: %d\n", 
-            qpStatus->qpn, hitNum, missNum);
+        HANGU_PRINT(WqeBufferManage, "wqeReadReqProcess: WQEs in buffer, pending req not sufficient! Launch more req! qpn: 0x%x, hitNum: %.0f, missNum: %.0f\n", 
+            qpStatus->qpn, hitNum.value(), missNum.value());
         int fetchNum;
         int fetchByte;
         int fetchOffset;
@@ -62,7 +70,7 @@ void HanGuRnic::WqeBufferManage::wqeReadReqProcess() {
         int sqWqeCap = sqSize / sizeof(TxDesc);
         assert((qpStatus->tail_ptr + wqeBufferMetadataTable[qpStatus->qpn]->pendingReqNum) % sqWqeCap + fetchNum <= sqWqeCap);
         fetchOffset = (qpStatus->tail_ptr + wqeBufferMetadataTable[qpStatus->qpn]->avaiNum + wqeBufferMetadataTable[qpStatus->qpn]->pendingReqNum) * sizeof(TxDesc) % sqSize;
-        MrReqRspPtr descReq = make_shared<MrReqRsp>(DMA_TYPE_RREQ, MR_RCHNL_TX_DESC_FETCH, qpStatus->key, fetchByte, fetchOffset, qpStatus->qpn);
+        MrReqRspPtr descReq = makePooled<MrReqRsp>(DMA_TYPE_RREQ, MR_RCHNL_TX_DESC_FETCH, qpStatus->key, fetchByte, fetchOffset, qpStatus->qpn);
         HANGU_PRINT(WqeBufferManage, "wqeReadReqProcess: read WQE! qpn: 0x%x, offset: %d, length: %d\n", qpStatus->qpn, fetchOffset, fetchByte);
         descReq->txDescRsp = new TxDesc[descNum];
         rNic->descReqFifo.push(descReq);
@@ -74,14 +82,14 @@ void HanGuRnic::WqeBufferManage::wqeReadReqProcess() {
     }
     else if (descNum > wqeBufferMetadataTable[qpStatus->qpn]->avaiNum) {
         missNum++;
-        HANGU_PRINT(WqeBufferManage, "wqeReadReqProcess: WQEs in buffer not sufficient, wait for pending req! qpn: 0x%x, hitNum: %d, missNum: %d\n", 
-            qpStatus->qpn, hitNum, missNum);
+        HANGU_PRINT(WqeBufferManage, "wqeReadReqProcess: WQEs in buffer not sufficient, wait for pending req! qpn: 0x%x, hitNum: %.0f, missNum: %.0f\n", 
+            qpStatus->qpn, hitNum.value(), missNum.value());
         wqeBufferMetadataTable[qpStatus->qpn]->fetchReqNum += descNum;
         wqeBufferMetadataTable[qpStatus->qpn]->replaceLock = true;
     }
     else { // WQEs in the buffer is sufficient
         hitNum++;
-        HANGU_PRINT(WqeBufferManage, "wqeReadReqProcess: WQEs in buffer sufficient! qpn: 0x%x, hitNum: %ld, missNum: %d\n", qpStatus->qpn, hitNum, missNum);
+        HANGU_PRINT(WqeBufferManage, "wqeReadReqProcess: WQEs in buffer sufficient! qpn: 0x%x, hitNum: %.0f, missNum: %.0f\n", qpStatus->qpn, hitNum.value(), missNum.value());
         WqeRspPtr wqeRsp = std::make_shared<WqeRsp>(descNum, qpStatus->qpn);
         for (int i = 0; i < descNum; i++) {
             wqeRsp->descList.push(wqeBuffer[qpStatus->qpn]->descArray[i]);
@@ -112,30 +120,55 @@ void HanGuRnic::WqeBufferManage::wqeReadRspProcess() {
     assert(wqeBufferMetadataTable[qpn]->pendingReqNum >= resp->length / sizeof(TxDesc));
     HANGU_PRINT(WqeBufferManage, "wqeReadRspProcess: descBufferUsed: %d!\n", descBufferUsed);
     // store WQEs
-    int min = maxReplaceParam;
     TxDescPtr txDesc;
+    int rspNum = resp->length / sizeof(TxDesc);
+    
+    // latWqeReserve entries are used by LAT_QP only, once there is one. 
+    // Bulk QPs replace LAT_QP WQEs only beyond the reserve, and LAT_QP 
+    // replaces bulk QPs first.
+    bool isLat = rNic->descScheduler.qpStatusTable[qpn]->type == LAT_QP;
+    int reserve = rNic->descScheduler.latQpNum ? rNic->latWqeReserve : 0;
+    int latUsed = reserve ? latDescUsed() : 0;
     
     // in case of desc buffer capacity is not enough, pick some descriptors and replace
-    while (descBufferCap - descBufferUsed < resp->length / sizeof(TxDesc)) {
+    while (descBufferCap - descBufferUsed < rspNum || 
+            (!isLat && descBufferCap - reserve - (descBufferUsed - latUsed) < rspNum)) {
         int replaceQpn = -1;
+        uint64_t min = maxReplaceParam;
+        bool replaceLat = true;
         
         // assert(wqeBufferMetadataTable.size() < 500);
         for (auto it = wqeBufferMetadataTable.begin(); it != wqeBufferMetadataTable.end(); it++) {
-            if (min > it->second->replaceParam && it->second->replaceLock == false && it->second->avaiNum > 0) {
+            if (it->second->replaceLock || it->second->avaiNum == 0) {
+                continue;
+            }
+            bool lat = reserve && rNic->descScheduler.qpStatusTable[it->first]->type == LAT_QP;
+            if (lat && !isLat && latUsed <= reserve) {
+                continue;
+            }
+            if ((replaceLat && !lat) || (replaceLat == lat && min > it->second->replaceParam)) {
                 min = it->second->replaceParam;
                 replaceQpn = it->first;
+                replaceLat = lat;
             }
         }
         HANGU_PRINT(WqeBufferManage, "wqeReadRspProcess: replace qpn: 0x%x, maxReplaceParam: %d, min: %d\n", replaceQpn, maxReplaceParam, min);
         
         assert(replaceQpn >= 0);
+        if (replaceLat) {
+            latUsed -= wqeBufferMetadataTable[replaceQpn]->avaiNum;
+        }
         descBufferUsed -= wqeBufferMetadataTable[replaceQpn]->avaiNum;
         wqeBufferMetadataTable[replaceQpn]->avaiNum = 0;
         wqeBuffer[replaceQpn]->descArray.clear();
+        rNic->rescPrefetcher.pfEvict(PF_WQE, replaceQpn);
     }
     
+    /* Descriptors share the ownership of the response array, 
+     * which is released with the last descriptor, no copy needed. */
+    TxDescPtr descArray(resp->txDescRsp, std::default_delete<TxDesc[]>());
     for (uint32_t i = 0; (i * sizeof(TxDesc)) < resp->length; ++i) {
-        txDesc = make_shared<TxDesc>(resp->txDescRsp + i);
+        txDesc = TxDescPtr(descArray, resp->txDescRsp + i);
         HANGU_PRINT(WqeBufferManage, "txDesc length: %d, lVaddr: 0x%x, opcode: %d, qpn: 0x%x, cq tag: %s\n", 
             txDesc->len, txDesc->lVaddr, txDesc->opcode, resp->qpn, txDesc->isSignaled() ? "true" : "false");
         assert(txDesc->len != 0);
@@ -160,6 +193,13 @@ void HanGuRnic::WqeBufferManage::wqeReadRspProcess() {
         HANGU_PRINT(WqeBufferManage, "wqeReadRspProcess: trigger WQE request return! qpn: 0x%x, avaiNum: %d, fetchReqNum: %d\n", 
             qpn, wqeBufferMetadataTable[qpn]->avaiNum, wqeBufferMetadataTable[qpn]->fetchReqNum);
 
+        if (wqeBufferMetadataTable[qpn]->missTick) {
+            double cost = curTick() - wqeBufferMetadataTable[qpn]->missTick;
+            wqeBufferMetadataTable[qpn]->missCost.sample(cost, rNic->wqeKeepGain);
+            avgMissCost.sample(cost, rNic->wqeKeepGain);
+            wqeBufferMetadataTable[qpn]->missTick = 0;
+        }
+
         WqeRspPtr wqeRsp = std::make_shared<WqeRsp>(wqeBufferMetadataTable[qpn]->fetchReqNum, qpn);
         for (int i = 0; i < wqeBufferMetadataTable[qpn]->fetchReqNum; i++) {
             TxDescPtr txDesc = wqeBuffer[qpn]->descArray[i];
@@ -217,18 +257,24 @@ void HanGuRnic::WqeBufferManage::wqePrefetchProc() {
     activeNum = rNic->descScheduler.qpStatusTable[qpn]->head_ptr - rNic->descScheduler.qpStatusTable[qpn]->tail_ptr;
     HANGU_PRINT(WqeBufferManage, "wqePrefetchProc: active num: %d\n", activeNum);
     
-    if (activeNum > MAX_PREFETCH_NUM) {
-        keepNum = MAX_PREFETCH_NUM;
+    int fetchDepth = rNic->quantumPolicy->fetchDepth();
+    if (activeNum > fetchDepth) {
+        keepNum = fetchDepth;
     }
     else {
-        keepNum = activeNum; // WARNING: HOW TO UPDATE KEEPNUM IN TIME?
+        keepNum = activeNum; // kept in time by adaptKeepNum, if adaptive_wqe_keep is set
     }
-    HANGU_PRINT(WqeBufferManage, "wqePrefetchProc: keepNum: %d!\n", keepNum);
     
+    bool created = false;
     if (wqeBufferMetadataTable.find(qpn) == wqeBufferMetadataTable.end()) {
-        wqeBufferMetadataTable[qpn] = std::make_shared<WqeBufferMetadata>(keepNum, maxReplaceParam);
+        wqeBufferMetadataTable[qpn] = std::make_shared<WqeBufferMetadata>(keepNum, maxReplaceParam, qpStatus->head_ptr);
+        created = true;
         HANGU_PRINT(WqeBufferManage, "wqePrefetchProc: create WQE buffer metadata!\n");
     }
+    if (rNic->adaptiveWqeKeep) {
+        keepNum = adaptKeepNum(qpn, activeNum, fetchDepth, !created);
+    }
+    HANGU_PRINT(WqeBufferManage, "wqePrefetchProc: keepNum: %d!\n", keepNum);
     wqeBufferMetadataTable[qpn]->keepNum = keepNum;
     wqeBufferMetadataTable[qpn]->replaceParam = maxReplaceParam;
     maxReplaceParam++;
@@ -243,6 +289,7 @@ void HanGuRnic::WqeBufferManage::wqePrefetchProc() {
         int prefetchNum = wqeBufferMetadataTable[qpn]->keepNum - wqeBufferMetadataTable[qpn]->avaiNum - wqeBufferMetadataTable[qpn]->pendingReqNum;
         // assert(wqeBufferMetadataTable[qpn]->pendingReqNum == 0);
         assert(prefetchNum > 0);
+        rNic->rescPrefetcher.pfIssue(PF_WQE, qpn);
 
         // WQE request exceeds the border of a QP, needs to send TWO MR request
         if ((qpStatus->tail_ptr + wqeBufferMetadataTable[qpn]->avaiNum + wqeBufferMetadataTable[qpn]->pendingReqNum) % sqWqeCap + prefetchNum > sqWqeCap) { 
@@ -253,7 +300,7 @@ void HanGuRnic::WqeBufferManage::wqePrefetchProc() {
             int tempPrefetchNum = sqWqeCap - (qpStatus->tail_ptr + wqeBufferMetadataTable[qpn]->avaiNum + wqeBufferMetadataTable[qpn]->pendingReqNum) % sqWqeCap;
             int tempPrefetchOffset = ((qpStatus->tail_ptr + wqeBufferMetadataTable[qpn]->avaiNum + wqeBufferMetadataTable[qpn]->pendingReqNum) % sqWqeCap) * sizeof(TxDesc);
             int tempPrefetchByte = tempPrefetchNum * sizeof(TxDesc);
-            MrReqRspPtr descPrefetchReq = make_shared<MrReqRsp>(DMA_TYPE_RREQ, MR_RCHNL_TX_DESC_PREFETCH, qpStatus->key, tempPrefetchByte, tempPrefetchOffset, qpStatus->qpn);
+            MrReqRspPtr descPrefetchReq = makePooled<MrReqRsp>(DMA_TYPE_RREQ, MR_RCHNL_TX_DESC_PREFETCH, qpStatus->key, tempPrefetchByte, tempPrefetchOffset, qpStatus->qpn);
             
             HANGU_PRINT(WqeBufferManage, "wqePrefetchProc: first prefetch num: %d, prefetch byte: %d, offset: %d, avai num: %d!\n", 
                 tempPrefetchNum, tempPrefetchByte, tempPrefetchOffset, wqeBufferMetadataTable[qpn]->avaiNum);
@@ -265,7 +312,7 @@ void HanGuRnic::WqeBufferManage::wqePrefetchProc() {
             tempPrefetchNum = prefetchNum - tempPrefetchNum;
             tempPrefetchOffset = 0;
             tempPrefetchByte = tempPrefetchNum * sizeof(TxDesc);
-            descPrefetchReq = make_shared<MrReqRsp>(DMA_TYPE_RREQ, MR_RCHNL_TX_DESC_PREFETCH, qpStatus->key, tempPrefetchByte, tempPrefetchOffset, qpStatus->qpn);
+            descPrefetchReq = makePooled<MrReqRsp>(DMA_TYPE_RREQ, MR_RCHNL_TX_DESC_PREFETCH, qpStatus->key, tempPrefetchByte, tempPrefetchOffset, qpStatus->qpn);
             
             HANGU_PRINT(WqeBufferManage, "wqePrefetchProc: second prefetch num: %d, prefetch byte: %d, offset: %d, avai num: %d!\n", 
                 tempPrefetchNum, tempPrefetchByte, tempPrefetchOffset, wqeBufferMetadataTable[qpn]->avaiNum);
@@ -278,7 +325,7 @@ void HanGuRnic::WqeBufferManage::wqePrefetchProc() {
             int tempPrefetchOffset = ((qpStatus->tail_ptr + wqeBufferMetadataTable[qpn]->avaiNum + wqeBufferMetadataTable[qpn]->pendingReqNum) % sqWqeCap) * sizeof(TxDesc);
             int prefetchByte = prefetchNum * sizeof(TxDesc);
 
-            MrReqRspPtr descPrefetchReq = make_shared<MrReqRsp>(DMA_TYPE_RREQ, MR_RCHNL_TX_DESC_PREFETCH, qpStatus->key, prefetchByte, tempPrefetchOffset, qpStatus->qpn);
+            MrReqRspPtr descPrefetchReq = makePooled<MrReqRsp>(DMA_TYPE_RREQ, MR_RCHNL_TX_DESC_PREFETCH, qpStatus->key, prefetchByte, tempPrefetchOffset, qpStatus->qpn);
             descPrefetchReq->txDescRsp = new TxDesc[prefetchNum];
             rNic->descReqFifo.push(descPrefetchReq);
 
@@ -348,6 +395,58 @@ void HanGuRnic::WqeBufferManage::triggerMemPrefetch(uint32_t qpn) {
         qpn, wqeBufferMetadataTable[qpn]->avaiNum);
 }
 
+/**
+ * @note
+ * keepNum is what the QP consumes each time it is served, rather than 
+ * the fetch depth for every QP. The WQE buffer (less the LAT_QP 
+ * reserve) is shared by the QPs in the QPN queue, each one weighted 
+ * by its need times its WQE fetch miss cost, so QPs stalling longer 
+ * on a miss keep more. A QP posting more than it consumes between 
+ * two prefetches is backlogged and served again soon, its weight 
+ * follows the post rate instead. The post rate is not sampled on 
+ * the prefetch which creates the metadata, no interval has passed.
+*/
+int HanGuRnic::WqeBufferManage::adaptKeepNum(uint32_t qpn, int activeNum, int fetchDepth, bool samplePost) {
+    WqeBufferMetadataPtr meta = wqeBufferMetadataTable[qpn];
+    uint32_t headPtr = rNic->descScheduler.qpStatusTable[qpn]->head_ptr;
+    double gain = rNic->wqeKeepGain;
+
+    if (samplePost) {
+        meta->postRate.sample(headPtr - meta->lastHead, gain);
+    }
+    meta->lastHead = headPtr;
+
+    double need = meta->consumeRate.sampled ? meta->consumeRate.avg : fetchDepth;
+    double cost = meta->missCost.sampled ? meta->missCost.avg : avgMissCost.avg;
+    double score = std::max(need, meta->postRate.avg) * std::max(cost, 1.0);
+    avgScore.sample(score, gain);
+
+    int budget = descBufferCap - (rNic->descScheduler.latQpNum ? rNic->latWqeReserve : 0);
+    int qpNum = std::max(rNic->descScheduler.lowPriorityQpnQue.size(), (size_t)1);
+    double share = budget * score / (qpNum * avgScore.avg);
+
+    int keepNum = std::min((int)std::ceil(need), (int)share);
+    keepNum = std::min(std::max(keepNum, 1), fetchDepth);
+    keepNum = std::min(keepNum, activeNum);
+    HANGU_PRINT(WqeBufferManage, "adaptKeepNum: qpn: 0x%x, need: %f, post: %f, cost: %f, share: %f, keepNum: %d\n", 
+        qpn, need, meta->postRate.avg, cost, share, keepNum);
+    return keepNum;
+}
+
+/**
+ * @note
+ * WQE buffer entries used by LAT_QP
+*/
+int HanGuRnic::WqeBufferManage::latDescUsed() {
+    int used = 0;
+    for (auto &item : wqeBufferMetadataTable) {
+        if (rNic->descScheduler.qpStatusTable[item.first]->type == LAT_QP) {
+            used += item.second->avaiNum;
+        }
+    }
+    return used;
+}
+
 void HanGuRnic::WqeBufferManage::createWqeBuffer() {
     while (rNic->createWqeBufferQue.size() != 0) {
         uint32_t qpn = rNic->createWqeBufferQue.front();
@@ -355,4 +454,172 @@ void HanGuRnic::WqeBufferManage::createWqeBuffer() {
         wqeBuffer[qpn] = std::make_shared<WqeBufferUnit>();
         HANGU_PRINT(WqeBufferManage, "create wqe buffer! qpn: 0x%x\n", qpn);
     }
-}
\ No newline at end of file
+}
+bool HanGuRnic::WqeBufferManage::isIdle() {
+    if (wqeReturnQue.size() || prefetchQpnQue.size() || wqeRspQue.size()) {
+        return false;
+    }
+    for (auto &item : wqeBufferMetadataTable) {
+        if (item.second->pendingReqNum || item.second->fetchReqNum) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void HanGuRnic::WqeBufferManage::regStats() {
+    hitNum
+        .name(_name + ".hitNum")
+        .desc("WQE fetches served from the WQE buffer")
+        ;
+
+    missNum
+        .name(_name + ".missNum")
+        .desc("WQE fetches waiting for WQEs to be read from memory")
+        ;
+
+    hitRate
+        .name(_name + ".hitRate")
+        .desc("Fraction of WQE fetches served from the WQE buffer")
+        .precision(3)
+        ;
+    hitRate = hitNum / (hitNum + missNum);
+}
+
+/**
+ * @note
+ * Buffered WQEs are kept across checkpoint, so that prefetched WQEs 
+ * are not fetched again after restore.
+*/
+void HanGuRnic::WqeBufferManage::serialize(CheckpointOut &cp) const {
+    SERIALIZE_SCALAR(maxReplaceParam);
+    SERIALIZE_SCALAR(descBufferUsed);
+    SERIALIZE_SCALAR(accessNum);
+    paramOut(cp, "avgMissCost", avgMissCost.avg);
+    paramOut(cp, "avgMissCostSampled", avgMissCost.sampled);
+    paramOut(cp, "avgScore", avgScore.avg);
+    paramOut(cp, "avgScoreSampled", avgScore.sampled);
+
+    std::vector<uint32_t> bufQpn, bufDescNum;
+    std::vector<uint8_t> bufDesc;
+    for (auto &item : wqeBuffer) {
+        bufQpn.push_back(item.first);
+        bufDescNum.push_back(item.second->descArray.size());
+        for (auto &desc : item.second->descArray) {
+            rawAppend(bufDesc, *desc);
+        }
+    }
+    SERIALIZE_CONTAINER(bufQpn);
+    SERIALIZE_CONTAINER(bufDescNum);
+    SERIALIZE_CONTAINER(bufDesc);
+
+    std::vector<uint32_t> metaQpn;
+    std::vector<uint16_t> metaAvaiNum, metaFetchReqNum, metaKeepNum, metaPendingReqNum;
+    std::vector<uint64_t> metaReplaceParam;
+    std::vector<bool> metaReplaceLock;
+    std::vector<uint32_t> metaLastHead;
+    std::vector<double> metaPostRate, metaConsumeRate, metaMissCost;
+    std::vector<bool> metaPostSampled, metaConsumeSampled, metaMissSampled;
+    std::vector<Tick> metaMissTick;
+    for (auto &item : wqeBufferMetadataTable) {
+        metaQpn.push_back(item.first);
+        metaAvaiNum.push_back(item.second->avaiNum);
+        metaFetchReqNum.push_back(item.second->fetchReqNum);
+        metaKeepNum.push_back(item.second->keepNum);
+        metaPendingReqNum.push_back(item.second->pendingReqNum);
+        metaReplaceParam.push_back(item.second->replaceParam);
+        metaReplaceLock.push_back(item.second->replaceLock);
+        metaLastHead.push_back(item.second->lastHead);
+        metaPostRate.push_back(item.second->postRate.avg);
+        metaConsumeRate.push_back(item.second->consumeRate.avg);
+        metaMissCost.push_back(item.second->missCost.avg);
+        metaPostSampled.push_back(item.second->postRate.sampled);
+        metaConsumeSampled.push_back(item.second->consumeRate.sampled);
+        metaMissSampled.push_back(item.second->missCost.sampled);
+        metaMissTick.push_back(item.second->missTick);
+    }
+    SERIALIZE_CONTAINER(metaQpn);
+    SERIALIZE_CONTAINER(metaAvaiNum);
+    SERIALIZE_CONTAINER(metaFetchReqNum);
+    SERIALIZE_CONTAINER(metaKeepNum);
+    SERIALIZE_CONTAINER(metaPendingReqNum);
+    SERIALIZE_CONTAINER(metaReplaceParam);
+    SERIALIZE_CONTAINER(metaReplaceLock);
+    SERIALIZE_CONTAINER(metaLastHead);
+    SERIALIZE_CONTAINER(metaPostRate);
+    SERIALIZE_CONTAINER(metaConsumeRate);
+    SERIALIZE_CONTAINER(metaMissCost);
+    SERIALIZE_CONTAINER(metaPostSampled);
+    SERIALIZE_CONTAINER(metaConsumeSampled);
+    SERIALIZE_CONTAINER(metaMissSampled);
+    SERIALIZE_CONTAINER(metaMissTick);
+}
+
+void HanGuRnic::WqeBufferManage::unserialize(CheckpointIn &cp) {
+    UNSERIALIZE_SCALAR(maxReplaceParam);
+    UNSERIALIZE_SCALAR(descBufferUsed);
+    UNSERIALIZE_SCALAR(accessNum);
+    paramIn(cp, "avgMissCost", avgMissCost.avg);
+    paramIn(cp, "avgMissCostSampled", avgMissCost.sampled);
+    paramIn(cp, "avgScore", avgScore.avg);
+    paramIn(cp, "avgScoreSampled", avgScore.sampled);
+
+    std::vector<uint32_t> bufQpn, bufDescNum;
+    std::vector<uint8_t> bufDesc;
+    UNSERIALIZE_CONTAINER(bufQpn);
+    UNSERIALIZE_CONTAINER(bufDescNum);
+    UNSERIALIZE_CONTAINER(bufDesc);
+    assert(bufQpn.size() == bufDescNum.size());
+    wqeBuffer.clear();
+    size_t descIdx = 0;
+    for (size_t i = 0; i < bufQpn.size(); ++i) {
+        WqeBufferUnitPtr unit = std::make_shared<WqeBufferUnit>();
+        for (uint32_t j = 0; j < bufDescNum[i]; ++j) {
+            TxDescPtr desc = makePooled<TxDesc>();
+            rawGet(*desc, bufDesc, descIdx++);
+            unit->descArray.push_back(desc);
+        }
+        wqeBuffer[bufQpn[i]] = unit;
+    }
+
+    std::vector<uint32_t> metaQpn;
+    std::vector<uint16_t> metaAvaiNum, metaFetchReqNum, metaKeepNum, metaPendingReqNum;
+    std::vector<uint64_t> metaReplaceParam;
+    std::vector<bool> metaReplaceLock;
+    std::vector<uint32_t> metaLastHead;
+    std::vector<double> metaPostRate, metaConsumeRate, metaMissCost;
+    std::vector<bool> metaPostSampled, metaConsumeSampled, metaMissSampled;
+    std::vector<Tick> metaMissTick;
+    UNSERIALIZE_CONTAINER(metaQpn);
+    UNSERIALIZE_CONTAINER(metaAvaiNum);
+    UNSERIALIZE_CONTAINER(metaFetchReqNum);
+    UNSERIALIZE_CONTAINER(metaKeepNum);
+    UNSERIALIZE_CONTAINER(metaPendingReqNum);
+    UNSERIALIZE_CONTAINER(metaReplaceParam);
+    UNSERIALIZE_CONTAINER(metaReplaceLock);
+    UNSERIALIZE_CONTAINER(metaLastHead);
+    UNSERIALIZE_CONTAINER(metaPostRate);
+    UNSERIALIZE_CONTAINER(metaConsumeRate);
+    UNSERIALIZE_CONTAINER(metaMissCost);
+    UNSERIALIZE_CONTAINER(metaPostSampled);
+    UNSERIALIZE_CONTAINER(metaConsumeSampled);
+    UNSERIALIZE_CONTAINER(metaMissSampled);
+    UNSERIALIZE_CONTAINER(metaMissTick);
+    wqeBufferMetadataTable.clear();
+    for (size_t i = 0; i < metaQpn.size(); ++i) {
+        WqeBufferMetadataPtr meta = std::make_shared<WqeBufferMetadata>(
+                metaKeepNum[i], metaReplaceParam[i], metaLastHead[i]);
+        meta->avaiNum       = metaAvaiNum[i];
+        meta->fetchReqNum   = metaFetchReqNum[i];
+        meta->pendingReqNum = metaPendingReqNum[i];
+        meta->replaceLock   = metaReplaceLock[i];
+        meta->postRate.avg          = metaPostRate[i];
+        meta->postRate.sampled      = metaPostSampled[i];
+        meta->consumeRate.avg       = metaConsumeRate[i];
+        meta->consumeRate.sampled   = metaConsumeSampled[i];
+        meta->missCost.avg          = metaMissCost[i];
+        meta->missCost.sampled      = metaMissSampled[i];
+        meta->missTick      = metaMissTick[i];
+        wqeBufferMetadataTable[metaQpn[i]] = meta;
+    }
+}
@@ -1,5 +1,8 @@
 #include "librdma.h"
 
+/* Type of test QPs, RC or UC (RDMA Write only) */
+uint8_t qp_type = QP_TYPE_RC;
+
 int clt_update_qps(struct rdma_resc *resc, uint16_t svr_lid) {
 
     /* Modify Local QP */
@@ -10,7 +13,7 @@ int clt_update_qps(struct rdma_resc *resc, uint16_t svr_lid) {
         struct ibv_qp *qp = resc->qp[i];
         qp->ctx = resc->ctx;
         qp->flag = 0;
-        qp->type = QP_TYPE_RC;
+        qp->type = qp_type;
         qp->cq = resc->cq[i % TEST_CQ_NUM];// 
         qp->snd_wqe_offset = 0;
         qp->rcv_wqe_offset = 0;
@@ -132,7 +135,7 @@ int clt_connect_qps(struct rdma_resc *resc, uint16_t svr_lid) {
         
         /* Modify Local QP */
         cr_snd[snd_cnt].flag      = CR_TYPE_REQ;
-        cr_snd[snd_cnt].qp_type   = QP_TYPE_RC;
+        cr_snd[snd_cnt].qp_type   = qp_type;
         cr_snd[snd_cnt].src_lid   = resc->ctx->lid;
         cr_snd[snd_cnt].src_qpn   = resc->qp[snd_sum]->qp_num;
         cr_snd[snd_cnt].snd_psn   = 0;
@@ -213,6 +216,7 @@ static void usage(const char *argv0) {
     printf("  -t, --num-client=<num_client>     number of clients (default 1)\n");
     printf("  -c, --cpu-id=<cpu_id>             id of the cpu (default 0)\n");
     printf("  -m, --op-mode=<op_mode>           opcode mode (default 0, which is RDMA Write)\n");
+    printf("  -u, --uc                          use UC QPs instead of RC, RDMA Write only\n");
 }
 
 int clt_fill_mr(struct ibv_mr *mr, uint32_t offset) {
@@ -245,10 +249,11 @@ int main (int argc, char **argv) {
             { .name = "num-client",   .has_arg = 1, .val = 't' },
             { .name = "cpu-id"    ,   .has_arg = 1, .val = 'c' },
             { .name = "op-mode"   ,   .has_arg = 1, .val = 'm' },
+            { .name = "uc"        ,   .has_arg = 0, .val = 'u' },
             { 0 }
         };
 
-        c = getopt_long(argc, argv, "s:l:t:c:m:", long_options, NULL);
+        c = getopt_long(argc, argv, "s:l:t:c:m:u", long_options, NULL);
         if (c == -1)
             break;
 
@@ -285,6 +290,9 @@ int main (int argc, char **argv) {
                 exit(-1);
             }
             break;
+        case 'u':
+            qp_type = QP_TYPE_UC;
+            break;
 
         default:
             usage(argv[0]);
@@ -292,6 +300,11 @@ int main (int argc, char **argv) {
         }
     }
 
+    if (qp_type == QP_TYPE_UC && op_mode != OPMODE_RDMA_WRITE) {
+        RDMA_PRINT(Client, "UC QP supports RDMA Write only. Exit.\n");
+        exit(-1);
+    }
+
     sprintf(id_name, "%d", llid);
     // RDMA_PRINT(Client, "num_client %d\n", num_client);
 
@@ -44,12 +44,19 @@ void trans_wait(struct ibv_context *context) {
     ioctl(dvr->fd, HGKFD_IOC_CHECK_GO, NULL);
 }
 
-uint8_t write_cmd(int fd, unsigned long request, void *args) {
+/* Post the command without waiting for it to finish, 
+ * only retry when the device could not accept it. */
+uint8_t post_cmd(int fd, unsigned long request, void *args) {
     while (ioctl(fd, request, (void *)args)) {
         // HGRNIC_PRINT(" %ld ioctl failed try again\n", request);
         wait(SLEEP_CNT);
         // usleep(1);
     }
+    return 0;
+}
+
+/* Wait for all posted commands to finish */
+uint8_t wait_cmd(int fd) {
     do {
         wait(SLEEP_CNT);
     } while (ioctl(fd, HGKFD_IOC_CHECK_GO, NULL));
@@ -57,6 +64,11 @@ uint8_t write_cmd(int fd, unsigned long request, void *args) {
     return 0;
 }
 
+uint8_t write_cmd(int fd, unsigned long request, void *args) {
+    post_cmd(fd, request, args);
+    return wait_cmd(fd);
+}
+
 
 int ibv_open_device(struct ibv_context *context, uint16_t lid) {
 
@@ -186,7 +198,7 @@ struct ibv_qp * ibv_create_batch_qp(struct ibv_context *context, struct ibv_qp_c
 
     struct hghca_context *dvr = (struct hghca_context *)context->dvr;
     struct ibv_qp *qp = (struct ibv_qp *)malloc(sizeof(struct ibv_qp) * batch_size);
-    memset(qp, 0, sizeof(struct ibv_qp));
+    memset(qp, 0, sizeof(struct ibv_qp) * batch_size);
 
     /* allocate QP */
     uint32_t batch_cnt = 0;
@@ -264,6 +276,22 @@ struct ibv_qp * ibv_create_qp(struct ibv_context *context, struct ibv_qp_create_
     return qp;
 }
 
+/**
+ * @note Use doorbell record for the QP, call it before ibv_modify_qp. 
+ *       ibv_post_send then updates the record, and rings the doorbell 
+ *       only if RNIC has run out of WQEs of this QP.
+ */
+int ibv_enable_db_record(struct ibv_qp *qp) {
+    void *rec;
+    if (posix_memalign(&rec, 64, sizeof(struct hghca_db_rec))) {
+        return -1;
+    }
+    qp->db_rec = (struct hghca_db_rec *)rec;
+    qp->db_rec->sq_pi = 0;
+    qp->db_rec->armed = 1; /* The first post rings the doorbell */
+    return 0;
+}
+
 int ibv_modify_batch_qp(struct ibv_context *context, struct ibv_qp *qp, uint32_t batch_size) {
     // HGRNIC_PRINT(" enter ibv_modify_batch_qp!\n");
     struct hghca_context *dvr = (struct hghca_context *)context->dvr;
@@ -303,17 +331,20 @@ int ibv_modify_batch_qp(struct ibv_context *context, struct ibv_qp *qp, uint32_t
             qpc_args->indicator[i]  = qp[batch_cnt + i].indicator;
             qpc_args->weight[i]     = qp[batch_cnt + i].weight;
             qpc_args->groupID[i]    = qp[batch_cnt + i].group_id;
+            qpc_args->dbr_addr[i]   = (uint64_t)qp[batch_cnt + i].db_rec;
+            qpc_args->port[i]       = qp[batch_cnt + i].port;
 
             // HGRNIC_PRINT(" ibv_modify_batch_qp! qpn 0x%x, indicator: %d, weight: %d, group: %d\n", 
                 // qp[batch_cnt + i].qp_num, qp[batch_cnt + i].indicator, qp[batch_cnt + i].weight, qp[batch_cnt + i].group_id);
         }
-        write_cmd(dvr->fd, HGKFD_IOC_WRITE_QPC, qpc_args);
+        post_cmd(dvr->fd, HGKFD_IOC_WRITE_QPC, qpc_args);
         
         batch_cnt  += sub_bsz;
         batch_left -= sub_bsz;
         assert(batch_cnt + batch_left == batch_size);
-        write_cmd(dvr->fd, HGKFD_IOC_UPDATE_QP_WEIGHT, qpc_args);
+        post_cmd(dvr->fd, HGKFD_IOC_UPDATE_QP_WEIGHT, qpc_args);
     }
+    wait_cmd(dvr->fd);
     free(qpc_args);
     
     // update all QP granularity
@@ -354,6 +385,8 @@ int ibv_modify_qp(struct ibv_context *context, struct ibv_qp *qp) {
     qpc_args->indicator[0]  = qp->indicator;
     qpc_args->weight[0]     = qp->weight;
     qpc_args->groupID[0]    = qp->group_id;
+    qpc_args->dbr_addr[0]   = (uint64_t)qp->db_rec;
+    qpc_args->port[0]       = qp->port;
     // HGRNIC_PRINT(" ibv_modify_qp! qpn 0x%x, indicator: %d, weight: %d, group: %d\n", 
                 // qp->qp_num, qp->indicator, qp->weight, qp->group_id);
     write_cmd(dvr->fd, HGKFD_IOC_WRITE_QPC, qpc_args);
@@ -403,17 +436,17 @@ struct ibv_mr * ibv_reg_batch_mr(struct ibv_context *context, struct ibv_mr_init
             mtt_args->vaddr[i] = mr[batch_cnt + i].mtt[0].vaddr;
         }
         mtt_args->batch_size = sub_bsz;
-        write_cmd(dvr->fd, HGKFD_IOC_ALLOC_MTT, (void *)mtt_args);
+        post_cmd(dvr->fd, HGKFD_IOC_ALLOC_MTT, (void *)mtt_args);
         for (uint32_t i = 0; i < sub_bsz; ++i) {
             mr[batch_cnt + i].mtt[0].mtt_index = mtt_args->mtt_index + i;
             mr[batch_cnt + i].mtt[0].paddr = mtt_args->paddr[i];
         }
         mtt_args->batch_size = sub_bsz;
-        write_cmd(dvr->fd, HGKFD_IOC_WRITE_MTT, (void *)mtt_args);
+        post_cmd(dvr->fd, HGKFD_IOC_WRITE_MTT, (void *)mtt_args);
 
         /* Allocate MPT */
         mpt_alloc_args->batch_size = sub_bsz;
-        write_cmd(dvr->fd, HGKFD_IOC_ALLOC_MPT, (void *)mpt_alloc_args);
+        post_cmd(dvr->fd, HGKFD_IOC_ALLOC_MPT, (void *)mpt_alloc_args);
         for (uint32_t i = 0; i < sub_bsz; ++i) {
             mr[batch_cnt + i].lkey = mpt_alloc_args->mpt_index + i;
             assert(mr[batch_cnt + i].lkey == mr[batch_cnt + i].mtt->mtt_index);
@@ -429,13 +462,14 @@ struct ibv_mr * ibv_reg_batch_mr(struct ibv_context *context, struct ibv_mr_init
             mpt_args->mtt_index[i] = mr[batch_cnt + i].mtt[0].mtt_index;
             mpt_args->mpt_index[i] = mr[batch_cnt + i].lkey;
         }
-        write_cmd(dvr->fd, HGKFD_IOC_WRITE_MPT, (void *)mpt_args);
+        post_cmd(dvr->fd, HGKFD_IOC_WRITE_MPT, (void *)mpt_args);
 
         /* update finished  */
         batch_left -= sub_bsz;
         batch_cnt += sub_bsz;
         assert(batch_cnt + batch_left == batch_size);
     }
+    wait_cmd(dvr->fd);
     free(mtt_args);
     free(mpt_alloc_args);
     free(mpt_args);
@@ -552,9 +586,11 @@ int ibv_post_send(struct ibv_context *context, struct ibv_wqe *wqe, struct ibv_q
                                                                                     * is not enough for one descriptor. */
             /* Post send doorbell */
             // tx_desc->opcode  = IBV_TYPE_NULL;
-            uint32_t db_low  = (sq_head << 4) | first_trans_type;
-            uint32_t db_high = (qp->qp_num << 8) | snd_cnt;
-            *doorbell = ((uint64_t)db_high << 32) | db_low;
+            if (qp->db_rec == NULL) {
+                uint32_t db_low  = (sq_head << 4) | first_trans_type;
+                uint32_t db_high = (qp->qp_num << 8) | snd_cnt;
+                *doorbell = ((uint64_t)db_high << 32) | db_low;
+            }
             
             sq_head = 0;
             first_trans_type = (i == num - 1) ? IBV_TYPE_NULL : wqe[i+1].trans_type;
@@ -574,7 +610,18 @@ int ibv_post_send(struct ibv_context *context, struct ibv_wqe *wqe, struct ibv_q
         assert(tx_desc->opcode != 0);
     }
 
-    if (snd_cnt) {
+    if (qp->db_rec) {
+        /* Update doorbell record, and ring the doorbell only if 
+         * RNIC asks for it. num in doorbell is ignored by RNIC. */
+        qp->db_rec->sq_pi += num;
+        __sync_synchronize();
+        if (qp->db_rec->armed) {
+            qp->db_rec->armed = 0;
+            uint32_t db_low  = (sq_head << 4) | wqe[0].trans_type;
+            uint32_t db_high = (qp->qp_num << 8) | num;
+            *doorbell = ((uint64_t)db_high << 32) | db_low;
+        }
+    } else if (snd_cnt) {
         /* Post send doorbell */
         uint32_t db_low  = (sq_head << 4) | first_trans_type;
         uint32_t db_high = (qp->qp_num << 8) | snd_cnt;
@@ -644,6 +691,30 @@ int ibv_poll_cpl(struct ibv_cq *cq, struct cpl_desc **desc, int max_num) {
     return cnt;
 }
 
+/**
+ * @note Arm the CQ, the next completion(s) of this CQ raise one event.
+ *       Poll the CQ again after arming, completions arrived before 
+ *       arming do not raise event.
+ */
+int ibv_req_notify_cq(struct ibv_context *context, struct ibv_cq *cq) {
+    struct hghca_context *dvr = (struct hghca_context *)context->dvr;
+    struct kfd_ioctl_cq_event_args args;
+    args.cq_num = cq->cq_num;
+    return ioctl(dvr->fd, HGKFD_IOC_REQ_NOTIFY_CQ, (void *)&args);
+}
+
+/**
+ * @note Block until an event of the CQ arrives, return number of events.
+ */
+int ibv_get_cq_event(struct ibv_context *context, struct ibv_cq *cq) {
+    struct hghca_context *dvr = (struct hghca_context *)context->dvr;
+    struct kfd_ioctl_cq_event_args args;
+    args.cq_num = cq->cq_num;
+    args.event_num = 0;
+    ioctl(dvr->fd, HGKFD_IOC_GET_CQ_EVENT, (void *)&args);
+    return args.event_num;
+}
+
 /**
  * @note create one QoS group
 */
@@ -686,6 +757,44 @@ int set_qos_group(struct ibv_context *context, struct ibv_qos_group *group, uint
     free(args);
 }
 
+static int set_rate_limit(struct ibv_context *context, uint8_t type, uint32_t id, uint32_t rate_mbps, uint32_t burst) {
+    struct kfd_ioctl_set_rate_limit_args *args = (struct kfd_ioctl_set_rate_limit_args *)malloc(sizeof(struct kfd_ioctl_set_rate_limit_args));
+    struct hghca_context *dvr = (struct hghca_context *)context->dvr;
+    args->limit_num = 1;
+    args->type[0]  = type;
+    args->id[0]    = id;
+    args->rate[0]  = rate_mbps;
+    args->burst[0] = burst;
+    write_cmd(dvr->fd, HGKFD_IOC_SET_RATE_LIMIT, args);
+    free(args);
+    return 0;
+}
+
+/**
+ * @note cap the QP at rate_mbps with a burst of burst bytes, rate_mbps 0 removes the cap
+*/
+int ibv_set_qp_rate_limit(struct ibv_context *context, struct ibv_qp *qp, uint32_t rate_mbps, uint32_t burst) {
+    return set_rate_limit(context, RATE_LIMIT_QP, qp->qp_num, rate_mbps, burst);
+}
+
+/**
+ * @note cap all QPs of the group together, rate_mbps 0 removes the cap
+*/
+int ibv_set_group_rate_limit(struct ibv_context *context, struct ibv_qos_group *group, uint32_t rate_mbps, uint32_t burst) {
+    return set_rate_limit(context, RATE_LIMIT_GROUP, group->id, rate_mbps, burst);
+}
+
+/**
+ * @note ask the simulator to take a checkpoint (see --checkpoint-dir), 
+ * posted commands are finished first
+*/
+int ibv_checkpoint(struct ibv_context *context) {
+    struct hghca_context *dvr = (struct hghca_context *)context->dvr;
+    wait_cmd(dvr->fd);
+    post_cmd(dvr->fd, HGKFD_IOC_CHECKPOINT, NULL);
+    return 0;
+}
+
 // void update_all_group_granularity(struct ibv_context *context) {
 //     struct kfd_ioctl_set_group_args *args = (struct kfd_ioctl_set_group_args *)malloc(sizeof(struct kfd_ioctl_set_group_args));
 //     struct hghca_context *dvr = (struct hghca_context *)context->dvr;
@@ -237,6 +237,12 @@ struct ibv_qp {
     uint8_t weight;
     enum perf_indicator indicator;
     uint16_t group_id;
+
+    // Ethernet port of the QP, ignored if the RNIC is in LAG mode
+    uint8_t port;
+
+    // Doorbell record, NULL if doorbell is rung for each post
+    volatile struct hghca_db_rec *db_rec;
 };
 
 
@@ -314,6 +320,17 @@ struct ibv_mr_init_attr {
 #define PAGE_SIZE_LOG 12
 #define PAGE_SIZE (1 << PAGE_SIZE_LOG)
 
+/**
+ * @note Doorbell record. This struct must BE IDENTICAL to DbRecord in hangu_rnic_defs.hh!!!!
+ *       sq_pi is the number of WQEs posted to SQ. RNIC reads it when the QP runs 
+ *       out of WQEs, and sets armed if there's no new WQE. Doorbell is rung 
+ *       only if armed is set.
+ */
+struct hghca_db_rec {
+    uint32_t sq_pi;
+    uint32_t armed;
+};
+
 struct hghca_context {
     uint32_t fd; // kernel file handler
     volatile void *doorbell; // doorbell address
@@ -400,16 +417,22 @@ int ibv_open_device(struct ibv_context *context, uint16_t llid);
 struct ibv_cq * ibv_create_cq(struct ibv_context *context, struct ibv_cq_init_attr *cq_attr);
 struct ibv_qp * ibv_create_qp(struct ibv_context *context, struct ibv_qp_create_attr *qp_attr);
 int ibv_modify_qp(struct ibv_context *context, struct ibv_qp *qp);
+int ibv_enable_db_record(struct ibv_qp *qp);
 struct ibv_mr * ibv_reg_mr(struct ibv_context *context, struct ibv_mr_init_attr *mr_attr);
 int ibv_post_send(struct ibv_context *context, struct ibv_wqe *wqe, struct ibv_qp *qp, uint8_t num);
 int ibv_post_recv(struct ibv_context *context, struct ibv_wqe *wqe, struct ibv_qp *qp, uint8_t num);
 
 int ibv_poll_cpl(struct ibv_cq *cq, struct cpl_desc **desc, int max_num);
+int ibv_req_notify_cq(struct ibv_context *context, struct ibv_cq *cq);
+int ibv_get_cq_event(struct ibv_context *context, struct ibv_cq *cq);
 
 int cpu_sync(struct ibv_context *context);
 
 struct ibv_qos_group* create_qos_group(struct ibv_context *context, int weight);
 int set_qos_group(struct ibv_context *context, struct ibv_qos_group *group, uint8_t group_num, uint16_t *weight);
+int ibv_set_qp_rate_limit(struct ibv_context *context, struct ibv_qp *qp, uint32_t rate_mbps, uint32_t burst);
+int ibv_set_group_rate_limit(struct ibv_context *context, struct ibv_qos_group *group, uint32_t rate_mbps, uint32_t burst);
+int ibv_checkpoint(struct ibv_context *context);
 // void update_all_group_granularity(struct ibv_context *context);
 
 void trans_wait(struct ibv_context *context);
@@ -1,5 +1,8 @@
 #include "librdma.h"
 
+/* Type of test QPs, RC or UC (RDMA Write only) */
+uint8_t qp_type = QP_TYPE_RC;
+
 int svr_update_qps(struct rdma_resc *resc) {
 
     for (int i = 0; i < resc->num_qp * resc->num_rem; ++i) {
@@ -7,7 +10,7 @@ int svr_update_qps(struct rdma_resc *resc) {
         struct ibv_qp *qp = resc->qp[i];
         qp->ctx = resc->ctx;
         qp->flag = 0;
-        qp->type = QP_TYPE_RC;
+        qp->type = qp_type;
         qp->cq = resc->cq[i % TEST_CQ_NUM];
         qp->snd_wqe_offset = 0;
         qp->rcv_wqe_offset = 0;
@@ -213,6 +216,8 @@ static void usage(const char *argv0) {
     printf("  -t, --num-client=<num_client>     number of clients (default 1)\n");
     printf("  -c, --cpu-id=<cpu_id>             id of the cpu (default 0)\n");
     printf("  -m, --op-mode=<op_mode>           opcode mode (default 0, which is RDMA Write)\n");
+    printf("  -u, --uc                          use UC QPs instead of RC, RDMA Write only\n");
+    printf("  -k, --checkpoint                  take a checkpoint once connections are set up\n");
 }
 
 double latency_test(struct rdma_resc *resc, int num_qp, uint8_t op_mode) {
@@ -303,6 +308,7 @@ int main (int argc, char **argv) {
     uint64_t snd_cnt = 0;
     uint16_t svr_lid = 0;
     uint8_t  op_mode = OPMODE_RDMA_WRITE; /* 0: RDMA Write; 1: RDMA Read */
+    uint8_t  checkpoint = 0;
 
     num_client = 1;
     cpu_id     = 0;
@@ -320,10 +326,12 @@ int main (int argc, char **argv) {
             { .name = "num-client",   .has_arg = 1, .val = 't' },
             { .name = "cpu-id"    ,   .has_arg = 1, .val = 'c' },
             { .name = "op-mode"   ,   .has_arg = 1, .val = 'm' },
+            { .name = "uc"        ,   .has_arg = 0, .val = 'u' },
+            { .name = "checkpoint",   .has_arg = 0, .val = 'k' },
             { 0 }
         };
 
-        c = getopt_long(argc, argv, "s:t:c:m:", long_options, NULL);
+        c = getopt_long(argc, argv, "s:t:c:m:ku", long_options, NULL);
         if (c == -1)
             break;
 
@@ -353,6 +361,12 @@ int main (int argc, char **argv) {
                 exit(-1);
             }
             break;
+          case 'k':
+            checkpoint = 1;
+            break;
+          case 'u':
+            qp_type = QP_TYPE_UC;
+            break;
 
           default:
             usage(argv[0]);
@@ -360,6 +374,11 @@ int main (int argc, char **argv) {
         }
     }
 
+    if (qp_type == QP_TYPE_UC && op_mode != OPMODE_RDMA_WRITE) {
+        RDMA_PRINT(Server, "UC QP supports RDMA Write only. Exit.\n");
+        exit(-1);
+    }
+
     sprintf(id_name, "%d", svr_lid);
     RDMA_PRINT(Server, "llid is %hd\n", svr_lid);
     RDMA_PRINT(Server, "num_client %d\n", num_client);
@@ -384,6 +403,12 @@ int main (int argc, char **argv) {
     /* sync to make sure that we could get start */
     rdma_recv_sync(resc);
 
+    /* All QPs are connected, the run continues from here on restore */
+    if (checkpoint) {
+        RDMA_PRINT(Server, "take checkpoint\n");
+        ibv_checkpoint(resc->ctx);
+    }
+
     /* Inform other CPUs that we can start the latency test */
     cpu_sync(resc->ctx);
 